@@ -0,0 +1,274 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "trec_format.h"
+#include "functions.h"
+
+/* Build a Zscore file (see get_zscores.c) from a set of reference runs
+ (--build-zscores).
+
+ Each reference run is evaluated on its own, writing the raw value of
+ every measure for every query as text lines
+ qid  measure_name  value
+ with value in hexadecimal floating point (%a), which is both exact and
+ quick to write and read (te_put_zscore_values).  These are then added
+ a run at a time (te_add_zscore_values) to a streaming (Welford)
+ accumulator per qid and measure, holding the number of runs, the mean
+ and the sum of squared deviations from the mean, so nothing of a run is
+ kept once it has been added.  Finally te_put_zscores writes, sorted by qid and measure_name,
+ qid  measure_name  mean  stddev
+ where stddev is the sample standard deviation over the runs which
+ evaluated the query (0 if only one did).
+ */
+
+#define HASH_INIT 14695981039346656037UL
+#define HASH_PRIME 1099511628211UL
+
+/* Accumulator of one qid and measure */
+typedef struct {
+	long key; /* Offset in key_pool of "qid\0measure_name\0" */
+	unsigned long hash; /* hash_key of qid and measure_name */
+	long num_runs;
+	double mean;
+	double m2; /* Sum of squared deviations from mean */
+} ZSCORE_ACC;
+
+static long find_acc(const char *qid, const char *meas);
+static int same_key(const long acc, const char *qid, const char *meas);
+static int rehash(long size);
+static unsigned long hash_key(const char *qid, const char *meas);
+static int comp_acc_key();
+
+/* static pools of memory, allocated here and freed in cleanup */
+static TE_THREAD char *key_pool = NULL;
+static TE_THREAD long num_key_pool = 0;
+static TE_THREAD long max_num_key_pool = 0;
+static TE_THREAD ZSCORE_ACC *accs = NULL;
+static TE_THREAD long num_accs = 0;
+static TE_THREAD long max_num_accs = 0;
+static TE_THREAD long *hash_table = NULL; /* Index in accs, -1 if empty */
+static TE_THREAD long hash_size = 0; /* Power of 2, at least twice num_accs */
+static TE_THREAD char *line = NULL;
+static TE_THREAD size_t max_line = 0;
+/* Accumulator following the last one found.  Every run writes its
+ values in the same order, so after the first run this is nearly always
+ the one wanted next */
+static TE_THREAD long next_acc = 0;
+
+/* Write the values from first_value up to end_value of the query
+ evaluated in q_eval to out */
+int te_put_zscore_values(FILE *out, const TREC_EVAL *q_eval,
+		const long first_value, const long end_value) {
+	long i;
+
+	for (i = first_value; i < end_value; i++)
+		if (0 > fprintf(out, "%s\t%s\t%a\n", q_eval->qid,
+				q_eval->values[i].name, q_eval->values[i].value))
+			return (UNDEF);
+	return (1);
+}
+
+/* Add the values of a reference run, written by te_put_zscore_values to
+ in, to the accumulators */
+int te_add_zscore_values(FILE *in) {
+	char *qid, *meas, *ptr;
+	double value, delta;
+	long a;
+
+	while (-1 != getline(&line, &max_line, in)) {
+		qid = line;
+		if (NULL == (meas = strchr(qid, '\t'))
+				|| NULL == (ptr = strchr(++meas, '\t'))) {
+			fprintf(stderr,
+					"rec_eval.build_zscores: Malformed reference values\n");
+			return (UNDEF);
+		}
+		meas[-1] = '\0';
+		*ptr++ = '\0';
+		value = strtod(ptr, NULL);
+
+		if (UNDEF == (a = find_acc(qid, meas)))
+			return (UNDEF);
+		accs[a].num_runs++;
+		delta = value - accs[a].mean;
+		accs[a].mean += delta / accs[a].num_runs;
+		accs[a].m2 += delta * (value - accs[a].mean);
+	}
+	if (ferror(in)) {
+		fprintf(stderr,
+				"rec_eval.build_zscores: Cannot read reference values\n");
+		return (UNDEF);
+	}
+	return (1);
+}
+
+/* Write the mean and stddev of every qid and measure added so far to
+ zscores_file */
+int te_put_zscores(const char *zscores_file) {
+	FILE *fd;
+	ZSCORE_ACC *acc;
+	char *qid;
+	double stddev;
+	long i;
+
+	if (NULL == (fd = fopen(zscores_file, "w"))) {
+		fprintf(stderr,
+				"rec_eval.build_zscores: Cannot create zscores file '%s'\n",
+				zscores_file);
+		return (UNDEF);
+	}
+	/* Sorting leaves the hash table stale, so rebuild it afterwards */
+	qsort((char *) accs, (int) num_accs, sizeof(ZSCORE_ACC), comp_acc_key);
+	if (hash_size > 0 && UNDEF == rehash(hash_size)) {
+		(void) fclose(fd);
+		return (UNDEF);
+	}
+	for (i = 0; i < num_accs; i++) {
+		acc = &accs[i];
+		qid = key_pool + acc->key;
+		stddev = acc->num_runs > 1 ?
+				sqrt(acc->m2 / (acc->num_runs - 1)) : 0.0;
+		if (0 > fprintf(fd, "%s\t%s\t%.15g\t%.15g\n", qid,
+				qid + strlen(qid) + 1, acc->mean, stddev))
+			break;
+	}
+	if (i < num_accs || 0 != fclose(fd)) {
+		fprintf(stderr,
+				"rec_eval.build_zscores: Cannot write zscores file '%s'\n",
+				zscores_file);
+		return (UNDEF);
+	}
+	return (1);
+}
+
+int te_build_zscores_cleanup() {
+	if (max_num_key_pool > 0) {
+		Free(key_pool);
+		max_num_key_pool = 0;
+		num_key_pool = 0;
+	}
+	if (max_num_accs > 0) {
+		Free(accs);
+		max_num_accs = 0;
+		num_accs = 0;
+		next_acc = 0;
+	}
+	if (hash_size > 0) {
+		Free(hash_table);
+		hash_size = 0;
+	}
+	if (max_line > 0) {
+		free(line);
+		line = NULL;
+		max_line = 0;
+	}
+	return (1);
+}
+
+/* Index in accs of the accumulator of qid and meas, added if new */
+static long find_acc(const char *qid, const char *meas) {
+	unsigned long hash, h;
+	long qid_len, meas_len;
+
+	if (next_acc < num_accs && same_key(next_acc, qid, meas))
+		return (next_acc++);
+
+	if (2 * (num_accs + 1) > hash_size
+			&& UNDEF == rehash(hash_size ? 2 * hash_size : 1024))
+		return (UNDEF);
+	hash = hash_key(qid, meas);
+	for (h = hash & (hash_size - 1); -1 != hash_table[h];
+			h = (h + 1) & (hash_size - 1)) {
+		if (accs[hash_table[h]].hash == hash
+				&& same_key(hash_table[h], qid, meas)) {
+			next_acc = hash_table[h] + 1;
+			return (hash_table[h]);
+		}
+	}
+
+	qid_len = strlen(qid) + 1;
+	meas_len = strlen(meas) + 1;
+	if (NULL
+			== (key_pool = te_chk_and_realloc(key_pool, &max_num_key_pool,
+					num_key_pool + qid_len + meas_len, sizeof(char)))
+			|| NULL
+					== (accs = te_chk_and_realloc(accs, &max_num_accs,
+							num_accs + 1, sizeof(ZSCORE_ACC))))
+		return (UNDEF);
+	(void) memcpy(key_pool + num_key_pool, qid, qid_len);
+	(void) memcpy(key_pool + num_key_pool + qid_len, meas, meas_len);
+	accs[num_accs].key = num_key_pool;
+	accs[num_accs].hash = hash;
+	accs[num_accs].num_runs = 0;
+	accs[num_accs].mean = 0.0;
+	accs[num_accs].m2 = 0.0;
+	num_key_pool += qid_len + meas_len;
+	hash_table[h] = num_accs;
+	next_acc = num_accs + 1;
+	return (num_accs++);
+}
+
+/* Whether accs[acc] is the accumulator of qid and meas */
+static int same_key(const long acc, const char *qid, const char *meas) {
+	char *key = key_pool + accs[acc].key;
+
+	return (0 == strcmp(key, qid) && 0 == strcmp(key + strlen(key) + 1, meas));
+}
+
+/* Resize hash_table to size entries, and reenter all accumulators */
+static int rehash(long size) {
+	unsigned long h;
+	long i;
+
+	if (hash_size > 0) {
+		Free(hash_table);
+		hash_size = 0;
+	}
+	if (NULL == (hash_table = Malloc(size, long)))
+		return (UNDEF);
+	hash_size = size;
+	for (i = 0; i < hash_size; i++)
+		hash_table[i] = -1;
+	for (i = 0; i < num_accs; i++) {
+		for (h = accs[i].hash & (hash_size - 1); -1 != hash_table[h];
+				h = (h + 1) & (hash_size - 1))
+			;
+		hash_table[h] = i;
+	}
+	return (1);
+}
+
+/* FNV-1a hash of qid and meas, each with its NUL */
+static unsigned long hash_key(const char *qid, const char *meas) {
+	unsigned long hash = HASH_INIT;
+	const unsigned char *ptr;
+
+	for (ptr = (const unsigned char *) qid;; ptr++) {
+		hash = (hash ^ *ptr) * HASH_PRIME;
+		if ('\0' == *ptr)
+			break;
+	}
+	for (ptr = (const unsigned char *) meas;; ptr++) {
+		hash = (hash ^ *ptr) * HASH_PRIME;
+		if ('\0' == *ptr)
+			break;
+	}
+	return (hash);
+}
+
+static int comp_acc_key(ZSCORE_ACC *ptr1, ZSCORE_ACC *ptr2) {
+	char *key1 = key_pool + ptr1->key;
+	char *key2 = key_pool + ptr2->key;
+	int cmp;
+
+	if (0 != (cmp = strcmp(key1, key2)))
+		return (cmp);
+	return (strcmp(key1 + strlen(key1) + 1, key2 + strlen(key2) + 1));
+}
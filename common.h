@@ -21,6 +21,11 @@
 #define MAX(A,B)  ((A) > (B) ? (A) : (B))
 #define MIN(A,B)  ((A) > (B) ? (B) : (A))
 
+/* Working storage the loaders, intermediate forms and measures keep in
+ statics is per thread, so that (librec_eval) evaluations on different
+ threads do not share it */
+#define TE_THREAD __thread
+
 #ifndef MAXLONG
 #define MAXLONG 2147483647L             /* largest long int. no. */
 #endif
@@ -18,19 +18,101 @@
 
  If the mean and stddev values for this measure and query are not found 
  in all_zscores, then the value is set to MISSING_ZSCORE_VALUE.
+
+ The zscores of each value are looked up once per evaluation, by
+ te_form_zscore_index, rather than for every query:  each query of the
+ rel info is joined to its zscores qid, and the values (whose names are
+ fixed once the measures are initialized) to the zscores measures of
+ that qid.  Most qids of a zscores file list the same measures, so
+ those share one row of value indices.  Converting a query then only
+ indexes the zscores of its values.
  */
 
-static ZSCORES *find_qid(const ALL_ZSCORES *all_zscores, const char *qid);
+static int same_meas(const ZSCORES *zscores1, const ZSCORES *zscores2);
 static ZSCORE_QID *find_meas(const ZSCORES *zscores, const char *meas);
 
-int te_convert_to_zscore(const ALL_ZSCORES *all_zscores, TREC_EVAL *q_eval) {
-	int return_value = 1;
-	long i;
-	ZSCORES *zscores;
+/* Index formed by te_form_zscore_index.  For rel info query j,
+ q_zscores[j] is the index of its ZSCORES in all_zscores (-1 if none).
+ For ZSCORES q, value v of a query has zscore
+ q_zscores[q].zscores[meas_index[zscores_row[q] * num_values + v]]
+ (none if the index is -1) */
+static TE_THREAD long *q_zscores;
+static TE_THREAD long max_q_zscores = 0;
+static TE_THREAD long *zscores_row;
+static TE_THREAD long max_zscores_row = 0;
+static TE_THREAD long *meas_index;
+static TE_THREAD long max_meas_index = 0;
+static TE_THREAD long num_values;
+
+int te_form_zscore_index(const ALL_ZSCORES *all_zscores,
+		const ALL_REL_INFO *all_rel_info, const TREC_EVAL *q_eval) {
+	long j, q, v;
+	long num_rows, row;
+	int cmp;
 	ZSCORE_QID *zscores_qid;
 
-	/* Do a binary search to find q_eval->qid */
-	if (NULL == (zscores = find_qid(all_zscores, q_eval->qid))) {
+	num_values = q_eval->num_values;
+	if (NULL
+			== (q_zscores = te_chk_and_malloc(q_zscores, &max_q_zscores,
+					all_rel_info->num_q_rels + 1, sizeof(long)))
+			||
+			NULL
+					== (zscores_row = te_chk_and_malloc(zscores_row,
+							&max_zscores_row, all_zscores->num_q_zscores + 1,
+							sizeof(long))))
+		return (UNDEF);
+
+	/* Join rel info queries and zscores qids, both sorted by qid */
+	q = 0;
+	for (j = 0; j < all_rel_info->num_q_rels; j++) {
+		cmp = -1;
+		while (q < all_zscores->num_q_zscores
+				&& 0
+						< (cmp = strcmp(all_rel_info->rel_info[j].qid,
+								all_zscores->q_zscores[q].qid)))
+			q++;
+		q_zscores[j] = (q < all_zscores->num_q_zscores && 0 == cmp) ? q : -1;
+	}
+
+	/* Give each zscores qid the row of value indices of the last qid
+	 with the same measures, or a new one */
+	num_rows = 0;
+	for (q = 0; q < all_zscores->num_q_zscores; q++) {
+		if (q > 0
+				&& same_meas(&all_zscores->q_zscores[q],
+						&all_zscores->q_zscores[q - 1])) {
+			zscores_row[q] = zscores_row[q - 1];
+			continue;
+		}
+		row = num_rows++;
+		if (NULL
+				== (meas_index = te_chk_and_realloc(meas_index,
+						&max_meas_index, num_rows * num_values, sizeof(long))))
+			return (UNDEF);
+		for (v = 0; v < num_values; v++) {
+			zscores_qid = find_meas(&all_zscores->q_zscores[q],
+					q_eval->values[v].name);
+			meas_index[row * num_values + v] =
+					zscores_qid ?
+							zscores_qid - all_zscores->q_zscores[q].zscores : -1;
+		}
+		zscores_row[q] = row;
+	}
+	return (1);
+}
+
+/* Convert the values of q_eval, the query with index rel_info_index in
+ the rel info given te_form_zscore_index.  Returns 0 if some value had
+ no zscore */
+int te_convert_to_zscore(const ALL_ZSCORES *all_zscores,
+		const long rel_info_index, TREC_EVAL *q_eval) {
+	int return_value = 1;
+	long i, q;
+	const long *index;
+	const ZSCORE_QID *zscores;
+	const ZSCORE_QID *zscores_qid;
+
+	if (0 > (q = q_zscores[rel_info_index])) {
 		/* If q_eval->qid not found, set all values in q_eval to
 		 MISSING_ZSCORE_VALUE and return 0 */
 		for (i = 0; i < q_eval->num_values; i++)
@@ -38,24 +120,24 @@ int te_convert_to_zscore(const ALL_ZSCORES *all_zscores, TREC_EVAL *q_eval) {
 		return (0);
 	}
 
-	/* For each measure in q_eval, do a binary search for that measure
-	 within zscores */
+	index = &meas_index[zscores_row[q] * num_values];
+	zscores = all_zscores->q_zscores[q].zscores;
 	for (i = 0; i < q_eval->num_values; i++) {
-		if (NULL
-				== (zscores_qid = find_meas(zscores, q_eval->values[i].name))) {
+		if (0 > index[i]) {
 			q_eval->values[i].value = MISSING_ZSCORE_VALUE;
 			return_value = 0;
-		} else {
-			if (zscores_qid->stddev)
-				q_eval->values[i].value = (q_eval->values[i].value
-						- zscores_qid->mean) / zscores_qid->stddev;
+			continue;
+		}
+		zscores_qid = &zscores[index[i]];
+		if (zscores_qid->stddev)
+			q_eval->values[i].value = (q_eval->values[i].value
+					- zscores_qid->mean) / zscores_qid->stddev;
+		else {
+			if (q_eval->values[i].value == zscores_qid->mean)
+				q_eval->values[i].value = 0;
 			else {
-				if (q_eval->values[i].value == zscores_qid->mean)
-					q_eval->values[i].value = 0;
-				else {
-					q_eval->values[i].value = MISSING_ZSCORE_VALUE;
-					return_value = 0;
-				}
+				q_eval->values[i].value = MISSING_ZSCORE_VALUE;
+				return_value = 0;
 			}
 		}
 	}
@@ -63,26 +145,17 @@ int te_convert_to_zscore(const ALL_ZSCORES *all_zscores, TREC_EVAL *q_eval) {
 	return (return_value);
 }
 
-static ZSCORES *
-find_qid(const ALL_ZSCORES *all_zscores, const char *qid) {
-	ZSCORES *base;
-	long start, end, current;
-	int result;
+/* Whether zscores1 and zscores2 list the same measures (in order) */
+static int same_meas(const ZSCORES *zscores1, const ZSCORES *zscores2) {
+	long i;
 
-	base = all_zscores->q_zscores;
-	end = all_zscores->num_q_zscores;
-	start = 0;
-	while (start <= end) {
-		current = (start + end) / 2;
-		result = strcmp(qid, base[current].qid);
-		if (result < 0)
-			end = current - 1;
-		else if (result > 0)
-			start = current + 1;
-		else
-			return (&base[current]);
+	if (zscores1->num_zscores != zscores2->num_zscores)
+		return (0);
+	for (i = 0; i < zscores1->num_zscores; i++) {
+		if (strcmp(zscores1->zscores[i].meas, zscores2->zscores[i].meas))
+			return (0);
 	}
-	return (NULL);
+	return (1);
 }
 
 static ZSCORE_QID *
@@ -92,7 +165,7 @@ find_meas(const ZSCORES *zscores, const char *meas) {
 	int result;
 
 	base = zscores->zscores;
-	end = zscores->num_zscores;
+	end = zscores->num_zscores - 1;
 	start = 0;
 	while (start <= end) {
 		current = (start + end) / 2;
@@ -107,3 +180,18 @@ find_meas(const ZSCORES *zscores, const char *meas) {
 	return (NULL);
 }
 
+int te_convert_zscores_cleanup() {
+	if (max_q_zscores > 0) {
+		Free(q_zscores);
+		max_q_zscores = 0;
+	}
+	if (max_zscores_row > 0) {
+		Free(zscores_row);
+		max_zscores_row = 0;
+	}
+	if (max_meas_index > 0) {
+		Free(meas_index);
+		max_meas_index = 0;
+	}
+	return (1);
+}
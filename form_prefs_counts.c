@@ -11,6 +11,7 @@
 #include "trec_eval.h"
 #include "trec_format.h"
 #include "functions.h"
+#include <pthread.h>
 
 /* Takes the top docs and judged prefs for a query, and returns a
  results_prefs_info object giving the preferences from judged_prefs that
@@ -39,8 +40,12 @@
  judgments are added - this happens when (doc A > doc B in JSG jsg1) and
  (doc B > doc C in JSG jsg2).  Note that a JG represents a single information
  need set of judgments, and is required to be consistent (inconsistent
- preferences are represented in different JGs).  Preference array is of
- size num_judged * num_judged.
+ preferences are represented in different JGs).  The preference array
+ only covers the docs the JG mentions: it is of size n * n bits for the
+ n distinct docs of the JG (however many docs the topic has judged),
+ indexed by their position in the increasing list of their docid_ranks.
+ Each row is a bitstring; transitives are added by Warshall's algorithm
+ a row word at a time.
  3. Go through the preference in each JG, and count num_fulfilled and
  num_possible preferences in categories "retrieved", "implied" and
  "not_retrieved" where
@@ -58,6 +63,11 @@
  If rank1 retrieved and rank2 was not, then implied pref fulfilled.
  If rank1 not retrieved and rank2 was, then preference was not fulfilled.
  If both not retrieved, then that count is incremented.
+ Only the first needs the ranks themselves, the others are products of
+ the numbers of retrieved and not retrieved docs in each EC.  The ECs
+ are taken from the lowest rel_level up, keeping the retrieved ranks of
+ the ECs below in a Fenwick tree, so that the fulfilled prefs of each
+ retrieved rank1 are counted in log time instead of by comparing pairs.
  B. Given preference array PA there are five areas of importance, divided
  by lines i == NJR (where NJR is num_judged_ret), j == NJR, and i == j
  NJR
@@ -79,14 +89,26 @@
  Area A3 is preference implied fulfilled (i retrieved, j not)
  Area A4 is preference implied not fulfilled (i not retrieved, j retrieved)
  Area A5 is both i and j not retrieved.
- Simply count the marks (PA[i][j] == 1) in each appropriate area.
-
- As well as storing counts within each JG, a counts array for the
- entire pref_results is constructed. Counts_array CA is exactly the same
- format and size as the preference arrays, except CA[i][j] is the sum
- of the conceptual PA[i][j] over all JGs.  This allows counts of
- confirmations (CA[i][j] > 1) and conflicts (CA[i][j] and CA[j][i] both
- non-zero).
+ Simply count the marks (PA[i][j] == 1) in each appropriate area, a word
+ of a row at a time.  Since the docs of PA are in docid_rank order, NJR
+ is the number of retrieved docs of the JG, and the areas hold the same
+ prefs as they would in an array over all judged docs.
+
+ As well as storing counts within each JG, pair counts for the
+ entire pref_results can be constructed (form_prefs_pair_counts, only
+ for the measures that need them).  For each pair of docs i < j with
+ a preference in any JG, they give the sum over all JGs of the conceptual
+ PA[i][j] and of PA[j][i].  This allows counts of confirmations (a count
+ > 1) and conflicts (both counts non-zero).  Each preference of each JG
+ is added to a list; once all JGs are done the list is sorted by pair
+ and the entries for the same pair combined, so that only pairs with
+ preferences take space.
+
+ Preference array JGs (which take most of the time when there are any)
+ are formed and counted in parallel, on up to one thread per online
+ processor, once the pool space of every JG has been laid out.  Each JG
+ only writes to its own pool space and counts, so the results do not
+ depend on the order JGs are done in.
 
  Not mentioned in steps 2 and 3 above since it adds even more confusion,
  is that the relevant (rel_level > 0.0) and nonrelevant docs are also
@@ -114,31 +136,70 @@ typedef struct {
 	float rel_level;
 	char *docno;
 	long rank;
+	long pa_index; /* Index of doc in the preference array of its JG */
 } PREFS_AND_RANKS;
 
+/* Judgment group within prefs_and_ranks */
+typedef struct {
+	long start; /* First line */
+	long num_prefs; /* Num lines */
+	long num_jsgs;
+	long num_rel_levels; /* Num changes of rel_level between lines */
+	long num_docs; /* Num distinct docs */
+} JG_SPAN;
+
+/* Preference array JG waiting to be formed */
+typedef struct {
+	PREFS_AND_RANKS *prefs;
+	long num_prefs;
+	JG *jg;
+} PA_JOB;
+
+/* Queued preference array JGs being formed by the threads of run_pa_jobs,
+ and the next to be taken and status of those done, under lock */
+typedef struct {
+	const PA_JOB *jobs;
+	long num_jobs;
+	RESULTS_PREFS *results_prefs;
+	long next_job;
+	int status;
+	pthread_mutex_t lock;
+} PA_JOBS;
+
+/* Fewer judged docs than this, and preference array JGs are formed on
+ the calling thread only */
+#define MIN_THREADED_JUDGED 128
+
 static int form_jg_ec(const PREFS_AND_RANKS *prefs, const long num_prefs,
 		long *rank_pool_ptr, JG *jg, RESULTS_PREFS *results_prefs);
 static int add_ec_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs);
+static int add_ec_pair_counts(JG *jg, RESULTS_PREFS *results_prefs);
 
-static int form_jg_pa(const PREFS_AND_RANKS *prefs, const long num_prefs,
-		JG *jg, RESULTS_PREFS *results_prefs);
+static int form_jg_pa(PREFS_AND_RANKS *prefs, const long num_prefs, JG *jg,
+		RESULTS_PREFS *results_prefs);
 static int add_transitives(PREFS_ARRAY *pa);
 static int add_pa_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs);
-static int mult_and_check_change(const PREFS_ARRAY *a1, const PREFS_ARRAY *a2,
-		PREFS_ARRAY *res);
-
-static int form_prefs_and_ranks(const EPI*epi,
-		const TEXT_RESULTS_INFO *text_results_info,
+static int add_pa_pair_counts(JG *jg, RESULTS_PREFS *results_prefs);
+static int add_pa_job(PREFS_AND_RANKS *prefs, const long num_prefs, JG *jg);
+static int run_pa_jobs(RESULTS_PREFS *results_prefs);
+static void *run_pa_jobs_thread(void *pa_jobs_ptr);
+static long count_bits(const unsigned long *row, long start, long end);
+static long count_word_bits(unsigned long word);
+static int add_pref_count(long doc_pref, long doc_nonpref,
+		RESULTS_PREFS *results_prefs);
+static void merge_pref_counts(RESULTS_PREFS *results_prefs);
+
+static int form_prefs_and_ranks(const EPI*epi, const RESULTS *results,
 		const TEXT_PREFS_INFO *trec_prefs, PREFS_AND_RANKS *prefs_and_ranks,
 		long *num_judged, long *num_judged_ret);
 
 static void init_prefs_array(PREFS_ARRAY *pa);
-static void init_counts_array(COUNTS_ARRAY *ca);
 static int comp_prefs_and_ranks_jg_rel_level();
 static int comp_prefs_and_ranks_docno();
-static int comp_sim_docno(), comp_docno(), comp_results_inc_rank();
+static int comp_docno(), comp_results_inc_rank();
+static int comp_pref_count(), comp_docid_rank();
 static void debug_print_ec(EC *ec), debug_print_prefs_array(PREFS_ARRAY *pa),
-		debug_print_counts_array(COUNTS_ARRAY *ca), debug_print_jg(JG *jg),
+		debug_print_pref_counts(PREF_COUNTS *pc), debug_print_jg(JG *jg),
 		debug_print_results_prefs(RESULTS_PREFS *rp);
 static void debug_print_docno_results(DOCNO_RESULTS *dr, long num_results,
 		char *location);
@@ -151,73 +212,82 @@ static void debug_print_prefs_and_ranks(PREFS_AND_RANKS *par, long num_prefs,
 /* Temp Structure for mapping results docno to results rank */
 
 /* Current cached query */
-static char *current_query = "no query";
-static long max_current_query = 0;
+static TE_THREAD char *current_query = "no query";
+static TE_THREAD long max_current_query = 0;
+/* Depth (epi->max_num_docs_per_topic) the cached values were formed for */
+static TE_THREAD long current_depth = 0;
 
 /* Space reserved for cached returned values */
-static long num_judged_ret;
-static long num_judged;
-static long num_jgs;
-static JG *jgs;
-static long max_num_jgs = 0;
-static long *rank_pool;
-static long max_rank_pool = 0;
-static EC *ec_pool;
-static long max_ec_pool = 0;
-static unsigned short *ca_pool;
-static long max_ca_pool = 0;
-static unsigned short **ca_ptr_pool;
-static long max_ca_ptr_pool = 0;
-static unsigned char *pa_pool;
-static long max_pa_pool = 0;
-static unsigned char **pa_ptr_pool;
-static long max_pa_ptr_pool = 0;
-static float *rel_pool;
-static long max_rel_pool = 0;
+static TE_THREAD long num_judged_ret;
+static TE_THREAD long num_judged;
+static TE_THREAD long num_jgs;
+static TE_THREAD JG *jgs;
+static TE_THREAD long max_num_jgs = 0;
+static TE_THREAD long *rank_pool;
+static TE_THREAD long max_rank_pool = 0;
+static TE_THREAD EC *ec_pool;
+static TE_THREAD long max_ec_pool = 0;
+static TE_THREAD PREF_COUNT *pc_pool;
+static TE_THREAD long max_pc_pool = 0;
+static TE_THREAD long num_pref_counts;
+static TE_THREAD long pref_counts_formed; /* Pair counts of cached query formed */
+static TE_THREAD unsigned long *pa_pool;
+static TE_THREAD long max_pa_pool = 0;
+static TE_THREAD unsigned long **pa_ptr_pool;
+static TE_THREAD long max_pa_ptr_pool = 0;
+static TE_THREAD long *pa_rank_pool;
+static TE_THREAD long max_pa_rank_pool = 0;
+static TE_THREAD float *rel_pool;
+static TE_THREAD long max_rel_pool = 0;
 /* Space reserved for intermediate values */
-static PREFS_AND_RANKS *prefs_and_ranks;
-static long max_prefs_and_ranks = 0;
-static DOCNO_RESULTS *docno_results;
-static long max_docno_results = 0;
-static unsigned char *temp_pa_pool;
-static long max_temp_pa_pool;
-static unsigned char **temp_pa_ptr_pool;
-static long max_temp_pa_ptr_pool;
-
-static long saved_num_judged = 0;
+static TE_THREAD PREFS_AND_RANKS *prefs_and_ranks;
+static TE_THREAD long max_prefs_and_ranks = 0;
+static TE_THREAD DOCNO_RESULTS *docno_results;
+static TE_THREAD long max_docno_results = 0;
+static TE_THREAD long *tie_ranks; /* Rank of each doc of the shared ranking, with
+ sim ties broken by increasing docno */
+static TE_THREAD long max_tie_ranks = 0;
+static TE_THREAD JG_SPAN *jg_spans;
+static TE_THREAD long max_jg_spans = 0;
+static TE_THREAD long *doc_jg; /* Last JG seen with each docid_rank, or -1 */
+static TE_THREAD long max_doc_jg = 0;
+static TE_THREAD long *fenwick; /* Retrieved ranks of lower ECs (1 based) */
+static TE_THREAD long max_fenwick = 0;
+static TE_THREAD long *doc_ec; /* EC of each docid_rank in the current JG, or -1 */
+static TE_THREAD long max_doc_ec = 0;
+static TE_THREAD PA_JOB *pa_jobs;
+static TE_THREAD long max_pa_jobs = 0;
+static TE_THREAD long num_pa_jobs;
 
 int form_prefs_counts(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, RESULTS_PREFS *results_prefs) {
 	long i;
-	char *jgid, *jsgid;
-	long jg_ind;
-	long num_jgs_with_subgroups;
+	char *jsgid;
 	float rel_level;
+	JG_SPAN *span;
+	long pa_docs, pa_words, pa_prefs; /* Totals over prefs array JGs */
 
 	EC * ec_pool_ptr;
 	float *rel_pool_ptr;
 	long *rank_pool_ptr;
-	unsigned char *pa_pool_ptr;
-	unsigned char **pa_ptr_pool_ptr;
-
-	long start_jg;
-	long num_rel_level;
-	long num_sub_group;
+	unsigned long *pa_pool_ptr;
+	unsigned long **pa_ptr_pool_ptr;
+	long *pa_rank_pool_ptr;
 
-	TEXT_RESULTS_INFO *text_results_info;
 	TEXT_PREFS_INFO *trec_prefs;
 
 	if (epi->debug_level >= 3)
 		printf("Debug: Form_prefs starting query '%s'\n", results->qid);
 
-	if (0 == strcmp(current_query, results->qid)) {
+	if (0 == strcmp(current_query, results->qid)
+			&& current_depth == epi->max_num_docs_per_topic) {
 		/* Have done this query already. Return cached values */
 		results_prefs->num_jgs = num_jgs;
 		results_prefs->jgs = jgs;
 		results_prefs->num_judged = num_judged;
 		results_prefs->num_judged_ret = num_judged_ret;
-		results_prefs->pref_counts = (COUNTS_ARRAY ) { ca_pool, ca_ptr_pool,
-						num_judged };
+		results_prefs->pref_counts = (PREF_COUNTS ) { pc_pool,
+						num_pref_counts };
 		if (epi->debug_level >= 3)
 			printf("Returned Cached Form_prefs\n");
 		return (0);
@@ -239,8 +309,8 @@ int form_prefs_counts(const EPI *epi, const REL_INFO *rel_info,
 					&max_current_query, i, sizeof(char))))
 		return (UNDEF);
 	(void) strncpy(current_query, results->qid, i);
+	current_depth = epi->max_num_docs_per_topic;
 
-	text_results_info = (TEXT_RESULTS_INFO *) results->q_results;
 	trec_prefs = (TEXT_PREFS_INFO *) rel_info->q_rel_info;
 
 	/* Reserve space for returned and intermediate values, if needed */
@@ -261,60 +331,104 @@ int form_prefs_counts(const EPI *epi, const REL_INFO *rel_info,
 	/* get prefs_and_ranks from results and prefs. Will be sorted by
 	 jg, jsg, rel_level, rank. Set num_judged, num_judged_ret */
 	if (UNDEF
-			== form_prefs_and_ranks(epi, text_results_info, trec_prefs,
+			== form_prefs_and_ranks(epi, results, trec_prefs,
 					prefs_and_ranks, &num_judged, &num_judged_ret))
 		return (UNDEF);
 
-	/* Go through prefs_and ranks, count and reserve space for judgment groups.
-	 Also count number of JGs that have subgroups and will need preference
-	 arrays. */
-	jgid = "";
-	jsgid = "";
+	/* EC counting works on all docid_ranks at once */
+	if (NULL
+			== (fenwick = te_chk_and_malloc(fenwick, &max_fenwick,
+					num_judged_ret + 1, sizeof(long)))
+			||
+			NULL
+					== (doc_ec = te_chk_and_malloc(doc_ec, &max_doc_ec,
+							num_judged, sizeof(long))))
+		return (UNDEF);
+	(void) memset((void *) fenwick, 0, (num_judged_ret + 1) * sizeof(long));
+	for (i = 0; i < num_judged; i++)
+		doc_ec[i] = -1;
+
+	/* Go through prefs_and_ranks and find the judgment groups, with the
+	 number of JSGs, rel_levels and distinct docs of each */
+	if (NULL
+			== (jg_spans = te_chk_and_malloc(jg_spans, &max_jg_spans,
+					trec_prefs->num_text_prefs, sizeof(JG_SPAN)))
+			||
+			NULL
+					== (doc_jg = te_chk_and_malloc(doc_jg, &max_doc_jg,
+							num_judged, sizeof(long))))
+		return (UNDEF);
+	for (i = 0; i < num_judged; i++)
+		doc_jg[i] = -1;
 	num_jgs = 0;
-	num_jgs_with_subgroups = 0;
+	span = NULL;
+	jsgid = "";
+	rel_level = -3.0; /* Illegal rel_level */
 	for (i = 0; i < trec_prefs->num_text_prefs; i++) {
-		if (strcmp(jgid, prefs_and_ranks[i].jg)) {
+		if (NULL == span
+				|| strcmp(prefs_and_ranks[span->start].jg,
+						prefs_and_ranks[i].jg)) {
 			/* New JG */
-			jgid = prefs_and_ranks[i].jg;
-			jsgid = prefs_and_ranks[i].jsg;
-			num_jgs++;
-		} else if (strcmp(jsgid, prefs_and_ranks[i].jsg)) {
+			span = &jg_spans[num_jgs++];
+			*span = (JG_SPAN ) { i, 0, 0, 0, 0 };
+			jsgid = "";
+			rel_level = -3.0;
+		}
+		span->num_prefs++;
+		if (strcmp(jsgid, prefs_and_ranks[i].jsg)) {
+			span->num_jsgs++;
 			jsgid = prefs_and_ranks[i].jsg;
-			num_jgs_with_subgroups++;
+		}
+		if (rel_level != prefs_and_ranks[i].rel_level) {
+			span->num_rel_levels++;
+			rel_level = prefs_and_ranks[i].rel_level;
+		}
+		if (doc_jg[prefs_and_ranks[i].rank] != num_jgs - 1) {
+			doc_jg[prefs_and_ranks[i].rank] = num_jgs - 1;
+			span->num_docs++;
 		}
 	}
 
-	/* Reserve pool space for JGs, and final pref_counts */
+	/* Reserve pool space for JGs.  Pref_counts grow as prefs are added */
 	if (NULL
 			== (jgs = te_chk_and_malloc(jgs, &max_num_jgs, num_jgs, sizeof(JG)))
 			||
 			NULL
-					== (ca_pool = te_chk_and_malloc(ca_pool, &max_ca_pool,
-							num_judged * num_judged, sizeof(unsigned short)))
-			||
-			NULL
-					== (ca_ptr_pool = te_chk_and_malloc(ca_ptr_pool,
-							&max_ca_ptr_pool, num_judged,
-							sizeof(unsigned short *))))
+					== (pa_jobs = te_chk_and_malloc(pa_jobs, &max_pa_jobs,
+							num_jgs, sizeof(PA_JOB))))
 		return (UNDEF);
-
-	if (num_jgs_with_subgroups) {
-		/* Reserve pool space for preference arrays, and rel_level arrays */
+	num_pa_jobs = 0;
+
+	/* JGs with several JSGs need preference arrays over their docs, and
+	 rel_level arrays */
+	pa_docs = 0;
+	pa_words = 0;
+	pa_prefs = 0;
+	for (i = 0; i < num_jgs; i++) {
+		if (jg_spans[i].num_jsgs > 1) {
+			pa_docs += jg_spans[i].num_docs;
+			pa_words += jg_spans[i].num_docs
+					* PA_NUM_WORDS(jg_spans[i].num_docs);
+			pa_prefs += jg_spans[i].num_prefs;
+		}
+	}
+	if (pa_docs) {
 		if (NULL
 				== (rel_pool = te_chk_and_malloc(rel_pool, &max_rel_pool,
-						num_judged * num_jgs_with_subgroups, sizeof(float)))
+						pa_docs, sizeof(float)))
 				||
 				NULL
 						== (pa_pool = te_chk_and_malloc(pa_pool, &max_pa_pool,
-								num_judged * num_judged
-										* num_jgs_with_subgroups,
-								sizeof(unsigned char)))
+								pa_words, sizeof(unsigned long)))
 				||
 				NULL
 						== (pa_ptr_pool = te_chk_and_malloc(pa_ptr_pool,
-								&max_pa_ptr_pool,
-								num_judged * num_jgs_with_subgroups,
-								sizeof(unsigned char *))))
+								&max_pa_ptr_pool, pa_docs,
+								sizeof(unsigned long *)))
+				||
+				NULL
+						== (pa_rank_pool = te_chk_and_malloc(pa_rank_pool,
+								&max_pa_rank_pool, pa_prefs, sizeof(long))))
 			return (UNDEF);
 	}
 
@@ -323,101 +437,86 @@ int form_prefs_counts(const EPI *epi, const REL_INFO *rel_info,
 	rank_pool_ptr = rank_pool;
 	pa_pool_ptr = pa_pool;
 	pa_ptr_pool_ptr = pa_ptr_pool;
+	pa_rank_pool_ptr = pa_rank_pool;
 
 	/* setup returned results_prefs so its summary values can be filled in */
 	results_prefs->num_jgs = num_jgs;
 	results_prefs->jgs = jgs;
 	results_prefs->num_judged = num_judged;
 	results_prefs->num_judged_ret = num_judged_ret;
-	results_prefs->pref_counts = (COUNTS_ARRAY ) { ca_pool, ca_ptr_pool,
-					num_judged };
-	init_counts_array(&results_prefs->pref_counts);
-
-	/* Go through prefs_and_ranks, determine and construct appropriate JG
-	 preference format.  Preferences are counted and add to summary values
-	 as each JG is handled. */
-	jg_ind = 0;
-	start_jg = 0;
-	num_rel_level = 0;
-	num_sub_group = 0;
-	rel_level = -3.0; /* Illegal rel_level */
-	jgid = prefs_and_ranks[0].jg;
-	jsgid = "";
-	for (i = 0; i < trec_prefs->num_text_prefs; i++) {
-		if (strcmp(jgid, prefs_and_ranks[i].jg)) {
-			/* New judgment group. Form previous JG and initialize coounts
-			 for new JG */
-			if (num_sub_group > 1) {
-				/* Preference array JG */
-				jgs[jg_ind].num_ecs = 0; /* Indicator thet prefs_array used */
-				jgs[jg_ind].prefs_array = (PREFS_ARRAY ) { pa_pool_ptr,
-								pa_ptr_pool_ptr, num_judged };
-				pa_pool_ptr += num_judged * num_judged;
-				pa_ptr_pool_ptr += num_judged;
-				jgs[jg_ind].rel_array = rel_pool_ptr;
-				rel_pool_ptr += num_judged;
-				if (UNDEF
-						== form_jg_pa(&prefs_and_ranks[start_jg], i - start_jg,
-								&jgs[jg_ind], results_prefs))
-					return (UNDEF);
-			} else {
-				/* EC JG */
-				jgs[jg_ind].ecs = ec_pool_ptr;
-				ec_pool_ptr += num_rel_level;
-				jgs[jg_ind].num_ecs = num_rel_level;
-				if (UNDEF
-						== form_jg_ec(&prefs_and_ranks[start_jg], i - start_jg,
-								rank_pool_ptr, &jgs[jg_ind], results_prefs))
-					return (UNDEF);
-				rank_pool_ptr += i - start_jg;
-			}
-			jgid = prefs_and_ranks[i].jg;
-			jg_ind++;
-			jsgid = "";
-			start_jg = i;
-			num_sub_group = 0;
-			num_rel_level = 0;
-			rel_level = -3.0; /* Illegal rel_level */
-		}
-		if (strcmp(jsgid, prefs_and_ranks[i].jsg)) {
-			num_sub_group++;
-			jsgid = prefs_and_ranks[i].jsg;
-		}
-		if (rel_level != prefs_and_ranks[i].rel_level) {
-			num_rel_level++;
-			rel_level = prefs_and_ranks[i].rel_level;
+	results_prefs->pref_counts = (PREF_COUNTS ) { pc_pool, 0 };
+	num_pref_counts = 0;
+	pref_counts_formed = 0;
+
+	/* Construct the appropriate preference format of each JG.  Preferences
+	 are counted and added to summary values as each JG is handled. */
+	for (i = 0; i < num_jgs; i++) {
+		span = &jg_spans[i];
+		if (span->num_jsgs > 1) {
+			/* Preference array JG.  docid_ranks holds all the lines'
+			 ranks until form_jg_pa keeps the distinct ones */
+			jgs[i].num_ecs = 0; /* Indicator thet prefs_array used */
+			jgs[i].prefs_array = (PREFS_ARRAY ) { pa_pool_ptr,
+							pa_ptr_pool_ptr, pa_rank_pool_ptr, span->num_docs,
+							PA_NUM_WORDS(span->num_docs), 0 };
+			pa_pool_ptr += span->num_docs * PA_NUM_WORDS(span->num_docs);
+			pa_ptr_pool_ptr += span->num_docs;
+			pa_rank_pool_ptr += span->num_prefs;
+			jgs[i].rel_array = rel_pool_ptr;
+			rel_pool_ptr += span->num_docs;
+			if (UNDEF
+					== add_pa_job(&prefs_and_ranks[span->start],
+							span->num_prefs, &jgs[i]))
+				return (UNDEF);
+		} else {
+			/* EC JG */
+			jgs[i].ecs = ec_pool_ptr;
+			ec_pool_ptr += span->num_rel_levels;
+			jgs[i].num_ecs = span->num_rel_levels;
+			if (UNDEF
+					== form_jg_ec(&prefs_and_ranks[span->start],
+							span->num_prefs, rank_pool_ptr, &jgs[i],
+							results_prefs))
+				return (UNDEF);
+			rank_pool_ptr += span->num_prefs;
 		}
 	}
-	/*  Form last JG  */
-	if (num_sub_group > 1) {
-		/* Preference array JG */
-		jgs[jg_ind].num_ecs = 0; /* Indicator thet prefs_array used */
-		jgs[jg_ind].prefs_array = (PREFS_ARRAY ) { pa_pool_ptr, pa_ptr_pool_ptr,
-						num_judged };
-		pa_pool_ptr += num_judged * num_judged;
-		pa_ptr_pool_ptr += num_judged;
-		jgs[jg_ind].rel_array = rel_pool_ptr;
-		rel_pool_ptr += num_judged;
-		if (UNDEF
-				== form_jg_pa(&prefs_and_ranks[start_jg], i - start_jg,
-						&jgs[jg_ind], results_prefs))
-			return (UNDEF);
-	} else {
-		/* EC JG */
-		jgs[jg_ind].ecs = ec_pool_ptr;
-		ec_pool_ptr += num_rel_level;
-		jgs[jg_ind].num_ecs = num_rel_level;
-		if (UNDEF
-				== form_jg_ec(&prefs_and_ranks[start_jg], i - start_jg,
-						rank_pool_ptr, &jgs[jg_ind], results_prefs))
-			return (UNDEF);
-	}
+	if (UNDEF == run_pa_jobs(results_prefs))
+		return (UNDEF);
 	if (epi->debug_level >= 3)
 		debug_print_results_prefs(results_prefs);
 
 	return (1);
 }
 
+/* form_prefs_counts, with the pair counts of results_prefs also formed */
+int form_prefs_pair_counts(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, RESULTS_PREFS *results_prefs) {
+	int status;
+	long i;
+
+	if (UNDEF
+			== (status = form_prefs_counts(epi, rel_info, results,
+					results_prefs)))
+		return (UNDEF);
+	if (pref_counts_formed)
+		return (status);
+
+	for (i = 0; i < num_jgs; i++) {
+		if (jgs[i].num_ecs) {
+			if (UNDEF == add_ec_pair_counts(&jgs[i], results_prefs))
+				return (UNDEF);
+		} else if (UNDEF == add_pa_pair_counts(&jgs[i], results_prefs))
+			return (UNDEF);
+	}
+	merge_pref_counts(results_prefs);
+	num_pref_counts = results_prefs->pref_counts.num_pairs;
+	pref_counts_formed = 1;
+	if (epi->debug_level >= 3)
+		debug_print_pref_counts(&results_prefs->pref_counts);
+	return (1);
+}
+
 static int form_jg_ec(const PREFS_AND_RANKS *prefs, const long num_prefs,
 		long *rank_pool_ptr, JG *jg, RESULTS_PREFS *results_prefs) {
 	EC *ec_ptr = jg->ecs;
@@ -448,12 +547,15 @@ static int form_jg_ec(const PREFS_AND_RANKS *prefs, const long num_prefs,
 	return (1);
 }
 
-/* Add counts of preference fulfilled and possible to jg for EC pref info */
+/* Add counts of preference fulfilled and possible to jg for EC pref info.
+ ECs are taken from the lowest rel_level up (see comment at top) */
 static int add_ec_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs) {
 	long num_judged_ret = results_prefs->num_judged_ret;
-	unsigned short **pc = results_prefs->pref_counts.array;
-	long *ptr1, *ptr2;
-	long ec1, ec2;
+	long num_ret, num_nonret; /* In current EC */
+	long below_ret = 0, below_nonret = 0; /* In the ECs below it */
+	long num_ful, num_before;
+	long ec, i, j;
+	EC *ecp;
 
 	jg->num_prefs_fulfilled_ret = 0;
 	jg->num_prefs_possible_ret = 0;
@@ -465,25 +567,84 @@ static int add_ec_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs) {
 	jg->num_rel = 0;
 	jg->num_rel_ret = 0;
 
-	/* Go through all ecs counting preferences, and setting up
-	 prefs_count */
-	for (ec1 = 0; ec1 < jg->num_ecs; ec1++) {
-		/* Count num rel and ret */
-		for (ptr1 = jg->ecs[ec1].docid_ranks;
-				ptr1 < &jg->ecs[ec1].docid_ranks[jg->ecs[ec1].num_in_ec];
-				ptr1++) {
-			if (*ptr1 >= num_judged_ret)
-				break;
+	/* check for inconsistency: same doc in multiple ec */
+	for (ec = 0; ec < jg->num_ecs; ec++) {
+		ecp = &jg->ecs[ec];
+		for (i = 0; i < ecp->num_in_ec; i++) {
+			if (doc_ec[ecp->docid_ranks[i]] >= 0
+					&& doc_ec[ecp->docid_ranks[i]] != ec) {
+				fprintf(stderr,
+						"rec_eval.form_prefs_counts: Internal docid %ld occurs with different rel_level in same jsg\n",
+						ecp->docid_ranks[i]);
+				return (UNDEF);
+			}
+			doc_ec[ecp->docid_ranks[i]] = ec;
 		}
-		if (jg->ecs[ec1].rel_level > 0.0) {
-			jg->num_rel_ret += ptr1 - jg->ecs[ec1].docid_ranks;
-			jg->num_rel += jg->ecs[ec1].num_in_ec;
+	}
+
+	for (ec = jg->num_ecs - 1; ec >= 0; ec--) {
+		ecp = &jg->ecs[ec];
+		/* Count num rel and ret.  Retrieved docs come first */
+		for (num_ret = 0;
+				num_ret < ecp->num_in_ec
+						&& ecp->docid_ranks[num_ret] < num_judged_ret;
+				num_ret++)
+			;
+		num_nonret = ecp->num_in_ec - num_ret;
+		if (ecp->rel_level > 0.0) {
+			jg->num_rel_ret += num_ret;
+			jg->num_rel += ecp->num_in_ec;
 		} else {
-			jg->num_nonrel_ret += ptr1 - jg->ecs[ec1].docid_ranks;
-			jg->num_nonrel += jg->ecs[ec1].num_in_ec;
+			jg->num_nonrel_ret += num_ret;
+			jg->num_nonrel += ecp->num_in_ec;
+		}
+
+		/* Count prefs of this EC over those below it.  A retrieved doc here
+		 fulfills its pref over each retrieved doc below it ranked after it */
+		num_ful = 0;
+		for (i = 0; i < num_ret; i++) {
+			num_before = 0;
+			for (j = ecp->docid_ranks[i] + 1; j > 0; j -= j & -j)
+				num_before += fenwick[j];
+			num_ful += below_ret - num_before;
 		}
+		jg->num_prefs_fulfilled_ret += num_ful;
+		jg->num_prefs_possible_ret += num_ret * below_ret - num_ful;
+		jg->num_prefs_fulfilled_imp += num_ret * below_nonret;
+		jg->num_prefs_possible_imp += num_nonret * below_ret;
+		jg->num_prefs_possible_notoccur += num_nonret * below_nonret;
+
+		for (i = 0; i < num_ret; i++)
+			for (j = ecp->docid_ranks[i] + 1; j <= num_judged_ret;
+					j += j & -j)
+				fenwick[j]++;
+		below_ret += num_ret;
+		below_nonret += num_nonret;
+	}
 
-		/* Count prefs */
+	/* Leave fenwick and doc_ec clear for the next JG */
+	for (ec = 0; ec < jg->num_ecs; ec++) {
+		ecp = &jg->ecs[ec];
+		for (i = 0; i < ecp->num_in_ec; i++) {
+			doc_ec[ecp->docid_ranks[i]] = -1;
+			if (ecp->docid_ranks[i] < num_judged_ret)
+				for (j = ecp->docid_ranks[i] + 1; j <= num_judged_ret;
+						j += j & -j)
+					fenwick[j]--;
+		}
+	}
+
+	jg->num_prefs_possible_ret += jg->num_prefs_fulfilled_ret;
+	jg->num_prefs_possible_imp += jg->num_prefs_fulfilled_imp;
+	return (1);
+}
+
+/* Add each pref of EC jg to the pair counts */
+static int add_ec_pair_counts(JG *jg, RESULTS_PREFS *results_prefs) {
+	long *ptr1, *ptr2;
+	long ec1, ec2;
+
+	for (ec1 = 0; ec1 < jg->num_ecs; ec1++) {
 		for (ec2 = ec1 + 1; ec2 < jg->num_ecs; ec2++) {
 			for (ptr1 = jg->ecs[ec1].docid_ranks;
 					ptr1 < &jg->ecs[ec1].docid_ranks[jg->ecs[ec1].num_in_ec];
@@ -491,49 +652,123 @@ static int add_ec_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs) {
 				for (ptr2 = jg->ecs[ec2].docid_ranks;
 						ptr2 < &jg->ecs[ec2].docid_ranks[jg->ecs[ec2].num_in_ec];
 						ptr2++) {
-					/* Add pref to summary info */
-					pc[*ptr1][*ptr2]++;
-					/* check for inconsistency: same doc in multiple ec */
-					if (*ptr1 == *ptr2) {
-						fprintf(stderr,
-								"rec_eval.form_prefs_counts: Internal docid %ld occurs with different rel_level in same jsg\n",
-								*ptr1);
+					if (UNDEF == add_pref_count(*ptr1, *ptr2, results_prefs))
 						return (UNDEF);
-						/* need to check this in pa also? */
-					}
-					/* Add count to appropriate jg_num* */
-					if (*ptr1 < *ptr2) {
-						/* judgment fulfilled */
-						if (*ptr2 < num_judged_ret)
-							jg->num_prefs_fulfilled_ret++;
-						else if (*ptr1 < num_judged_ret)
-							jg->num_prefs_fulfilled_imp++;
-						else
-							jg->num_prefs_possible_notoccur++;
-					} else {
-						if (*ptr1 < num_judged_ret)
-							jg->num_prefs_possible_ret++;
-						else if (*ptr2 < num_judged_ret)
-							jg->num_prefs_possible_imp++;
-						else
-							jg->num_prefs_possible_notoccur++;
-					}
 				}
 			}
 		}
 	}
+	return (1);
+}
 
-	jg->num_prefs_possible_ret += jg->num_prefs_fulfilled_ret;
-	jg->num_prefs_possible_imp += jg->num_prefs_fulfilled_imp;
+/* Queue the preference array jg (pool space already set) to be formed
+ from prefs by run_pa_jobs */
+static int add_pa_job(PREFS_AND_RANKS *prefs, const long num_prefs, JG *jg) {
+	pa_jobs[num_pa_jobs++] = (PA_JOB ) { prefs, num_prefs, jg };
 	return (1);
 }
 
-static int form_jg_pa(const PREFS_AND_RANKS *prefs, const long num_prefs,
-		JG *jg, RESULTS_PREFS *results_prefs) {
+/* Form all queued preference array JGs, in parallel if there are several
+ and they are large enough to be worth it */
+static int run_pa_jobs(RESULTS_PREFS *results_prefs) {
+	PA_JOBS jobs;
+	pthread_t *threads;
+	long num_threads, i;
+
+	jobs.jobs = pa_jobs;
+	jobs.num_jobs = num_pa_jobs;
+	jobs.results_prefs = results_prefs;
+	jobs.next_job = 0;
+	jobs.status = 1;
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > num_pa_jobs)
+		num_threads = num_pa_jobs;
+	if (num_threads <= 1 || results_prefs->num_judged < MIN_THREADED_JUDGED
+			|| 0 != pthread_mutex_init(&jobs.lock, NULL)) {
+		for (i = 0; i < num_pa_jobs; i++)
+			if (UNDEF
+					== form_jg_pa(pa_jobs[i].prefs, pa_jobs[i].num_prefs,
+							pa_jobs[i].jg, results_prefs))
+				return (UNDEF);
+		return (1);
+	}
+
+	/* This thread takes jobs too.  If a thread cannot be started, the
+	 others take its share */
+	if (NULL == (threads = Malloc(num_threads - 1, pthread_t))) {
+		(void) pthread_mutex_destroy(&jobs.lock);
+		return (UNDEF);
+	}
+	for (i = 0; i < num_threads - 1; i++)
+		if (0
+				!= pthread_create(&threads[i], NULL, run_pa_jobs_thread,
+						&jobs))
+			break;
+	num_threads = i;
+	(void) run_pa_jobs_thread(&jobs);
+	for (i = 0; i < num_threads; i++)
+		(void) pthread_join(threads[i], NULL);
+	Free(threads);
+	(void) pthread_mutex_destroy(&jobs.lock);
+	return (jobs.status);
+}
+
+/* Form queued preference array JGs of pa_jobs_ptr (a PA_JOBS) until there
+ are none left, or one has failed */
+static void *run_pa_jobs_thread(void *pa_jobs_ptr) {
+	PA_JOBS *jobs = pa_jobs_ptr;
+	long job;
+	int status;
+
+	while (1) {
+		(void) pthread_mutex_lock(&jobs->lock);
+		job = UNDEF == jobs->status ? jobs->num_jobs : jobs->next_job++;
+		(void) pthread_mutex_unlock(&jobs->lock);
+		if (job >= jobs->num_jobs)
+			break;
+		status = form_jg_pa(jobs->jobs[job].prefs, jobs->jobs[job].num_prefs,
+				jobs->jobs[job].jg, jobs->results_prefs);
+		if (UNDEF == status) {
+			(void) pthread_mutex_lock(&jobs->lock);
+			jobs->status = UNDEF;
+			(void) pthread_mutex_unlock(&jobs->lock);
+		}
+	}
+	return (NULL);
+}
+
+static int form_jg_pa(PREFS_AND_RANKS *prefs, const long num_prefs, JG *jg,
+		RESULTS_PREFS *results_prefs) {
 	long i, j;
+	long num_docs;
+	long *doc_ptr;
 
 	PREFS_ARRAY *pa = &jg->prefs_array;
 
+	/* Docs of the JG, in docid_rank order, and the index of the doc of
+	 each pref among them */
+	for (i = 0; i < num_prefs; i++)
+		pa->docid_ranks[i] = prefs[i].rank;
+	qsort((char *) pa->docid_ranks, (int) num_prefs, sizeof(long),
+			comp_docid_rank);
+	num_docs = 0;
+	for (i = 0; i < num_prefs; i++) {
+		if (0 == num_docs || pa->docid_ranks[i] != pa->docid_ranks[num_docs - 1])
+			pa->docid_ranks[num_docs++] = pa->docid_ranks[i];
+	}
+	for (pa->num_judged_ret = 0;
+			pa->num_judged_ret < num_docs
+					&& pa->docid_ranks[pa->num_judged_ret]
+							< results_prefs->num_judged_ret;
+			pa->num_judged_ret++)
+		;
+	for (i = 0; i < num_prefs; i++) {
+		doc_ptr = (long *) bsearch((char *) &prefs[i].rank,
+				(char *) pa->docid_ranks, (int) num_docs, sizeof(long),
+				comp_docid_rank);
+		prefs[i].pa_index = doc_ptr - pa->docid_ranks;
+	}
+
 	/* Initialize and zero prefs_array */
 	init_prefs_array(pa);
 
@@ -547,15 +782,16 @@ static int form_jg_pa(const PREFS_AND_RANKS *prefs, const long num_prefs,
 	/* prefs is sorted by jsg, then rel_level, then rank */
 	for (i = 0; i < num_prefs; i++) {
 		/* check for consistency and add rel_level info */
-		if ((jg->rel_array[prefs[i].rank] > 0.0 && prefs[i].rel_level == 0.0)
-				|| (jg->rel_array[prefs[i].rank] == 0.0
+		if ((jg->rel_array[prefs[i].pa_index] > 0.0
+				&& prefs[i].rel_level == 0.0)
+				|| (jg->rel_array[prefs[i].pa_index] == 0.0
 						&& prefs[i].rel_level > 0.0)) {
 			fprintf(stderr,
 					"rec_eval.form_prefs_counts: doc '%s' has both 0 and non-0 rel_level assigned\n",
 					prefs[i].docno);
 			return (UNDEF);
 		}
-		jg->rel_array[prefs[i].rank] = prefs[i].rel_level;
+		jg->rel_array[prefs[i].pa_index] = prefs[i].rel_level;
 
 		/* Add preference for i to all other entries in this JSG with lower
 		 rel_levels */
@@ -566,7 +802,7 @@ static int form_jg_pa(const PREFS_AND_RANKS *prefs, const long num_prefs,
 			j++;
 		/* Rest of JSG has lower rel_level */
 		while (j < num_prefs && 0 == strcmp(prefs[i].jsg, prefs[j].jsg)) {
-			pa->array[prefs[i].rank][prefs[j].rank] = 1;
+			PA_SET_BIT(pa, prefs[i].pa_index, prefs[j].pa_index);
 			j++;
 		}
 	}
@@ -583,76 +819,38 @@ static int form_jg_pa(const PREFS_AND_RANKS *prefs, const long num_prefs,
 	return (1);
 }
 
+/* Add to pa all preferences implied by transitivity (Warshall's
+ algorithm: once the docs preferred by k are added to every row preferring
+ k, paths through docs 0..k are all present) */
 static int add_transitives(PREFS_ARRAY *pa) {
-	PREFS_ARRAY m1;
-	PREFS_ARRAY m2;
-
-	long i, j;
-	PREFS_ARRAY *array_in, *array_out, *temp;
-
-	/* Need two temporary arrays of same size as pa. Reserve space and
-	 zero out arrays */
-	if (NULL
-			== (temp_pa_pool = te_chk_and_malloc(temp_pa_pool,
-					&max_temp_pa_pool, 2 * pa->num_judged * pa->num_judged,
-					sizeof(unsigned char)))
-			||
-			NULL
-					== (temp_pa_ptr_pool = te_chk_and_malloc(temp_pa_ptr_pool,
-							&max_temp_pa_ptr_pool, 2 * pa->num_judged,
-							sizeof(unsigned char *))))
-		return (UNDEF);
+	long i, j, k, w;
+	unsigned long *row_i, *row_k;
 
-	m1 = (PREFS_ARRAY ) { temp_pa_pool, temp_pa_ptr_pool, pa->num_judged };
-	m2 = (PREFS_ARRAY ) { temp_pa_pool + pa->num_judged * pa->num_judged,
-					temp_pa_ptr_pool + pa->num_judged, pa->num_judged };
-	if (pa->num_judged != saved_num_judged) {
-		/* if new size array, must reset row pointers */
-		saved_num_judged = pa->num_judged;
+	for (k = 0; k < pa->num_judged; k++) {
+		row_k = pa->array[k];
 		for (i = 0; i < pa->num_judged; i++) {
-			m1.array[i] = m1.full_array + i * pa->num_judged;
-			m2.array[i] = m2.full_array + i * pa->num_judged;
+			if (!PA_BIT(pa, i, k))
+				continue;
+			row_i = pa->array[i];
+			for (w = 0; w < pa->num_words; w++)
+				row_i[w] |= row_k[w];
 		}
 	}
 
-	/* Add diagonal all ones in pa */
-	for (i = 0; i < pa->num_judged; i++) {
-		pa->array[i][i] = 1;
-	}
-
-	/* Multiply prefs_array by itself until there are no changes */
-	array_in = pa;
-	array_out = &m1;
-	if (mult_and_check_change(pa, array_in, array_out)) {
-		array_in = array_out;
-		array_out = &m2;
-		while (mult_and_check_change(pa, array_in, array_out)) {
-			temp = array_in;
-			array_in = array_out;
-			array_out = temp;
-		}
-		/* There were changes,  now set pa values to those of array_out */
-		for (i = 0; i < pa->num_judged; i++) {
-			for (j = 0; j < pa->num_judged; j++) {
-				pa->array[i][j] = array_out->array[i][j];
-			}
-		}
-	}
-
-	/* Reset all diagonals to 0 in pa */
-	for (i = 0; i < pa->num_judged; i++) {
-		pa->array[i][i] = 0;
-	}
-
-	/* Check for inconsistencies */
+	/* A doc in a cycle is now preferred to itself.  Clear the diagonal.
+	 Only a doc judged at two levels of a JSG is its own cycle; cycles
+	 with other docs are inconsistencies, normally already found (and
+	 dropped or failed) by te_get_prefs */
 	for (i = 0; i < pa->num_judged; i++) {
+		if (!PA_BIT(pa, i, i))
+			continue;
+		PA_CLEAR_BIT(pa, i, i);
 		for (j = 0; j < pa->num_judged; j++) {
-			if (i != j && pa->array[i][j] && pa->array[j][i]) {
+			if (j != i && PA_BIT(pa, i, j) && PA_BIT(pa, j, i)) {
 				fprintf(stderr,
 						"rec_eval.form_prefs_counts: Pref inconsistency found\n      internal rank %ld and internal rank %ld are conflicted\n",
 						i, j);
-				abort();
-				return (-1);
+				return (UNDEF);
 			}
 		}
 	}
@@ -662,11 +860,11 @@ static int add_transitives(PREFS_ARRAY *pa) {
 
 /* Add counts of preference fulfilled and possible to jg */
 static int add_pa_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs) {
-	unsigned char **a = jg->prefs_array.array;
-	unsigned short **c = results_prefs->pref_counts.array;
-	long num_judged = results_prefs->num_judged;
-	long num_judged_ret = results_prefs->num_judged_ret;
-	long i, j;
+	PREFS_ARRAY *pa = &jg->prefs_array;
+	long num_judged = pa->num_judged;
+	long num_judged_ret = pa->num_judged_ret;
+	unsigned long *row;
+	long i;
 
 	jg->num_prefs_fulfilled_ret = 0;
 	jg->num_prefs_possible_ret = 0;
@@ -693,43 +891,23 @@ static int add_pa_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs) {
 			jg->num_nonrel++;
 	}
 
-	for (i = 0; i < num_judged_ret; i++) {
-		for (j = 0; j < i; j++) {
-			if (a[i][j]) {
-				/* Pref not fulfilled.  Area A2 (see comment at top) */
-				c[i][j]++;
-				jg->num_prefs_possible_ret++;
-			}
-		}
-		for (j = i + 1; j < num_judged_ret; j++) {
-			if (a[i][j]) {
-				/* Pref fulfilled.  Area A1 (see comment at top) */
-				c[i][j]++;
-				jg->num_prefs_fulfilled_ret++;
-			}
-		}
-		for (j = num_judged_ret; j < num_judged; j++) {
-			if (a[i][j]) {
-				/* Pref fulfilled implied.  Area A3 (see comment at top) */
-				c[i][j]++;
-				jg->num_prefs_fulfilled_imp++;
-			}
-		}
-	}
-	for (i = num_judged_ret; i < num_judged; i++) {
-		for (j = 0; j < num_judged_ret; j++) {
-			if (a[i][j]) {
-				/* Pref not fulfilled implied.  Area A4 (see comment at top) */
-				c[i][j]++;
-				jg->num_prefs_possible_imp++;
-			}
-		}
-		for (j = num_judged_ret; j < num_judged; j++) {
-			if (a[i][j]) {
-				/* Pref not occur at all.  Area A5 (see comment at top) */
-				c[i][j]++;
-				jg->num_prefs_possible_notoccur++;
-			}
+	for (i = 0; i < num_judged; i++) {
+		row = pa->array[i];
+		if (i < num_judged_ret) {
+			/* Pref not fulfilled.  Area A2 (see comment at top) */
+			jg->num_prefs_possible_ret += count_bits(row, 0, i);
+			/* Pref fulfilled.  Area A1 (see comment at top) */
+			jg->num_prefs_fulfilled_ret += count_bits(row, i + 1,
+					num_judged_ret);
+			/* Pref fulfilled implied.  Area A3 (see comment at top) */
+			jg->num_prefs_fulfilled_imp += count_bits(row, num_judged_ret,
+					num_judged);
+		} else {
+			/* Pref not fulfilled implied.  Area A4 (see comment at top) */
+			jg->num_prefs_possible_imp += count_bits(row, 0, num_judged_ret);
+			/* Pref not occur at all.  Area A5 (see comment at top) */
+			jg->num_prefs_possible_notoccur += count_bits(row, num_judged_ret,
+					num_judged);
 		}
 	}
 
@@ -738,32 +916,100 @@ static int add_pa_pref_to_jg(JG *jg, RESULTS_PREFS *results_prefs) {
 	return (1);
 }
 
-/* Multiply array a1 * array a2 and put result in array res.
- Return (1) if array res is changed from array a2 after multiplication
- else return 0 */
-static int mult_and_check_change(const PREFS_ARRAY *a1, const PREFS_ARRAY *a2,
-		PREFS_ARRAY *res) {
-	int change = 0;
-	long i, j, k;
-	for (i = 0; i < a1->num_judged; i++) {
-		for (j = 0; j < a1->num_judged; j++) {
-			res->array[i][j] = 0;
-			for (k = 0; k < a1->num_judged; k++) {
-				if (a1->array[i][k] && a2->array[k][j]) {
-					res->array[i][j] = 1;
-					break;
-				}
-			}
+/* Add each pref of prefs array jg to the pair counts */
+static int add_pa_pair_counts(JG *jg, RESULTS_PREFS *results_prefs) {
+	PREFS_ARRAY *pa = &jg->prefs_array;
+	unsigned long word;
+	long i, w;
 
-			if (a2->array[i][j] != res->array[i][j])
-				change = 1;
+	for (i = 0; i < pa->num_judged; i++) {
+		for (w = 0; w < pa->num_words; w++) {
+			for (word = pa->array[i][w]; word; word &= word - 1)
+				if (UNDEF
+						== add_pref_count(pa->docid_ranks[i],
+								pa->docid_ranks[w * PA_WORD_BITS
+										+ count_word_bits((word & -word) - 1)],
+								results_prefs))
+					return (UNDEF);
 		}
 	}
-	return (change);
+	return (1);
+}
+
+/* Number of bits set in row from bit start up to (not including) end */
+static long count_bits(const unsigned long *row, long start, long end) {
+	long first = start / PA_WORD_BITS;
+	long last = end / PA_WORD_BITS;
+	unsigned long first_mask = ~0UL << (start % PA_WORD_BITS);
+	unsigned long last_mask = (1UL << (end % PA_WORD_BITS)) - 1;
+	long count, w;
+
+	if (start >= end)
+		return (0);
+	if (first == last)
+		return (count_word_bits(row[first] & first_mask & last_mask));
+	count = count_word_bits(row[first] & first_mask);
+	for (w = first + 1; w < last; w++)
+		count += count_word_bits(row[w]);
+	if (last_mask)
+		count += count_word_bits(row[last] & last_mask);
+	return (count);
+}
+
+/* Add a preference for doc_pref over doc_nonpref to the pair counts of
+ results_prefs, to be combined with others for the same pair later */
+static int add_pref_count(long doc_pref, long doc_nonpref,
+		RESULTS_PREFS *results_prefs) {
+	PREF_COUNTS *pc = &results_prefs->pref_counts;
+
+	if (NULL
+			== (pc_pool = te_chk_and_realloc(pc_pool, &max_pc_pool,
+					pc->num_pairs + 1, sizeof(PREF_COUNT))))
+		return (UNDEF);
+	pc->pairs = pc_pool;
+	if (doc_pref < doc_nonpref)
+		pc->pairs[pc->num_pairs++] = (PREF_COUNT ) { doc_pref, doc_nonpref,
+						1, 0 };
+	else
+		pc->pairs[pc->num_pairs++] = (PREF_COUNT ) { doc_nonpref, doc_pref,
+						0, 1 };
+	return (1);
+}
+
+/* Sort the pair counts of results_prefs by pair and combine those of the
+ same pair */
+static void merge_pref_counts(RESULTS_PREFS *results_prefs) {
+	PREF_COUNTS *pc = &results_prefs->pref_counts;
+	long i, num_pairs;
+
+	if (0 == pc->num_pairs)
+		return;
+	qsort((char *) pc->pairs, (int) pc->num_pairs, sizeof(PREF_COUNT),
+			comp_pref_count);
+	num_pairs = 0;
+	for (i = 1; i < pc->num_pairs; i++) {
+		if (pc->pairs[i].doc1 == pc->pairs[num_pairs].doc1
+				&& pc->pairs[i].doc2 == pc->pairs[num_pairs].doc2) {
+			pc->pairs[num_pairs].count12 += pc->pairs[i].count12;
+			pc->pairs[num_pairs].count21 += pc->pairs[i].count21;
+		} else
+			pc->pairs[++num_pairs] = pc->pairs[i];
+	}
+	pc->num_pairs = num_pairs + 1;
+}
+
+static long count_word_bits(unsigned long word) {
+#ifdef __GNUC__
+	return (__builtin_popcountl(word));
+#else
+	long count = 0;
+	for (; word; word &= word - 1)
+		count++;
+	return (count);
+#endif
 }
 
-static int form_prefs_and_ranks(const EPI*epi,
-		const TEXT_RESULTS_INFO *text_results_info,
+static int form_prefs_and_ranks(const EPI*epi, const RESULTS *results,
 		const TEXT_PREFS_INFO *trec_prefs, PREFS_AND_RANKS *prefs_and_ranks,
 		long *num_judged, long *num_judged_ret) {
 	long lnum_judged_ret; /* local num_judged_ret */
@@ -772,37 +1018,50 @@ static int form_prefs_and_ranks(const EPI*epi,
 	long num_results; /* Current number of results (changes as docs
 	 thrown away from docno_results) */
 	long num_prefs = trec_prefs->num_text_prefs;
+	long num_ranked, run_start, run_end, rank;
+	RANKED_RESULTS ranked_results;
+	RANKED_DOC *ranked, *docno_index;
 	PREFS_AND_RANKS *ranks_ptr, *end_ranks, *start_ptr;
 
-	/* Copy docno results and add ranks */
-	num_results = text_results_info->num_text_results;
+	/* Get the ranking of the results shared with the other builders */
+	if (UNDEF == te_form_ranked_results(epi, results, &ranked_results))
+		return (UNDEF);
+	num_ranked = ranked_results.num_ranked;
+	ranked = ranked_results.ranked;
+	docno_index = ranked_results.docno_index;
 	if (NULL
 			== (docno_results = te_chk_and_malloc(docno_results,
-					&max_docno_results, num_results, sizeof(DOCNO_RESULTS))))
+					&max_docno_results, num_ranked, sizeof(DOCNO_RESULTS)))
+			||
+			NULL
+					== (tie_ranks = te_chk_and_malloc(tie_ranks, &max_tie_ranks,
+							num_ranked, sizeof(long))))
 		return (UNDEF);
 
-	for (i = 0; i < num_results; i++) {
-		docno_results[i].docno = text_results_info->text_results[i].docno;
-		docno_results[i].sim = text_results_info->text_results[i].sim;
+	/* Preferences have always broken sim ties by increasing docno, the
+	 reverse of the shared ranking, so rank each run of equal sims in
+	 reverse (starting at 1) */
+	for (run_start = 0; run_start < num_ranked; run_start = run_end) {
+		run_end = run_start + 1;
+		while (run_end < num_ranked
+				&& ranked[run_end].sim == ranked[run_start].sim)
+			run_end++;
+		for (i = run_start; i < run_end; i++)
+			tie_ranks[i] = run_start + run_end - i;
 	}
-	/* Sort results by sim, breaking ties lexicographically using docno */
-	qsort((char *) docno_results, (int) num_results, sizeof(DOCNO_RESULTS),
-			comp_sim_docno);
 
-	if (epi->debug_level >= 5)
-		debug_print_docno_results(docno_results, num_results,
-				"After input, before ranks");
-
-	/* Only look at epi->max_num_docs_per_topic (not normally an issue) */
-	if (num_results > epi->max_num_docs_per_topic)
-		num_results = epi->max_num_docs_per_topic;
-	/* Add ranks to docno_results (starting at 1) */
-	for (i = 0; i < num_results; i++) {
-		docno_results[i].rank = i + 1;
+	/* Copy docno results within epi->max_num_docs_per_topic (not normally
+	 an issue), in increasing docno order */
+	num_results = 0;
+	for (i = 0; i < num_ranked; i++) {
+		rank = tie_ranks[docno_index[i].rank - 1];
+		if (rank <= epi->max_num_docs_per_topic) {
+			docno_results[num_results].docno = docno_index[i].docno;
+			docno_results[num_results].sim = docno_index[i].sim;
+			docno_results[num_results].rank = rank;
+			num_results++;
+		}
 	}
-	/* Sort docno_results by increasing docno */
-	qsort((char *) docno_results, (int) num_results, sizeof(DOCNO_RESULTS),
-			comp_docno);
 	/* Error checking for duplicates */
 	for (i = 1; i < num_results; i++) {
 		if (0 == strcmp(docno_results[i].docno, docno_results[i - 1].docno)) {
@@ -924,26 +1183,14 @@ static int form_prefs_and_ranks(const EPI*epi,
 }
 
 static void init_prefs_array(PREFS_ARRAY *pa) {
-	unsigned char *row_ptr;
+	unsigned long *row_ptr;
 	long i;
 	(void) memset((void *) pa->full_array, 0,
-			pa->num_judged * pa->num_judged * sizeof(unsigned char));
+			pa->num_judged * pa->num_words * sizeof(unsigned long));
 	row_ptr = pa->full_array;
 	for (i = 0; i < pa->num_judged; i++) {
 		pa->array[i] = row_ptr;
-		row_ptr += pa->num_judged;
-	}
-}
-
-static void init_counts_array(COUNTS_ARRAY *ca) {
-	unsigned short *row_ptr;
-	long i;
-	(void) memset((void *) ca->full_array, 0,
-			ca->num_judged * ca->num_judged * sizeof(unsigned short));
-	row_ptr = ca->full_array;
-	for (i = 0; i < ca->num_judged; i++) {
-		ca->array[i] = row_ptr;
-		row_ptr += ca->num_judged;
+		row_ptr += pa->num_words;
 	}
 }
 
@@ -967,15 +1214,6 @@ static int comp_prefs_and_ranks_jg_rel_level(PREFS_AND_RANKS *ptr1,
 	return (ptr1->rank - ptr2->rank);
 }
 
-static int comp_sim_docno(ptr1, ptr2)
-	DOCNO_RESULTS *ptr1;DOCNO_RESULTS *ptr2; {
-	if (ptr1->sim > ptr2->sim)
-		return (-1);
-	if (ptr1->sim < ptr2->sim)
-		return (1);
-	return (strcmp(ptr1->docno, ptr2->docno));
-}
-
 static int comp_docno(DOCNO_RESULTS *ptr1, DOCNO_RESULTS *ptr2) {
 	return (strcmp(ptr1->docno, ptr2->docno));
 }
@@ -984,6 +1222,20 @@ static int comp_results_inc_rank(DOCNO_RESULTS *ptr1, DOCNO_RESULTS *ptr2) {
 	return (ptr1->rank - ptr2->rank);
 }
 
+static int comp_docid_rank(long *ptr1, long *ptr2) {
+	if (*ptr1 != *ptr2)
+		return (*ptr1 < *ptr2 ? -1 : 1);
+	return (0);
+}
+
+static int comp_pref_count(PREF_COUNT *ptr1, PREF_COUNT *ptr2) {
+	if (ptr1->doc1 != ptr2->doc1)
+		return (ptr1->doc1 < ptr2->doc1 ? -1 : 1);
+	if (ptr1->doc2 != ptr2->doc2)
+		return (ptr1->doc2 < ptr2->doc2 ? -1 : 1);
+	return (0);
+}
+
 static void debug_print_prefs_and_ranks(PREFS_AND_RANKS *par, long num_prefs,
 		char *location) {
 	long i;
@@ -1021,31 +1273,27 @@ static void debug_print_ec(EC *ec) {
 
 static void debug_print_prefs_array(PREFS_ARRAY *pa) {
 	long i, j;
-	printf("    Prefs_Array Dump. Num_judged %ld", pa->num_judged);
+	printf("    Prefs_Array Dump. Num_judged %ld, num_judged_ret %ld",
+			pa->num_judged, pa->num_judged_ret);
 	for (i = 0; i < pa->num_judged; i++) {
-		printf("\n      Row %3ld\n      ", i);
+		printf("\n      Row %3ld (docid_rank %ld)\n      ", i,
+				pa->docid_ranks[i]);
 		for (j = 0; j < pa->num_judged; j++) {
 			if (j && 0 == (j % 20))
 				printf("    (%ld)\n     ", j);
-			printf("%2hhd", pa->array[i][j]);
+			printf("%2ld", (long) PA_BIT(pa, i, j));
 		}
 	}
 	putchar('\n');
 	fflush(stdout);
 }
 
-static void debug_print_counts_array(COUNTS_ARRAY *ca) {
-	long i, j;
-	printf("  Counts_Array Dump. Num_judged %ld", ca->num_judged);
-	for (i = 0; i < ca->num_judged; i++) {
-		printf("\n    Row %3ld\n    ", i);
-		for (j = 0; j < ca->num_judged; j++) {
-			if (j && 0 == (j % 20))
-				printf("    (%ld)\n   ", j);
-			printf("%2hd ", ca->array[i][j]);
-		}
-	}
-	putchar('\n');
+static void debug_print_pref_counts(PREF_COUNTS *pc) {
+	long i;
+	printf("  Pref_counts Dump. Num_pairs %ld\n", pc->num_pairs);
+	for (i = 0; i < pc->num_pairs; i++)
+		printf("    %3ld %3ld\t%3ld %3ld\n", pc->pairs[i].doc1,
+				pc->pairs[i].doc2, pc->pairs[i].count12, pc->pairs[i].count21);
 	fflush(stdout);
 }
 
@@ -1088,7 +1336,8 @@ static void debug_print_results_prefs(RESULTS_PREFS *rp) {
 			rp->num_judged);
 	for (i = 0; i < rp->num_jgs; i++)
 		debug_print_jg(&rp->jgs[i]);
-	debug_print_counts_array(&rp->pref_counts);
+	if (pref_counts_formed)
+		debug_print_pref_counts(&rp->pref_counts);
 }
 
 int te_form_pref_counts_cleanup() {
@@ -1109,13 +1358,21 @@ int te_form_pref_counts_cleanup() {
 		Free(ec_pool);
 		max_ec_pool = 0;
 	}
-	if (max_ca_pool > 0) {
-		Free(ca_pool);
-		max_ca_pool = 0;
+	if (max_pc_pool > 0) {
+		Free(pc_pool);
+		max_pc_pool = 0;
+	}
+	if (max_fenwick > 0) {
+		Free(fenwick);
+		max_fenwick = 0;
+	}
+	if (max_doc_ec > 0) {
+		Free(doc_ec);
+		max_doc_ec = 0;
 	}
-	if (max_ca_ptr_pool > 0) {
-		Free(ca_ptr_pool);
-		max_ca_ptr_pool = 0;
+	if (max_pa_jobs > 0) {
+		Free(pa_jobs);
+		max_pa_jobs = 0;
 	}
 	if (max_pa_pool > 0) {
 		Free(pa_pool);
@@ -1125,6 +1382,10 @@ int te_form_pref_counts_cleanup() {
 		Free(pa_ptr_pool);
 		max_pa_ptr_pool = 0;
 	}
+	if (max_pa_rank_pool > 0) {
+		Free(pa_rank_pool);
+		max_pa_rank_pool = 0;
+	}
 	if (max_rel_pool > 0) {
 		Free(rel_pool);
 		max_rel_pool = 0;
@@ -1133,17 +1394,21 @@ int te_form_pref_counts_cleanup() {
 		Free(prefs_and_ranks);
 		max_prefs_and_ranks = 0;
 	}
+	if (max_tie_ranks > 0) {
+		Free(tie_ranks);
+		max_tie_ranks = 0;
+	}
 	if (max_docno_results > 0) {
 		Free(docno_results);
 		max_docno_results = 0;
 	}
-	if (max_temp_pa_pool > 0) {
-		Free(temp_pa_pool);
-		max_temp_pa_pool = 0;
+	if (max_jg_spans > 0) {
+		Free(jg_spans);
+		max_jg_spans = 0;
 	}
-	if (max_temp_pa_ptr_pool > 0) {
-		Free(temp_pa_ptr_pool);
-		max_temp_pa_ptr_pool = 0;
+	if (max_doc_jg > 0) {
+		Free(doc_jg);
+		max_doc_jg = 0;
 	}
-	return (1);
+	return (te_form_ranked_results_cleanup());
 }
@@ -0,0 +1,152 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "trec_format.h"
+#include "functions.h"
+/* Takes the retrieved docs for a query, and returns a RANKED_RESULTS
+ object giving them in rank order (decreasing sim, ties broken by
+ decreasing docno), plus an index of them by docno giving the rank of
+ each.  The whole ranking is formed, whatever
+ epi->max_num_docs_per_topic is; the intermediate form builders apply
+ the depth themselves.
+
+ This procedure may be called repeatedly for a given topic, by any of
+ the intermediate form builders - returned values are cached until the
+ query changes, so the results are sorted once per query however many
+ builders and depths look at them.
+
+ results format must be "trec_results".
+
+ UNDEF returned if error, 0 if used cache values, 1 if new values.
+ */
+
+static int comp_sim_docno(), comp_docno_rank();
+
+/* Current cached query */
+static TE_THREAD char *current_query = "no query";
+static TE_THREAD long max_current_query = 0;
+
+/* Space reserved for cached returned values */
+static TE_THREAD RANKED_RESULTS saved_ranked_results;
+static TE_THREAD RANKED_DOC *ranked;
+static TE_THREAD long max_ranked = 0;
+static TE_THREAD RANKED_DOC *docno_index;
+static TE_THREAD long max_docno_index = 0;
+
+int te_form_ranked_results(const EPI *epi, const RESULTS *results,
+		RANKED_RESULTS *ranked_results) {
+	long i;
+	long num_results;
+	TEXT_RESULTS_INFO *text_results_info;
+
+	if (0 == strcmp(current_query, results->qid)) {
+		/* Have done this query already. Return cached values */
+		*ranked_results = saved_ranked_results;
+		return (0);
+	}
+
+	/* Check that format type of result info is correct */
+	if (strcmp("trec_results", results->ret_format)) {
+		fprintf(stderr,
+				"rec_eval.form_ranked_results: results format not trec_results\n");
+		return (UNDEF);
+	}
+
+	text_results_info = (TEXT_RESULTS_INFO *) results->q_results;
+	num_results = text_results_info->num_text_results;
+
+	if (NULL
+			== (ranked = te_chk_and_malloc(ranked, &max_ranked, num_results,
+					sizeof(RANKED_DOC)))
+			||
+			NULL
+					== (docno_index = te_chk_and_malloc(docno_index,
+							&max_docno_index, num_results, sizeof(RANKED_DOC))))
+		return (UNDEF);
+
+	for (i = 0; i < num_results; i++) {
+		ranked[i].docno = text_results_info->text_results[i].docno;
+		ranked[i].sim = text_results_info->text_results[i].sim;
+	}
+
+	/* Sort results by sim, breaking ties lexicographically using docno */
+	qsort((char *) ranked, (int) num_results, sizeof(RANKED_DOC),
+			comp_sim_docno);
+
+	/* Add ranks (starting at 1), and index them by docno (ties by rank) */
+	for (i = 0; i < num_results; i++) {
+		ranked[i].rank = i + 1;
+		docno_index[i] = ranked[i];
+	}
+	qsort((char *) docno_index, (int) num_results, sizeof(RANKED_DOC),
+			comp_docno_rank);
+
+	/* A duplicate docno is only an error for a builder if both copies are
+	 within the depth it evaluates, so remember the smallest depth at which
+	 that happens */
+	saved_ranked_results.dup_depth = MAXLONG;
+	saved_ranked_results.dup_docno = NULL;
+	for (i = 1; i < num_results; i++) {
+		if (0 == strcmp(docno_index[i].docno, docno_index[i - 1].docno)
+				&& docno_index[i].rank < saved_ranked_results.dup_depth) {
+			saved_ranked_results.dup_depth = docno_index[i].rank;
+			saved_ranked_results.dup_docno = docno_index[i].docno;
+		}
+	}
+
+	saved_ranked_results.num_ranked = num_results;
+	saved_ranked_results.ranked = ranked;
+	saved_ranked_results.docno_index = docno_index;
+
+	/* Make sure enough space for query and save copy.  Only done once
+	 the ranking is complete, so a failure leaves no stale cache */
+	i = strlen(results->qid) + 1;
+	if (NULL
+			== (current_query = te_chk_and_malloc(current_query,
+					&max_current_query, i, sizeof(char))))
+		return (UNDEF);
+	(void) strncpy(current_query, results->qid, i);
+
+	*ranked_results = saved_ranked_results;
+	return (1);
+}
+
+static int comp_sim_docno(ptr1, ptr2)
+	RANKED_DOC *ptr1;RANKED_DOC *ptr2; {
+	if (ptr1->sim > ptr2->sim)
+		return (-1);
+	if (ptr1->sim < ptr2->sim)
+		return (1);
+	return (strcmp(ptr2->docno, ptr1->docno));
+}
+
+static int comp_docno_rank(ptr1, ptr2)
+	RANKED_DOC *ptr1;RANKED_DOC *ptr2; {
+	int cmp = strcmp(ptr1->docno, ptr2->docno);
+	if (cmp)
+		return (cmp);
+	return (ptr1->rank - ptr2->rank);
+}
+
+int te_form_ranked_results_cleanup() {
+	if (max_current_query > 0) {
+		Free(current_query);
+		max_current_query = 0;
+		current_query = "no_query";
+	}
+	if (max_ranked > 0) {
+		Free(ranked);
+		max_ranked = 0;
+	}
+	if (max_docno_index > 0) {
+		Free(docno_index);
+		max_docno_index = 0;
+	}
+	return (1);
+}
@@ -19,7 +19,11 @@
  RELVALUE_UNJUDGED (-2) if docno is in text_qrels and was not judged.
 
  This procedure may be called repeatedly for a given topic - returned
- values are cached until the query changes.
+ values are cached until the query changes.  The join against text_qrels
+ is done once per query over the complete ranking (shared with the other
+ builders, see form_ranked_results.c); the values for
+ epi->max_num_docs_per_topic are then derived from that cached join, so
+ evaluating several -M depths for a query costs only one join.
 
  results and rel_info formats must be "trec_results" and "qrels"
  respectively.
@@ -27,46 +31,74 @@
  UNDEF returned if error, 0 if used cache values, 1 if new values.
  */
 
-static int comp_rank_judged(), comp_sim_docno(), comp_docno();
-
-/* Definitions used for temporary and cached values */
-typedef struct {
-	char *docno;
-	float sim;
-	long rank;
-	long rel;
-} DOCNO_INFO;
+static int form_depth_res_rels(const EPI *epi);
+static int same_rel_map(const REL_MAP *map1, const REL_MAP *map2);
 
 /* Current cached query */
-static char *current_query = "no query";
-static long max_current_query = 0;
+static TE_THREAD char *current_query = "no query";
+static TE_THREAD long max_current_query = 0;
+/* Depth (epi->max_num_docs_per_topic) saved_res_rels was formed for */
+static TE_THREAD long current_depth = 0;
 
 /* Space reserved for cached returned values */
-static long *rel_levels;
-static long max_rel_levels = 0;
-static RES_RELS saved_res_rels;
-static long *ranked_rel_list;
-static long max_ranked_rel_list = 0;
-
-/* Space reserved for intermediate values */
-static DOCNO_INFO *docno_info;
-static long max_docno_info = 0;
+static TE_THREAD long *rel_levels;
+static TE_THREAD long max_rel_levels = 0;
+static TE_THREAD RES_RELS saved_res_rels;
+/* Relevance of every retrieved doc of the query in rank order, and
+ the subset of those that were judged (used for -J) */
+static TE_THREAD long *ranked_rel_list;
+static TE_THREAD long max_ranked_rel_list = 0;
+static TE_THREAD long *judged_rel_list;
+static TE_THREAD long max_judged_rel_list = 0;
+static TE_THREAD long num_ranked;
+static TE_THREAD long num_judged_ranked;
+/* Smallest depth at which a duplicate docno is within the ranking */
+static TE_THREAD long dup_depth;
+static TE_THREAD char *dup_docno;
+
+/* Bumped whenever saved_res_rels is formed anew (new query or depth) */
+static TE_THREAD long res_rels_generation = 0;
+
+/* Relevance mapped versions of saved_res_rels, one per distinct REL_MAP
+ asked for (see te_form_res_rels_map).  An entry is current only while
+ its generation is res_rels_generation */
+typedef struct {
+	const REL_MAP *rel_map;
+	long generation;
+	RES_RELS res_rels;
+	long *rel_levels;
+	long max_rel_levels;
+	long *results_rel_list;
+	long max_results_rel_list;
+} MAPPED_RES_RELS;
+static TE_THREAD MAPPED_RES_RELS *mapped_res_rels;
+static TE_THREAD long num_mapped_res_rels = 0;
+static TE_THREAD long max_mapped_res_rels = 0;
 
 int te_form_res_rels(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, RES_RELS *res_rels) {
 	long i;
 	long num_results;
 	long max_rel;
+	long rel;
 
-	TEXT_RESULTS_INFO *text_results_info;
+	RANKED_RESULTS ranked_results;
+	RANKED_DOC *docno_index;
 	TEXT_QRELS_INFO *trec_qrels;
 
 	TEXT_QRELS *qrels_ptr, *end_qrels;
 
 	if (0 == strcmp(current_query, results->qid)) {
-		/* Have done this query already. Return cached values */
+		if (current_depth == epi->max_num_docs_per_topic) {
+			/* Have done this query already. Return cached values */
+			*res_rels = saved_res_rels;
+			return (0);
+		}
+		/* Have ranked this query already, only depth has changed */
+		if (UNDEF == form_depth_res_rels(epi))
+			return (UNDEF);
 		*res_rels = saved_res_rels;
-		return (0);
+		return (1);
 	}
 
 	/* Check that format type of result info and rel info are correct */
@@ -77,6 +109,17 @@ int te_form_res_rels(const EPI *epi, const REL_INFO *rel_info,
 		return (UNDEF);
 	}
 
+	/* Get the whole ranking, indexed by docno (ties by rank).
+	 epi->max_num_docs_per_topic is applied in form_depth_res_rels */
+	if (UNDEF == te_form_ranked_results(epi, results, &ranked_results))
+		return (UNDEF);
+	num_results = ranked_results.num_ranked;
+	docno_index = ranked_results.docno_index;
+	/* A duplicate is only an error if both copies are within the
+	 evaluated depth */
+	dup_depth = ranked_results.dup_depth;
+	dup_docno = ranked_results.dup_docno;
+
 	/* Make sure enough space for query and save copy */
 	i = strlen(results->qid) + 1;
 	if (NULL
@@ -85,53 +128,18 @@ int te_form_res_rels(const EPI *epi, const REL_INFO *rel_info,
 		return (UNDEF);
 	(void) strncpy(current_query, results->qid, i);
 
-	text_results_info = (TEXT_RESULTS_INFO *) results->q_results;
 	trec_qrels = (TEXT_QRELS_INFO *) rel_info->q_rel_info;
 
-	num_results = text_results_info->num_text_results;
-
 	/* Check and reserve space for output structure */
-	/* Reserve space for temp structure copying results */
 	if (NULL
 			== (ranked_rel_list = te_chk_and_malloc(ranked_rel_list,
 					&max_ranked_rel_list, num_results, sizeof(long)))
 			||
 			NULL
-					== (docno_info = te_chk_and_malloc(docno_info,
-							&max_docno_info, num_results, sizeof(DOCNO_INFO))))
+					== (judged_rel_list = te_chk_and_malloc(judged_rel_list,
+							&max_judged_rel_list, num_results, sizeof(long))))
 		return (UNDEF);
 
-	for (i = 0; i < num_results; i++) {
-		docno_info[i].docno = text_results_info->text_results[i].docno;
-		docno_info[i].sim = text_results_info->text_results[i].sim;
-	}
-
-	/* Sort results by sim, breaking ties lexicographically using docno */
-	qsort((char *) docno_info, (int) num_results, sizeof(DOCNO_INFO),
-			comp_sim_docno);
-
-	/* Only look at epi->max_num_docs_per_topic (not normally an issue) */
-	if (num_results > epi->max_num_docs_per_topic)
-		num_results = epi->max_num_docs_per_topic;
-
-	/* Add ranks to docno_info (starting at 1) */
-	for (i = 0; i < num_results; i++) {
-		docno_info[i].rank = i + 1;
-	}
-
-	/* Sort trec_top lexicographically */
-	qsort((char *) docno_info, (int) num_results, sizeof(DOCNO_INFO),
-			comp_docno);
-
-	/* Error checking for duplicates */
-	for (i = 1; i < num_results; i++) {
-		if (0 == strcmp(docno_info[i].docno, docno_info[i - 1].docno)) {
-			fprintf(stderr, "rec_eval.form_res_qrels: duplicate docs %s",
-					docno_info[i].docno);
-			return (UNDEF);
-		}
-	}
-
 	/* Find max_rel among qid, reserve and zero space for rel_levels */
 	/* Check for duplicate docnos. */
 	qrels_ptr = trec_qrels->text_qrels;
@@ -154,35 +162,41 @@ int te_form_res_rels(const EPI *epi, const REL_INFO *rel_info,
 		return (UNDEF);
 	(void) memset(rel_levels, 0, (max_rel + 1) * sizeof(long));
 
-	/* Construct rank_rel array and rel_levels */
-	/* Go through docno_info, trec_qrels in parallel to determine relevance
-	 for each doc in docno_info.
+	/* Construct ranked_rel_list and rel_levels */
+	/* Go through docno_index, trec_qrels in parallel to determine relevance
+	 for each doc in docno_index, laying it out at the doc's rank.
 	 Note that trec_qrels already sorted by docno with no duplicates */
 	qrels_ptr = trec_qrels->text_qrels;
 	end_qrels = &trec_qrels->text_qrels[trec_qrels->num_text_qrels];
 	for (i = 0; i < num_results; i++) {
 		while (qrels_ptr < end_qrels
-				&& strcmp(qrels_ptr->docno, docno_info[i].docno) < 0) {
+				&& strcmp(qrels_ptr->docno, docno_index[i].docno) < 0) {
 			if (qrels_ptr->rel >= 0)
 				rel_levels[qrels_ptr->rel]++;
 			qrels_ptr++;
 		}
 		if (qrels_ptr >= end_qrels
-				|| strcmp(qrels_ptr->docno, docno_info[i].docno) > 0) {
+				|| strcmp(qrels_ptr->docno, docno_index[i].docno) > 0) {
 			/* Doc is non-judged */
-			docno_info[i].rel = RELVALUE_NONPOOL;
+			rel = RELVALUE_NONPOOL;
 		} else {
 			/* Doc is in pool, assign relevance */
 			if (qrels_ptr->rel < 0)
 				/* In pool, but unjudged (eg, infAP uses a sample of pool)*/
-				docno_info[i].rel = RELVALUE_UNJUDGED;
+				rel = RELVALUE_UNJUDGED;
 			else {
-				docno_info[i].rel = qrels_ptr->rel;
+				rel = qrels_ptr->rel;
+			}
+			/* Duplicate results docnos (beyond the evaluated depth) are
+			 all given the judgement */
+			if (i + 1 >= num_results
+					|| strcmp(docno_index[i + 1].docno, docno_index[i].docno)) {
+				if (qrels_ptr->rel >= 0)
+					rel_levels[qrels_ptr->rel]++;
+				qrels_ptr++;
 			}
-			if (qrels_ptr->rel >= 0)
-				rel_levels[qrels_ptr->rel]++;
-			qrels_ptr++;
 		}
+		ranked_rel_list[docno_index[i].rank - 1] = rel;
 	}
 	/* Finish counting rels */
 	while (qrels_ptr < end_qrels) {
@@ -191,89 +205,195 @@ int te_form_res_rels(const EPI *epi, const REL_INFO *rel_info,
 		qrels_ptr++;
 	}
 
+	/* Lay out relevance of the judged docs only */
+	num_ranked = num_results;
+	num_judged_ranked = 0;
+	for (i = 0; i < num_results; i++) {
+		if (ranked_rel_list[i] >= 0)
+			judged_rel_list[num_judged_ranked++] = ranked_rel_list[i];
+	}
+
+	/* Counts among total relevance judgments (independent of depth) */
+	saved_res_rels.rel_levels = rel_levels;
+	saved_res_rels.num_rel = 0;
+	for (i = 0; i <= max_rel; i++) {
+		if (saved_res_rels.rel_levels[i]) {
+			saved_res_rels.num_rel_levels = i + 1;
+			if (i >= epi->relevance_level)
+				saved_res_rels.num_rel += saved_res_rels.rel_levels[i];
+		}
+	}
+
+	if (UNDEF == form_depth_res_rels(epi))
+		return (UNDEF);
+
+	*res_rels = saved_res_rels;
+
+	return (1);
+}
+
+/* Fill in the retrieval dependent parts of saved_res_rels for the
+ current ranking, looking only at epi->max_num_docs_per_topic docs */
+static int form_depth_res_rels(const EPI *epi) {
+	long i;
+	long num_results;
+	long rel;
+
+	/* Only look at epi->max_num_docs_per_topic (not normally an issue) */
+	num_results = num_ranked;
+	if (num_results > epi->max_num_docs_per_topic)
+		num_results = epi->max_num_docs_per_topic;
+
+	if (num_results >= dup_depth) {
+		fprintf(stderr, "rec_eval.form_res_qrels: duplicate docs %s",
+				dup_docno);
+		return (UNDEF);
+	}
+
 	/* Construct ranked_rel_list and associated counts */
 	saved_res_rels.num_rel_ret = 0;
 	saved_res_rels.num_nonpool = 0;
 	saved_res_rels.num_unjudged_in_pool = 0;
-	saved_res_rels.results_rel_list = ranked_rel_list;
-	saved_res_rels.rel_levels = rel_levels;
 	if (epi->judged_docs_only_flag) {
-		/* If judged_docs_only_flag, then must fix up ranks to
-		 reflect unjudged docs being thrown out. Note: done this way
-		 to preserve original tie-breaking based on text docno */
-		long rrl;
-		/* Sort tuples by increasing rank among judged docs*/
-		qsort((char *) docno_info, (int) num_results, sizeof(DOCNO_INFO),
-				comp_rank_judged);
-		rrl = 0;
-		i = 0;
-		while (i < num_results && docno_info[i].rel >= 0) {
-			if (docno_info[i].rel >= epi->relevance_level)
-				saved_res_rels.num_rel_ret++;
-			saved_res_rels.results_rel_list[rrl++] = docno_info[i++].rel;
+		/* If judged_docs_only_flag, then unjudged docs are thrown out.
+		 The judged docs within the top num_results are exactly a prefix
+		 of judged_rel_list, preserving the original tie-breaking based on
+		 text docno */
+		saved_res_rels.results_rel_list = judged_rel_list;
+		saved_res_rels.num_ret = 0;
+		for (i = 0; i < num_results; i++) {
+			rel = ranked_rel_list[i];
+			if (rel >= 0) {
+				if (rel >= epi->relevance_level)
+					saved_res_rels.num_rel_ret++;
+				saved_res_rels.num_ret++;
+			}
 		}
-		saved_res_rels.num_ret = rrl;
 	} else {
-		/* Normal path.  Assign rel value to appropriate rank */
+		/* Normal path.  Retrieved docs are a prefix of the ranking */
+		saved_res_rels.results_rel_list = ranked_rel_list;
 		for (i = 0; i < num_results; i++) {
-			saved_res_rels.results_rel_list[docno_info[i].rank - 1] =
-					docno_info[i].rel;
-			if (RELVALUE_NONPOOL == docno_info[i].rel)
+			rel = ranked_rel_list[i];
+			if (RELVALUE_NONPOOL == rel)
 				saved_res_rels.num_nonpool++;
-			else if (RELVALUE_UNJUDGED == docno_info[i].rel)
+			else if (RELVALUE_UNJUDGED == rel)
 				saved_res_rels.num_unjudged_in_pool++;
-			else {
-				if (docno_info[i].rel >= epi->relevance_level)
-					saved_res_rels.num_rel_ret++;
-			}
+			else if (rel >= epi->relevance_level)
+				saved_res_rels.num_rel_ret++;
 		}
 		saved_res_rels.num_ret = num_results;
 	}
-	saved_res_rels.num_rel = 0;
-	for (i = 0; i <= max_rel; i++) {
-		if (saved_res_rels.rel_levels[i]) {
-			saved_res_rels.num_rel_levels = i + 1;
-			if (i >= epi->relevance_level)
-				saved_res_rels.num_rel += saved_res_rels.rel_levels[i];
-		}
-	}
-
-	*res_rels = saved_res_rels;
-
+	current_depth = epi->max_num_docs_per_topic;
+	res_rels_generation++;
 	return (1);
 }
 
-static int comp_rank_judged(ptr1, ptr2)
-	DOCNO_INFO *ptr1;DOCNO_INFO *ptr2; {
-	if (ptr1->rel >= 0 && ptr2->rel >= 0) {
-		if (ptr1->rank < ptr2->rank)
-			return (-1);
-		if (ptr1->rank > ptr2->rank)
-			return (1);
+/* As te_form_res_rels, but with the judged relevance levels of the
+ returned RES_RELS mapped by rel_map (no mapping if rel_map is NULL).
+ Mapped values are derived from the cached te_form_res_rels values once
+ per query and depth for each distinct mapping, and are themselves cached,
+ so several measures using the same mapping share them.
+ The mapped rel_levels keep at least the original number of levels, so
+ measures normalizing by the top level (eg, err) see the same scale as
+ without the mapping.  num_rel and num_rel_ret are counted on the mapped
+ levels.
+
+ UNDEF returned if error, 0 if used cache values, 1 if new values. */
+int te_form_res_rels_map(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, const REL_MAP *rel_map, RES_RELS *res_rels) {
+	MAPPED_RES_RELS *mapped;
+	long num_levels;
+	long i, rel;
+	int status;
+
+	if (UNDEF == (status = te_form_res_rels(epi, rel_info, results, res_rels)))
+		return (UNDEF);
+	if (NULL == rel_map)
+		return (status);
+
+	for (i = 0; i < num_mapped_res_rels; i++) {
+		if (same_rel_map(mapped_res_rels[i].rel_map, rel_map))
+			break;
+	}
+	if (i == num_mapped_res_rels) {
+		if (NULL
+				== (mapped_res_rels = te_chk_and_realloc(mapped_res_rels,
+						&max_mapped_res_rels, num_mapped_res_rels + 1,
+						sizeof(MAPPED_RES_RELS))))
+			return (UNDEF);
+		mapped_res_rels[i].rel_map = rel_map;
+		mapped_res_rels[i].generation = -1;
+		mapped_res_rels[i].max_rel_levels = 0;
+		mapped_res_rels[i].max_results_rel_list = 0;
+		num_mapped_res_rels++;
+	}
+	mapped = &mapped_res_rels[i];
+	if (mapped->generation == res_rels_generation) {
+		*res_rels = mapped->res_rels;
 		return (0);
 	}
-	if (ptr1->rel >= 0)
-		return (-1);
-	if (ptr2->rel >= 0)
-		return (1);
-	return (0);
+
+	num_levels = res_rels->num_rel_levels;
+	for (i = 0; i < res_rels->num_rel_levels; i++) {
+		if (res_rels->rel_levels[i] && te_map_rel(rel_map, i) >= num_levels)
+			num_levels = te_map_rel(rel_map, i) + 1;
+	}
+	if (NULL
+			== (mapped->rel_levels = te_chk_and_malloc(mapped->rel_levels,
+					&mapped->max_rel_levels, num_levels + 1, sizeof(long)))
+			|| NULL
+					== (mapped->results_rel_list = te_chk_and_malloc(
+							mapped->results_rel_list,
+							&mapped->max_results_rel_list, res_rels->num_ret + 1,
+							sizeof(long))))
+		return (UNDEF);
+	(void) memset(mapped->rel_levels, 0, num_levels * sizeof(long));
+
+	mapped->res_rels = *res_rels;
+	mapped->res_rels.rel_levels = mapped->rel_levels;
+	mapped->res_rels.results_rel_list = mapped->results_rel_list;
+	mapped->res_rels.num_rel_levels = num_levels;
+	mapped->res_rels.num_rel = 0;
+	mapped->res_rels.num_rel_ret = 0;
+	for (i = 0; i < res_rels->num_rel_levels; i++)
+		mapped->rel_levels[te_map_rel(rel_map, i)] += res_rels->rel_levels[i];
+	for (i = 0; i < num_levels; i++) {
+		if (i >= epi->relevance_level)
+			mapped->res_rels.num_rel += mapped->rel_levels[i];
+	}
+	for (i = 0; i < res_rels->num_ret; i++) {
+		rel = res_rels->results_rel_list[i];
+		if (rel >= 0) {
+			rel = te_map_rel(rel_map, rel);
+			if (rel >= epi->relevance_level)
+				mapped->res_rels.num_rel_ret++;
+		}
+		mapped->results_rel_list[i] = rel;
+	}
+	mapped->generation = res_rels_generation;
+
+	*res_rels = mapped->res_rels;
+	return (1);
 }
 
-static int comp_sim_docno(ptr1, ptr2)
-	DOCNO_INFO *ptr1;DOCNO_INFO *ptr2; {
-	if (ptr1->sim > ptr2->sim)
-		return (-1);
-	if (ptr1->sim < ptr2->sim)
-		return (1);
-	return (strcmp(ptr2->docno, ptr1->docno));
+static int same_rel_map(const REL_MAP *map1, const REL_MAP *map2) {
+	return (map1 == map2
+			|| (map1->num_levels == map2->num_levels
+					&& 0
+							== memcmp(map1->levels, map2->levels,
+									map1->num_levels * sizeof(long))));
 }
 
-static int comp_docno(ptr1, ptr2)
-	DOCNO_INFO *ptr1;DOCNO_INFO *ptr2; {
-	return (strcmp(ptr1->docno, ptr2->docno));
+/* Level rel of the rel info as mapped by rel_map (unchanged if NULL) */
+long te_map_rel(const REL_MAP *rel_map, const long rel) {
+	if (NULL == rel_map)
+		return (rel);
+	return (rel >= 0 && rel < rel_map->num_levels ? rel_map->levels[rel] : 0);
 }
 
 int te_form_res_rels_cleanup() {
+	long i;
+
 	if (max_current_query > 0) {
 		Free(current_query);
 		max_current_query = 0;
@@ -287,9 +407,20 @@ int te_form_res_rels_cleanup() {
 		Free(ranked_rel_list);
 		max_ranked_rel_list = 0;
 	}
-	if (max_docno_info > 0) {
-		Free(docno_info);
-		max_docno_info = 0;
+	if (max_judged_rel_list > 0) {
+		Free(judged_rel_list);
+		max_judged_rel_list = 0;
 	}
-	return (1);
+	for (i = 0; i < num_mapped_res_rels; i++) {
+		if (mapped_res_rels[i].max_rel_levels > 0)
+			Free(mapped_res_rels[i].rel_levels);
+		if (mapped_res_rels[i].max_results_rel_list > 0)
+			Free(mapped_res_rels[i].results_rel_list);
+	}
+	num_mapped_res_rels = 0;
+	if (max_mapped_res_rels > 0) {
+		Free(mapped_res_rels);
+		max_mapped_res_rels = 0;
+	}
+	return (te_form_ranked_results_cleanup());
 }
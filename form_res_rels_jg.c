@@ -20,7 +20,8 @@
  RELVALUE_UNJUDGED (-2) if docno is in text_qrels and was not judged.
 
  This procedure may be called repeatedly for a given topic - returned
- values are cached until the query changes.
+ values are cached until the query changes.  The ranking of the results
+ is shared with the other builders (see form_ranked_results.c).
 
  results and rel_info formats must be "trec_results" and "qrels_jg"
  respectively.
@@ -28,30 +29,29 @@
  UNDEF returned if error, 0 if used cache values, 1 if new values.
  */
 
-static int comp_rank_judged(), comp_sim_docno(), comp_docno();
-
 /* Definitions used for temporary and cached values */
 typedef struct {
 	char *docno;
-	float sim;
 	long rank;
 	long rel;
 } DOCNO_INFO;
 
 /* Current cached query */
-static char *current_query = "no query";
-static long max_current_query = 0;
+static TE_THREAD char *current_query = "no query";
+static TE_THREAD long max_current_query = 0;
+/* Depth (epi->max_num_docs_per_topic) the cached values were formed for */
+static TE_THREAD long current_depth = 0;
 
 /* Space reserved for cached returned values */
-static long *rel_levels;
-static long max_rel_levels = 0;
-static RES_RELS *jgs;
-static long num_jgs;
-static long max_num_jgs = 0;
-static long *ranked_rel_list;
-static long max_ranked_rel_list = 0;
-static DOCNO_INFO *docno_info;
-static long max_docno_info = 0;
+static TE_THREAD long *rel_levels;
+static TE_THREAD long max_rel_levels = 0;
+static TE_THREAD RES_RELS *jgs;
+static TE_THREAD long num_jgs;
+static TE_THREAD long max_num_jgs = 0;
+static TE_THREAD long *ranked_rel_list;
+static TE_THREAD long max_ranked_rel_list = 0;
+static TE_THREAD DOCNO_INFO *docno_info;
+static TE_THREAD long max_docno_info = 0;
 
 int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, RES_RELS_JG *res_rels) {
@@ -59,7 +59,7 @@ int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 	long num_results;
 	long jg;
 
-	TEXT_RESULTS_INFO *text_results_info;
+	RANKED_RESULTS ranked_results;
 	TEXT_QRELS_JG_INFO *trec_qrels;
 
 	TEXT_QRELS *qrels_ptr, *end_qrels;
@@ -67,7 +67,8 @@ int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 
 	long *rel_level_ptr;
 
-	if (0 == strcmp(current_query, results->qid)) {
+	if (0 == strcmp(current_query, results->qid)
+			&& current_depth == epi->max_num_docs_per_topic) {
 		/* Have done this query already. Return cached values */
 		res_rels->qid = results->qid;
 		res_rels->num_jgs = num_jgs;
@@ -83,6 +84,9 @@ int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 		return (UNDEF);
 	}
 
+	if (UNDEF == te_form_ranked_results(epi, results, &ranked_results))
+		return (UNDEF);
+
 	/* Make sure enough space for query and save copy */
 	i = strlen(results->qid) + 1;
 	if (NULL
@@ -90,16 +94,19 @@ int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 					&max_current_query, i, sizeof(char))))
 		return (UNDEF);
 	(void) strncpy(current_query, results->qid, i);
+	current_depth = epi->max_num_docs_per_topic;
 
-	text_results_info = (TEXT_RESULTS_INFO *) results->q_results;
 	trec_qrels = (TEXT_QRELS_JG_INFO *) rel_info->q_rel_info;
 
-	num_results = text_results_info->num_text_results;
+	/* Only look at epi->max_num_docs_per_topic (not normally an issue) */
+	num_results = ranked_results.num_ranked;
+	if (num_results > epi->max_num_docs_per_topic)
+		num_results = epi->max_num_docs_per_topic;
 	num_jgs = trec_qrels->num_text_qrels_jg;
 
 	/* Check and reserve space for output structure */
 	/* Need an output array of size num_results for each of the jg in queries */
-	/* Reserve space for temp structure copying results */
+	/* Reserve space for temp structure copying the ranked docs */
 	if (NULL
 			== (ranked_rel_list = te_chk_and_malloc(ranked_rel_list,
 					&max_ranked_rel_list, num_results * num_jgs, sizeof(long)))
@@ -113,28 +120,16 @@ int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 							&max_docno_info, num_results, sizeof(DOCNO_INFO))))
 		return (UNDEF);
 
-	for (i = 0; i < num_results; i++) {
-		docno_info[i].docno = text_results_info->text_results[i].docno;
-		docno_info[i].sim = text_results_info->text_results[i].sim;
-	}
-
-	/* Sort results by sim, breaking ties lexicographically using docno */
-	qsort((char *) docno_info, (int) num_results, sizeof(DOCNO_INFO),
-			comp_sim_docno);
-
-	/* Only look at epi->max_num_docs_per_topic (not normally an issue) */
-	if (num_results > epi->max_num_docs_per_topic)
-		num_results = epi->max_num_docs_per_topic;
-
-	/* Add ranks to docno_info (starting at 1) */
-	for (i = 0; i < num_results; i++) {
-		docno_info[i].rank = i + 1;
+	/* Copy the docs within the depth, in docno order */
+	num_results = 0;
+	for (i = 0; i < ranked_results.num_ranked; i++) {
+		if (ranked_results.docno_index[i].rank <= epi->max_num_docs_per_topic) {
+			docno_info[num_results].docno = ranked_results.docno_index[i].docno;
+			docno_info[num_results].rank = ranked_results.docno_index[i].rank;
+			num_results++;
+		}
 	}
 
-	/* Sort trec_top lexicographically */
-	qsort((char *) docno_info, (int) num_results, sizeof(DOCNO_INFO),
-			comp_docno);
-
 	/* Error checking for duplicates */
 	for (i = 1; i < num_results; i++) {
 		if (0 == strcmp(docno_info[i].docno, docno_info[i - 1].docno)) {
@@ -213,21 +208,20 @@ int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 			 reflect unjudged docs being thrown out. Note: done this way
 			 to preserve original tie-breaking based on text docno */
 			long rrl;
-			/* Sort tuples by increasing rank among judged docs*/
-			qsort((char *) docno_info, (int) num_results, sizeof(DOCNO_INFO),
-					comp_rank_judged);
+			/* Lay out rel values by rank, then keep those of judged docs */
+			for (i = 0; i < num_results; i++)
+				jgs[jg].results_rel_list[docno_info[i].rank - 1] =
+						docno_info[i].rel;
 			rrl = 0;
-			i = 0;
-			while (i < num_results && docno_info[i].rel >= 0) {
-				if (docno_info[i].rel >= epi->relevance_level)
-					jgs[jg].num_rel_ret++;
-				jgs[jg].results_rel_list[rrl++] = docno_info[i++].rel;
+			for (i = 0; i < num_results; i++) {
+				if (jgs[jg].results_rel_list[i] >= 0) {
+					if (jgs[jg].results_rel_list[i] >= epi->relevance_level)
+						jgs[jg].num_rel_ret++;
+					jgs[jg].results_rel_list[rrl++] =
+							jgs[jg].results_rel_list[i];
+				}
 			}
 			jgs[jg].num_ret = rrl;
-			/* resort by docno for next jg */
-			if (jg != num_jgs - 1)
-				qsort((char *) docno_info, (int) num_results,
-						sizeof(DOCNO_INFO), comp_docno);
 		} else {
 			/* Normal path.  Assign rel value to appropriate rank */
 			for (i = 0; i < num_results; i++) {
@@ -261,36 +255,6 @@ int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 	return (1);
 }
 
-static int comp_rank_judged(ptr1, ptr2)
-	DOCNO_INFO *ptr1;DOCNO_INFO *ptr2; {
-	if (ptr1->rel >= 0 && ptr2->rel >= 0) {
-		if (ptr1->rank < ptr2->rank)
-			return (-1);
-		if (ptr1->rank > ptr2->rank)
-			return (1);
-		return (0);
-	}
-	if (ptr1->rel >= 0)
-		return (-1);
-	if (ptr2->rel >= 0)
-		return (1);
-	return (0);
-}
-
-static int comp_sim_docno(ptr1, ptr2)
-	DOCNO_INFO *ptr1;DOCNO_INFO *ptr2; {
-	if (ptr1->sim > ptr2->sim)
-		return (-1);
-	if (ptr1->sim < ptr2->sim)
-		return (1);
-	return (strcmp(ptr2->docno, ptr1->docno));
-}
-
-static int comp_docno(ptr1, ptr2)
-	DOCNO_INFO *ptr1;DOCNO_INFO *ptr2; {
-	return (strcmp(ptr1->docno, ptr2->docno));
-}
-
 int te_form_res_rels_jg_cleanup() {
 	if (max_current_query > 0) {
 		Free(current_query);
@@ -314,5 +278,5 @@ int te_form_res_rels_jg_cleanup() {
 		Free(docno_info);
 		max_docno_info = 0;
 	}
-	return (1);
+	return (te_form_ranked_results_cleanup());
 }
@@ -126,6 +126,10 @@ Within a single JG, preferences are transistive:\n\
       qid1  ujg1  sub2  docno4  4.0\n\
 expresses 5 preferences (1>2, 1>3, 2>3, 2>4, 1>4).  There is no\n\
 preference expressed between 3 and 4.\n\
+Inconsistent preferences of a JG (doc A > doc B in one JSG, and B > A\n\
+in another, possibly through other docs) are listed when the file is\n\
+read; --prefs-conflicts says whether that is an error (the default) or\n\
+the JG, or the judgments of the docs involved, are ignored.\n\
 \n\
 Different JGs may contain contradictory preferences, as in an earlier\n\
 example.  These disagreements are realistic and desirable: users (or\n\
@@ -17,7 +17,65 @@ void * te_chk_and_realloc(void *ptr, long *current_bound, const long needed,
 int te_get_zscores(const EPI *epi, const char *zscores_file,
 		ALL_ZSCORES *zscores);
 int te_get_zscores_cleanup();
-int te_convert_to_zscore(const ALL_ZSCORES *all_zscores, TREC_EVAL *q_eval);
+int te_form_zscore_index(const ALL_ZSCORES *all_zscores,
+		const ALL_REL_INFO *all_rel_info, const TREC_EVAL *q_eval);
+int te_convert_to_zscore(const ALL_ZSCORES *all_zscores,
+		const long rel_info_index, TREC_EVAL *q_eval);
+int te_convert_zscores_cleanup();
+
+/* Functions for building a zscores file from reference runs
+ (build_zscores.c) */
+int te_put_zscore_values(FILE *out, const TREC_EVAL *q_eval,
+		const long first_value, const long end_value);
+int te_add_zscore_values(FILE *in);
+int te_put_zscores(const char *zscores_file);
+int te_build_zscores_cleanup();
+/* Policy for cyclic preferences named by policy (get_prefs.c) */
+long te_get_prefs_conflicts(const char *policy);
+/* Functions for writing and merging partial accumulators (partial.c) */
+int te_put_partial_open(const EPI *epi, const char *partial_file,
+		const TREC_EVAL *accum_eval);
+int te_put_partial_query(const EPI *epi, const TREC_EVAL *q_acc);
+int te_put_partial_rel_info(const EPI *epi, const ALL_REL_INFO *all_rel_info);
+int te_put_partial_close(const EPI *epi, const char *run_id);
+int te_get_partials(const EPI *epi, char **partial_files,
+		long num_partial_files, TREC_EVAL *accum_eval,
+		ALL_REL_INFO *all_rel_info, char **run_id);
+int te_get_partials_cleanup();
+/* Functions for splitting input files into partitions (partition.c) */
+int te_partition_files(const EPI *epi, char *rel_info_file,
+		char *results_file, long max_memory, PARTITION **partitions,
+		long *num_partitions, char **run_id, char **scratch_file);
+int te_partition_files_cleanup();
+/* Functions for several rel info inputs, -R format:file (rel_info_inputs.c) */
+int te_add_rel_info_input(EPI *epi, char *optarg);
+long te_num_rel_info_inputs();
+long te_meas_rel_info_input(const char *name);
+int te_get_rel_info_inputs(EPI *epi, ALL_REL_INFO **all_rel_info);
+int te_rel_info_inputs_cleanup();
+/* Functions for rel info images (rel_image.c) */
+int te_put_rel_image(const EPI *epi, const ALL_REL_INFO *all_rel_info,
+		const char *image_file);
+int te_is_rel_image(const char *file);
+int te_get_rel_image(const EPI *epi, const char *image_file,
+		ALL_REL_INFO *all_rel_info);
+int te_get_rel_image_cleanup();
+int te_map_rel_image(const EPI *epi, const char *image_file,
+		ALL_REL_INFO *all_rel_info, char **map, size_t *map_size);
+int te_unmap_rel_image(char *map, size_t map_size);
+int te_copy_rel_info(const EPI *epi, const ALL_REL_INFO *all_rel_info,
+		ALL_REL_INFO *copy, char **copy_buf);
+/* Functions for the query value cache (query_cache.c) */
+int te_cache_open(const EPI *epi, const char *cache_file,
+		const TREC_EVAL *accum_eval, const char *meas_config);
+int te_cache_get_query(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, double **values);
+int te_cache_put_query(const EPI *epi, const char *qid);
+int te_cache_close(const EPI *epi);
+int te_cache_cleanup();
+/* Serving evaluation requests on a socket (serve.c) */
+int te_serve(const char *socket_path, long num_jobs,
+		int (*serve_request)(int fd, void *info), void *info);
 
 /* ------------------- Generic Routines for Measures ------------------------ */
 
@@ -49,6 +107,15 @@ int te_acc_meas_s(const EPI *epi, const TREC_MEAS *tm, const TREC_EVAL *q_eval,
 /* Accumulate an array of values (one per cutoff) */
 int te_acc_meas_a_cut(const EPI *epi, const TREC_MEAS *tm,
 		const TREC_EVAL *q_eval, TREC_EVAL *accum_eval);
+/* Accumulate the log of a single value (of tm->base_meas if shared) */
+int te_acc_meas_s_gm(const EPI *epi, const TREC_MEAS *tm,
+		const TREC_EVAL *q_eval, TREC_EVAL *accum_eval);
+/* Accumulate the logs of an array of values (one per cutoff) */
+int te_acc_meas_a_cut_gm(const EPI *epi, const TREC_MEAS *tm,
+		const TREC_EVAL *q_eval, TREC_EVAL *accum_eval);
+/* Calculate values of tm->base_meas for tm, unless already calculated */
+int te_calc_meas_base(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval);
 
 /* ----- Calculate Average measure ---- */
 /* Code is in meas_calc_avg.c */
@@ -64,6 +131,9 @@ int te_calc_avg_meas_a_cut(const EPI *epi, const TREC_MEAS *tm,
 /* Measure is a single value using geometric mean */
 int te_calc_avg_meas_s_gm(const EPI *epi, const TREC_MEAS *tm,
 		const ALL_REL_INFO *all_rel_info, TREC_EVAL *accum_eval);
+/* Measure is an array of values (one per cutoff) using geometric mean */
+int te_calc_avg_meas_a_cut_gm(const EPI *epi, const TREC_MEAS *tm,
+		const ALL_REL_INFO *all_rel_info, TREC_EVAL *accum_eval);
 
 /* ----- Print single query for measure ---- */
 /* Code is in meas_print_single.c */
@@ -93,5 +163,8 @@ int te_print_final_meas_a_cut(const EPI *epi, TREC_MEAS *tm, TREC_EVAL *eval);
 /* Measure is a single float with float params */
 int te_print_final_meas_s_float_p(const EPI *epi, TREC_MEAS *tm,
 		TREC_EVAL *eval);
+/* As te_print_final_meas_s_float_p, for measures calculated by ndcg (whose
+ discount table is freed) */
+int te_print_final_meas_ndcg(const EPI *epi, TREC_MEAS *tm, TREC_EVAL *eval);
 
 #endif /* FUNCTIONSH */
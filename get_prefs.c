@@ -8,6 +8,7 @@
 #include "common.h"
 #include "sysfunc.h"
 #include "trec_eval.h"
+#include "functions.h"
 #include "trec_format.h"
 #include <ctype.h>
 
@@ -86,6 +87,18 @@
  expresses 5 preferences (1>2, 1>3, 2>3, 2>4, 1>4).  There is no
  preference expressed between 3 and 4.
 
+ Inconsistent preferences within a JG (A > B in one JSG, and B > A in
+ another, possibly by transitivity through other docs) are found here,
+ once when the file is read, as strongly connected components of a
+ graph of the preferences of the JG.  To keep the graph linear in the
+ number of lines, each JSG level with lower levels below it gets a node
+ standing for all docs below it: the docs of the level point to that
+ node, and it points to the docs of the next lower level and to the
+ node of that level.  A component with two or more docs is a cycle.
+ Cycles are listed on stderr and, as epi->prefs_conflicts says, make
+ reading fail or have their JG, or the lines of the docs in them,
+ dropped.
+
  Different JGs may contain contradictory preferences, as in an earlier
  example.  These disagreements are realistic and desirable: users (or
  even the same user at different times) often do not agree with each
@@ -113,17 +126,6 @@
 
  */
 
-static int parse_prefs_line(char **start_ptr, char **qid_ptr, char **jg_ptr,
-		char **jsg_ptr, char **docno_ptr, char **rel_ptr);
-static int comp_lines_qid_docno();
-
-/* static pools of memory, allocated here and never changed.
- Declared static so one day I can write a cleanup procedure to free them */
-static char *trec_prefs_buf = NULL;
-static TEXT_PREFS_INFO *text_info_pool = NULL;
-static TEXT_PREFS *text_prefs_pool = NULL;
-static REL_INFO *rel_info_pool = NULL;
-
 /* Temp structure for values in input line */
 typedef struct {
 	char *qid;
@@ -131,8 +133,47 @@ typedef struct {
 	char *jsg;
 	char *docno;
 	char *rel;
+	double rel_level;
+	long node; /* Doc node in the preference graph of the JG */
+	long drop; /* Line is dropped (--prefs-conflicts) */
 } LINES;
 
+static int parse_prefs_line(char **start_ptr, char **qid_ptr, char **jg_ptr,
+		char **jsg_ptr, char **docno_ptr, char **rel_ptr);
+static int comp_lines_qid_docno();
+static int check_prefs_cycles(EPI *epi, char *text_prefs_file, LINES *lines,
+		long num_lines);
+static long check_jg_cycles(EPI *epi, LINES **jg_lines, long num_jg_lines);
+static int comp_lines_jg_docno();
+static int comp_lines_jsg_rel();
+static int comp_node();
+
+/* static pools of memory, allocated here and never changed.
+ Declared static so one day I can write a cleanup procedure to free them */
+static TE_THREAD char *trec_prefs_buf = NULL;
+static TE_THREAD TEXT_PREFS_INFO *text_info_pool = NULL;
+static TE_THREAD TEXT_PREFS *text_prefs_pool = NULL;
+static TE_THREAD REL_INFO *rel_info_pool = NULL;
+
+/* Work space of check_prefs_cycles, allocated and freed there.  Sized for
+ all lines, which bounds the graph of any JG: at most a doc node and a
+ level node per line, and three edges per line */
+static TE_THREAD LINES **cyc_lines = NULL; /* Lines of the current qid */
+static TE_THREAD LINES **cyc_doc_line = NULL; /* First line of each doc node */
+static TE_THREAD long *cyc_edge_from = NULL;
+static TE_THREAD long *cyc_edge_to = NULL;
+static TE_THREAD long *cyc_start = NULL; /* Edges of node v are cyc_adj[cyc_start[v]]
+ to cyc_adj[cyc_start[v+1]-1] */
+static TE_THREAD long *cyc_adj = NULL;
+static TE_THREAD long *cyc_index = NULL; /* Tarjan's depth first search order */
+static TE_THREAD long *cyc_low = NULL; /* Lowest index reachable through subtree */
+static TE_THREAD long *cyc_scc_stack = NULL;
+static TE_THREAD long *cyc_call_node = NULL; /* Depth first search call stack */
+static TE_THREAD long *cyc_call_edge = NULL;
+static TE_THREAD long *cyc_members = NULL; /* Doc nodes of a component */
+static TE_THREAD char *cyc_on_stack = NULL;
+static TE_THREAD char *cyc_in_cycle = NULL; /* Doc node is in a cycle */
+
 int te_get_prefs(EPI *epi, char *text_prefs_file, ALL_REL_INFO *all_rel_info) {
 	int fd;
 	int size = 0;
@@ -184,6 +225,8 @@ int te_get_prefs(EPI *epi, char *text_prefs_file, ALL_REL_INFO *all_rel_info) {
 					(long) (line_ptr - lines + 1));
 			return (UNDEF);
 		}
+		line_ptr->rel_level = atof(line_ptr->rel);
+		line_ptr->drop = 0;
 		line_ptr++;
 	}
 	num_lines = line_ptr - lines;
@@ -191,6 +234,23 @@ int te_get_prefs(EPI *epi, char *text_prefs_file, ALL_REL_INFO *all_rel_info) {
 	/* Sort all lines by qid, then docno */
 	qsort((char *) lines, (int) num_lines, sizeof(LINES), comp_lines_qid_docno);
 
+	/* Find inconsistent preferences, and remove the lines they drop */
+	if (UNDEF == check_prefs_cycles(epi, text_prefs_file, lines, num_lines)) {
+		Free(lines);
+		return (UNDEF);
+	}
+	for (i = 0, line_ptr = lines; i < num_lines; i++) {
+		if (!lines[i].drop)
+			*line_ptr++ = lines[i];
+	}
+	num_lines = line_ptr - lines;
+	if (0 == num_lines) {
+		all_rel_info->num_q_rels = 0;
+		all_rel_info->rel_info = NULL;
+		Free(lines);
+		return (1);
+	}
+
 	/* Go through lines and count number of qid */
 	num_qid = 1;
 	for (i = 1; i < num_lines; i++) {
@@ -226,7 +286,7 @@ int te_get_prefs(EPI *epi, char *text_prefs_file, ALL_REL_INFO *all_rel_info) {
 		}
 		text_prefs_ptr->jg = lines[i].jg;
 		text_prefs_ptr->jsg = lines[i].jsg;
-		text_prefs_ptr->rel_level = atof(lines[i].rel);
+		text_prefs_ptr->rel_level = lines[i].rel_level;
 		text_prefs_ptr->docno = lines[i].docno;
 		text_prefs_ptr++;
 	}
@@ -247,6 +307,255 @@ static int comp_lines_qid_docno(LINES *ptr1, LINES *ptr2) {
 	return (strcmp(ptr1->docno, ptr2->docno));
 }
 
+/* Check the preferences of each JG of each qid in lines (sorted by qid)
+ for cycles, report them and mark the lines dropped by
+ epi->prefs_conflicts.  Return UNDEF if there are cycles and that is an
+ error */
+static int check_prefs_cycles(EPI *epi, char *text_prefs_file, LINES *lines,
+		long num_lines) {
+	long start, end, i, j;
+	long num_cycles = 0;
+
+	if (NULL == (cyc_lines = Malloc(num_lines, LINES *)) ||
+	NULL == (cyc_doc_line = Malloc(num_lines, LINES *)) ||
+	NULL == (cyc_edge_from = Malloc(3 * num_lines, long)) ||
+	NULL == (cyc_edge_to = Malloc(3 * num_lines, long)) ||
+	NULL == (cyc_start = Malloc(2 * num_lines + 1, long)) ||
+	NULL == (cyc_adj = Malloc(3 * num_lines, long)) ||
+	NULL == (cyc_index = Malloc(2 * num_lines, long)) ||
+	NULL == (cyc_low = Malloc(2 * num_lines, long)) ||
+	NULL == (cyc_scc_stack = Malloc(2 * num_lines, long)) ||
+	NULL == (cyc_call_node = Malloc(2 * num_lines, long)) ||
+	NULL == (cyc_call_edge = Malloc(2 * num_lines, long)) ||
+	NULL == (cyc_members = Malloc(num_lines, long)) ||
+	NULL == (cyc_on_stack = Malloc(2 * num_lines, char)) ||
+	NULL == (cyc_in_cycle = Malloc(num_lines, char)))
+		return (UNDEF);
+
+	for (start = 0; start < num_lines; start = end) {
+		/* Lines of this qid, sorted by jg then docno */
+		for (end = start;
+				end < num_lines && 0 == strcmp(lines[start].qid, lines[end].qid);
+				end++)
+			cyc_lines[end - start] = &lines[end];
+		qsort((char *) cyc_lines, (int) (end - start), sizeof(LINES *),
+				comp_lines_jg_docno);
+		for (i = 0; i < end - start; i = j) {
+			for (j = i + 1;
+					j < end - start
+							&& 0 == strcmp(cyc_lines[i]->jg, cyc_lines[j]->jg);
+					j++)
+				;
+			num_cycles += check_jg_cycles(epi, &cyc_lines[i], j - i);
+		}
+	}
+
+	Free(cyc_lines);
+	Free(cyc_doc_line);
+	Free(cyc_edge_from);
+	Free(cyc_edge_to);
+	Free(cyc_start);
+	Free(cyc_adj);
+	Free(cyc_index);
+	Free(cyc_low);
+	Free(cyc_scc_stack);
+	Free(cyc_call_node);
+	Free(cyc_call_edge);
+	Free(cyc_members);
+	Free(cyc_on_stack);
+	Free(cyc_in_cycle);
+
+	if (num_cycles && PREFS_CONFLICTS_FAIL == epi->prefs_conflicts) {
+		fprintf(stderr,
+				"rec_eval.get_prefs: %ld inconsistent preference cycle(s) in '%s'\n",
+				num_cycles, text_prefs_file);
+		return (UNDEF);
+	}
+	return (1);
+}
+
+/* Find the cycles of the preferences in jg_lines (the lines of one JG,
+ sorted by docno), with Tarjan's strongly connected components algorithm
+ (iterative).  Report them, mark the lines dropped, and return the number
+ of cycles */
+static long check_jg_cycles(EPI *epi, LINES **jg_lines, long num_jg_lines) {
+	long num_docs, num_nodes, num_edges, num_members;
+	long num_cycles = 0;
+	long next_index, sp, cp;
+	long below;
+	long i, j, k, v, w, root;
+
+	/* Doc nodes, in docno order */
+	num_docs = 0;
+	for (i = 0; i < num_jg_lines; i++) {
+		if (0 == i || strcmp(jg_lines[i - 1]->docno, jg_lines[i]->docno))
+			cyc_doc_line[num_docs++] = jg_lines[i];
+		jg_lines[i]->node = num_docs - 1;
+	}
+
+	/* Edges.  Level nodes are numbered from num_docs, in JSG level order,
+	 so the node of the level below the current one is the next one */
+	qsort((char *) jg_lines, (int) num_jg_lines, sizeof(LINES *),
+			comp_lines_jsg_rel);
+	num_nodes = num_docs;
+	num_edges = 0;
+	for (i = 0; i < num_jg_lines; i = j) {
+		/* Lines i to j-1 are a level of a JSG */
+		for (j = i + 1;
+				j < num_jg_lines && 0 == strcmp(jg_lines[i]->jsg, jg_lines[j]->jsg)
+						&& jg_lines[i]->rel_level == jg_lines[j]->rel_level;
+				j++)
+			;
+		if (j >= num_jg_lines || strcmp(jg_lines[i]->jsg, jg_lines[j]->jsg))
+			/* Lowest level of the JSG */
+			continue;
+		below = num_nodes++;
+		for (k = i; k < j; k++) {
+			cyc_edge_from[num_edges] = jg_lines[k]->node;
+			cyc_edge_to[num_edges++] = below;
+		}
+		for (k = j;
+				k < num_jg_lines && 0 == strcmp(jg_lines[j]->jsg, jg_lines[k]->jsg)
+						&& jg_lines[j]->rel_level == jg_lines[k]->rel_level;
+				k++) {
+			cyc_edge_from[num_edges] = below;
+			cyc_edge_to[num_edges++] = jg_lines[k]->node;
+		}
+		if (k < num_jg_lines && 0 == strcmp(jg_lines[j]->jsg, jg_lines[k]->jsg)) {
+			cyc_edge_from[num_edges] = below;
+			cyc_edge_to[num_edges++] = below + 1;
+		}
+	}
+
+	/* Adjacency lists (cyc_index is the fill position of each node) */
+	for (v = 0; v <= num_nodes; v++)
+		cyc_start[v] = 0;
+	for (i = 0; i < num_edges; i++)
+		cyc_start[cyc_edge_from[i] + 1]++;
+	for (v = 0; v < num_nodes; v++) {
+		cyc_start[v + 1] += cyc_start[v];
+		cyc_index[v] = cyc_start[v];
+	}
+	for (i = 0; i < num_edges; i++)
+		cyc_adj[cyc_index[cyc_edge_from[i]]++] = cyc_edge_to[i];
+
+	/* Strongly connected components.  Every component with a doc in it is
+	 reached from a doc node */
+	for (v = 0; v < num_nodes; v++) {
+		cyc_index[v] = UNDEF;
+		cyc_on_stack[v] = 0;
+	}
+	for (v = 0; v < num_docs; v++)
+		cyc_in_cycle[v] = 0;
+	next_index = 0;
+	sp = 0;
+	for (root = 0; root < num_docs; root++) {
+		if (UNDEF != cyc_index[root])
+			continue;
+		cyc_index[root] = cyc_low[root] = next_index++;
+		cyc_scc_stack[sp++] = root;
+		cyc_on_stack[root] = 1;
+		cyc_call_node[0] = root;
+		cyc_call_edge[0] = cyc_start[root];
+		cp = 1;
+		while (cp > 0) {
+			v = cyc_call_node[cp - 1];
+			if (cyc_call_edge[cp - 1] < cyc_start[v + 1]) {
+				w = cyc_adj[cyc_call_edge[cp - 1]++];
+				if (UNDEF == cyc_index[w]) {
+					cyc_index[w] = cyc_low[w] = next_index++;
+					cyc_scc_stack[sp++] = w;
+					cyc_on_stack[w] = 1;
+					cyc_call_node[cp] = w;
+					cyc_call_edge[cp] = cyc_start[w];
+					cp++;
+				} else if (cyc_on_stack[w] && cyc_index[w] < cyc_low[v])
+					cyc_low[v] = cyc_index[w];
+				continue;
+			}
+			cp--;
+			if (cp > 0 && cyc_low[v] < cyc_low[cyc_call_node[cp - 1]])
+				cyc_low[cyc_call_node[cp - 1]] = cyc_low[v];
+			if (cyc_low[v] != cyc_index[v])
+				continue;
+			/* v is the root of a component */
+			num_members = 0;
+			do {
+				w = cyc_scc_stack[--sp];
+				cyc_on_stack[w] = 0;
+				if (w < num_docs)
+					cyc_members[num_members++] = w;
+			} while (w != v);
+			if (num_members < 2)
+				continue;
+			num_cycles++;
+			qsort((char *) cyc_members, (int) num_members, sizeof(long),
+					comp_node);
+			fprintf(stderr, "rec_eval.get_prefs: qid %s jg %s: docs",
+					jg_lines[0]->qid, jg_lines[0]->jg);
+			for (i = 0; i < num_members; i++) {
+				fprintf(stderr, " %s", cyc_doc_line[cyc_members[i]]->docno);
+				cyc_in_cycle[cyc_members[i]] = 1;
+			}
+			fprintf(stderr, " are preferred to each other%s\n",
+					PREFS_CONFLICTS_DROP_JG == epi->prefs_conflicts ?
+							" (jg dropped)" :
+					PREFS_CONFLICTS_DROP_CYCLES == epi->prefs_conflicts ?
+							" (docs dropped)" : "");
+		}
+	}
+
+	if (num_cycles && PREFS_CONFLICTS_DROP_JG == epi->prefs_conflicts) {
+		for (i = 0; i < num_jg_lines; i++)
+			jg_lines[i]->drop = 1;
+	} else if (num_cycles
+			&& PREFS_CONFLICTS_DROP_CYCLES == epi->prefs_conflicts) {
+		for (i = 0; i < num_jg_lines; i++) {
+			if (cyc_in_cycle[jg_lines[i]->node])
+				jg_lines[i]->drop = 1;
+		}
+	}
+	return (num_cycles);
+}
+
+static int comp_lines_jg_docno(LINES **ptr1, LINES **ptr2) {
+	int cmp = strcmp((*ptr1)->jg, (*ptr2)->jg);
+	if (cmp)
+		return (cmp);
+	return (strcmp((*ptr1)->docno, (*ptr2)->docno));
+}
+
+/* JSG, then decreasing rel_level */
+static int comp_lines_jsg_rel(LINES **ptr1, LINES **ptr2) {
+	int cmp = strcmp((*ptr1)->jsg, (*ptr2)->jsg);
+	if (cmp)
+		return (cmp);
+	if ((*ptr1)->rel_level > (*ptr2)->rel_level)
+		return (-1);
+	if ((*ptr1)->rel_level < (*ptr2)->rel_level)
+		return (1);
+	return (0);
+}
+
+static int comp_node(long *ptr1, long *ptr2) {
+	if (*ptr1 < *ptr2)
+		return (-1);
+	if (*ptr1 > *ptr2)
+		return (1);
+	return (0);
+}
+
+/* Return the PREFS_CONFLICTS_* policy named policy, UNDEF if none */
+long te_get_prefs_conflicts(const char *policy) {
+	if (0 == strcmp(policy, "fail"))
+		return (PREFS_CONFLICTS_FAIL);
+	if (0 == strcmp(policy, "drop-jg"))
+		return (PREFS_CONFLICTS_DROP_JG);
+	if (0 == strcmp(policy, "drop-cycles"))
+		return (PREFS_CONFLICTS_DROP_CYCLES);
+	return (UNDEF);
+}
+
 static int parse_prefs_line(char **start_ptr, char **qid_ptr, char**jg_ptr,
 		char **jsg_ptr, char **docno_ptr, char **rel_ptr) {
 	char *ptr = *start_ptr;
@@ -64,10 +64,10 @@ static int comp_lines_qid_docno();
 
 /* static pools of memory, allocated here and never changed.
  Declared static so one day I can write a cleanup procedure to free them */
-static char *trec_qrels_buf = NULL;
-static TEXT_QRELS_INFO *text_info_pool = NULL;
-static TEXT_QRELS *text_qrels_pool = NULL;
-static REL_INFO *rel_info_pool = NULL;
+static TE_THREAD char *trec_qrels_buf = NULL;
+static TE_THREAD TEXT_QRELS_INFO *text_info_pool = NULL;
+static TE_THREAD TEXT_QRELS *text_qrels_pool = NULL;
+static TE_THREAD REL_INFO *rel_info_pool = NULL;
 
 int te_get_qrels(EPI *epi, char *text_qrels_file, ALL_REL_INFO *all_rel_info) {
 	int fd;
@@ -90,10 +90,10 @@ static int comp_lines_qid_docno();
 
 /* static pools of memory, allocated here and never changed.
  Declared static so one day I can write a cleanup procedure to free them */
-static char *trec_prefs_buf = NULL;
-static TEXT_PREFS_INFO *text_info_pool = NULL;
-static TEXT_PREFS *text_prefs_pool = NULL;
-static REL_INFO *rel_info_pool = NULL;
+static TE_THREAD char *trec_prefs_buf = NULL;
+static TE_THREAD TEXT_PREFS_INFO *text_info_pool = NULL;
+static TE_THREAD TEXT_PREFS *text_prefs_pool = NULL;
+static TE_THREAD REL_INFO *rel_info_pool = NULL;
 
 /* Temp structure for values in input line */
 typedef struct {
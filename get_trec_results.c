@@ -43,10 +43,10 @@ static int comp_lines_qid_docno();
 
 /* static pools of memory, allocated here and never changed.
  Declared static so one day I can write a cleanup procedure to free them */
-static char *trec_results_buf = NULL;
-static TEXT_RESULTS_INFO *text_info_pool = NULL;
-static TEXT_RESULTS *text_results_pool = NULL;
-static RESULTS *q_results_pool = NULL;
+static TE_THREAD char *trec_results_buf = NULL;
+static TE_THREAD TEXT_RESULTS_INFO *text_info_pool = NULL;
+static TE_THREAD TEXT_RESULTS *text_results_pool = NULL;
+static TE_THREAD RESULTS *q_results_pool = NULL;
 
 int te_get_trec_results(EPI *epi, char *text_results_file,
 		ALL_RESULTS *all_results) {
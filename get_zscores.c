@@ -56,9 +56,9 @@ static int parse_zscore_line(char **start_ptr, char **qid_ptr, char **meas_ptr,
 static int comp_lines_qid_meas();
 
 /* static pools of memory, allocated here and never changed.  */
-static char *trec_zscores_buf = NULL;
-static ZSCORE_QID *text_zscores_pool = NULL;
-static ZSCORES *zscores_pool = NULL;
+static TE_THREAD char *trec_zscores_buf = NULL;
+static TE_THREAD ZSCORE_QID *text_zscores_pool = NULL;
+static TE_THREAD ZSCORES *zscores_pool = NULL;
 
 int te_get_zscores(const EPI *epi, const char *zscores_file,
 		ALL_ZSCORES *all_zscores) {
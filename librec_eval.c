@@ -0,0 +1,1250 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "functions.h"
+#include "trec_format.h"
+#include "rec_eval.h"
+#include <stdarg.h>
+
+/* Context API of librec_eval (see rec_eval.h).
+
+ Everything a context configures lives in the context: its EPI, the
+ measures asked for (as names, never marked in te_trec_measures), a
+ private copy of its rel info (see te_copy_rel_info) and the values of
+ its last evaluation.  Each evaluation works on private copies of the
+ measures it needs, as the rec_eval command does for -M depths, so
+ te_trec_measures is only ever read.  The working storage the loaders,
+ the intermediate form procedures and the measures keep in statics is per
+ thread (TE_THREAD), and is cleaned up after each load and evaluation.
+ The API is thus reentrant: different contexts may load and evaluate at
+ the same time on different threads (a context itself must be used by one
+ thread at a time).
+ */
+
+typedef struct {
+	char *qid;
+	char *docno;
+	float sim;
+} LIB_RESULT;
+
+typedef struct {
+	char *qid;
+	char *docno;
+	long rel;
+} LIB_QREL;
+
+/* Text of results added, in blocks of at least TEXT_BLOCK_SIZE chars
+ (following the header) */
+typedef struct text_block {
+	struct text_block *next;
+	long used;
+	long size;
+} TEXT_BLOCK;
+#define TEXT_BLOCK_SIZE 65536
+
+/* A column of an Arrow record batch */
+typedef struct {
+	const struct ArrowArray *array;
+	char format; /* l (int64), i (int32), u (utf8), U (large_utf8),
+	 f (float32) or g (float64) */
+	int64_t offset; /* Of the batch's row 0 in array */
+} ARROW_COLUMN;
+
+struct rec_eval_ctx {
+	EPI epi;
+	char error[256];
+
+	/* Measures requested: flags indexed as te_trec_measures, and their
+	 parameters as MEAS_ARG (NULL terminated) */
+	char *marked;
+	MEAS_ARG *meas_arg;
+	long num_meas_arg;
+	long max_num_meas_arg;
+
+	ALL_REL_INFO all_rel_info;
+	char *rel_info_buf; /* Copy of rel info read, or */
+	char *rel_info_map; /* mapped rel info image */
+	size_t rel_info_map_size;
+
+	LIB_RESULT *results;
+	long num_results;
+	long max_num_results;
+	TEXT_BLOCK *text_blocks; /* Their qids and docnos */
+
+	/* Values of last evaluation */
+	long num_values;
+	char **value_names;
+	double *values;
+	long num_queries;
+	long max_num_queries;
+	char **qids;
+	double *query_values;
+	long max_query_values;
+};
+
+static int set_error(rec_eval_ctx *ctx, const char *format, ...);
+static int mark_single_measure(rec_eval_ctx *ctx, const char *name);
+static int add_meas_arg(rec_eval_ctx *ctx, const char *name,
+		const char *params);
+static int evaluate(rec_eval_ctx *ctx, const ALL_RESULTS *all_results);
+static int evaluate_queries(rec_eval_ctx *ctx, const ALL_RESULTS *all_results,
+		TREC_MEAS **tms, long num_tms, const long *first_value,
+		TREC_EVAL *accum_eval);
+static int form_results(rec_eval_ctx *ctx, ALL_RESULTS *all_results);
+static void free_rel_info(rec_eval_ctx *ctx);
+static void free_values(rec_eval_ctx *ctx);
+static void cleanup_forms();
+static long find_rel_info(const ALL_REL_INFO *all_rel_info, const char *qid);
+static int load_qrels(rec_eval_ctx *ctx, LIB_QREL *qrels, long num_qrels);
+static char *save_text(rec_eval_ctx *ctx, long length);
+static void free_results(rec_eval_ctx *ctx);
+static int get_column(rec_eval_ctx *ctx, const struct ArrowArray *batch,
+		const struct ArrowSchema *schema, const char *name, long position,
+		const char *formats, ARROW_COLUMN *column);
+static long column_text_length(const ARROW_COLUMN *column, int64_t row);
+static char *put_column_text(const ARROW_COLUMN *column, int64_t row,
+		char *text);
+static double column_value(const ARROW_COLUMN *column, int64_t row);
+static int comp_lib_result();
+static int comp_lib_qrel();
+static int comp_results_qid();
+static int comp_text_results_docno();
+static long id_length(int64_t id);
+static char *put_id(char *text, int64_t id);
+
+extern long te_num_trec_measures;
+extern TREC_MEAS *te_trec_measures[];
+extern long te_num_trec_measure_nicknames;
+extern TREC_MEASURE_NICKNAMES te_trec_measure_nicknames[];
+extern long te_num_rel_info_format;
+extern REL_INFO_FILE_FORMAT te_rel_info_format[];
+extern long te_num_results_format;
+extern RESULTS_FILE_FORMAT te_results_format[];
+extern long te_num_form_inter_procs;
+extern RESULTS_FILE_FORMAT te_form_inter_procs[];
+
+rec_eval_ctx *rec_eval_create(void) {
+	rec_eval_ctx *ctx;
+
+	if (NULL == (ctx = Malloc(1, rec_eval_ctx)))
+		return (NULL);
+	(void) memset(ctx, 0, sizeof(rec_eval_ctx));
+	if (NULL == (ctx->marked = Malloc(te_num_trec_measures, char))) {
+		Free(ctx);
+		return (NULL);
+	}
+	(void) memset(ctx->marked, 0, te_num_trec_measures);
+
+	/* Defaults of the rec_eval command */
+	ctx->epi.summary_flag = 1;
+	ctx->epi.relation_flag = 1;
+	ctx->epi.relevance_level = 1;
+	ctx->epi.max_num_docs_per_topic = MAXLONG;
+	ctx->epi.rel_info_format = "qrels";
+	ctx->epi.results_format = "trec_results";
+	ctx->epi.prefs_conflicts = PREFS_CONFLICTS_FAIL;
+	(void) strcpy(ctx->error, "no error");
+	return (ctx);
+}
+
+void rec_eval_destroy(rec_eval_ctx *ctx) {
+	long i;
+
+	if (NULL == ctx)
+		return;
+	free_rel_info(ctx);
+	free_values(ctx);
+	free_results(ctx);
+	if (ctx->max_num_results)
+		Free(ctx->results);
+	for (i = 0; i < ctx->num_meas_arg; i++) {
+		Free(ctx->meas_arg[i].measure_name);
+		Free(ctx->meas_arg[i].parameters);
+	}
+	if (ctx->max_num_meas_arg)
+		Free(ctx->meas_arg);
+	if (ctx->max_num_queries)
+		Free(ctx->qids);
+	if (ctx->max_query_values)
+		Free(ctx->query_values);
+	Free(ctx->marked);
+	Free(ctx);
+}
+
+const char *rec_eval_error(const rec_eval_ctx *ctx) {
+	return (ctx->error);
+}
+
+int rec_eval_set_option(rec_eval_ctx *ctx, const char *option,
+		const char *value) {
+	long i;
+
+	if (0 == strcmp(option, "complete_rel_info_wanted")
+			|| 0 == strcmp(option, "c"))
+		ctx->epi.average_complete_flag = (NULL == value || atol(value));
+	else if (0 == strcmp(option, "Judged_docs_only")
+			|| 0 == strcmp(option, "J"))
+		ctx->epi.judged_docs_only_flag = (NULL == value || atol(value));
+	else if (NULL == value)
+		return (set_error(ctx, "option '%s' needs a value", option));
+	else if (0 == strcmp(option, "level_for_rel") || 0 == strcmp(option, "l"))
+		ctx->epi.relevance_level = atol(value);
+	else if (0 == strcmp(option, "Number_docs_in_coll")
+			|| 0 == strcmp(option, "N"))
+		ctx->epi.num_docs_in_coll = atol(value);
+	else if (0 == strcmp(option, "Max_retrieved_per_topic")
+			|| 0 == strcmp(option, "M")) {
+		if (0 >= (ctx->epi.max_num_docs_per_topic = atol(value)))
+			return (set_error(ctx, "illegal depth '%s'", value));
+	} else if (0 == strcmp(option, "Rel_info_format")
+			|| 0 == strcmp(option, "R")) {
+		/* Point at the format's own (static) name */
+		for (i = 0; i < te_num_rel_info_format; i++) {
+			if (0 == strcmp(value, te_rel_info_format[i].name))
+				break;
+		}
+		if (i >= te_num_rel_info_format)
+			return (set_error(ctx, "illegal rel_format '%s'", value));
+		free_rel_info(ctx);
+		ctx->epi.rel_info_format = te_rel_info_format[i].name;
+	} else if (0 == strcmp(option, "Results_format")
+			|| 0 == strcmp(option, "T")) {
+		for (i = 0; i < te_num_results_format; i++) {
+			if (0 == strcmp(value, te_results_format[i].name))
+				break;
+		}
+		if (i >= te_num_results_format)
+			return (set_error(ctx, "illegal results_format '%s'", value));
+		ctx->epi.results_format = te_results_format[i].name;
+	} else if (0 == strcmp(option, "prefs-conflicts")) {
+		if (UNDEF == (i = te_get_prefs_conflicts(value)))
+			return (set_error(ctx, "illegal prefs conflicts policy '%s'",
+					value));
+		ctx->epi.prefs_conflicts = i;
+	} else
+		return (set_error(ctx, "unknown option '%s'", option));
+	return (1);
+}
+
+int rec_eval_load_rel_info(rec_eval_ctx *ctx, const char *rel_info_file) {
+	ALL_REL_INFO all_rel_info;
+	long i;
+	int status;
+
+	free_rel_info(ctx);
+	if (te_is_rel_image(rel_info_file)) {
+		if (UNDEF
+				== te_map_rel_image(&ctx->epi, rel_info_file,
+						&ctx->all_rel_info, &ctx->rel_info_map,
+						&ctx->rel_info_map_size))
+			return (set_error(ctx, "cannot attach rel info image '%s'",
+					rel_info_file));
+		return (1);
+	}
+
+	for (i = 0; i < te_num_rel_info_format; i++) {
+		if (0 == strcmp(ctx->epi.rel_info_format, te_rel_info_format[i].name))
+			break;
+	}
+	status = te_rel_info_format[i].get_file(&ctx->epi, (char *) rel_info_file,
+			&all_rel_info);
+	if (UNDEF != status)
+		status = te_copy_rel_info(&ctx->epi, &all_rel_info,
+				&ctx->all_rel_info, &ctx->rel_info_buf);
+	(void) te_rel_info_format[i].cleanup();
+	if (UNDEF == status) {
+		ctx->rel_info_buf = NULL;
+		return (set_error(ctx, "cannot read rel info file '%s'",
+				rel_info_file));
+	}
+	return (1);
+}
+
+int rec_eval_add_measure(rec_eval_ctx *ctx, const char *measure) {
+	char *name;
+	const char *params;
+	long i;
+	int status = 1;
+
+	if (NULL != (params = strchr(measure, '.'))) {
+		if (strchr(params, ':'))
+			return (set_error(ctx,
+					"labelled measure instances are not supported: '%s'",
+					measure));
+		if ('\0' == params[1])
+			return (set_error(ctx, "improper measure in parameter '%s'",
+					measure));
+	}
+	if (NULL == (name = Malloc(strlen(measure) + 1, char)))
+		return (set_error(ctx, "out of memory"));
+	(void) strcpy(name, measure);
+	if (params)
+		name[params++ - measure] = '\0';
+
+	for (i = 0; i < te_num_trec_measure_nicknames; i++) {
+		if (0 == strcmp(name, te_trec_measure_nicknames[i].name)) {
+			char **names = te_trec_measure_nicknames[i].name_list;
+			while (*names && UNDEF != status)
+				status = mark_single_measure(ctx, *names++);
+			break;
+		}
+	}
+	if (i >= te_num_trec_measure_nicknames)
+		status = mark_single_measure(ctx, name);
+	if (UNDEF != status && params)
+		status = add_meas_arg(ctx, name, params);
+	if (UNDEF == status) {
+		(void) set_error(ctx, "illegal measure '%s'", measure);
+		Free(name);
+		return (UNDEF);
+	}
+	Free(name);
+	return (1);
+}
+
+int rec_eval_add_result(rec_eval_ctx *ctx, const char *qid,
+		const char *docno, double sim) {
+	LIB_RESULT *result;
+
+	if (NULL
+			== (ctx->results = te_chk_and_realloc(ctx->results,
+					&ctx->max_num_results, ctx->num_results + 1,
+					sizeof(LIB_RESULT))))
+		return (set_error(ctx, "out of memory"));
+	result = &ctx->results[ctx->num_results];
+	if (NULL == (result->qid = save_text(ctx, strlen(qid) + 1))
+			|| NULL == (result->docno = save_text(ctx, strlen(docno) + 1)))
+		return (set_error(ctx, "out of memory"));
+	(void) strcpy(result->qid, qid);
+	(void) strcpy(result->docno, docno);
+	result->sim = (float) sim;
+	ctx->num_results++;
+	return (1);
+}
+
+int rec_eval_evaluate(rec_eval_ctx *ctx) {
+	ALL_RESULTS all_results;
+	int status;
+
+	if (UNDEF == (status = form_results(ctx, &all_results)))
+		(void) set_error(ctx, "out of memory");
+	else {
+		status = evaluate(ctx, &all_results);
+		if (all_results.num_q_results) {
+			TEXT_RESULTS_INFO *info = all_results.results[0].q_results;
+			Free(info->text_results);
+			Free(info);
+			Free(all_results.results);
+		}
+	}
+	free_results(ctx);
+	return (status);
+}
+
+int rec_eval_evaluate_file(rec_eval_ctx *ctx, const char *results_file) {
+	ALL_RESULTS all_results;
+	long i;
+	int status;
+
+	for (i = 0; i < te_num_results_format; i++) {
+		if (0 == strcmp(ctx->epi.results_format, te_results_format[i].name))
+			break;
+	}
+	if (UNDEF
+			== (status = te_results_format[i].get_file(&ctx->epi,
+					(char *) results_file, &all_results)))
+		(void) set_error(ctx, "cannot read results file '%s'", results_file);
+	else
+		status = evaluate(ctx, &all_results);
+	(void) te_results_format[i].cleanup();
+	return (status);
+}
+
+int rec_eval_load_qrels_arrays(rec_eval_ctx *ctx, long num_qrels,
+		const int64_t *users, const int64_t *items, const int64_t *rels) {
+	LIB_QREL *qrels;
+	char *text, *text_ptr;
+	long text_size, i;
+	int status;
+
+	if (strcmp(ctx->epi.rel_info_format, "qrels"))
+		return (set_error(ctx, "rel_format must be qrels for qrels arrays"));
+	if (num_qrels <= 0)
+		return (set_error(ctx, "no qrels given"));
+
+	/* The ids as text, in one block */
+	text_size = 0;
+	for (i = 0; i < num_qrels; i++)
+		text_size += id_length(users[i]) + id_length(items[i]) + 2;
+	if (NULL == (qrels = Malloc(num_qrels, LIB_QREL)))
+		return (set_error(ctx, "out of memory"));
+	if (NULL == (text = Malloc(text_size, char))) {
+		Free(qrels);
+		return (set_error(ctx, "out of memory"));
+	}
+	text_ptr = text;
+	for (i = 0; i < num_qrels; i++) {
+		qrels[i].qid = text_ptr;
+		text_ptr = put_id(text_ptr, users[i]);
+		qrels[i].docno = text_ptr;
+		text_ptr = put_id(text_ptr, items[i]);
+		qrels[i].rel = (long) rels[i];
+	}
+	status = load_qrels(ctx, qrels, num_qrels);
+	Free(text);
+	Free(qrels);
+	return (status);
+}
+
+int rec_eval_load_qrels_arrow(rec_eval_ctx *ctx,
+		const struct ArrowArray *batch, const struct ArrowSchema *schema,
+		const char *user_column, const char *item_column,
+		const char *rel_column) {
+	ARROW_COLUMN users, items, rels;
+	LIB_QREL *qrels;
+	char *text, *text_ptr;
+	long num_qrels, text_size, i;
+	int status;
+
+	if (strcmp(ctx->epi.rel_info_format, "qrels"))
+		return (set_error(ctx, "rel_format must be qrels for qrels arrays"));
+	if (UNDEF
+			== get_column(ctx, batch, schema, user_column, 0, "liuU", &users)
+			|| UNDEF
+					== get_column(ctx, batch, schema, item_column, 1, "liuU",
+							&items)
+			|| UNDEF
+					== get_column(ctx, batch, schema, rel_column, 2, "li",
+							&rels))
+		return (UNDEF);
+	if (0 >= (num_qrels = (long) batch->length))
+		return (set_error(ctx, "no qrels given"));
+
+	text_size = 0;
+	for (i = 0; i < num_qrels; i++)
+		text_size += column_text_length(&users, i)
+				+ column_text_length(&items, i) + 2;
+	if (NULL == (qrels = Malloc(num_qrels, LIB_QREL)))
+		return (set_error(ctx, "out of memory"));
+	if (NULL == (text = Malloc(text_size, char))) {
+		Free(qrels);
+		return (set_error(ctx, "out of memory"));
+	}
+	text_ptr = text;
+	for (i = 0; i < num_qrels; i++) {
+		qrels[i].qid = text_ptr;
+		text_ptr = put_column_text(&users, i, text_ptr);
+		qrels[i].docno = text_ptr;
+		text_ptr = put_column_text(&items, i, text_ptr);
+		qrels[i].rel = (long) column_value(&rels, i);
+	}
+	status = load_qrels(ctx, qrels, num_qrels);
+	Free(text);
+	Free(qrels);
+	return (status);
+}
+
+int rec_eval_add_results_arrow(rec_eval_ctx *ctx,
+		const struct ArrowArray *batch, const struct ArrowSchema *schema,
+		const char *user_column, const char *item_column,
+		const char *score_column) {
+	ARROW_COLUMN users, items, scores;
+	LIB_RESULT *result;
+	long num_rows, i;
+
+	if (UNDEF
+			== get_column(ctx, batch, schema, user_column, 0, "liuU", &users)
+			|| UNDEF
+					== get_column(ctx, batch, schema, item_column, 1, "liuU",
+							&items)
+			|| UNDEF
+					== get_column(ctx, batch, schema, score_column, 2, "fg",
+							&scores))
+		return (UNDEF);
+	num_rows = (long) batch->length;
+	if (NULL
+			== (ctx->results = te_chk_and_realloc(ctx->results,
+					&ctx->max_num_results, ctx->num_results + num_rows + 1,
+					sizeof(LIB_RESULT))))
+		return (set_error(ctx, "out of memory"));
+	for (i = 0; i < num_rows; i++) {
+		result = &ctx->results[ctx->num_results];
+		if (NULL
+				== (result->qid = save_text(ctx,
+						column_text_length(&users, i) + 1))
+				|| NULL
+						== (result->docno = save_text(ctx,
+								column_text_length(&items, i) + 1)))
+			return (set_error(ctx, "out of memory"));
+		(void) put_column_text(&users, i, result->qid);
+		(void) put_column_text(&items, i, result->docno);
+		result->sim = (float) column_value(&scores, i);
+		ctx->num_results++;
+	}
+	return (1);
+}
+
+int rec_eval_evaluate_arrays(rec_eval_ctx *ctx, long num_users,
+		const int64_t *users, const int64_t *offsets, const int64_t *items,
+		const float *scores) {
+	ALL_RESULTS all_results;
+	RESULTS *results = NULL;
+	TEXT_RESULTS_INFO *info = NULL;
+	TEXT_RESULTS *text_results = NULL;
+	char *text = NULL, *text_ptr;
+	long num_q, num_rows, text_size, u, i;
+	int64_t j;
+	int status = 1;
+
+	if (num_users < 0)
+		return (set_error(ctx, "illegal number of users %ld", num_users));
+	num_rows = 0;
+	text_size = 0;
+	for (u = 0; u < num_users; u++) {
+		if (offsets[u] < 0 || offsets[u + 1] < offsets[u])
+			return (set_error(ctx, "illegal offsets for user %ld", u));
+		num_rows += offsets[u + 1] - offsets[u];
+		text_size += id_length(users[u]) + 1;
+		for (j = offsets[u]; j < offsets[u + 1]; j++)
+			text_size += id_length(items[j]) + 1;
+	}
+
+	/* Queries in the form of the trec_results format, with the ids as
+	 text in one block.  Users without results are left out, as they
+	 would be from a results file */
+	if (NULL == (results = Malloc(num_users + 1, RESULTS))
+			|| NULL == (info = Malloc(num_users + 1, TEXT_RESULTS_INFO))
+			|| NULL == (text_results = Malloc(num_rows + 1, TEXT_RESULTS))
+			|| NULL == (text = Malloc(text_size + 1, char)))
+		status = set_error(ctx, "out of memory");
+	else {
+		text_ptr = text;
+		num_q = 0;
+		i = 0;
+		for (u = 0; u < num_users; u++) {
+			if (offsets[u + 1] == offsets[u])
+				continue;
+			results[num_q].qid = text_ptr;
+			text_ptr = put_id(text_ptr, users[u]);
+			results[num_q].run_id = "rec_eval";
+			results[num_q].ret_format = "trec_results";
+			results[num_q].q_results = &info[num_q];
+			info[num_q].num_text_results = offsets[u + 1] - offsets[u];
+			info[num_q].max_num_text_results = info[num_q].num_text_results;
+			info[num_q].text_results = &text_results[i];
+			for (j = offsets[u]; j < offsets[u + 1]; j++) {
+				text_results[i].docno = text_ptr;
+				text_ptr = put_id(text_ptr, items[j]);
+				text_results[i].sim = scores[j];
+				i++;
+			}
+			qsort((char *) info[num_q].text_results,
+					(int) info[num_q].num_text_results, sizeof(TEXT_RESULTS),
+					comp_text_results_docno);
+			num_q++;
+		}
+		/* In qid (and docno) order, as the results loaders give them */
+		qsort((char *) results, (int) num_q, sizeof(RESULTS),
+				comp_results_qid);
+		for (i = 1; i < num_q && UNDEF != status; i++) {
+			if (0 == strcmp(results[i - 1].qid, results[i].qid))
+				status = set_error(ctx, "user %s given more than once",
+						results[i].qid);
+		}
+		if (UNDEF != status) {
+			all_results.num_q_results = num_q;
+			all_results.max_num_q_results = num_q;
+			all_results.results = results;
+			status = evaluate(ctx, &all_results);
+		}
+	}
+
+	if (text)
+		Free(text);
+	if (text_results)
+		Free(text_results);
+	if (info)
+		Free(info);
+	if (results)
+		Free(results);
+	return (status);
+}
+
+long rec_eval_num_values(const rec_eval_ctx *ctx) {
+	return (ctx->num_values);
+}
+
+const char *rec_eval_value_name(const rec_eval_ctx *ctx, long value) {
+	if (value < 0 || value >= ctx->num_values)
+		return (NULL);
+	return (ctx->value_names[value]);
+}
+
+double rec_eval_value(const rec_eval_ctx *ctx, long value) {
+	if (value < 0 || value >= ctx->num_values)
+		return (0.0);
+	return (ctx->values[value]);
+}
+
+long rec_eval_num_queries(const rec_eval_ctx *ctx) {
+	return (ctx->num_queries);
+}
+
+const char *rec_eval_query_id(const rec_eval_ctx *ctx, long query) {
+	if (query < 0 || query >= ctx->num_queries)
+		return (NULL);
+	return (ctx->qids[query]);
+}
+
+double rec_eval_query_value(const rec_eval_ctx *ctx, long query, long value) {
+	if (query < 0 || query >= ctx->num_queries || value < 0
+			|| value >= ctx->num_values)
+		return (0.0);
+	return (ctx->query_values[query * ctx->num_values + value]);
+}
+
+static int set_error(rec_eval_ctx *ctx, const char *format, ...) {
+	va_list args;
+
+	va_start(args, format);
+	(void) vsnprintf(ctx->error, sizeof(ctx->error), format, args);
+	va_end(args);
+	return (UNDEF);
+}
+
+static int mark_single_measure(rec_eval_ctx *ctx, const char *name) {
+	long i;
+
+	for (i = 0; i < te_num_trec_measures; i++) {
+		if (0 == strcmp(name, te_trec_measures[i]->name)) {
+			ctx->marked[i] = 1;
+			return (1);
+		}
+	}
+	return (UNDEF);
+}
+
+/* Parameters params for measure name, replacing any given before */
+static int add_meas_arg(rec_eval_ctx *ctx, const char *name,
+		const char *params) {
+	MEAS_ARG *meas_arg;
+	long i;
+
+	for (i = 0; i < ctx->num_meas_arg; i++) {
+		if (0 == strcmp(name, ctx->meas_arg[i].measure_name))
+			break;
+	}
+	if (NULL
+			== (ctx->meas_arg = te_chk_and_realloc(ctx->meas_arg,
+					&ctx->max_num_meas_arg, ctx->num_meas_arg + 2,
+					sizeof(MEAS_ARG))))
+		return (UNDEF);
+	meas_arg = &ctx->meas_arg[i];
+	if (i < ctx->num_meas_arg)
+		Free(meas_arg->parameters);
+	else if (NULL
+			== (meas_arg->measure_name = Malloc(strlen(name) + 1, char)))
+		return (UNDEF);
+	else {
+		(void) strcpy(meas_arg->measure_name, name);
+		ctx->num_meas_arg++;
+		ctx->meas_arg[ctx->num_meas_arg].measure_name = NULL;
+	}
+	if (NULL == (meas_arg->parameters = Malloc(strlen(params) + 1, char)))
+		return (UNDEF);
+	(void) strcpy(meas_arg->parameters, params);
+	return (1);
+}
+
+/* Evaluate all_results with the measures of ctx, keeping the values in
+ ctx */
+static int evaluate(rec_eval_ctx *ctx, const ALL_RESULTS *all_results) {
+	TREC_EVAL accum_eval;
+	TREC_MEAS **tms = NULL;
+	long *base = NULL, *first_value = NULL;
+	long num_tms, num_init, num_args, i, j;
+	MEAS_ARG *meas_arg = NULL;
+	int status = 1;
+
+	if (NULL == ctx->all_rel_info.rel_info)
+		return (set_error(ctx, "no rel info loaded"));
+	free_values(ctx);
+
+	/* As for the rec_eval command, "official" if no measure was asked for */
+	for (i = 0; i < te_num_trec_measures && !ctx->marked[i]; i++)
+		;
+	if (i >= te_num_trec_measures
+			&& UNDEF == rec_eval_add_measure(ctx, "official"))
+		return (UNDEF);
+
+	/* Private copies of the measures, in te_trec_measures order, with
+	 parameter strings of their own (init_meas modifies them) */
+	num_args = 0;
+	if (NULL == (tms = Malloc(te_num_trec_measures, TREC_MEAS *))
+			|| NULL == (base = Malloc(te_num_trec_measures, long))
+			|| NULL
+					== (first_value = Malloc(te_num_trec_measures + 1, long))
+			|| NULL == (meas_arg = Malloc(ctx->num_meas_arg + 1, MEAS_ARG)))
+		status = set_error(ctx, "out of memory");
+	while (UNDEF != status && num_args < ctx->num_meas_arg) {
+		meas_arg[num_args].measure_name = ctx->meas_arg[num_args].measure_name;
+		if (NULL
+				== (meas_arg[num_args].parameters = Malloc(
+						strlen(ctx->meas_arg[num_args].parameters) + 1, char)))
+			status = set_error(ctx, "out of memory");
+		else {
+			(void) strcpy(meas_arg[num_args].parameters,
+					ctx->meas_arg[num_args].parameters);
+			num_args++;
+		}
+	}
+	if (UNDEF != status)
+		meas_arg[num_args].measure_name = NULL;
+
+	num_tms = 0;
+	for (i = 0; i < te_num_trec_measures && UNDEF != status; i++) {
+		if (!ctx->marked[i])
+			continue;
+		if (NULL == (tms[num_tms] = Malloc(1, TREC_MEAS)))
+			status = set_error(ctx, "out of memory");
+		else {
+			*tms[num_tms] = *te_trec_measures[i];
+			if (te_trec_measures[i]->meas_params
+					&& NULL
+							== (tms[num_tms]->meas_params = Malloc(1, PARAMS))) {
+				Free(tms[num_tms]);
+				status = set_error(ctx, "out of memory");
+			} else {
+				if (te_trec_measures[i]->meas_params)
+					*tms[num_tms]->meas_params =
+							*te_trec_measures[i]->meas_params;
+				MARK_MEASURE(tms[num_tms]);
+				base[num_tms++] = i;
+			}
+		}
+	}
+	/* Measures aggregating another (base_meas) share the copy of it */
+	for (i = 0; i < num_tms; i++) {
+		for (j = 0; tms[i]->base_meas && j < num_tms; j++) {
+			if (tms[i]->base_meas == te_trec_measures[base[j]]) {
+				tms[i]->base_meas = tms[j];
+				break;
+			}
+		}
+	}
+
+	accum_eval = (TREC_EVAL ) { "all", 0, NULL, 0, 0 };
+	ctx->epi.meas_arg = meas_arg;
+	num_init = 0;
+	while (num_init < num_tms && UNDEF != status) {
+		first_value[num_init] = accum_eval.num_values;
+		if (UNDEF
+				== tms[num_init]->init_meas(&ctx->epi, tms[num_init],
+						&accum_eval))
+			status = set_error(ctx, "cannot initialize measure '%s'",
+					tms[num_init]->name);
+		else
+			num_init++;
+	}
+	if (UNDEF != status) {
+		first_value[num_init] = accum_eval.num_values;
+		status = evaluate_queries(ctx, all_results, tms, num_tms, first_value,
+				&accum_eval);
+	}
+
+	/* Measures free the names and parameters they made while printing */
+	ctx->epi.summary_flag = 0;
+	for (i = 0; i < num_init; i++)
+		(void) tms[i]->print_final_and_cleanup_meas(&ctx->epi, tms[i],
+				&accum_eval);
+	ctx->epi.summary_flag = 1;
+	ctx->epi.meas_arg = NULL;
+	for (i = 0; i < num_tms; i++) {
+		if (tms[i]->meas_params)
+			Free(tms[i]->meas_params);
+		Free(tms[i]);
+	}
+	for (i = 0; i < num_args; i++)
+		Free(meas_arg[i].parameters);
+	if (meas_arg)
+		Free(meas_arg);
+	if (first_value)
+		Free(first_value);
+	if (base)
+		Free(base);
+	if (tms)
+		Free(tms);
+	if (accum_eval.values)
+		Free(accum_eval.values);
+	cleanup_forms();
+	return (status);
+}
+
+/* Calculate and accumulate the values of each query of all_results with
+ rel info, then average them, keeping copies in ctx.  The values of tms[m]
+ are those from first_value[m] up to first_value[m+1]; those of measures
+ rec_eval -q does not print per query are kept as NaN */
+static int evaluate_queries(rec_eval_ctx *ctx, const ALL_RESULTS *all_results,
+		TREC_MEAS **tms, long num_tms, const long *first_value,
+		TREC_EVAL *accum_eval) {
+	TREC_EVAL q_eval;
+	long i, j, m, q;
+
+	if (NULL
+			== (q_eval.values = Malloc(accum_eval->num_values + 1,
+					TREC_EVAL_VALUE)))
+		return (set_error(ctx, "out of memory"));
+	(void) memcpy(q_eval.values, accum_eval->values,
+			accum_eval->num_values * sizeof(TREC_EVAL_VALUE));
+	q_eval.num_values = accum_eval->num_values;
+	q_eval.num_queries = 0;
+
+	for (i = 0; i < all_results->num_q_results; i++) {
+		if (0 > (j = find_rel_info(&ctx->all_rel_info,
+				all_results->results[i].qid)))
+			continue;
+		for (m = 0; m < q_eval.num_values; m++)
+			q_eval.values[m].value = 0;
+		q_eval.qid = all_results->results[i].qid;
+		for (m = 0; m < num_tms; m++) {
+			if (MEASURE_REQUESTED(tms[m])
+					&& UNDEF
+							== tms[m]->calc_meas(&ctx->epi,
+									&ctx->all_rel_info.rel_info[j],
+									&all_results->results[i], tms[m],
+									&q_eval)) {
+				Free(q_eval.values);
+				return (set_error(ctx, "cannot calculate measure '%s'",
+						tms[m]->name));
+			}
+		}
+		for (m = 0; m < num_tms; m++) {
+			if (MEASURE_REQUESTED(tms[m])
+					&& UNDEF
+							== tms[m]->acc_meas(&ctx->epi, tms[m], &q_eval,
+									accum_eval)) {
+				Free(q_eval.values);
+				return (set_error(ctx, "cannot accumulate measure '%s'",
+						tms[m]->name));
+			}
+		}
+		accum_eval->num_queries++;
+
+		/* Keep the query's values */
+		q = ctx->num_queries;
+		if (NULL
+				== (ctx->qids = te_chk_and_realloc(ctx->qids,
+						&ctx->max_num_queries, q + 1, sizeof(char *)))
+				|| NULL
+						== (ctx->query_values = te_chk_and_realloc(
+								ctx->query_values, &ctx->max_query_values,
+								(q + 1) * q_eval.num_values + 1,
+								sizeof(double)))
+				|| NULL
+						== (ctx->qids[q] = Malloc(strlen(q_eval.qid) + 1,
+								char))) {
+			Free(q_eval.values);
+			return (set_error(ctx, "out of memory"));
+		}
+		(void) strcpy(ctx->qids[q], q_eval.qid);
+		for (m = 0; m < q_eval.num_values; m++)
+			ctx->query_values[q * q_eval.num_values + m] =
+					q_eval.values[m].value;
+		for (m = 0; m < num_tms; m++) {
+			if (te_print_single_meas_empty == tms[m]->print_single_meas) {
+				for (j = first_value[m]; j < first_value[m + 1]; j++)
+					ctx->query_values[q * q_eval.num_values + j] = NAN;
+			}
+		}
+		ctx->num_queries++;
+	}
+	Free(q_eval.values);
+
+	for (m = 0; m < num_tms; m++) {
+		if (MEASURE_REQUESTED(tms[m])
+				&& UNDEF
+						== tms[m]->calc_avg_meas(&ctx->epi, tms[m],
+								&ctx->all_rel_info, accum_eval))
+			return (set_error(ctx, "cannot average measure '%s'",
+					tms[m]->name));
+	}
+
+	/* Names are freed by the measures at cleanup, so are copied */
+	if (NULL
+			== (ctx->value_names = Malloc(accum_eval->num_values + 1, char *))
+			|| NULL
+					== (ctx->values = Malloc(accum_eval->num_values + 1,
+							double)))
+		return (set_error(ctx, "out of memory"));
+	for (m = 0; m < accum_eval->num_values; m++) {
+		if (NULL
+				== (ctx->value_names[m] = Malloc(
+						strlen(accum_eval->values[m].name) + 1, char)))
+			return (set_error(ctx, "out of memory"));
+		(void) strcpy(ctx->value_names[m], accum_eval->values[m].name);
+		ctx->values[m] = accum_eval->values[m].value;
+		ctx->num_values++;
+	}
+	return (1);
+}
+
+/* Form the results added to ctx into all_results (in the form of the
+ trec_results format, sorted by qid and docno), all in three blocks:
+ results, the first query's TEXT_RESULTS_INFO (followed by those of the
+ others) and the first query's TEXT_RESULTS (followed by the others) */
+static int form_results(rec_eval_ctx *ctx, ALL_RESULTS *all_results) {
+	TEXT_RESULTS_INFO *info;
+	TEXT_RESULTS *text_results;
+	long num_q, i;
+
+	all_results->num_q_results = 0;
+	all_results->max_num_q_results = 0;
+	all_results->results = NULL;
+	if (0 == ctx->num_results)
+		return (1);
+
+	qsort((char *) ctx->results, (int) ctx->num_results, sizeof(LIB_RESULT),
+			comp_lib_result);
+	num_q = 1;
+	for (i = 1; i < ctx->num_results; i++) {
+		if (strcmp(ctx->results[i - 1].qid, ctx->results[i].qid))
+			num_q++;
+	}
+	if (NULL == (all_results->results = Malloc(num_q, RESULTS))
+			|| NULL == (info = Malloc(num_q, TEXT_RESULTS_INFO))
+			|| NULL
+					== (text_results = Malloc(ctx->num_results,
+							TEXT_RESULTS)))
+		return (UNDEF);
+
+	num_q = 0;
+	for (i = 0; i < ctx->num_results; i++) {
+		if (0 == i || strcmp(ctx->results[i - 1].qid, ctx->results[i].qid)) {
+			all_results->results[num_q].qid = ctx->results[i].qid;
+			all_results->results[num_q].run_id = "rec_eval";
+			all_results->results[num_q].ret_format = "trec_results";
+			all_results->results[num_q].q_results = &info[num_q];
+			info[num_q].num_text_results = 0;
+			info[num_q].max_num_text_results = 0;
+			info[num_q].text_results = &text_results[i];
+			num_q++;
+		}
+		text_results[i].docno = ctx->results[i].docno;
+		text_results[i].sim = ctx->results[i].sim;
+		info[num_q - 1].num_text_results++;
+		info[num_q - 1].max_num_text_results++;
+	}
+	all_results->num_q_results = num_q;
+	all_results->max_num_q_results = num_q;
+	return (1);
+}
+
+/* Load qrels (pointing at text of the caller's) as the rel info of ctx,
+ sorting them as the qrels loader sorts its lines */
+static int load_qrels(rec_eval_ctx *ctx, LIB_QREL *qrels, long num_qrels) {
+	ALL_REL_INFO all_rel_info;
+	REL_INFO *rel_info = NULL;
+	TEXT_QRELS_INFO *info = NULL;
+	TEXT_QRELS *text_qrels = NULL;
+	long num_q, i;
+	int status = 1;
+
+	free_rel_info(ctx);
+	qsort((char *) qrels, (int) num_qrels, sizeof(LIB_QREL), comp_lib_qrel);
+
+	num_q = 1;
+	for (i = 1; i < num_qrels; i++) {
+		if (strcmp(qrels[i - 1].qid, qrels[i].qid))
+			num_q++;
+	}
+	if (NULL == (rel_info = Malloc(num_q, REL_INFO))
+			|| NULL == (info = Malloc(num_q, TEXT_QRELS_INFO))
+			|| NULL == (text_qrels = Malloc(num_qrels, TEXT_QRELS)))
+		status = set_error(ctx, "out of memory");
+	else {
+		num_q = 0;
+		for (i = 0; i < num_qrels; i++) {
+			if (0 == i || strcmp(qrels[i - 1].qid, qrels[i].qid)) {
+				rel_info[num_q].qid = qrels[i].qid;
+				rel_info[num_q].rel_format = "qrels";
+				rel_info[num_q].q_rel_info = &info[num_q];
+				info[num_q].num_text_qrels = 0;
+				info[num_q].text_qrels = &text_qrels[i];
+				num_q++;
+			}
+			text_qrels[i].docno = qrels[i].docno;
+			text_qrels[i].rel = qrels[i].rel;
+			info[num_q - 1].num_text_qrels++;
+			info[num_q - 1].max_num_text_qrels =
+					info[num_q - 1].num_text_qrels;
+		}
+		all_rel_info.num_q_rels = num_q;
+		all_rel_info.max_num_q_rels = num_q;
+		all_rel_info.rel_info = rel_info;
+		if (UNDEF
+				== te_copy_rel_info(&ctx->epi, &all_rel_info,
+						&ctx->all_rel_info, &ctx->rel_info_buf)) {
+			ctx->rel_info_buf = NULL;
+			status = set_error(ctx, "out of memory");
+		}
+	}
+
+	if (text_qrels)
+		Free(text_qrels);
+	if (info)
+		Free(info);
+	if (rel_info)
+		Free(rel_info);
+	return (status);
+}
+
+/* Space for length chars of text of the results added to ctx */
+static char *save_text(rec_eval_ctx *ctx, long length) {
+	TEXT_BLOCK *block = ctx->text_blocks;
+	long size;
+
+	if (NULL == block || block->used + length > block->size) {
+		size = (length > TEXT_BLOCK_SIZE) ? length : TEXT_BLOCK_SIZE;
+		if (NULL
+				== (block = (TEXT_BLOCK *) Malloc(sizeof(TEXT_BLOCK) + size,
+						char)))
+			return (NULL);
+		block->next = ctx->text_blocks;
+		block->used = 0;
+		block->size = size;
+		ctx->text_blocks = block;
+	}
+	block->used += length;
+	return ((char *) (block + 1) + block->used - length);
+}
+
+static void free_results(rec_eval_ctx *ctx) {
+	TEXT_BLOCK *block;
+
+	while (NULL != (block = ctx->text_blocks)) {
+		ctx->text_blocks = block->next;
+		Free(block);
+	}
+	ctx->num_results = 0;
+}
+
+/* Find column name (or the column at position, if name is NULL) of the
+ record batch, checking it is of one of formats with no nulls */
+static int get_column(rec_eval_ctx *ctx, const struct ArrowArray *batch,
+		const struct ArrowSchema *schema, const char *name, long position,
+		const char *formats, ARROW_COLUMN *column) {
+	const struct ArrowSchema *child;
+	const char *format;
+	long i;
+
+	if (strcmp(schema->format, "+s") || batch->n_children != schema->n_children)
+		return (set_error(ctx, "arrow batch is not a struct array"));
+	if (name) {
+		for (i = 0; i < schema->n_children; i++) {
+			if (schema->children[i]->name
+					&& 0 == strcmp(name, schema->children[i]->name))
+				break;
+		}
+		if (i >= schema->n_children)
+			return (set_error(ctx, "arrow batch has no column '%s'", name));
+	} else if ((i = position) >= schema->n_children)
+		return (set_error(ctx, "arrow batch has only %ld columns",
+				(long) schema->n_children));
+	child = schema->children[i];
+	column->array = batch->children[i];
+	column->offset = batch->offset + column->array->offset;
+	format = child->format;
+
+	if ('\0' == format[0] || '\0' != format[1] || NULL == strchr(formats, *format))
+		return (set_error(ctx, "arrow column '%s' has unsupported format '%s'",
+				child->name ? child->name : "", format));
+	if (column->array->length < batch->offset + batch->length)
+		return (set_error(ctx, "arrow column '%s' is too short",
+				child->name ? child->name : ""));
+	if (column->array->null_count != 0 && column->array->buffers[0])
+		return (set_error(ctx, "arrow column '%s' has nulls",
+				child->name ? child->name : ""));
+	column->format = *format;
+	return (1);
+}
+
+/* Length of the text of row of column (as a string, or in decimal) */
+static long column_text_length(const ARROW_COLUMN *column, int64_t row) {
+	const void **buffers = column->array->buffers;
+
+	row += column->offset;
+	switch (column->format) {
+	case 'l':
+		return (id_length(((const int64_t *) buffers[1])[row]));
+	case 'i':
+		return (id_length(((const int32_t *) buffers[1])[row]));
+	case 'u':
+		return ((long) (((const int32_t *) buffers[1])[row + 1]
+				- ((const int32_t *) buffers[1])[row]));
+	default:
+		return ((long) (((const int64_t *) buffers[1])[row + 1]
+				- ((const int64_t *) buffers[1])[row]));
+	}
+}
+
+/* Write the text of row of column, '\0' terminated, at text, returning the
+ position following it */
+static char *put_column_text(const ARROW_COLUMN *column, int64_t row,
+		char *text) {
+	const void **buffers = column->array->buffers;
+	long length = column_text_length(column, row);
+	int64_t start;
+
+	row += column->offset;
+	switch (column->format) {
+	case 'l':
+		return (put_id(text, ((const int64_t *) buffers[1])[row]));
+	case 'i':
+		return (put_id(text, ((const int32_t *) buffers[1])[row]));
+	case 'u':
+		start = ((const int32_t *) buffers[1])[row];
+		break;
+	default:
+		start = ((const int64_t *) buffers[1])[row];
+		break;
+	}
+	(void) memcpy(text, (const char *) buffers[2] + start, length);
+	text[length] = '\0';
+	return (text + length + 1);
+}
+
+/* Value of row of a numeric column */
+static double column_value(const ARROW_COLUMN *column, int64_t row) {
+	const void **buffers = column->array->buffers;
+
+	row += column->offset;
+	switch (column->format) {
+	case 'l':
+		return ((double) ((const int64_t *) buffers[1])[row]);
+	case 'i':
+		return ((double) ((const int32_t *) buffers[1])[row]);
+	case 'f':
+		return ((double) ((const float *) buffers[1])[row]);
+	default:
+		return (((const double *) buffers[1])[row]);
+	}
+}
+
+static void free_rel_info(rec_eval_ctx *ctx) {
+	if (ctx->rel_info_buf) {
+		Free(ctx->rel_info_buf);
+		ctx->rel_info_buf = NULL;
+	}
+	if (ctx->rel_info_map) {
+		(void) te_unmap_rel_image(ctx->rel_info_map, ctx->rel_info_map_size);
+		ctx->rel_info_map = NULL;
+	}
+	ctx->all_rel_info.num_q_rels = 0;
+	ctx->all_rel_info.rel_info = NULL;
+}
+
+static void free_values(rec_eval_ctx *ctx) {
+	long i;
+
+	for (i = 0; i < ctx->num_values; i++)
+		Free(ctx->value_names[i]);
+	if (ctx->value_names) {
+		Free(ctx->value_names);
+		Free(ctx->values);
+	}
+	ctx->value_names = NULL;
+	ctx->values = NULL;
+	ctx->num_values = 0;
+	for (i = 0; i < ctx->num_queries; i++)
+		Free(ctx->qids[i]);
+	ctx->num_queries = 0;
+}
+
+/* The intermediate forms are cached by qid, and so must not outlive an
+ evaluation, since contexts share qids */
+static void cleanup_forms() {
+	long i;
+
+	for (i = 0; i < te_num_form_inter_procs; i++)
+		(void) te_form_inter_procs[i].cleanup();
+}
+
+/* Index of the rel info for qid in all_rel_info, -1 if none */
+static long find_rel_info(const ALL_REL_INFO *all_rel_info, const char *qid) {
+	long low = 0;
+	long high = all_rel_info->num_q_rels - 1;
+	long mid;
+	int cmp;
+
+	while (low <= high) {
+		mid = low + (high - low) / 2;
+		cmp = strcmp(qid, all_rel_info->rel_info[mid].qid);
+		if (0 == cmp)
+			return (mid);
+		if (cmp < 0)
+			high = mid - 1;
+		else
+			low = mid + 1;
+	}
+	return (-1);
+}
+
+static int comp_lib_result(LIB_RESULT *ptr1, LIB_RESULT *ptr2) {
+	int cmp = strcmp(ptr1->qid, ptr2->qid);
+
+	if (cmp)
+		return (cmp);
+	return (strcmp(ptr1->docno, ptr2->docno));
+}
+
+static int comp_lib_qrel(LIB_QREL *ptr1, LIB_QREL *ptr2) {
+	int cmp = strcmp(ptr1->qid, ptr2->qid);
+
+	if (cmp)
+		return (cmp);
+	return (strcmp(ptr1->docno, ptr2->docno));
+}
+
+static int comp_results_qid(RESULTS *ptr1, RESULTS *ptr2) {
+	return (strcmp(ptr1->qid, ptr2->qid));
+}
+
+static int comp_text_results_docno(TEXT_RESULTS *ptr1, TEXT_RESULTS *ptr2) {
+	return (strcmp(ptr1->docno, ptr2->docno));
+}
+
+/* Length of the decimal text of id */
+static long id_length(int64_t id) {
+	uint64_t value = (id < 0) ? -(uint64_t) id : (uint64_t) id;
+	long length = (id < 0) ? 2 : 1;
+
+	while (value >= 10) {
+		value /= 10;
+		length++;
+	}
+	return (length);
+}
+
+/* Write the decimal text of id, '\0' terminated, at text, returning the
+ position following it */
+static char *put_id(char *text, int64_t id) {
+	uint64_t value = (id < 0) ? -(uint64_t) id : (uint64_t) id;
+	long length = id_length(id);
+	char *ptr = text + length;
+
+	*ptr = '\0';
+	do {
+		*--ptr = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	if (id < 0)
+		*--ptr = '-';
+	return (text + length + 1);
+}
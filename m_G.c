@@ -62,6 +62,8 @@ static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
 		GAINS *gains);
 static double get_gain(const long rel_level, const GAINS *gains);
 static int comp_rel_gain();
+static int calc_G_binary(const RES_RELS *res_rels, const TREC_MEAS *tm,
+		TREC_EVAL *eval);
 
 static int te_calc_G(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval) {
@@ -77,6 +79,13 @@ static int te_calc_G(const EPI *epi, const REL_INFO *rel_info,
 	if (UNDEF == te_form_res_rels(epi, rel_info, results, &res_rels))
 		return (UNDEF);
 
+	/* Only relevance levels 0 and 1 with default gains (and no tracing):
+	 the ideal gain (and cost) after rank i is i, so no level walk needed */
+	if (res_rels.num_rel_levels <= 2
+			&& (NULL == tm->meas_params || 0 == tm->meas_params->num_params)
+			&& 0 == epi->debug_level)
+		return (calc_G_binary(&res_rels, tm, eval));
+
 	if (UNDEF == setup_gains(tm, &res_rels, &gains))
 		return (UNDEF);
 
@@ -159,6 +168,25 @@ static int te_calc_G(const EPI *epi, const REL_INFO *rel_info,
 	return (1);
 }
 
+static int calc_G_binary(const RES_RELS *res_rels, const TREC_MEAS *tm,
+		TREC_EVAL *eval) {
+	long num_rel = res_rels->num_rel_levels > 1 ? res_rels->rel_levels[1] : 0;
+	long rel_so_far = 0;
+	double results_g = 0.0;
+	long i;
+
+	if (0 == num_rel)
+		return (1);
+	for (i = 0; i < res_rels->num_ret; i++) {
+		if (1 == res_rels->results_rel_list[i]) {
+			rel_so_far++;
+			results_g += 1.0 / log2((double) (i + 3 - rel_so_far));
+		}
+	}
+	eval->values[tm->eval_index].value = results_g / (double) num_rel;
+	return (1);
+}
+
 static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
 		GAINS *gains) {
 	FLOAT_PARAM_PAIR *pairs = NULL;
@@ -42,11 +42,25 @@ static int te_calc_err(const EPI *epi, const REL_INFO *rel_info,
 	double gain;
 	long r;
 
-	if (UNDEF == te_form_res_rels(epi, rel_info, results, &res_rels))
+	if (UNDEF
+			== te_form_res_rels_map(epi, rel_info, results, tm->rel_map,
+					&res_rels))
 		return (UNDEF);
 
 	p = 1.0;
 	err = 0.0;
+	if (res_rels.num_rel_levels <= 2) {
+		/* Only relevance levels 0 and 1: relevant docs have gain 1/2, and
+		 the others leave err and p unchanged */
+		for (r = 0; r < res_rels.num_ret; r++) {
+			if (1 == res_rels.results_rel_list[r]) {
+				err += p * 0.5 / (double) (r + 1);
+				p *= 0.5;
+			}
+		}
+		eval->values[tm->eval_index].value = err;
+		return (1);
+	}
 	for (r = 0; r < res_rels.num_ret; r++) {
 		gain = compute_gain(res_rels.results_rel_list[r],
 				res_rels.num_rel_levels);
@@ -11,9 +11,8 @@
 #include "functions.h"
 #include "trec_format.h"
 
-static int
-te_calc_err45(const EPI *epi, const REL_INFO *rel_info, const RESULTS *results,
-		const TREC_MEAS *tm, TREC_EVAL *eval);
+extern TREC_MEAS te_meas_err;
+extern REL_MAP te_rel_map_45;
 
 /* See trec_eval.h for definition of TREC_MEAS */
 TREC_MEAS te_meas_err45 =
@@ -28,39 +27,7 @@ TREC_MEAS te_meas_err45 =
 		the 18th ACM Conference on Information and Knowledge Management\n\
 		(CIKM '09). ACM, New York, NY, USA, 621-630.\n\
 		DOI=http://dx.doi.org/10.1145/1645953.1646033 \n",
-				te_init_meas_s_float, te_calc_err45, te_acc_meas_s,
+				te_init_meas_s_float, te_calc_meas_base, te_acc_meas_s,
 				te_calc_avg_meas_s, te_print_single_meas_s_float,
-				te_print_final_meas_s_float, NULL, -1 };
-
-static double compute_gain(const long rel_level, const long max_rel);
-
-static int te_calc_err45(const EPI *epi, const REL_INFO *rel_info,
-		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval) {
-
-	RES_RELS res_rels;
-	double p;
-	double err;
-	double gain;
-	long r;
-
-	if (UNDEF == te_form_res_rels(epi, rel_info, results, &res_rels))
-		return (UNDEF);
-
-	p = 1.0;
-	err = 0.0;
-	for (r = 0; r < res_rels.num_ret; r++) {
-		gain = compute_gain(res_rels.results_rel_list[r],
-				res_rels.num_rel_levels);
-		err += p * gain / (double) (r + 1);
-		p *= 1.0 - gain;
-	}
-	eval->values[tm->eval_index].value = err;
-
-	return (1);
-
-}
-
-static inline double compute_gain(const long rel_level, const long max_rel) {
-	return rel_level > 3 ?
-			(pow(2.0, rel_level - 3) - 1.0) / pow(2.0, (max_rel - 1)) : 0.0;
-}
+				te_print_final_meas_s_float, NULL, -1,
+				&te_meas_err, &te_rel_map_45 };
@@ -34,7 +34,7 @@ TREC_MEAS te_meas_ndcg =
     Based on an implementation by Ian Soboroff\n",
 				te_init_meas_s_float_p_pair, te_calc_ndcg, te_acc_meas_s,
 				te_calc_avg_meas_s, te_print_single_meas_s_float,
-				te_print_final_meas_s_float_p, &default_ndcg_gains, -1 };
+				te_print_final_meas_ndcg, &default_ndcg_gains, -1 };
 
 /* Keep track of valid rel_levels and associated gains */
 /* Initialized in setup_gains */
@@ -51,9 +51,22 @@ typedef struct {
 } GAINS;
 
 static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
-		GAINS *gains);
+		const REL_MAP *gain_map, GAINS *gains);
 static double get_gain(const long rel_level, const GAINS *gains);
 static int comp_rel_gain();
+static int calc_ndcg_binary(const RES_RELS *res_rels, const TREC_MEAS *tm,
+		TREC_EVAL *eval);
+
+/* Discount 1/log2(i+2) of the doc at rank i+1, and the DCG of i+1 docs of
+ gain 1 (the ideal DCG with binary relevance).  Kept across queries, and
+ freed with the summary of any measure calculated by ndcg */
+typedef struct {
+	double discount;
+	double ideal_dcg;
+} DISCOUNT;
+static TE_THREAD DISCOUNT *discounts = NULL;
+static TE_THREAD long num_discounts = 0;
+static TE_THREAD long max_discounts = 0;
 
 static int te_calc_ndcg(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval) {
@@ -64,12 +77,30 @@ static int te_calc_ndcg(const EPI *epi, const REL_INFO *rel_info,
 	long cur_lvl, lvl_count;
 	long i;
 	GAINS gains;
+	const REL_MAP *rel_map = tm->rel_map;
+	const REL_MAP *gain_map = NULL;
 
-	if (UNDEF == te_form_res_rels(epi, rel_info, results, &res_rels)) {
+	/* Gains given as parameters name judged levels, so a measure mapping
+	 relevance levels (eg ndcg45) with some then works on the judged
+	 levels, its mapping giving only the default gains of the others */
+	if (rel_map && tm->meas_params && tm->meas_params->num_params) {
+		gain_map = rel_map;
+		rel_map = NULL;
+	}
+	if (UNDEF
+			== te_form_res_rels_map(epi, rel_info, results, rel_map,
+					&res_rels)) {
 		return (UNDEF);
 	}
 
-	if (UNDEF == setup_gains(tm, &res_rels, &gains)) {
+	/* Only relevance levels 0 and 1 with default gains (and no tracing):
+	 use the closed form */
+	if (res_rels.num_rel_levels <= 2
+			&& (NULL == tm->meas_params || 0 == tm->meas_params->num_params)
+			&& 0 == epi->debug_level)
+		return (calc_ndcg_binary(&res_rels, tm, eval));
+
+	if (UNDEF == setup_gains(tm, &res_rels, gain_map, &gains)) {
 		return (UNDEF);
 	}
 
@@ -142,8 +173,45 @@ static int te_calc_ndcg(const EPI *epi, const REL_INFO *rel_info,
 
 }
 
+static int calc_ndcg_binary(const RES_RELS *res_rels, const TREC_MEAS *tm,
+		TREC_EVAL *eval) {
+	long num_rel = res_rels->num_rel_levels > 1 ? res_rels->rel_levels[1] : 0;
+	long needed = MAX(num_rel, res_rels->num_ret);
+	double results_dcg;
+	long i;
+
+	if (0 == num_rel)
+		return (1);
+
+	if (needed > num_discounts) {
+		if (NULL
+				== (discounts = te_chk_and_realloc(discounts, &max_discounts,
+						needed, sizeof(DISCOUNT))))
+			return (UNDEF);
+		for (i = num_discounts; i < needed; i++) {
+			discounts[i].discount = 1.0 / log2((double) (i + 2));
+			discounts[i].ideal_dcg = discounts[i].discount;
+			if (i > 0)
+				discounts[i].ideal_dcg = discounts[i - 1].ideal_dcg
+						+ discounts[i].discount;
+		}
+		num_discounts = needed;
+	}
+
+	results_dcg = 0.0;
+	for (i = 0; i < res_rels->num_ret; i++) {
+		if (1 == res_rels->results_rel_list[i])
+			results_dcg += discounts[i].discount;
+	}
+	eval->values[tm->eval_index].value = results_dcg
+			/ discounts[num_rel - 1].ideal_dcg;
+	return (1);
+}
+
+/* Gains of the levels of res_rels: those given as parameters, else the
+ level as mapped by gain_map (the level itself if NULL) */
 static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
-		GAINS *gains) {
+		const REL_MAP *gain_map, GAINS *gains) {
 
 	FLOAT_PARAM_PAIR *pairs = NULL;
 	long num_pairs = 0;
@@ -177,7 +245,8 @@ static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
 		} else {
 			/* Not included in list of parameters. New gain level */
 			gains->rel_gains[num_gains].rel_level = i;
-			gains->rel_gains[num_gains].gain = (double) i;
+			gains->rel_gains[num_gains].gain = (double) te_map_rel(gain_map,
+					i);
 			gains->rel_gains[num_gains].num_at_level = res_rels->rel_levels[i];
 			num_gains++;
 		}
@@ -210,3 +279,13 @@ static double get_gain(const long rel_level, const GAINS *gains) {
 	return (0.0); /* Print Error ?? */
 }
 
+
+int te_print_final_meas_ndcg(const EPI *epi, TREC_MEAS *tm, TREC_EVAL *eval) {
+	if (max_discounts > 0) {
+		Free(discounts);
+		discounts = NULL;
+		max_discounts = 0;
+		num_discounts = 0;
+	}
+	return (te_print_final_meas_s_float_p(epi, tm, eval));
+}
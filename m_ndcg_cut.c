@@ -44,7 +44,9 @@ static int te_calc_ndcg_cut(const EPI *epi, const REL_INFO *rel_info,
 	long cur_lvl, lvl_count;
 	long i;
 
-	if (UNDEF == te_form_res_rels(epi, rel_info, results, &res_rels)) {
+	if (UNDEF
+			== te_form_res_rels_map(epi, rel_info, results, tm->rel_map,
+					&res_rels)) {
 		return (UNDEF);
 	}
 
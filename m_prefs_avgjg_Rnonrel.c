@@ -152,9 +152,9 @@ static void recalculate(const JG *jg, const long num_judged_ret,
 		 to the code in form_prefs_count for now */
 		long i, j;
 		long first_discarded_nonrel;
-		unsigned char **a = jg->prefs_array.array;
+		const PREFS_ARRAY *a = &jg->prefs_array;
 		long num_nonrel_seen = 0;
-		long num_judged = jg->prefs_array.num_judged;
+		long num_judged = a->num_judged;
 
 		for (i = 0; i < num_judged; i++) {
 			if (jg->rel_array[i] == 0.0) {
@@ -165,49 +165,49 @@ static void recalculate(const JG *jg, const long num_judged_ret,
 		}
 		first_discarded_nonrel = i;
 
-		for (i = 0; i < num_judged_ret; i++) {
+		for (i = 0; i < a->num_judged_ret; i++) {
 			if (i >= first_discarded_nonrel && jg->rel_array[i] == 0.0)
 				continue;
 			for (j = 0; j < i; j++) {
 				if (j >= first_discarded_nonrel && jg->rel_array[j] == 0.0)
 					continue;
-				if (a[i][j]) {
+				if (PA_BIT(a, i, j)) {
 					/* Pref not fulfilled.  Area A2 (see comment at top) */
 					num_poss++;
 				}
 			}
-			for (j = i + 1; j < num_judged_ret; j++) {
+			for (j = i + 1; j < a->num_judged_ret; j++) {
 				if (j >= first_discarded_nonrel && jg->rel_array[j] == 0.0)
 					continue;
-				if (a[i][j]) {
+				if (PA_BIT(a, i, j)) {
 					/* Pref fulfilled.  Area A1 (see comment at top) */
 					num_ful++;
 				}
 			}
-			for (j = num_judged_ret; j < num_judged; j++) {
+			for (j = a->num_judged_ret; j < num_judged; j++) {
 				if (j >= first_discarded_nonrel && jg->rel_array[j] == 0.0)
 					continue;
-				if (a[i][j]) {
+				if (PA_BIT(a, i, j)) {
 					/* Pref fulfilled implied.  Area A3 (see comment at top) */
 					num_ful++;
 				}
 			}
 		}
-		for (i = num_judged_ret; i < num_judged; i++) {
+		for (i = a->num_judged_ret; i < num_judged; i++) {
 			if (i >= first_discarded_nonrel && jg->rel_array[i] == 0.0)
 				continue;
-			for (j = 0; j < num_judged_ret; j++) {
+			for (j = 0; j < a->num_judged_ret; j++) {
 				if (j >= first_discarded_nonrel && jg->rel_array[j] == 0.0)
 					continue;
-				if (a[i][j]) {
+				if (PA_BIT(a, i, j)) {
 					/* Pref not fulfilled implied.  Area A4 (see comment at top) */
 					num_poss++;
 				}
 			}
-			for (j = num_judged_ret; j < num_judged; j++) {
+			for (j = a->num_judged_ret; j < num_judged; j++) {
 				if (j >= first_discarded_nonrel && jg->rel_array[j] == 0.0)
 					continue;
-				if (a[i][j]) {
+				if (PA_BIT(a, i, j)) {
 					/* Pref not occur at all.  Area A5 (see comment at top) */
 					num_poss++;
 				}
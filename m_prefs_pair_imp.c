@@ -35,32 +35,29 @@ TREC_MEAS te_meas_prefs_pair_imp =
 static int te_calc_prefs_pair_imp(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval) {
 	RESULTS_PREFS rp;
-	long i, j;
+	PREF_COUNT *pc;
+	long p;
 	double sum = 0;
 	long num_pairs = 0;
 
-	if (UNDEF == form_prefs_counts(epi, rel_info, results, &rp))
+	if (UNDEF == form_prefs_pair_counts(epi, rel_info, results, &rp))
 		return (UNDEF);
 
-	for (i = 0; i < rp.num_judged_ret; i++) {
-		for (j = i + 1; j < rp.num_judged_ret; j++) {
-			if (rp.pref_counts.array[i][j] || rp.pref_counts.array[j][i]) {
-				num_pairs++;
-				sum += (double) rp.pref_counts.array[i][j]
-						/ (double) (rp.pref_counts.array[i][j]
-								+ rp.pref_counts.array[j][i]);
-			}
+	/* Pairs with both docs retrieved */
+	for (p = 0; p < rp.pref_counts.num_pairs; p++) {
+		pc = &rp.pref_counts.pairs[p];
+		if (pc->doc2 < rp.num_judged_ret) {
+			num_pairs++;
+			sum += (double) pc->count12 / (double) (pc->count12 + pc->count21);
 		}
 	}
 
-	for (i = 0; i < rp.num_judged_ret; i++) {
-		for (j = rp.num_judged_ret; j < rp.num_judged; j++) {
-			if (rp.pref_counts.array[i][j] || rp.pref_counts.array[j][i]) {
-				num_pairs++;
-				sum += (double) rp.pref_counts.array[i][j]
-						/ (double) (rp.pref_counts.array[i][j]
-								+ rp.pref_counts.array[j][i]);
-			}
+	/* Pairs with only doc1 retrieved */
+	for (p = 0; p < rp.pref_counts.num_pairs; p++) {
+		pc = &rp.pref_counts.pairs[p];
+		if (pc->doc1 < rp.num_judged_ret && pc->doc2 >= rp.num_judged_ret) {
+			num_pairs++;
+			sum += (double) pc->count12 / (double) (pc->count12 + pc->count21);
 		}
 	}
 
@@ -51,9 +51,11 @@ typedef struct {
 } GAINS;
 
 static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
-		GAINS *gains);
+		const REL_MAP *gain_map, GAINS *gains);
 static double get_gain(const long rel_level, const GAINS *gains);
 static int comp_rel_gain();
+static int calc_qm_binary(const RES_RELS *res_rels, const TREC_MEAS *tm,
+		TREC_EVAL *eval);
 
 static int te_calc_qm(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval) {
@@ -65,16 +67,33 @@ static int te_calc_qm(const EPI *epi, const REL_INFO *rel_info,
 	double q_measure = 0.0;
 	double cg = 0.0;
 	GAINS gains;
+	const REL_MAP *rel_map = tm->rel_map;
+	const REL_MAP *gain_map = NULL;
 	double *cgi;
 	double max_cgi;
 	long total = 0.0;
 	double gain;
 
-	if (UNDEF == te_form_res_rels(epi, rel_info, results, &res_rels)) {
+	/* Gains given as parameters name judged levels, so a measure mapping
+	 relevance levels (eg ndcg45) with some then works on the judged
+	 levels, its mapping giving only the default gains of the others */
+	if (rel_map && tm->meas_params && tm->meas_params->num_params) {
+		gain_map = rel_map;
+		rel_map = NULL;
+	}
+	if (UNDEF
+			== te_form_res_rels_map(epi, rel_info, results, rel_map,
+					&res_rels)) {
 		return (UNDEF);
 	}
 
-	if (UNDEF == setup_gains(tm, &res_rels, &gains)) {
+	/* Only relevance levels 0 and 1 with default gains: the ideal
+	 cumulative gain at rank i is just i, so no cgi array is needed */
+	if (res_rels.num_rel_levels <= 2
+			&& (NULL == tm->meas_params || 0 == tm->meas_params->num_params))
+		return (calc_qm_binary(&res_rels, tm, eval));
+
+	if (UNDEF == setup_gains(tm, &res_rels, gain_map, &gains)) {
 		return (UNDEF);
 	}
 
@@ -132,8 +151,32 @@ static int te_calc_qm(const EPI *epi, const REL_INFO *rel_info,
 
 }
 
+static int calc_qm_binary(const RES_RELS *res_rels, const TREC_MEAS *tm,
+		TREC_EVAL *eval) {
+	long total = res_rels->num_rel_levels > 1 ? res_rels->rel_levels[1] : 0;
+	long rel_so_far = 0;
+	double q_measure = 0.0;
+	long i;
+
+	if (!total) {
+		eval->values[tm->eval_index].value = 0.0;
+		return (1);
+	}
+	for (i = 0; i < res_rels->num_ret; i++) {
+		if (1 == res_rels->results_rel_list[i]) {
+			rel_so_far++;
+			q_measure += (double) (2 * rel_so_far)
+					/ (i + 1 + (double) (i >= total ? total : i + 1));
+		}
+	}
+	eval->values[tm->eval_index].value = q_measure / (double) total;
+	return (1);
+}
+
+/* Gains of the levels of res_rels: those given as parameters, else the
+ level as mapped by gain_map (the level itself if NULL) */
 static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
-		GAINS *gains) {
+		const REL_MAP *gain_map, GAINS *gains) {
 
 	FLOAT_PARAM_PAIR *pairs = NULL;
 	long num_pairs = 0;
@@ -167,7 +210,8 @@ static int setup_gains(const TREC_MEAS *tm, const RES_RELS *res_rels,
 		} else {
 			/* Not included in list of parameters. New gain level */
 			gains->rel_gains[num_gains].rel_level = i;
-			gains->rel_gains[num_gains].gain = (double) i;
+			gains->rel_gains[num_gains].gain = (double) te_map_rel(gain_map,
+					i);
 			gains->rel_gains[num_gains].num_at_level = res_rels->rel_levels[i];
 			num_gains++;
 		}
@@ -52,7 +52,9 @@ static int te_calc_qm_cut(const EPI *epi, const REL_INFO *rel_info,
 	double gain;
 	long total = 0.0;
 
-	if (UNDEF == te_form_res_rels(epi, rel_info, results, &res_rels)) {
+	if (UNDEF
+			== te_form_res_rels_map(epi, rel_info, results, tm->rel_map,
+					&res_rels)) {
 		return (UNDEF);
 	}
 
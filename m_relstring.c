@@ -14,8 +14,8 @@
 static double relstring_len[] = { 10.0 };
 static PARAMS default_relstring_params = { NULL, 1, &relstring_len[0] };
 
-static char *current_string;
-static long string_len = 0;
+static TE_THREAD char *current_string;
+static TE_THREAD long string_len = 0;
 
 static int te_calc_relstring(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval);
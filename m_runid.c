@@ -23,7 +23,7 @@ TREC_MEAS te_meas_runid = { "runid", "    Runid given by results input file.\n",
 		te_calc_avg_meas_empty, te_print_single_meas_empty, te_print_runid,
 		NULL, -1 };
 
-static char *runid;
+static TE_THREAD char *runid;
 static int te_calc_runid(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval) {
 	runid = results->run_id;
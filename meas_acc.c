@@ -20,8 +20,13 @@
  ...
  } TREC_MEAS;
  Measures are defined in measures.c.
+ Measures that only aggregate the per-query values of another measure
+ differently (eg, gm_map over map) use te_calc_meas_base as calc_meas,
+ and one of the _gm accumulators here.
  */
 
+static long base_values_index(const EPI *epi, const TREC_MEAS *tm);
+
 /* ---------------- Acc measure generic procedures -------------- */
 
 /* Measure does not require accumulation */
@@ -49,3 +54,66 @@ int te_acc_meas_a_cut(const EPI *epi, const TREC_MEAS *tm,
 	}
 	return (1);
 }
+
+/* Measure is a single value accumulated as the log of the value, to be
+ averaged with geometric mean */
+int te_acc_meas_s_gm(const EPI *epi, const TREC_MEAS *tm,
+		const TREC_EVAL *q_eval, TREC_EVAL *accum_eval) {
+	accum_eval->values[tm->eval_index].value += log(
+			MAX(q_eval->values[base_values_index(epi, tm)].value, MIN_GEO_MEAN));
+	return (1);
+}
+
+/* Measure is an array with cutoffs, each accumulated as the log of the
+ value, to be averaged with geometric mean */
+int te_acc_meas_a_cut_gm(const EPI *epi, const TREC_MEAS *tm,
+		const TREC_EVAL *q_eval, TREC_EVAL *accum_eval) {
+	long index = base_values_index(epi, tm);
+	long i;
+
+	for (i = 0; i < tm->meas_params->num_params; i++) {
+		accum_eval->values[tm->eval_index + i].value += log(
+				MAX(q_eval->values[index + i].value, MIN_GEO_MEAN));
+	}
+	return (1);
+}
+
+/* ---------------- Calc measure from base measure -------------- */
+
+/* Calculate the per-query values of tm->base_meas, using the parameters,
+ relevance mapping and value space of tm.  Nothing is calculated if
+ base_meas is itself being calculated with the same parameters: the
+ accumulator reads its values instead (all measures of a query are
+ calculated before any are accumulated) */
+int te_calc_meas_base(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, const TREC_MEAS *tm, TREC_EVAL *eval) {
+	TREC_MEAS base;
+
+	if (base_values_index(epi, tm) != tm->eval_index)
+		return (1);
+	base = *tm->base_meas;
+	base.meas_params = tm->meas_params;
+	base.rel_map = tm->rel_map;
+	base.eval_index = tm->eval_index;
+	return (base.calc_meas(epi, rel_info, results, &base, eval));
+}
+
+/* Index within the query TREC_EVAL of the per-query values tm aggregates.
+ Values of base_meas are shared unless its parameters or relevance mapping
+ differ, or they get converted to Z scores before accumulation */
+static long base_values_index(const EPI *epi, const TREC_MEAS *tm) {
+	const TREC_MEAS *base = tm->base_meas;
+	char *params, *base_params;
+
+	if (NULL == base || !MEASURE_REQUESTED(base) || epi->zscore_flag
+			|| tm->rel_map != base->rel_map)
+		return (tm->eval_index);
+	params = tm->meas_params ? tm->meas_params->printable_params : NULL;
+	base_params =
+			base->meas_params ? base->meas_params->printable_params : NULL;
+	if (params != base_params
+			&& (NULL == params || NULL == base_params
+					|| strcmp(params, base_params)))
+		return (tm->eval_index);
+	return (base->eval_index);
+}
@@ -77,3 +77,27 @@ int te_calc_avg_meas_s_gm(const EPI *epi, const TREC_MEAS *tm,
 	return (1);
 }
 
+
+/* Measure is an array of values (one per cutoff) to be averaged with
+ geometric mean */
+int te_calc_avg_meas_a_cut_gm(const EPI *epi, const TREC_MEAS *tm,
+		const ALL_REL_INFO *all_rel_info, TREC_EVAL *accum_eval) {
+	double sum;
+	long num_queries = accum_eval->num_queries;
+	long i;
+	if (epi->average_complete_flag)
+		num_queries = all_rel_info->num_q_rels;
+
+	if (num_queries > 0) {
+		for (i = 0; i < tm->meas_params->num_params; i++) {
+			sum = accum_eval->values[tm->eval_index + i].value;
+			if (epi->average_complete_flag)
+				/* Patch up averages for any missing queries */
+				sum += (num_queries - accum_eval->num_queries)
+						* log(MIN_GEO_MEAN);
+			accum_eval->values[tm->eval_index + i].value = exp(
+					(double) (sum / num_queries));
+		}
+	}
+	return (1);
+}
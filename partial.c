@@ -0,0 +1,436 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "trec_format.h"
+#include "functions.h"
+
+/* Partial accumulator files, for evaluating a run in shards (--emit-partial)
+ and printing the summary of all shards afterwards (--merge).
+
+ Every measure accumulates by summing a per-query contribution into the
+ summary TREC_EVAL (the value itself, or its log for gm_* measures).  A
+ partial file holds those contributions per query rather than their sum,
+ so that merging can add them up in qid order, exactly as a single
+ process reading the whole results file would have done.  It also holds
+ the qids (and number of relevant docs) of the rel info the shard was
+ evaluated against, needed to average over the complete rel info (-c).
+
+ Format, binary in native byte order and sizes:
+ string   PARTIAL_MAGIC
+ long     num_values, followed by num_values strings (value names)
+ then, in any order, for each query evaluated:
+ long     PARTIAL_QUERY
+ string   qid
+ double   num_values contributions
+ and for each rel info query:
+ long     PARTIAL_REL_INFO
+ string   qid
+ string   rel_format
+ long     num_rel (-1 unless rel_format is qrels or qrels_jg)
+ and finally
+ long     PARTIAL_END
+ string   runid (empty if none)
+
+ where a string is a long length followed by that many chars and a NUL.
+ */
+
+#define PARTIAL_MAGIC "rec_eval partial 1"
+#define PARTIAL_END 0
+#define PARTIAL_QUERY 1
+#define PARTIAL_REL_INFO 2
+
+/* Query contributions while merging, pointing into a file buffer */
+typedef struct {
+	char *qid;
+	char *values; /* num_values doubles, not necessarily aligned */
+} PARTIAL_Q;
+
+/* Rel info query while merging */
+typedef struct {
+	char *qid;
+	char *rel_format;
+	long num_rel;
+} PARTIAL_REL;
+
+static int put_long(long l);
+static int put_string(const char *s);
+static long count_num_rel(const REL_INFO *rel_info);
+static int get_partial_file(const char *partial_file, char *ptr, char *end,
+		const TREC_EVAL *accum_eval, char **run_id);
+static int malformed(const char *partial_file);
+static int get_long(char **ptr, char *end, long *l);
+static int get_string(char **ptr, char *end, char **s);
+static int comp_partial_q();
+static int comp_partial_rel();
+
+/* Partial file being written */
+static FILE *partial_fd = NULL;
+static const char *partial_name = NULL;
+
+/* static pools of memory for merged partials, freed in cleanup */
+static char **partial_bufs = NULL;
+static long num_partial_bufs = 0;
+static REL_INFO *rel_info_pool = NULL;
+static TEXT_QRELS_INFO *text_qrels_info_pool = NULL;
+static TEXT_QRELS *text_qrels_pool = NULL;
+
+/* Queries and rel info queries of all partials being merged */
+static PARTIAL_Q *qs = NULL;
+static long num_qs, max_num_qs;
+static PARTIAL_REL *rels = NULL;
+static long num_rels, max_num_rels;
+
+/* Start partial_file, for summary values laid out as in accum_eval */
+int te_put_partial_open(const EPI *epi, const char *partial_file,
+		const TREC_EVAL *accum_eval) {
+	long i;
+
+	partial_name = partial_file;
+	if (NULL == (partial_fd = fopen(partial_file, "wb"))) {
+		fprintf(stderr,
+				"rec_eval.put_partial: Cannot create partial file '%s'\n",
+				partial_file);
+		return (UNDEF);
+	}
+	if (UNDEF == put_string(PARTIAL_MAGIC)
+			|| UNDEF == put_long(accum_eval->num_values))
+		return (UNDEF);
+	for (i = 0; i < accum_eval->num_values; i++) {
+		if (UNDEF == put_string(accum_eval->values[i].name))
+			return (UNDEF);
+	}
+	return (1);
+}
+
+/* Add the contributions q_acc->values of query q_acc->qid */
+int te_put_partial_query(const EPI *epi, const TREC_EVAL *q_acc) {
+	long i;
+
+	if (UNDEF == put_long(PARTIAL_QUERY) || UNDEF == put_string(q_acc->qid))
+		return (UNDEF);
+	for (i = 0; i < q_acc->num_values; i++) {
+		if (1 != fwrite(&q_acc->values[i].value, sizeof(double), 1,
+						partial_fd))
+			return (UNDEF);
+	}
+	return (1);
+}
+
+/* Add the queries of all_rel_info the evaluation was against */
+int te_put_partial_rel_info(const EPI *epi, const ALL_REL_INFO *all_rel_info) {
+	long i;
+
+	for (i = 0; i < all_rel_info->num_q_rels; i++) {
+		if (UNDEF == put_long(PARTIAL_REL_INFO)
+				|| UNDEF == put_string(all_rel_info->rel_info[i].qid)
+				|| UNDEF == put_string(all_rel_info->rel_info[i].rel_format)
+				|| UNDEF == put_long(count_num_rel(&all_rel_info->rel_info[i])))
+			return (UNDEF);
+	}
+	return (1);
+}
+
+/* Finish the partial file with the run's runid */
+int te_put_partial_close(const EPI *epi, const char *run_id) {
+	if (UNDEF == put_long(PARTIAL_END)
+			|| UNDEF == put_string(run_id ? run_id : "")) {
+		(void) fclose(partial_fd);
+		partial_fd = NULL;
+		return (UNDEF);
+	}
+	if (0 != fclose(partial_fd)) {
+		partial_fd = NULL;
+		fprintf(stderr, "rec_eval.put_partial: Cannot write partial file '%s'\n",
+				partial_name);
+		return (UNDEF);
+	}
+	partial_fd = NULL;
+	return (1);
+}
+
+/* Number of relevant docs in rel_info, counted as m_num_rel does */
+static long count_num_rel(const REL_INFO *rel_info) {
+	long num_rel = 0;
+	long j, k;
+
+	if (0 == strcmp("qrels", rel_info->rel_format)) {
+		TEXT_QRELS_INFO *trec_qrels = (TEXT_QRELS_INFO *) rel_info->q_rel_info;
+		for (j = 0; j < trec_qrels->num_text_qrels; j++) {
+			if (trec_qrels->text_qrels[j].rel > 0)
+				num_rel++;
+		}
+	} else if (0 == strcmp("qrels_jg", rel_info->rel_format)) {
+		TEXT_QRELS_JG_INFO *trec_qrels =
+				(TEXT_QRELS_JG_INFO *) rel_info->q_rel_info;
+		for (j = 0; j < trec_qrels->num_text_qrels_jg; j++) {
+			for (k = 0; k < trec_qrels->text_qrels_jg[j].num_text_qrels; k++) {
+				if (trec_qrels->text_qrels_jg[j].text_qrels[k].rel > 0)
+					num_rel++;
+			}
+		}
+	} else
+		return (-1);
+	return (num_rel);
+}
+
+static int put_long(long l) {
+	if (1 != fwrite(&l, sizeof(long), 1, partial_fd))
+		return (UNDEF);
+	return (1);
+}
+
+static int put_string(const char *s) {
+	long len = strlen(s);
+
+	if (UNDEF == put_long(len)
+			|| 1 != fwrite(s, (size_t) len + 1, 1, partial_fd))
+		return (UNDEF);
+	return (1);
+}
+
+/* Merge the num_partial_files partial_files into accum_eval (already
+ initialized with the measures the partials were emitted with).  The
+ rel info queries of all partials are returned in all_rel_info, in a form
+ good enough for averaging (number of queries and relevant docs), and
+ the runid of the first partial giving one in run_id */
+int te_get_partials(const EPI *epi, char **partial_files,
+		long num_partial_files, TREC_EVAL *accum_eval,
+		ALL_REL_INFO *all_rel_info, char **run_id) {
+	int fd;
+	off_t size;
+	long f, i, j, n, num_text_qrels;
+	double value;
+
+	num_qs = max_num_qs = num_rels = max_num_rels = 0;
+	*run_id = NULL;
+	if (NULL == (partial_bufs = Malloc(num_partial_files, char *)))
+		return (UNDEF);
+
+	for (f = 0; f < num_partial_files; f++) {
+		/* Read entire file into memory */
+		if (-1 == (fd = open(partial_files[f], 0))
+				|| 0 >= (size = lseek(fd, 0L, 2))
+				|| NULL == (partial_bufs[f] = malloc((size_t) size))
+				|| -1 == lseek(fd, 0L, 0)
+				|| size != read(fd, partial_bufs[f], (size_t) size)
+				|| -1 == close(fd)) {
+			fprintf(stderr,
+					"rec_eval.get_partials: Cannot read partial file '%s'\n",
+					partial_files[f]);
+			return (UNDEF);
+		}
+		num_partial_bufs = f + 1;
+		if (UNDEF
+				== get_partial_file(partial_files[f], partial_bufs[f],
+						partial_bufs[f] + size, accum_eval, run_id))
+			return (UNDEF);
+	}
+
+	/* Sum query contributions in qid order, the order results are
+	 evaluated in */
+	qsort((char *) qs, (int) num_qs, sizeof(PARTIAL_Q), comp_partial_q);
+	for (i = 0; i < num_qs; i++) {
+		if (i > 0 && 0 == strcmp(qs[i - 1].qid, qs[i].qid)) {
+			fprintf(stderr,
+					"rec_eval.get_partials: Query '%s' is in more than one partial file\n",
+					qs[i].qid);
+			return (UNDEF);
+		}
+		for (j = 0; j < accum_eval->num_values; j++) {
+			(void) memcpy(&value, qs[i].values + j * sizeof(double),
+					sizeof(double));
+			accum_eval->values[j].value += value;
+		}
+	}
+	accum_eval->num_queries += num_qs;
+
+	/* Union of the rel info queries.  Shards may share rel info */
+	qsort((char *) rels, (int) num_rels, sizeof(PARTIAL_REL),
+			comp_partial_rel);
+	n = 0;
+	num_text_qrels = 0;
+	for (i = 0; i < num_rels; i++) {
+		if (n > 0 && 0 == strcmp(rels[n - 1].qid, rels[i].qid))
+			continue;
+		rels[n] = rels[i];
+		if (rels[n].num_rel > 0)
+			num_text_qrels += rels[n].num_rel;
+		n++;
+	}
+	num_rels = n;
+
+	/* Rel info queries from qrels formats get one relevant judgement per
+	 relevant doc, which is all that averaging looks at */
+	if (NULL == (rel_info_pool = Malloc(num_rels, REL_INFO))
+			|| NULL
+					== (text_qrels_info_pool = Malloc(num_rels, TEXT_QRELS_INFO))
+			|| NULL == (text_qrels_pool = Malloc(num_text_qrels, TEXT_QRELS)))
+		return (UNDEF);
+	for (i = 0; i < num_text_qrels; i++) {
+		text_qrels_pool[i].docno = "";
+		text_qrels_pool[i].rel = 1;
+	}
+	num_text_qrels = 0;
+	for (i = 0; i < num_rels; i++) {
+		rel_info_pool[i].qid = rels[i].qid;
+		if (rels[i].num_rel < 0) {
+			rel_info_pool[i].rel_format = rels[i].rel_format;
+			rel_info_pool[i].q_rel_info = NULL;
+			continue;
+		}
+		rel_info_pool[i].rel_format = "qrels";
+		rel_info_pool[i].q_rel_info = &text_qrels_info_pool[i];
+		text_qrels_info_pool[i].num_text_qrels = rels[i].num_rel;
+		text_qrels_info_pool[i].max_num_text_qrels = rels[i].num_rel;
+		text_qrels_info_pool[i].text_qrels = &text_qrels_pool[num_text_qrels];
+		num_text_qrels += rels[i].num_rel;
+	}
+	all_rel_info->num_q_rels = num_rels;
+	all_rel_info->max_num_q_rels = num_rels;
+	all_rel_info->rel_info = rel_info_pool;
+	return (1);
+}
+
+/* Parse the partial file partial_file held in [ptr, end), adding its
+ queries to qs and its rel info queries to rels */
+static int get_partial_file(const char *partial_file, char *ptr, char *end,
+		const TREC_EVAL *accum_eval, char **run_id) {
+	char *str;
+	long i, n, type;
+
+	/* Header must match the measures being merged */
+	if (UNDEF == get_string(&ptr, end, &str) || strcmp(str, PARTIAL_MAGIC)) {
+		fprintf(stderr, "rec_eval.get_partials: '%s' is not a partial file\n",
+				partial_file);
+		return (UNDEF);
+	}
+	if (UNDEF == get_long(&ptr, end, &n))
+		return (malformed(partial_file));
+	if (n != accum_eval->num_values) {
+		fprintf(stderr,
+				"rec_eval.get_partials: Partial file '%s' has different measures\n",
+				partial_file);
+		return (UNDEF);
+	}
+	for (i = 0; i < n; i++) {
+		if (UNDEF == get_string(&ptr, end, &str))
+			return (malformed(partial_file));
+		if (strcmp(str, accum_eval->values[i].name)) {
+			fprintf(stderr,
+					"rec_eval.get_partials: Partial file '%s' has measure '%s' instead of '%s'\n",
+					partial_file, str, accum_eval->values[i].name);
+			return (UNDEF);
+		}
+	}
+
+	/* Queries and rel info queries */
+	while (1) {
+		if (UNDEF == get_long(&ptr, end, &type))
+			return (malformed(partial_file));
+		if (PARTIAL_END == type)
+			break;
+		if (PARTIAL_QUERY == type) {
+			if (NULL
+					== (qs = te_chk_and_realloc(qs, &max_num_qs, num_qs + 1,
+							sizeof(PARTIAL_Q))))
+				return (UNDEF);
+			if (UNDEF == get_string(&ptr, end, &qs[num_qs].qid)
+					|| (size_t) (end - ptr) < n * sizeof(double))
+				return (malformed(partial_file));
+			qs[num_qs].values = ptr;
+			ptr += n * sizeof(double);
+			num_qs++;
+		} else if (PARTIAL_REL_INFO == type) {
+			if (NULL
+					== (rels = te_chk_and_realloc(rels, &max_num_rels,
+							num_rels + 1, sizeof(PARTIAL_REL))))
+				return (UNDEF);
+			if (UNDEF == get_string(&ptr, end, &rels[num_rels].qid)
+					|| UNDEF
+							== get_string(&ptr, end, &rels[num_rels].rel_format)
+					|| UNDEF == get_long(&ptr, end, &rels[num_rels].num_rel))
+				return (malformed(partial_file));
+			num_rels++;
+		} else
+			return (malformed(partial_file));
+	}
+
+	if (UNDEF == get_string(&ptr, end, &str) || ptr != end)
+		return (malformed(partial_file));
+	if (NULL == *run_id && *str)
+		*run_id = str;
+	return (1);
+}
+
+static int malformed(const char *partial_file) {
+	fprintf(stderr, "rec_eval.get_partials: Malformed partial file '%s'\n",
+			partial_file);
+	return (UNDEF);
+}
+
+static int get_long(char **ptr, char *end, long *l) {
+	if ((size_t) (end - *ptr) < sizeof(long))
+		return (UNDEF);
+	(void) memcpy(l, *ptr, sizeof(long));
+	*ptr += sizeof(long);
+	return (1);
+}
+
+static int get_string(char **ptr, char *end, char **s) {
+	long len;
+
+	if (UNDEF == get_long(ptr, end, &len) || len < 0 || len >= end - *ptr
+			|| (*ptr)[len] != '\0')
+		return (UNDEF);
+	*s = *ptr;
+	*ptr += len + 1;
+	return (1);
+}
+
+static int comp_partial_q(const PARTIAL_Q *ptr1, const PARTIAL_Q *ptr2) {
+	return (strcmp(ptr1->qid, ptr2->qid));
+}
+
+static int comp_partial_rel(const PARTIAL_REL *ptr1, const PARTIAL_REL *ptr2) {
+	return (strcmp(ptr1->qid, ptr2->qid));
+}
+
+int te_get_partials_cleanup() {
+	long i;
+
+	for (i = 0; i < num_partial_bufs; i++)
+		Free(partial_bufs[i]);
+	if (partial_bufs != NULL) {
+		Free(partial_bufs);
+		partial_bufs = NULL;
+	}
+	num_partial_bufs = 0;
+	if (qs != NULL) {
+		Free(qs);
+		qs = NULL;
+	}
+	if (rels != NULL) {
+		Free(rels);
+		rels = NULL;
+	}
+	if (rel_info_pool != NULL) {
+		Free(rel_info_pool);
+		rel_info_pool = NULL;
+	}
+	if (text_qrels_info_pool != NULL) {
+		Free(text_qrels_info_pool);
+		text_qrels_info_pool = NULL;
+	}
+	if (text_qrels_pool != NULL) {
+		Free(text_qrels_pool);
+		text_qrels_pool = NULL;
+	}
+	return (1);
+}
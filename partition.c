@@ -0,0 +1,404 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "functions.h"
+
+/* Split a rel_info file and a results file too large to be evaluated in
+ memory (--max-memory) into partitions, each holding all the lines of a
+ range of qids, small enough to be read and evaluated in memory on its own.
+
+ All rel_info and results formats are text files with one line per
+ judgement or retrieved doc, starting with the qid.  A first streaming
+ pass over both files estimates the memory each qid needs; qids are then
+ assigned, in sorted order, to consecutive partitions of at most
+ max_memory.  Partitions cover ranges of qids rather than hash buckets so
+ that evaluating them in turn visits queries in the order a single
+ in-memory evaluation does, and per-query output comes out identical.
+ A second pass copies each line to the spill file of its partition,
+ MAX_OPEN_SPILLS partitions at a time.
+
+ Spill files go in $TMPDIR (default /tmp) and are removed by
+ te_partition_files_cleanup, or at exit if evaluation fails before that.
+ */
+
+/* Estimated memory used per input line besides its text: the parsed line
+ and its stored form, plus (for results) the sorted ranking of the query */
+#define REL_INFO_LINE_COST 64
+#define RESULTS_LINE_COST 96
+
+#define MAX_OPEN_SPILLS 64
+
+typedef struct {
+	char *qid;
+	size_t cost; /* Estimated memory needed to evaluate qid */
+	long partition;
+} PART_QID;
+
+static int scan_file(char *file, size_t line_cost, char **last_line);
+static PART_QID *lookup_qid(char *qid, long qid_len, long add_flag);
+static int spill_file(char *file, long first, long last, long results_flag,
+		FILE **spills);
+static int make_spill(char **name, FILE **fd);
+static int comp_part_qid();
+static void remove_spills_at_exit();
+
+/* Hash table of all qids (open addressing, size a power of 2) */
+static PART_QID **qid_table = NULL;
+static long max_qid_table = 0;
+static long num_qids = 0;
+
+static PARTITION *partitions_pool = NULL;
+static long num_partitions_pool = 0;
+static char *scratch_name = NULL;
+static long exit_handler_flag = 0;
+
+static char *line = NULL;
+static size_t max_line = 0;
+static char *last_line = NULL;
+static long max_last_line = 0;
+
+/* Partition rel_info_file and results_file into *num_partitions
+ partitions (in qid order) of at most max_memory bytes each (as
+ estimated; a single qid needing more gets a partition of its own).  A
+ partition's rel_info_file or results_file is NULL if it has no lines.
+ run_id is set to the runid of the last line of results_file, which is
+ the one an in-memory evaluation reports, and scratch_file to the name of
+ an empty temporary file for the caller's use */
+int te_partition_files(const EPI *epi, char *rel_info_file,
+		char *results_file, long max_memory, PARTITION **partitions,
+		long *num_partitions, char **run_id, char **scratch_file) {
+	PART_QID **sorted;
+	FILE *spills[2 * MAX_OPEN_SPILLS];
+	FILE *fd;
+	size_t partition_cost;
+	long i, p, first, last, num_fields;
+	char *ptr;
+
+	if (!exit_handler_flag) {
+		(void) atexit(remove_spills_at_exit);
+		exit_handler_flag++;
+	}
+
+	if (UNDEF == scan_file(rel_info_file, REL_INFO_LINE_COST, NULL)
+			|| UNDEF == scan_file(results_file, RESULTS_LINE_COST, &last_line))
+		return (UNDEF);
+
+	/* Assign qids in sorted order to partitions */
+	if (NULL == (sorted = Malloc(num_qids + 1, PART_QID *)))
+		return (UNDEF);
+	for (i = 0, p = 0; i < max_qid_table; i++) {
+		if (qid_table[i])
+			sorted[p++] = qid_table[i];
+	}
+	qsort((char *) sorted, (int) num_qids, sizeof(PART_QID *), comp_part_qid);
+	num_partitions_pool = 0;
+	partition_cost = 0;
+	for (i = 0; i < num_qids; i++) {
+		if (0 == i
+				|| partition_cost + sorted[i]->cost > (size_t) max_memory) {
+			num_partitions_pool++;
+			partition_cost = 0;
+		}
+		partition_cost += sorted[i]->cost;
+		sorted[i]->partition = num_partitions_pool - 1;
+	}
+	Free(sorted);
+
+	if (NULL
+			== (partitions_pool = Malloc(num_partitions_pool + 1, PARTITION)))
+		return (UNDEF);
+	for (p = 0; p < num_partitions_pool; p++) {
+		partitions_pool[p].rel_info_file = NULL;
+		partitions_pool[p].results_file = NULL;
+	}
+
+	/* Copy lines to spill files, a window of partitions at a time */
+	for (first = 0; first < num_partitions_pool; first = last) {
+		last = MIN(first + MAX_OPEN_SPILLS, num_partitions_pool);
+		for (p = first; p < last; p++) {
+			if (UNDEF
+					== make_spill(&partitions_pool[p].rel_info_file,
+							&spills[2 * (p - first)])
+					|| UNDEF
+							== make_spill(&partitions_pool[p].results_file,
+									&spills[2 * (p - first) + 1]))
+				return (UNDEF);
+		}
+		if (UNDEF == spill_file(rel_info_file, first, last, 0, spills)
+				|| UNDEF == spill_file(results_file, first, last, 1, spills))
+			return (UNDEF);
+		for (p = first; p < last; p++) {
+			for (i = 0; i < 2; i++) {
+				fd = spills[2 * (p - first) + i];
+				ptr = i ? partitions_pool[p].results_file
+						: partitions_pool[p].rel_info_file;
+				if (0 != fclose(fd)) {
+					fprintf(stderr,
+							"rec_eval.partition: Cannot write spill file '%s'\n",
+							ptr);
+					return (UNDEF);
+				}
+			}
+		}
+	}
+
+	/* Drop spill files nothing was written to */
+	for (p = 0; p < num_partitions_pool; p++) {
+		struct stat buf;
+		if (0 == stat(partitions_pool[p].rel_info_file, &buf)
+				&& 0 == buf.st_size) {
+			(void) unlink(partitions_pool[p].rel_info_file);
+			Free(partitions_pool[p].rel_info_file);
+			partitions_pool[p].rel_info_file = NULL;
+		}
+		if (0 == stat(partitions_pool[p].results_file, &buf)
+				&& 0 == buf.st_size) {
+			(void) unlink(partitions_pool[p].results_file);
+			Free(partitions_pool[p].results_file);
+			partitions_pool[p].results_file = NULL;
+		}
+	}
+
+	/* Runid is the 6th field of the last results line */
+	*run_id = NULL;
+	if (last_line) {
+		ptr = last_line;
+		for (num_fields = 0; num_fields < 6; num_fields++) {
+			while (*ptr && isspace(*ptr))
+				ptr++;
+			if ('\0' == *ptr)
+				break;
+			*run_id = ptr;
+			while (*ptr && !isspace(*ptr))
+				ptr++;
+		}
+		if (num_fields < 6)
+			*run_id = NULL;
+		else
+			*ptr = '\0';
+	}
+
+	if (UNDEF == make_spill(&scratch_name, &fd) || 0 != fclose(fd))
+		return (UNDEF);
+	*scratch_file = scratch_name;
+
+	*partitions = partitions_pool;
+	*num_partitions = num_partitions_pool;
+	return (1);
+}
+
+/* Add the estimated cost of each line of file to its qid.  If last_line,
+ a copy of the last non-blank line is kept there */
+static int scan_file(char *file, size_t line_cost, char **last_line_ptr) {
+	FILE *fd;
+	ssize_t len;
+	char *ptr, *qid;
+	PART_QID *part_qid;
+
+	if (NULL == (fd = fopen(file, "r"))) {
+		fprintf(stderr, "rec_eval.partition: Cannot read file '%s'\n", file);
+		return (UNDEF);
+	}
+	while (-1 != (len = getline(&line, &max_line, fd))) {
+		for (ptr = line; *ptr && isspace(*ptr); ptr++)
+			;
+		if ('\0' == *ptr)
+			continue;
+		for (qid = ptr; *ptr && !isspace(*ptr); ptr++)
+			;
+		if (NULL == (part_qid = lookup_qid(qid, ptr - qid, 1)))
+			return (UNDEF);
+		part_qid->cost += len + line_cost;
+		if (last_line_ptr) {
+			if (NULL
+					== (last_line = te_chk_and_malloc(last_line,
+							&max_last_line, len + 1, sizeof(char))))
+				return (UNDEF);
+			(void) strcpy(last_line, line);
+		}
+	}
+	if (ferror(fd)) {
+		fprintf(stderr, "rec_eval.partition: Cannot read file '%s'\n", file);
+		return (UNDEF);
+	}
+	(void) fclose(fd);
+	return (1);
+}
+
+/* Copy each line of file belonging to partitions first to last-1 to its
+ spill file (rel info or results, by results_flag) */
+static int spill_file(char *file, long first, long last, long results_flag,
+		FILE **spills) {
+	FILE *fd;
+	ssize_t len;
+	char *ptr, *qid;
+	PART_QID *part_qid;
+	long p;
+
+	if (NULL == (fd = fopen(file, "r"))) {
+		fprintf(stderr, "rec_eval.partition: Cannot read file '%s'\n", file);
+		return (UNDEF);
+	}
+	while (-1 != (len = getline(&line, &max_line, fd))) {
+		for (ptr = line; *ptr && isspace(*ptr); ptr++)
+			;
+		if ('\0' == *ptr)
+			continue;
+		for (qid = ptr; *ptr && !isspace(*ptr); ptr++)
+			;
+		if (NULL == (part_qid = lookup_qid(qid, ptr - qid, 0)))
+			return (UNDEF);
+		p = part_qid->partition;
+		if (p < first || p >= last)
+			continue;
+		if (EOF == fputs(line, spills[2 * (p - first) + results_flag])
+				|| (line[len - 1] != '\n'
+						&& EOF
+								== putc('\n',
+										spills[2 * (p - first) + results_flag]))) {
+			fprintf(stderr, "rec_eval.partition: Cannot write spill file\n");
+			return (UNDEF);
+		}
+	}
+	(void) fclose(fd);
+	return (1);
+}
+
+/* Entry for the qid_len chars of qid, added to the table if add_flag */
+static PART_QID *lookup_qid(char *qid, long qid_len, long add_flag) {
+	unsigned long h = 5381;
+	long i, j, old_max;
+	PART_QID **old_table;
+
+	for (i = 0; i < qid_len; i++)
+		h = h * 33 + (unsigned char) qid[i];
+
+	if (max_qid_table > 0) {
+		for (i = h & (max_qid_table - 1); qid_table[i];
+				i = (i + 1) & (max_qid_table - 1)) {
+			if (0 == strncmp(qid_table[i]->qid, qid, qid_len)
+					&& '\0' == qid_table[i]->qid[qid_len])
+				return (qid_table[i]);
+		}
+	}
+	if (!add_flag) {
+		fprintf(stderr, "rec_eval.partition: File changed while reading\n");
+		return (NULL);
+	}
+
+	/* Keep the table at most half full */
+	if (2 * (num_qids + 1) > max_qid_table) {
+		old_table = qid_table;
+		old_max = max_qid_table;
+		max_qid_table = old_max ? 2 * old_max : 1024;
+		if (NULL == (qid_table = Malloc(max_qid_table, PART_QID *)))
+			return (NULL);
+		for (i = 0; i < max_qid_table; i++)
+			qid_table[i] = NULL;
+		for (j = 0; j < old_max; j++) {
+			if (NULL == old_table[j])
+				continue;
+			h = 5381;
+			for (i = 0; old_table[j]->qid[i]; i++)
+				h = h * 33 + (unsigned char) old_table[j]->qid[i];
+			for (i = h & (max_qid_table - 1); qid_table[i];
+					i = (i + 1) & (max_qid_table - 1))
+				;
+			qid_table[i] = old_table[j];
+		}
+		if (old_max)
+			Free(old_table);
+		return (lookup_qid(qid, qid_len, add_flag));
+	}
+
+	if (NULL == (qid_table[i] = Malloc(1, PART_QID))
+			|| NULL == (qid_table[i]->qid = Malloc(qid_len + 1, char)))
+		return (NULL);
+	(void) strncpy(qid_table[i]->qid, qid, qid_len);
+	qid_table[i]->qid[qid_len] = '\0';
+	qid_table[i]->cost = 0;
+	qid_table[i]->partition = -1;
+	num_qids++;
+	return (qid_table[i]);
+}
+
+/* Create a new empty temporary file, opened for writing */
+static int make_spill(char **name, FILE **fd) {
+	char *tmpdir;
+	int tmp_fd;
+
+	if (NULL == (tmpdir = getenv("TMPDIR")) || '\0' == *tmpdir)
+		tmpdir = "/tmp";
+	if (NULL == (*name = Malloc(strlen(tmpdir) + 20, char)))
+		return (UNDEF);
+	(void) sprintf(*name, "%s/rec_eval.XXXXXX", tmpdir);
+	if (-1 == (tmp_fd = mkstemp(*name))
+			|| NULL == (*fd = fdopen(tmp_fd, "w"))) {
+		fprintf(stderr, "rec_eval.partition: Cannot create spill file '%s'\n",
+				*name);
+		return (UNDEF);
+	}
+	return (1);
+}
+
+static int comp_part_qid(PART_QID **ptr1, PART_QID **ptr2) {
+	return (strcmp((*ptr1)->qid, (*ptr2)->qid));
+}
+
+static void remove_spills_at_exit() {
+	(void) te_partition_files_cleanup();
+}
+
+int te_partition_files_cleanup() {
+	long i;
+
+	for (i = 0; partitions_pool && i < num_partitions_pool; i++) {
+		if (partitions_pool[i].rel_info_file) {
+			(void) unlink(partitions_pool[i].rel_info_file);
+			Free(partitions_pool[i].rel_info_file);
+		}
+		if (partitions_pool[i].results_file) {
+			(void) unlink(partitions_pool[i].results_file);
+			Free(partitions_pool[i].results_file);
+		}
+	}
+	num_partitions_pool = 0;
+	if (partitions_pool != NULL) {
+		Free(partitions_pool);
+		partitions_pool = NULL;
+	}
+	if (scratch_name != NULL) {
+		(void) unlink(scratch_name);
+		Free(scratch_name);
+		scratch_name = NULL;
+	}
+	for (i = 0; i < max_qid_table; i++) {
+		if (qid_table[i]) {
+			Free(qid_table[i]->qid);
+			Free(qid_table[i]);
+		}
+	}
+	if (max_qid_table > 0) {
+		Free(qid_table);
+		max_qid_table = 0;
+	}
+	num_qids = 0;
+	if (max_line > 0) {
+		Free(line);
+		line = NULL;
+		max_line = 0;
+	}
+	if (max_last_line > 0) {
+		Free(last_line);
+		last_line = NULL;
+		max_last_line = 0;
+	}
+	return (1);
+}
@@ -0,0 +1,445 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "rec_eval.h"
+
+/* Python module rec_eval (make python): librec_eval's context API.
+
+ ev = rec_eval.Evaluator("ndcg_cut.10", "map", M="100")
+ ev.load_qrels(users, items, rels)      # or ev.load_rel_info("qrels")
+ summary, qids, values = ev.evaluate(users, offsets, items, scores)
+
+ Arrays are anything exporting a C contiguous buffer (numpy arrays,
+ array.array, ...) of int64 (ids, offsets, rels) or float32 (scores);
+ they are used in place, never copied or converted to text.  summary is
+ a dict from value name to summary value, qids the list of queries
+ evaluated, and values a 2-d float64 memoryview with a row per query and
+ a column per summary value (numpy.asarray(values) shares it).
+
+ The GIL is released while rec_eval reads and evaluates.  An Evaluator
+ must only be used by one thread at a time; different Evaluators
+ evaluate in parallel on different threads.
+ */
+
+typedef struct {
+	PyObject_HEAD
+	rec_eval_ctx *ctx;
+	int busy; /* A call on ctx has released the GIL */
+} Evaluator;
+
+static PyObject *rec_eval_error_type;
+
+static int check_idle(Evaluator *self);
+static PyObject *raise_error(Evaluator *self);
+static int get_array(PyObject *obj, Py_buffer *view, const char *kind,
+		Py_ssize_t itemsize, const char *what);
+static PyObject *get_values(Evaluator *self);
+static PyObject *get_summary(Evaluator *self);
+static PyObject *get_qids(Evaluator *self);
+static PyObject *get_query_values(Evaluator *self);
+
+static int Evaluator_init(Evaluator *self, PyObject *args, PyObject *kwds) {
+	PyObject *key, *value;
+	Py_ssize_t i, pos = 0;
+	const char *measure, *option, *option_value;
+
+	if (NULL == self->ctx && NULL == (self->ctx = rec_eval_create())) {
+		PyErr_NoMemory();
+		return (-1);
+	}
+	for (i = 0; i < PyTuple_GET_SIZE(args); i++) {
+		if (NULL == (measure = PyUnicode_AsUTF8(PyTuple_GET_ITEM(args, i))))
+			return (-1);
+		if (0 > rec_eval_add_measure(self->ctx, measure)) {
+			(void) raise_error(self);
+			return (-1);
+		}
+	}
+	/* Options by their rec_eval names; True for a flag, False to clear it */
+	while (kwds && PyDict_Next(kwds, &pos, &key, &value)) {
+		if (NULL == (option = PyUnicode_AsUTF8(key)))
+			return (-1);
+		if (Py_True == value)
+			option_value = NULL;
+		else if (Py_False == value)
+			option_value = "0";
+		else {
+			PyObject *str = PyObject_Str(value);
+			int status;
+			if (NULL == str || NULL == (option_value = PyUnicode_AsUTF8(str))) {
+				Py_XDECREF(str);
+				return (-1);
+			}
+			status = rec_eval_set_option(self->ctx, option, option_value);
+			Py_DECREF(str);
+			if (0 > status) {
+				(void) raise_error(self);
+				return (-1);
+			}
+			continue;
+		}
+		if (0 > rec_eval_set_option(self->ctx, option, option_value)) {
+			(void) raise_error(self);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static void Evaluator_dealloc(Evaluator *self) {
+	rec_eval_destroy(self->ctx);
+	Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *Evaluator_add_measure(Evaluator *self, PyObject *args) {
+	const char *measure;
+
+	if (!PyArg_ParseTuple(args, "s:add_measure", &measure) || check_idle(self))
+		return (NULL);
+	if (0 > rec_eval_add_measure(self->ctx, measure))
+		return (raise_error(self));
+	Py_RETURN_NONE;
+}
+
+static PyObject *Evaluator_set_option(Evaluator *self, PyObject *args) {
+	const char *option, *value = NULL;
+
+	if (!PyArg_ParseTuple(args, "s|z:set_option", &option, &value)
+			|| check_idle(self))
+		return (NULL);
+	if (0 > rec_eval_set_option(self->ctx, option, value))
+		return (raise_error(self));
+	Py_RETURN_NONE;
+}
+
+static PyObject *Evaluator_load_rel_info(Evaluator *self, PyObject *args) {
+	PyObject *path;
+	int status;
+
+	if (!PyArg_ParseTuple(args, "O&:load_rel_info", PyUnicode_FSConverter,
+			&path))
+		return (NULL);
+	if (check_idle(self)) {
+		Py_DECREF(path);
+		return (NULL);
+	}
+	self->busy = 1;
+	Py_BEGIN_ALLOW_THREADS
+	status = rec_eval_load_rel_info(self->ctx, PyBytes_AS_STRING(path));
+	Py_END_ALLOW_THREADS
+	self->busy = 0;
+	Py_DECREF(path);
+	if (0 > status)
+		return (raise_error(self));
+	Py_RETURN_NONE;
+}
+
+static PyObject *Evaluator_load_qrels(Evaluator *self, PyObject *args) {
+	PyObject *users_obj, *items_obj, *rels_obj;
+	Py_buffer users, items, rels;
+	int status;
+
+	if (!PyArg_ParseTuple(args, "OOO:load_qrels", &users_obj, &items_obj,
+			&rels_obj))
+		return (NULL);
+	if (get_array(users_obj, &users, "ql", 8, "users"))
+		return (NULL);
+	if (get_array(items_obj, &items, "ql", 8, "items")) {
+		PyBuffer_Release(&users);
+		return (NULL);
+	}
+	if (get_array(rels_obj, &rels, "ql", 8, "rels")) {
+		PyBuffer_Release(&users);
+		PyBuffer_Release(&items);
+		return (NULL);
+	}
+	if (items.len != users.len || rels.len != users.len) {
+		PyErr_SetString(PyExc_ValueError,
+				"users, items and rels must have the same length");
+		status = 0;
+	} else if (check_idle(self))
+		status = 0;
+	else {
+		self->busy = 1;
+		Py_BEGIN_ALLOW_THREADS
+		status = rec_eval_load_qrels_arrays(self->ctx,
+				(long) (users.len / 8), users.buf, items.buf, rels.buf);
+		Py_END_ALLOW_THREADS
+		self->busy = 0;
+		if (0 > status) {
+			(void) raise_error(self);
+			status = 0;
+		}
+	}
+	PyBuffer_Release(&users);
+	PyBuffer_Release(&items);
+	PyBuffer_Release(&rels);
+	if (!status)
+		return (NULL);
+	Py_RETURN_NONE;
+}
+
+static PyObject *Evaluator_evaluate(Evaluator *self, PyObject *args) {
+	PyObject *objs[4];
+	Py_buffer views[4];
+	static const char *kinds[4] = { "ql", "ql", "ql", "f" };
+	static const Py_ssize_t itemsizes[4] = { 8, 8, 8, 4 };
+	static const char *names[4] = { "users", "offsets", "items", "scores" };
+	const int64_t *offsets;
+	Py_ssize_t num_users, num_rows, i;
+	int num_views, status = 1;
+
+	if (!PyArg_ParseTuple(args, "OOOO:evaluate", &objs[0], &objs[1],
+			&objs[2], &objs[3]))
+		return (NULL);
+	for (num_views = 0; num_views < 4; num_views++) {
+		if (get_array(objs[num_views], &views[num_views], kinds[num_views],
+				itemsizes[num_views], names[num_views])) {
+			status = 0;
+			break;
+		}
+	}
+
+	if (status) {
+		num_users = views[0].len / 8;
+		num_rows = views[2].len / 8;
+		offsets = views[1].buf;
+		if (views[1].len / 8 != num_users + 1 || views[3].len / 4 != num_rows) {
+			PyErr_SetString(PyExc_ValueError,
+					"need len(offsets) == len(users) + 1 and len(scores) == len(items)");
+			status = 0;
+		}
+		/* Offsets must stay within items; their order is checked by
+		 rec_eval_evaluate_arrays */
+		for (i = 0; status && i <= num_users; i++) {
+			if (offsets[i] < 0 || offsets[i] > num_rows) {
+				PyErr_Format(PyExc_ValueError,
+						"offsets[%zd] out of range of items", i);
+				status = 0;
+			}
+		}
+	}
+	if (status && check_idle(self))
+		status = 0;
+	if (status) {
+		self->busy = 1;
+		Py_BEGIN_ALLOW_THREADS
+		status = rec_eval_evaluate_arrays(self->ctx, (long) num_users,
+				views[0].buf, views[1].buf, views[2].buf, views[3].buf);
+		Py_END_ALLOW_THREADS
+		self->busy = 0;
+		if (0 > status) {
+			(void) raise_error(self);
+			status = 0;
+		}
+	}
+	for (i = 0; i < num_views; i++)
+		PyBuffer_Release(&views[i]);
+	if (!status)
+		return (NULL);
+	return (get_values(self));
+}
+
+static PyObject *Evaluator_evaluate_file(Evaluator *self, PyObject *args) {
+	PyObject *path;
+	int status;
+
+	if (!PyArg_ParseTuple(args, "O&:evaluate_file", PyUnicode_FSConverter,
+			&path))
+		return (NULL);
+	if (check_idle(self)) {
+		Py_DECREF(path);
+		return (NULL);
+	}
+	self->busy = 1;
+	Py_BEGIN_ALLOW_THREADS
+	status = rec_eval_evaluate_file(self->ctx, PyBytes_AS_STRING(path));
+	Py_END_ALLOW_THREADS
+	self->busy = 0;
+	Py_DECREF(path);
+	if (0 > status)
+		return (raise_error(self));
+	return (get_values(self));
+}
+
+/* Check self is set up and not in use by another thread */
+static int check_idle(Evaluator *self) {
+	if (NULL == self->ctx) {
+		PyErr_SetString(rec_eval_error_type, "Evaluator not initialized");
+		return (-1);
+	}
+	if (self->busy) {
+		PyErr_SetString(rec_eval_error_type,
+				"Evaluator in use by another thread");
+		return (-1);
+	}
+	return (0);
+}
+
+static PyObject *raise_error(Evaluator *self) {
+	PyErr_SetString(rec_eval_error_type, rec_eval_error(self->ctx));
+	return (NULL);
+}
+
+/* Get a C contiguous, one dimensional buffer of obj, of items of size
+ itemsize and a format character in kind */
+static int get_array(PyObject *obj, Py_buffer *view, const char *kind,
+		Py_ssize_t itemsize, const char *what) {
+	const char *format;
+
+	if (0 > PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT))
+		return (-1);
+	/* Skip byte order ('=', '<', '@' for native) */
+	format = view->format ? view->format : "B";
+	if (('=' == *format || '<' == *format || '@' == *format) && format[1])
+		format++;
+	if (view->ndim > 1 || view->itemsize != itemsize || format[1]
+			|| NULL == strchr(kind, *format)) {
+		PyErr_Format(PyExc_TypeError, "%s must be a 1-d array of %s", what,
+				4 == itemsize ? "float32" : "int64");
+		PyBuffer_Release(view);
+		return (-1);
+	}
+	return (0);
+}
+
+/* (summary, qids, values) of the last evaluation of self */
+static PyObject *get_values(Evaluator *self) {
+	PyObject *summary, *qids, *values;
+
+	summary = get_summary(self);
+	qids = get_qids(self);
+	values = get_query_values(self);
+	if (NULL == summary || NULL == qids || NULL == values) {
+		Py_XDECREF(summary);
+		Py_XDECREF(qids);
+		Py_XDECREF(values);
+		return (NULL);
+	}
+	return (Py_BuildValue("(NNN)", summary, qids, values));
+}
+
+static PyObject *get_summary(Evaluator *self) {
+	PyObject *summary, *value;
+	long i;
+	int status = 0;
+
+	if (NULL == (summary = PyDict_New()))
+		return (NULL);
+	for (i = 0; i < rec_eval_num_values(self->ctx) && 0 == status; i++) {
+		if (NULL == (value = PyFloat_FromDouble(rec_eval_value(self->ctx, i))))
+			status = -1;
+		else {
+			status = PyDict_SetItemString(summary,
+					rec_eval_value_name(self->ctx, i), value);
+			Py_DECREF(value);
+		}
+	}
+	if (status) {
+		Py_DECREF(summary);
+		return (NULL);
+	}
+	return (summary);
+}
+
+static PyObject *get_qids(Evaluator *self) {
+	PyObject *qids, *qid;
+	long i;
+
+	if (NULL == (qids = PyList_New(rec_eval_num_queries(self->ctx))))
+		return (NULL);
+	for (i = 0; i < rec_eval_num_queries(self->ctx); i++) {
+		if (NULL
+				== (qid = PyUnicode_FromString(rec_eval_query_id(self->ctx, i)))) {
+			Py_DECREF(qids);
+			return (NULL);
+		}
+		PyList_SET_ITEM(qids, i, qid);
+	}
+	return (qids);
+}
+
+/* Per query values as a (queries x values) float64 memoryview */
+static PyObject *get_query_values(Evaluator *self) {
+	PyObject *data, *view, *values;
+	long num_values = rec_eval_num_values(self->ctx);
+	long num_queries = rec_eval_num_queries(self->ctx);
+	double *buf;
+	long i, j;
+
+	if (NULL
+			== (data = PyByteArray_FromStringAndSize(NULL,
+					num_queries * num_values * sizeof(double))))
+		return (NULL);
+	buf = (double *) PyByteArray_AS_STRING(data);
+	for (i = 0; i < num_queries; i++) {
+		for (j = 0; j < num_values; j++)
+			buf[i * num_values + j] = rec_eval_query_value(self->ctx, i, j);
+	}
+	view = PyMemoryView_FromObject(data);
+	Py_DECREF(data);
+	if (NULL == view)
+		return (NULL);
+	values = PyObject_CallMethod(view, "cast", "s(ll)", "d", num_queries,
+			num_values);
+	Py_DECREF(view);
+	return (values);
+}
+
+static PyMethodDef Evaluator_methods[] = {
+	{ "add_measure", (PyCFunction) Evaluator_add_measure, METH_VARARGS,
+		"add_measure(measure): add a measure or nickname, as for -m" },
+	{ "set_option", (PyCFunction) Evaluator_set_option, METH_VARARGS,
+		"set_option(option, value=None): set a rec_eval option" },
+	{ "load_rel_info", (PyCFunction) Evaluator_load_rel_info, METH_VARARGS,
+		"load_rel_info(path): read a rel_info file or attach an image" },
+	{ "load_qrels", (PyCFunction) Evaluator_load_qrels, METH_VARARGS,
+		"load_qrels(users, items, rels): qrels from int64 arrays" },
+	{ "evaluate", (PyCFunction) Evaluator_evaluate, METH_VARARGS,
+		"evaluate(users, offsets, items, scores) -> (summary, qids, values)\n"
+		"Evaluate results in CSR form: users[u] retrieved items[j] with\n"
+		"scores[j] for offsets[u] <= j < offsets[u+1]" },
+	{ "evaluate_file", (PyCFunction) Evaluator_evaluate_file, METH_VARARGS,
+		"evaluate_file(path) -> (summary, qids, values)" },
+	{ NULL } };
+
+static PyTypeObject EvaluatorType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "rec_eval.Evaluator",
+	.tp_basicsize = sizeof(Evaluator),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Evaluator(*measures, **options): a rec_eval evaluation setup",
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc) Evaluator_init,
+	.tp_dealloc = (destructor) Evaluator_dealloc,
+	.tp_methods = Evaluator_methods, };
+
+static struct PyModuleDef rec_eval_module = {
+	PyModuleDef_HEAD_INIT, "rec_eval",
+	"Evaluation of rankings with rec_eval measures (see librec_eval)", -1,
+	NULL };
+
+PyMODINIT_FUNC PyInit_rec_eval(void) {
+	PyObject *module;
+
+	if (0 > PyType_Ready(&EvaluatorType)
+			|| NULL == (module = PyModule_Create(&rec_eval_module)))
+		return (NULL);
+	rec_eval_error_type = PyErr_NewException("rec_eval.Error",
+			PyExc_RuntimeError, NULL);
+	Py_INCREF(&EvaluatorType);
+	if (NULL == rec_eval_error_type
+			|| 0 > PyModule_AddObject(module, "Evaluator",
+					(PyObject *) &EvaluatorType)
+			|| 0 > PyModule_AddObject(module, "Error", rec_eval_error_type)) {
+		Py_DECREF(module);
+		return (NULL);
+	}
+	return (module);
+}
@@ -0,0 +1,481 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "trec_format.h"
+#include "functions.h"
+
+/* Per query value cache (--cache), for re-evaluating runs of which only
+ some queries' results changed.
+
+ For every query evaluated, the cache file keeps the values calc_meas
+ gave it (at each -M depth, before any zscore conversion), keyed by the
+ qid and by hashes of the query's results and rel info.  When a run is
+ evaluated with the cache, a query whose results and rel info hash as
+ cached gets the cached values instead of being calculated; they then go
+ through zscore conversion, printing and accumulation exactly as
+ calculated values would, so output is unchanged.  The whole cache is
+ for one configuration (measures and their parameters, -M, -l, -J, -N,
+ formats and rec_eval version), recorded in its header; evaluating with
+ another configuration starts the cache afresh.
+
+ The cache is rewritten by each evaluation (under a temporary name then
+ renamed): queries evaluated, then the old entries of queries that were
+ not evaluated, so queries absent from one run are still cached for the
+ next.
+
+ Format, binary in native byte order and sizes:
+ string   CACHE_MAGIC
+ string   configuration
+ long     num_depths
+ long     num_values, followed by num_values strings (value names)
+ then for each query:
+ long     CACHE_QUERY
+ string   qid
+ ulong    hash of results, hash of rel info
+ double   num_depths * num_values values
+ and finally
+ long     CACHE_END
+
+ where a string is a long length followed by that many chars and a NUL.
+ */
+
+#define CACHE_MAGIC "rec_eval cache 1"
+#define CACHE_END 0
+#define CACHE_QUERY 1
+
+/* FNV-1a */
+#define HASH_INIT 14695981039346656037UL
+#define HASH_PRIME 1099511628211UL
+
+/* Query of the old cache, pointing into its file buffer */
+typedef struct {
+	char *qid;
+	unsigned long results_hash;
+	unsigned long rel_hash;
+	char *values; /* num_depths * num_values doubles, not aligned */
+	long replaced; /* Evaluated (and so rewritten) this time */
+} CACHE_Q;
+
+static int get_cache_file(const char *cache_file, const char *config,
+		const TREC_EVAL *accum_eval, long num_depths);
+static char *get_config(const EPI *epi, const char *meas_config);
+static unsigned long hash_bytes(unsigned long hash, const void *buf,
+		size_t len);
+static unsigned long hash_string(unsigned long hash, const char *s);
+static unsigned long hash_results(const RESULTS *results);
+static int hash_rel_info(const REL_INFO *rel_info, unsigned long *hash);
+static int put_long(long l);
+static int put_string(const char *s);
+static int get_long(char **ptr, char *end, long *l);
+static int get_string(char **ptr, char *end, char **s);
+static int comp_cache_q();
+static void remove_temp_at_exit();
+
+/* Old cache */
+static char *cache_buf = NULL;
+static CACHE_Q *qs = NULL;
+static long num_qs, max_num_qs;
+
+/* New cache being written */
+static FILE *cache_fd = NULL;
+static const char *cache_name = NULL;
+static char *temp_name = NULL;
+static long exit_handler_flag = 0;
+
+/* Query being evaluated */
+static double *query_values = NULL;
+static long max_query_values = 0;
+static long num_query_values;
+static unsigned long results_hash, rel_hash;
+
+/* Start using cache_file for values laid out as in accum_eval, at each of
+ the depths of epi, of measures described by meas_config (names and
+ parameters) */
+int te_cache_open(const EPI *epi, const char *cache_file,
+		const TREC_EVAL *accum_eval, const char *meas_config) {
+	long num_depths = epi->num_max_num_docs ? epi->num_max_num_docs : 1;
+	char *config;
+	mode_t mask;
+	int fd;
+	long i;
+
+	if (!exit_handler_flag) {
+		(void) atexit(remove_temp_at_exit);
+		exit_handler_flag++;
+	}
+	if (NULL == (config = get_config(epi, meas_config)))
+		return (UNDEF);
+	num_qs = 0;
+	if (UNDEF == get_cache_file(cache_file, config, accum_eval, num_depths)) {
+		Free(config);
+		return (UNDEF);
+	}
+
+	num_query_values = num_depths * accum_eval->num_values;
+	if (NULL
+			== (query_values = te_chk_and_malloc(query_values,
+					&max_query_values, num_query_values + 1, sizeof(double)))
+			|| NULL
+					== (temp_name = Malloc(strlen(cache_file) + 8, char))) {
+		Free(config);
+		return (UNDEF);
+	}
+	(void) sprintf(temp_name, "%s.XXXXXX", cache_file);
+	cache_name = cache_file;
+	/* Readable as any new file would be, unlike mkstemp's */
+	mask = umask(0);
+	(void) umask(mask);
+	if (-1 == (fd = mkstemp(temp_name)) || -1 == fchmod(fd, 0666 & ~mask)
+			|| NULL == (cache_fd = fdopen(fd, "wb"))) {
+		fprintf(stderr, "rec_eval.cache: Cannot create cache file '%s'\n",
+				cache_file);
+		if (-1 != fd) {
+			(void) close(fd);
+			(void) unlink(temp_name);
+		}
+		Free(temp_name);
+		temp_name = NULL;
+		Free(config);
+		return (UNDEF);
+	}
+
+	if (UNDEF == put_string(CACHE_MAGIC) || UNDEF == put_string(config)
+			|| UNDEF == put_long(num_depths)
+			|| UNDEF == put_long(accum_eval->num_values)) {
+		Free(config);
+		return (UNDEF);
+	}
+	Free(config);
+	for (i = 0; i < accum_eval->num_values; i++) {
+		if (UNDEF == put_string(accum_eval->values[i].name))
+			return (UNDEF);
+	}
+	return (1);
+}
+
+/* Look up the query of results (with rel_info) in the cache.  values is
+ set to the query's values at each depth (num_values per depth), which
+ are those cached if 1 is returned.  If 0 is returned they are not
+ cached, and the caller is to fill them in */
+int te_cache_get_query(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, double **values) {
+	CACHE_Q key, *q;
+
+	results_hash = hash_results(results);
+	if (UNDEF == hash_rel_info(rel_info, &rel_hash))
+		return (UNDEF);
+	*values = query_values;
+
+	key.qid = results->qid;
+	if (NULL
+			== (q = bsearch((char *) &key, (char *) qs, (size_t) num_qs,
+					sizeof(CACHE_Q), comp_cache_q)))
+		return (0);
+	q->replaced = 1;
+	if (q->results_hash != results_hash || q->rel_hash != rel_hash)
+		return (0);
+	(void) memcpy(query_values, q->values, num_query_values * sizeof(double));
+	return (1);
+}
+
+/* Add the values of the query last looked up, qid, to the new cache */
+int te_cache_put_query(const EPI *epi, const char *qid) {
+	if (UNDEF == put_long(CACHE_QUERY) || UNDEF == put_string(qid)
+			|| 1 != fwrite(&results_hash, sizeof(unsigned long), 1, cache_fd)
+			|| 1 != fwrite(&rel_hash, sizeof(unsigned long), 1, cache_fd)
+			|| (num_query_values
+					&& 1
+							!= fwrite(query_values,
+									num_query_values * sizeof(double), 1,
+									cache_fd))) {
+		fprintf(stderr, "rec_eval.cache: Cannot write cache file '%s'\n",
+				cache_name);
+		return (UNDEF);
+	}
+	return (1);
+}
+
+/* Finish the new cache with the old queries not evaluated, and replace
+ the old cache with it */
+int te_cache_close(const EPI *epi) {
+	long i;
+	int status = 1;
+
+	for (i = 0; i < num_qs && UNDEF != status; i++) {
+		if (qs[i].replaced)
+			continue;
+		if (UNDEF == put_long(CACHE_QUERY) || UNDEF == put_string(qs[i].qid)
+				|| 1
+						!= fwrite(&qs[i].results_hash, sizeof(unsigned long), 1,
+								cache_fd)
+				|| 1
+						!= fwrite(&qs[i].rel_hash, sizeof(unsigned long), 1,
+								cache_fd)
+				|| (num_query_values
+						&& 1
+								!= fwrite(qs[i].values,
+										num_query_values * sizeof(double), 1,
+										cache_fd)))
+			status = UNDEF;
+	}
+	if (UNDEF == status || UNDEF == put_long(CACHE_END)
+			|| 0 != fflush(cache_fd) || -1 == fsync(fileno(cache_fd)))
+		status = UNDEF;
+	if (0 != fclose(cache_fd))
+		status = UNDEF;
+	cache_fd = NULL;
+	if (UNDEF == status || -1 == rename(temp_name, cache_name)) {
+		fprintf(stderr, "rec_eval.cache: Cannot write cache file '%s'\n",
+				cache_name);
+		return (UNDEF);
+	}
+	Free(temp_name);
+	temp_name = NULL;
+	return (1);
+}
+
+/* Read the old cache in cache_file into qs, if it is there and is for
+ config and the measure values of accum_eval */
+static int get_cache_file(const char *cache_file, const char *config,
+		const TREC_EVAL *accum_eval, long num_depths) {
+	char *ptr, *end, *str;
+	int fd;
+	off_t size;
+	long i, n, type;
+
+	if (-1 == (fd = open(cache_file, 0)))
+		return (1);
+	if (0 >= (size = lseek(fd, 0L, 2))
+			|| NULL == (cache_buf = malloc((size_t) size))
+			|| -1 == lseek(fd, 0L, 0)
+			|| size != read(fd, cache_buf, (size_t) size)) {
+		(void) close(fd);
+		fprintf(stderr, "rec_eval.cache: Cannot read cache file '%s'\n",
+				cache_file);
+		return (UNDEF);
+	}
+	(void) close(fd);
+	ptr = cache_buf;
+	end = cache_buf + size;
+
+	/* A cache of another configuration is not used */
+	if (UNDEF == get_string(&ptr, end, &str) || strcmp(str, CACHE_MAGIC)) {
+		fprintf(stderr, "rec_eval.cache: '%s' is not a cache file\n",
+				cache_file);
+		return (UNDEF);
+	}
+	if (UNDEF == get_string(&ptr, end, &str) || strcmp(str, config)
+			|| UNDEF == get_long(&ptr, end, &n) || n != num_depths
+			|| UNDEF == get_long(&ptr, end, &n)
+			|| n != accum_eval->num_values)
+		return (1);
+	for (i = 0; i < n; i++) {
+		if (UNDEF == get_string(&ptr, end, &str)
+				|| strcmp(str, accum_eval->values[i].name))
+			return (1);
+	}
+
+	while (1) {
+		if (UNDEF == get_long(&ptr, end, &type))
+			break;
+		if (CACHE_END == type) {
+			qsort((char *) qs, (int) num_qs, sizeof(CACHE_Q), comp_cache_q);
+			return (1);
+		}
+		if (CACHE_QUERY != type)
+			break;
+		if (NULL
+				== (qs = te_chk_and_realloc(qs, &max_num_qs, num_qs + 1,
+						sizeof(CACHE_Q))))
+			return (UNDEF);
+		if (UNDEF == get_string(&ptr, end, &qs[num_qs].qid)
+				|| (size_t) (end - ptr)
+						< 2 * sizeof(unsigned long)
+								+ num_depths * n * sizeof(double))
+			break;
+		(void) memcpy(&qs[num_qs].results_hash, ptr, sizeof(unsigned long));
+		ptr += sizeof(unsigned long);
+		(void) memcpy(&qs[num_qs].rel_hash, ptr, sizeof(unsigned long));
+		ptr += sizeof(unsigned long);
+		qs[num_qs].values = ptr;
+		ptr += num_depths * n * sizeof(double);
+		qs[num_qs].replaced = 0;
+		num_qs++;
+	}
+	fprintf(stderr, "rec_eval.cache: Malformed cache file '%s'\n", cache_file);
+	return (UNDEF);
+}
+
+/* Everything besides the results and rel info that calculated values
+ depend on */
+static char *get_config(const EPI *epi, const char *meas_config) {
+	char *config;
+	long i;
+
+	if (NULL
+			== (config = Malloc(strlen(VERSIONID) + strlen(epi->rel_info_format)
+					+ strlen(epi->results_format) + strlen(meas_config)
+					+ 22 * (epi->num_max_num_docs + 5), char)))
+		return (NULL);
+	(void) sprintf(config, "%s %s %s -J%ld -N%ld -l%ld -M", VERSIONID,
+			epi->rel_info_format, epi->results_format,
+			epi->judged_docs_only_flag, epi->num_docs_in_coll,
+			epi->relevance_level);
+	if (epi->num_max_num_docs) {
+		for (i = 0; i < epi->num_max_num_docs; i++)
+			(void) sprintf(config + strlen(config), "%s%ld", i ? "," : "",
+					epi->max_num_docs_list[i]);
+	} else
+		(void) sprintf(config + strlen(config), "%ld",
+				epi->max_num_docs_per_topic);
+	(void) sprintf(config + strlen(config), " %s", meas_config);
+	return (config);
+}
+
+static unsigned long hash_bytes(unsigned long hash, const void *buf,
+		size_t len) {
+	const unsigned char *ptr = buf;
+
+	while (len--) {
+		hash ^= *ptr++;
+		hash *= HASH_PRIME;
+	}
+	return (hash);
+}
+
+/* Hash of s including its NUL, so that consecutive strings are delimited */
+static unsigned long hash_string(unsigned long hash, const char *s) {
+	return (hash_bytes(hash, s, strlen(s) + 1));
+}
+
+static unsigned long hash_results(const RESULTS *results) {
+	TEXT_RESULTS_INFO *info = (TEXT_RESULTS_INFO *) results->q_results;
+	unsigned long hash = hash_string(HASH_INIT, results->ret_format);
+	long i;
+
+	hash = hash_bytes(hash, &info->num_text_results, sizeof(long));
+	for (i = 0; i < info->num_text_results; i++) {
+		hash = hash_string(hash, info->text_results[i].docno);
+		hash = hash_bytes(hash, &info->text_results[i].sim, sizeof(float));
+	}
+	return (hash);
+}
+
+static int hash_rel_info(const REL_INFO *rel_info, unsigned long *hash) {
+	long i, j;
+
+	*hash = hash_string(HASH_INIT, rel_info->rel_format);
+	if (0 == strcmp("qrels", rel_info->rel_format)) {
+		TEXT_QRELS_INFO *info = (TEXT_QRELS_INFO *) rel_info->q_rel_info;
+		*hash = hash_bytes(*hash, &info->num_text_qrels, sizeof(long));
+		for (i = 0; i < info->num_text_qrels; i++) {
+			*hash = hash_string(*hash, info->text_qrels[i].docno);
+			*hash = hash_bytes(*hash, &info->text_qrels[i].rel, sizeof(long));
+		}
+	} else if (0 == strcmp("qrels_jg", rel_info->rel_format)) {
+		TEXT_QRELS_JG_INFO *info = (TEXT_QRELS_JG_INFO *) rel_info->q_rel_info;
+		*hash = hash_bytes(*hash, &info->num_text_qrels_jg, sizeof(long));
+		for (i = 0; i < info->num_text_qrels_jg; i++) {
+			TEXT_QRELS_JG *jg = &info->text_qrels_jg[i];
+			*hash = hash_bytes(*hash, &jg->num_text_qrels, sizeof(long));
+			for (j = 0; j < jg->num_text_qrels; j++) {
+				*hash = hash_string(*hash, jg->text_qrels[j].docno);
+				*hash = hash_bytes(*hash, &jg->text_qrels[j].rel,
+						sizeof(long));
+			}
+		}
+	} else if (0 == strcmp("prefs", rel_info->rel_format)
+			|| 0 == strcmp("qrels_prefs", rel_info->rel_format)) {
+		TEXT_PREFS_INFO *info = (TEXT_PREFS_INFO *) rel_info->q_rel_info;
+		*hash = hash_bytes(*hash, &info->num_text_prefs, sizeof(long));
+		for (i = 0; i < info->num_text_prefs; i++) {
+			*hash = hash_string(*hash, info->text_prefs[i].jg);
+			*hash = hash_string(*hash, info->text_prefs[i].jsg);
+			*hash = hash_bytes(*hash, &info->text_prefs[i].rel_level,
+					sizeof(float));
+			*hash = hash_string(*hash, info->text_prefs[i].docno);
+		}
+	} else {
+		fprintf(stderr, "rec_eval.cache: Cannot cache rel_format '%s'\n",
+				rel_info->rel_format);
+		return (UNDEF);
+	}
+	return (1);
+}
+
+static int put_long(long l) {
+	if (1 != fwrite(&l, sizeof(long), 1, cache_fd))
+		return (UNDEF);
+	return (1);
+}
+
+static int put_string(const char *s) {
+	long len = strlen(s);
+
+	if (UNDEF == put_long(len) || 1 != fwrite(s, (size_t) len + 1, 1, cache_fd))
+		return (UNDEF);
+	return (1);
+}
+
+static int get_long(char **ptr, char *end, long *l) {
+	if ((size_t) (end - *ptr) < sizeof(long))
+		return (UNDEF);
+	(void) memcpy(l, *ptr, sizeof(long));
+	*ptr += sizeof(long);
+	return (1);
+}
+
+static int get_string(char **ptr, char *end, char **s) {
+	long len;
+
+	if (UNDEF == get_long(ptr, end, &len) || len < 0 || len >= end - *ptr
+			|| (*ptr)[len] != '\0')
+		return (UNDEF);
+	*s = *ptr;
+	*ptr += len + 1;
+	return (1);
+}
+
+static int comp_cache_q(const CACHE_Q *ptr1, const CACHE_Q *ptr2) {
+	return (strcmp(ptr1->qid, ptr2->qid));
+}
+
+/* A cache not closed (the evaluation failed) is left as it was */
+static void remove_temp_at_exit() {
+	(void) te_cache_cleanup();
+}
+
+int te_cache_cleanup() {
+	if (cache_fd) {
+		(void) fclose(cache_fd);
+		cache_fd = NULL;
+	}
+	if (temp_name) {
+		(void) unlink(temp_name);
+		Free(temp_name);
+		temp_name = NULL;
+	}
+	if (cache_buf) {
+		Free(cache_buf);
+		cache_buf = NULL;
+	}
+	if (max_num_qs) {
+		Free(qs);
+		qs = NULL;
+		max_num_qs = 0;
+	}
+	num_qs = 0;
+	if (max_query_values) {
+		Free(query_values);
+		query_values = NULL;
+		max_query_values = 0;
+	}
+	return (1);
+}
@@ -0,0 +1,158 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+#ifndef REC_EVALH
+#define REC_EVALH
+
+#include <stdint.h>
+
+/* librec_eval: evaluation from within another program (make lib).
+
+ A context holds everything one evaluation setup needs: options, rel
+ info, measures, and the values of the last evaluation.  Typical use:
+
+ ctx = rec_eval_create();
+ rec_eval_load_rel_info(ctx, "qrels");
+ rec_eval_add_measure(ctx, "ndcg_cut.10");
+ for each step {
+	 for each retrieved doc
+		 rec_eval_add_result(ctx, qid, docno, score);
+	 rec_eval_evaluate(ctx);
+	 for (i = 0; i < rec_eval_num_values(ctx); i++)
+		 ... rec_eval_value_name(ctx, i), rec_eval_value(ctx, i) ...
+ }
+ rec_eval_destroy(ctx);
+
+ Functions returning int return 1 on success, -1 on error; the error is
+ then described by rec_eval_error(ctx).  No function exits the process.
+
+ The API is reentrant.  A context must only be used by one thread at a
+ time, but different contexts can load and evaluate at the same time on
+ different threads: the working storage of the rel info and results
+ loaders and of the measures is per thread.
+ */
+
+typedef struct rec_eval_ctx rec_eval_ctx;
+
+/* The Apache Arrow C Data Interface (as published by Arrow; no Arrow
+ library is needed) */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	const char *format;
+	const char *name;
+	const char *metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema **children;
+	struct ArrowSchema *dictionary;
+	void (*release)(struct ArrowSchema *);
+	void *private_data;
+};
+
+struct ArrowArray {
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void **buffers;
+	struct ArrowArray **children;
+	struct ArrowArray *dictionary;
+	void (*release)(struct ArrowArray *);
+	void *private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
+/* Create a context with the defaults of the rec_eval command, NULL if out
+ of memory */
+rec_eval_ctx *rec_eval_create(void);
+void rec_eval_destroy(rec_eval_ctx *ctx);
+
+/* Description of the last error in ctx */
+const char *rec_eval_error(const rec_eval_ctx *ctx);
+
+/* Set an option, named as the rec_eval command's long or short option
+ (value NULL for flags): complete_rel_info_wanted (c), level_for_rel (l),
+ Judged_docs_only (J), Number_docs_in_coll (N), Max_retrieved_per_topic
+ (M, a single depth), Rel_info_format (R), Results_format (T),
+ prefs-conflicts */
+int rec_eval_set_option(rec_eval_ctx *ctx, const char *option,
+		const char *value);
+
+/* Read the rel info in rel_info_file (in the Rel_info_format set), or
+ attach to it if it is an image made by rec_eval --publish.  Replaces
+ any rel info loaded before */
+int rec_eval_load_rel_info(rec_eval_ctx *ctx, const char *rel_info_file);
+
+/* Add a measure or measure nickname, optionally with parameters, as
+ for -m (eg "P.5,10", "official") */
+int rec_eval_add_measure(rec_eval_ctx *ctx, const char *measure);
+
+/* Add one retrieved document to the results evaluated by the next
+ rec_eval_evaluate */
+int rec_eval_add_result(rec_eval_ctx *ctx, const char *qid,
+		const char *docno, double sim);
+
+/* Evaluate the results added since the last evaluation (which are then
+ discarded), or those in results_file (in the Results_format set) */
+int rec_eval_evaluate(rec_eval_ctx *ctx);
+int rec_eval_evaluate_file(rec_eval_ctx *ctx, const char *results_file);
+
+/* Batch forms of rec_eval_load_rel_info and rec_eval_evaluate, taking
+ arrays instead of text, for callers with integer ids already in memory.
+ Ids stand for their decimal text, so user 7 is the same query as qid "7"
+ of a qrels file.
+
+ rec_eval_load_qrels_arrays loads num_qrels judgements (users[i],
+ items[i], rels[i]) as qrels rel info (Rel_info_format must be qrels).
+
+ rec_eval_evaluate_arrays evaluates results in CSR form: user users[u]
+ retrieved items[j] with score scores[j], for offsets[u] <= j <
+ offsets[u+1].  Results added by rec_eval_add_result are not included */
+int rec_eval_load_qrels_arrays(rec_eval_ctx *ctx, long num_qrels,
+		const int64_t *users, const int64_t *items, const int64_t *rels);
+int rec_eval_evaluate_arrays(rec_eval_ctx *ctx, long num_users,
+		const int64_t *users, const int64_t *offsets, const int64_t *items,
+		const float *scores);
+
+/* Arrow forms of rec_eval_load_qrels_arrays and rec_eval_add_result,
+ taking a record batch (a struct array) with a row per judgement or
+ retrieved document.  Columns are named by user_column, item_column and
+ rel_column (or score_column), or if those are NULL are the first three
+ columns.  User and item columns are int64, int32 or utf8 (large_utf8)
+ strings; rel columns int64 or int32; score columns float32 or float64;
+ none may contain nulls.  The batch is read in place and stays owned by
+ the caller (it is not released).  rec_eval_add_results_arrow may be
+ called for each batch of a stream before rec_eval_evaluate */
+int rec_eval_load_qrels_arrow(rec_eval_ctx *ctx,
+		const struct ArrowArray *batch, const struct ArrowSchema *schema,
+		const char *user_column, const char *item_column,
+		const char *rel_column);
+int rec_eval_add_results_arrow(rec_eval_ctx *ctx,
+		const struct ArrowArray *batch, const struct ArrowSchema *schema,
+		const char *user_column, const char *item_column,
+		const char *score_column);
+
+/* Summary values of the last evaluation */
+long rec_eval_num_values(const rec_eval_ctx *ctx);
+const char *rec_eval_value_name(const rec_eval_ctx *ctx, long value);
+double rec_eval_value(const rec_eval_ctx *ctx, long value);
+
+/* Per query values of the last evaluation, for the queries evaluated in
+ qid order.  Values are in the order of the summary values; those of
+ measures only defined over all queries (eg num_q, gm_map) are NaN */
+long rec_eval_num_queries(const rec_eval_ctx *ctx);
+const char *rec_eval_query_id(const rec_eval_ctx *ctx, long query);
+double rec_eval_query_value(const rec_eval_ctx *ctx, long query, long value);
+
+#endif /* REC_EVALH */
@@ -0,0 +1,417 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "functions.h"
+#include "trec_format.h"
+#include <errno.h>
+
+/* Rel info images (--publish).  An image holds the ALL_REL_INFO of a
+ rel_info file exactly as the loaders build it (queries sorted by qid,
+ judgements by docno), with all its pointers, in a file meant to be
+ mapped read-only at a fixed address.  Any number of processes can then
+ attach to the same image (put it in /dev/shm to keep it in memory)
+ without parsing the text file, sharing one physical copy of it.
+
+ Pointers in the image assume it is mapped at header.base.  If that
+ address is taken in an attaching process, the image is mapped privately
+ wherever it fits and its pointers relocated, which costs that process a
+ private copy of the pages holding pointers.
+
+ Image layout, each item aligned to IMAGE_ALIGN:
+ REL_IMAGE_HEADER, giving the ALL_REL_INFO
+ REL_INFO[num_q_rels]
+ For each query: its qid, rel_format (shared by consecutive queries of
+ the same format) and q_rel_info, as TEXT_QRELS_INFO (qrels),
+ TEXT_QRELS_JG_INFO (qrels_jg) or TEXT_PREFS_INFO (prefs, qrels_prefs),
+ followed by its arrays and their strings.
+ */
+
+#define REL_IMAGE_MAGIC "rec_eval rel_image 1\n"
+#define IMAGE_ALIGN 8
+#define MAX_REL_FORMAT 32
+#if ULONG_MAX > 0xffffffffUL
+#define REL_IMAGE_BASE 0x500000000000UL
+#else
+#define REL_IMAGE_BASE 0x60000000UL
+#endif
+
+typedef struct {
+	char magic[24];
+	unsigned long base; /* Address the image's pointers assume */
+	unsigned long size; /* Size of the image file */
+	char rel_format[MAX_REL_FORMAT]; /* epi->rel_info_format used */
+	ALL_REL_INFO all_rel_info;
+} REL_IMAGE_HEADER;
+
+/* Image being laid out.  With buf NULL, items are only sized */
+typedef struct {
+	char *buf;
+	unsigned long base;
+	size_t used;
+	size_t size;
+} IMAGE;
+
+static int layout_image(IMAGE *im, const char *rel_format,
+		const ALL_REL_INFO *all_rel_info);
+static void *put_qrels(IMAGE *im, const TEXT_QRELS *text_qrels,
+		long num_text_qrels);
+static size_t image_alloc(IMAGE *im, size_t size);
+static void *image_addr(const IMAGE *im, size_t offset);
+static void image_put(IMAGE *im, size_t offset, const void *item, size_t size);
+static char *image_string(IMAGE *im, const char *string);
+static void relocate_image(REL_IMAGE_HEADER *header, long delta);
+static void relocate_qrels(TEXT_QRELS **text_qrels, long num_text_qrels,
+		long delta);
+
+static TE_THREAD char *image = NULL;
+static TE_THREAD size_t image_size = 0;
+
+/* Write all_rel_info, read in format epi->rel_info_format, as an image in
+ image_file.  The image is written under a temporary name and renamed, so
+ processes attaching to image_file never see it half written */
+int te_put_rel_image(const EPI *epi, const ALL_REL_INFO *all_rel_info,
+		const char *image_file) {
+	IMAGE im;
+	char *tmp_file;
+	int fd;
+	mode_t mask;
+
+	if (strlen(epi->rel_info_format) >= MAX_REL_FORMAT) {
+		fprintf(stderr, "rec_eval.rel_image: Illegal rel_format '%s'\n",
+				epi->rel_info_format);
+		return (UNDEF);
+	}
+
+	/* Size the image, then lay it out in the mapped file */
+	im.buf = NULL;
+	im.base = REL_IMAGE_BASE;
+	im.used = 0;
+	if (UNDEF == layout_image(&im, epi->rel_info_format, all_rel_info))
+		return (UNDEF);
+
+	if (NULL == (tmp_file = Malloc(strlen(image_file) + 8, char)))
+		return (UNDEF);
+	(void) sprintf(tmp_file, "%s.XXXXXX", image_file);
+	/* Readable as any new file would be, unlike mkstemp's */
+	mask = umask(0);
+	(void) umask(mask);
+	if (-1 == (fd = mkstemp(tmp_file)) || -1 == fchmod(fd, 0666 & ~mask)
+			|| -1 == ftruncate(fd, (off_t) im.used)
+			|| MAP_FAILED == (im.buf = mmap(NULL, im.used,
+					PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
+		fprintf(stderr, "rec_eval.rel_image: Cannot create image '%s'\n",
+				image_file);
+		if (-1 != fd)
+			(void) unlink(tmp_file);
+		Free(tmp_file);
+		return (UNDEF);
+	}
+	im.size = im.used;
+	im.used = 0;
+	(void) layout_image(&im, epi->rel_info_format, all_rel_info);
+	if (-1 == munmap(im.buf, im.size) || -1 == fsync(fd) || -1 == close(fd)
+			|| -1 == rename(tmp_file, image_file)) {
+		fprintf(stderr, "rec_eval.rel_image: Cannot write image '%s'\n",
+				image_file);
+		(void) unlink(tmp_file);
+		Free(tmp_file);
+		return (UNDEF);
+	}
+	Free(tmp_file);
+	return (1);
+}
+
+/* Whether file is a rel info image */
+int te_is_rel_image(const char *file) {
+	char magic[sizeof(REL_IMAGE_MAGIC)];
+	int fd;
+	long n;
+
+	if (-1 == (fd = open(file, O_RDONLY)))
+		return (0);
+	n = read(fd, magic, sizeof(REL_IMAGE_MAGIC));
+	(void) close(fd);
+	return (n == sizeof(REL_IMAGE_MAGIC)
+			&& 0 == memcmp(magic, REL_IMAGE_MAGIC, sizeof(REL_IMAGE_MAGIC)));
+}
+
+/* Attach to the rel info image in image_file (which must be one, see
+ te_is_rel_image), giving all_rel_info.  epi->rel_info_format must be the
+ format the image was made from */
+int te_get_rel_image(const EPI *epi, const char *image_file,
+		ALL_REL_INFO *all_rel_info) {
+	return (te_map_rel_image(epi, image_file, all_rel_info, &image,
+			&image_size));
+}
+
+int te_get_rel_image_cleanup() {
+	if (image != NULL) {
+		(void) te_unmap_rel_image(image, image_size);
+		image = NULL;
+	}
+	return (1);
+}
+
+/* As te_get_rel_image, but the mapping is returned in map and map_size
+ (for te_unmap_rel_image) instead of being kept until cleanup */
+int te_map_rel_image(const EPI *epi, const char *image_file,
+		ALL_REL_INFO *all_rel_info, char **map, size_t *map_size) {
+	REL_IMAGE_HEADER header;
+	struct stat buf;
+	int fd;
+	int flags;
+
+	if (-1 == (fd = open(image_file, O_RDONLY)) || -1 == fstat(fd, &buf)
+			|| sizeof(header) != read(fd, &header, sizeof(header))
+			|| header.size != (unsigned long) buf.st_size) {
+		fprintf(stderr, "rec_eval.rel_image: Cannot read image '%s'\n",
+				image_file);
+		if (-1 != fd)
+			(void) close(fd);
+		return (UNDEF);
+	}
+	if (strcmp(header.rel_format, epi->rel_info_format)) {
+		fprintf(stderr,
+				"rec_eval.rel_image: Image '%s' holds rel_format '%s' (use -R %s)\n",
+				image_file, header.rel_format, header.rel_format);
+		(void) close(fd);
+		return (UNDEF);
+	}
+
+	*map_size = header.size;
+	flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+	flags |= MAP_FIXED_NOREPLACE;
+#endif
+	*map = mmap((void *) header.base, *map_size, PROT_READ, flags, fd, 0);
+	if (MAP_FAILED != *map && (unsigned long) *map != header.base) {
+		/* Placed elsewhere; only a hint without MAP_FIXED_NOREPLACE */
+		(void) munmap(*map, *map_size);
+		*map = MAP_FAILED;
+	}
+	if (MAP_FAILED == *map) {
+		if (MAP_FAILED
+				== (*map = mmap(NULL, *map_size, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE, fd, 0))) {
+			fprintf(stderr, "rec_eval.rel_image: Cannot map image '%s'\n",
+					image_file);
+			*map = NULL;
+			(void) close(fd);
+			return (UNDEF);
+		}
+		relocate_image((REL_IMAGE_HEADER *) *map,
+				(long) ((unsigned long) *map - header.base));
+	}
+	(void) close(fd);
+
+	*all_rel_info = ((REL_IMAGE_HEADER *) *map)->all_rel_info;
+	return (1);
+}
+
+int te_unmap_rel_image(char *map, size_t map_size) {
+	if (-1 == munmap(map, map_size))
+		return (UNDEF);
+	return (1);
+}
+
+/* Copy all_rel_info (in format epi->rel_info_format) into a single block
+ of memory, returned in copy_buf (to be freed by the caller), giving
+ copy.  The copy does not depend on the loader's storage */
+int te_copy_rel_info(const EPI *epi, const ALL_REL_INFO *all_rel_info,
+		ALL_REL_INFO *copy, char **copy_buf) {
+	IMAGE im;
+
+	if (strlen(epi->rel_info_format) >= MAX_REL_FORMAT)
+		return (UNDEF);
+	im.buf = NULL;
+	im.base = 0;
+	im.used = 0;
+	if (UNDEF == layout_image(&im, epi->rel_info_format, all_rel_info)
+			|| NULL == (im.buf = Malloc(im.used, char)))
+		return (UNDEF);
+	im.base = (unsigned long) im.buf;
+	im.size = im.used;
+	im.used = 0;
+	(void) layout_image(&im, epi->rel_info_format, all_rel_info);
+	*copy = ((REL_IMAGE_HEADER *) im.buf)->all_rel_info;
+	*copy_buf = im.buf;
+	return (1);
+}
+
+static int layout_image(IMAGE *im, const char *rel_format,
+		const ALL_REL_INFO *all_rel_info) {
+	REL_IMAGE_HEADER header;
+	size_t header_offset, rel_info_offset, offset;
+	const char *last_format = NULL;
+	char *format_addr = NULL;
+	long i, j;
+
+	header_offset = image_alloc(im, sizeof(REL_IMAGE_HEADER));
+	rel_info_offset = image_alloc(im,
+			all_rel_info->num_q_rels * sizeof(REL_INFO));
+
+	for (i = 0; i < all_rel_info->num_q_rels; i++) {
+		REL_INFO q_rel_info = all_rel_info->rel_info[i];
+		if (NULL == last_format || strcmp(last_format, q_rel_info.rel_format)) {
+			last_format = q_rel_info.rel_format;
+			format_addr = image_string(im, last_format);
+		}
+		q_rel_info.rel_format = format_addr;
+		q_rel_info.qid = image_string(im, q_rel_info.qid);
+
+		if (0 == strcmp("qrels", last_format)) {
+			TEXT_QRELS_INFO info = *(TEXT_QRELS_INFO *) q_rel_info.q_rel_info;
+			offset = image_alloc(im, sizeof(TEXT_QRELS_INFO));
+			info.text_qrels = put_qrels(im, info.text_qrels,
+					info.num_text_qrels);
+			info.max_num_text_qrels = info.num_text_qrels;
+			image_put(im, offset, &info, sizeof(info));
+		} else if (0 == strcmp("qrels_jg", last_format)) {
+			TEXT_QRELS_JG_INFO info =
+					*(TEXT_QRELS_JG_INFO *) q_rel_info.q_rel_info;
+			TEXT_QRELS_JG *jgs = info.text_qrels_jg;
+			size_t jg_offset;
+			offset = image_alloc(im, sizeof(TEXT_QRELS_JG_INFO));
+			jg_offset = image_alloc(im,
+					info.num_text_qrels_jg * sizeof(TEXT_QRELS_JG));
+			info.text_qrels_jg = image_addr(im, jg_offset);
+			image_put(im, offset, &info, sizeof(info));
+			for (j = 0; j < info.num_text_qrels_jg; j++) {
+				TEXT_QRELS_JG jg = jgs[j];
+				jg.text_qrels = put_qrels(im, jg.text_qrels,
+						jg.num_text_qrels);
+				image_put(im, jg_offset + j * sizeof(TEXT_QRELS_JG), &jg,
+						sizeof(jg));
+			}
+		} else if (0 == strcmp("prefs", last_format)
+				|| 0 == strcmp("qrels_prefs", last_format)) {
+			TEXT_PREFS_INFO info = *(TEXT_PREFS_INFO *) q_rel_info.q_rel_info;
+			TEXT_PREFS *prefs = info.text_prefs;
+			size_t prefs_offset;
+			offset = image_alloc(im, sizeof(TEXT_PREFS_INFO));
+			prefs_offset = image_alloc(im,
+					info.num_text_prefs * sizeof(TEXT_PREFS));
+			info.text_prefs = image_addr(im, prefs_offset);
+			info.max_num_text_prefs = info.num_text_prefs;
+			image_put(im, offset, &info, sizeof(info));
+			for (j = 0; j < info.num_text_prefs; j++) {
+				TEXT_PREFS pref = prefs[j];
+				pref.jg = image_string(im, pref.jg);
+				pref.jsg = image_string(im, pref.jsg);
+				pref.docno = image_string(im, pref.docno);
+				image_put(im, prefs_offset + j * sizeof(TEXT_PREFS), &pref,
+						sizeof(pref));
+			}
+		} else {
+			fprintf(stderr,
+					"rec_eval.rel_image: rel_format '%s' cannot be imaged\n",
+					last_format);
+			return (UNDEF);
+		}
+		q_rel_info.q_rel_info = image_addr(im, offset);
+		image_put(im, rel_info_offset + i * sizeof(REL_INFO), &q_rel_info,
+				sizeof(q_rel_info));
+	}
+
+	(void) memset(&header, 0, sizeof(header));
+	(void) strcpy(header.magic, REL_IMAGE_MAGIC);
+	header.base = im->base;
+	header.size = im->used;
+	(void) strcpy(header.rel_format, rel_format);
+	header.all_rel_info.num_q_rels = all_rel_info->num_q_rels;
+	header.all_rel_info.max_num_q_rels = all_rel_info->num_q_rels;
+	header.all_rel_info.rel_info = image_addr(im, rel_info_offset);
+	image_put(im, header_offset, &header, sizeof(header));
+	return (1);
+}
+
+/* Put a copy of the text_qrels array in the image, returning its address */
+static void *put_qrels(IMAGE *im, const TEXT_QRELS *text_qrels,
+		long num_text_qrels) {
+	TEXT_QRELS qrel;
+	size_t offset;
+	long i;
+
+	offset = image_alloc(im, num_text_qrels * sizeof(TEXT_QRELS));
+	for (i = 0; i < num_text_qrels; i++) {
+		qrel.docno = image_string(im, text_qrels[i].docno);
+		qrel.rel = text_qrels[i].rel;
+		image_put(im, offset + i * sizeof(TEXT_QRELS), &qrel, sizeof(qrel));
+	}
+	return (image_addr(im, offset));
+}
+
+/* Reserve size bytes in the image, returning their offset */
+static size_t image_alloc(IMAGE *im, size_t size) {
+	size_t offset = im->used;
+
+	im->used += (size + IMAGE_ALIGN - 1) & ~((size_t) IMAGE_ALIGN - 1);
+	return (offset);
+}
+
+/* Address of offset once the image is attached */
+static void *image_addr(const IMAGE *im, size_t offset) {
+	return ((void *) (im->base + offset));
+}
+
+static void image_put(IMAGE *im, size_t offset, const void *item, size_t size) {
+	if (im->buf)
+		(void) memcpy(im->buf + offset, item, size);
+}
+
+static char *image_string(IMAGE *im, const char *string) {
+	size_t offset = image_alloc(im, strlen(string) + 1);
+
+	image_put(im, offset, string, strlen(string) + 1);
+	return (image_addr(im, offset));
+}
+
+/* Add delta to all pointers in the image at header */
+#define RELOCATE(ptr, delta) ((ptr) = (void *) ((char *) (ptr) + (delta)))
+
+static void relocate_image(REL_IMAGE_HEADER *header, long delta) {
+	REL_INFO *rel_info;
+	long i, j;
+
+	RELOCATE(header->all_rel_info.rel_info, delta);
+	rel_info = header->all_rel_info.rel_info;
+	for (i = 0; i < header->all_rel_info.num_q_rels; i++) {
+		RELOCATE(rel_info[i].qid, delta);
+		RELOCATE(rel_info[i].rel_format, delta);
+		RELOCATE(rel_info[i].q_rel_info, delta);
+		if (0 == strcmp("qrels", rel_info[i].rel_format)) {
+			TEXT_QRELS_INFO *info = rel_info[i].q_rel_info;
+			relocate_qrels(&info->text_qrels, info->num_text_qrels, delta);
+		} else if (0 == strcmp("qrels_jg", rel_info[i].rel_format)) {
+			TEXT_QRELS_JG_INFO *info = rel_info[i].q_rel_info;
+			RELOCATE(info->text_qrels_jg, delta);
+			for (j = 0; j < info->num_text_qrels_jg; j++)
+				relocate_qrels(&info->text_qrels_jg[j].text_qrels,
+						info->text_qrels_jg[j].num_text_qrels, delta);
+		} else {
+			TEXT_PREFS_INFO *info = rel_info[i].q_rel_info;
+			RELOCATE(info->text_prefs, delta);
+			for (j = 0; j < info->num_text_prefs; j++) {
+				RELOCATE(info->text_prefs[j].jg, delta);
+				RELOCATE(info->text_prefs[j].jsg, delta);
+				RELOCATE(info->text_prefs[j].docno, delta);
+			}
+		}
+	}
+}
+
+static void relocate_qrels(TEXT_QRELS **text_qrels, long num_text_qrels,
+		long delta) {
+	long i;
+
+	RELOCATE(*text_qrels, delta);
+	for (i = 0; i < num_text_qrels; i++)
+		RELOCATE((*text_qrels)[i].docno, delta);
+}
@@ -0,0 +1,204 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "functions.h"
+
+/* Several rel info files, of different formats, given with -R format:file
+ instead of the single rel_info_file argument.
+
+ Each measure is evaluated against one of them: the first input of a
+ format the measure needs.  The measures needing each format other than
+ qrels are those of the nicknames of rel_format_measures; all others need
+ qrels.  Each loader keeps its own storage, so files of different formats
+ can be held at once, but only one of each format.
+ */
+
+extern long te_num_trec_measure_nicknames;
+extern TREC_MEASURE_NICKNAMES te_trec_measure_nicknames[];
+extern long te_num_rel_info_format;
+extern REL_INFO_FILE_FORMAT te_rel_info_format[];
+
+typedef struct {
+	char *format;
+	char *file;
+} REL_INFO_INPUT;
+
+/* Nicknames listing the measures that need each rel info format other
+ than qrels */
+static struct {
+	char *format;
+	char *nickname;
+} rel_format_measures[] = { { "prefs", "all_prefs" }, { "qrels_prefs",
+		"all_prefs" }, { "qrels_jg", "qrels_jg" } };
+static const long num_rel_format_measures = sizeof(rel_format_measures)
+		/ sizeof(rel_format_measures[0]);
+
+static int in_nickname(const char *nickname, const char *name);
+
+static REL_INFO_INPUT *rel_info_inputs = NULL;
+static long num_rel_info_inputs = 0;
+static long max_num_rel_info_inputs = 0;
+
+/* Rel info of each input, once read */
+static ALL_REL_INFO *all_rel_infos = NULL;
+static long num_all_rel_infos = 0;
+
+/* Add the rel info input optarg, of form format:file.  Each format can
+ only be given once, since its loader holds a single file, and file must
+ be a text file, since images of all formats share the storage of
+ rel_image.c.  Errors are reported here */
+int te_add_rel_info_input(EPI *epi, char *optarg) {
+	char *ptr;
+	long i;
+
+	ptr = strchr(optarg, ':');
+	for (i = 0; i < te_num_rel_info_format; i++) {
+		if (strlen(te_rel_info_format[i].name) == ptr - optarg
+				&& 0 == strncmp(optarg, te_rel_info_format[i].name,
+						ptr - optarg))
+			break;
+	}
+	if (i >= te_num_rel_info_format || '\0' == ptr[1]) {
+		fprintf(stderr, "rec_eval: illegal rel info file '%s'\n", optarg);
+		return (UNDEF);
+	}
+	for (i = 0; i < num_rel_info_inputs; i++) {
+		if (strlen(rel_info_inputs[i].format) == ptr - optarg
+				&& 0 == strncmp(optarg, rel_info_inputs[i].format,
+						ptr - optarg)) {
+			fprintf(stderr, "rec_eval: format %s given twice with -R\n",
+					rel_info_inputs[i].format);
+			return (UNDEF);
+		}
+	}
+	if (te_is_rel_image(ptr + 1)) {
+		fprintf(stderr, "rec_eval: -R format:file needs text rel_info files\n");
+		return (UNDEF);
+	}
+	*ptr++ = '\0';
+	if (NULL
+			== (rel_info_inputs = te_chk_and_realloc(rel_info_inputs,
+					&max_num_rel_info_inputs, num_rel_info_inputs + 1,
+					sizeof(REL_INFO_INPUT))))
+		return (UNDEF);
+	rel_info_inputs[num_rel_info_inputs].format = optarg;
+	rel_info_inputs[num_rel_info_inputs].file = ptr;
+	num_rel_info_inputs++;
+	/* For the format descriptions of -h */
+	epi->rel_info_format = optarg;
+	return (1);
+}
+
+/* Number of rel info inputs given, 0 if the rel_info_file argument is to
+ be used */
+long te_num_rel_info_inputs() {
+	return (num_rel_info_inputs);
+}
+
+/* Index of the rel info input measure name is evaluated against: the
+ first whose format the measure needs (see rel_format_measures).
+ Measures listed for every format (runid, num_q) take the first input.
+ UNDEF if no input has a format the measure needs */
+long te_meas_rel_info_input(const char *name) {
+	long i, r;
+	long num_listed = 0;
+
+	for (i = 0; i < num_rel_format_measures; i++) {
+		if (in_nickname(rel_format_measures[i].nickname, name))
+			num_listed++;
+	}
+	if (num_listed == num_rel_format_measures)
+		return (0);
+	for (r = 0; r < num_rel_info_inputs; r++) {
+		if (0 == num_listed) {
+			if (0 == strcmp("qrels", rel_info_inputs[r].format))
+				return (r);
+			continue;
+		}
+		for (i = 0; i < num_rel_format_measures; i++) {
+			if (0 == strcmp(rel_format_measures[i].format,
+					rel_info_inputs[r].format)
+					&& in_nickname(rel_format_measures[i].nickname, name))
+				return (r);
+		}
+	}
+	return (UNDEF);
+}
+
+/* Read the rel info of every input, in the order given, into
+ *all_rel_info (one ALL_REL_INFO per input).  Errors are reported here */
+int te_get_rel_info_inputs(EPI *epi, ALL_REL_INFO **all_rel_info) {
+	long i, r;
+
+	if (NULL
+			== (all_rel_infos = Malloc(num_rel_info_inputs, ALL_REL_INFO)))
+		return (UNDEF);
+	num_all_rel_infos = num_rel_info_inputs;
+	for (r = 0; r < num_rel_info_inputs; r++) {
+		for (i = 0; i < te_num_rel_info_format; i++) {
+			if (0 == strcmp(rel_info_inputs[r].format,
+					te_rel_info_format[i].name))
+				break;
+		}
+		epi->rel_info_format = rel_info_inputs[r].format;
+		if (UNDEF
+				== te_rel_info_format[i].get_file(epi, rel_info_inputs[r].file,
+						&all_rel_infos[r])) {
+			fprintf(stderr, "rec_eval: Quit in file '%s'\n",
+					rel_info_inputs[r].file);
+			return (UNDEF);
+		}
+	}
+	*all_rel_info = all_rel_infos;
+	return (1);
+}
+
+/* Free the rel info read for the inputs and the inputs themselves */
+int te_rel_info_inputs_cleanup() {
+	long i, r;
+
+	for (r = 0; r < num_all_rel_infos; r++) {
+		for (i = 0; i < te_num_rel_info_format; i++) {
+			if (0 == strcmp(rel_info_inputs[r].format,
+					te_rel_info_format[i].name)) {
+				if (UNDEF == te_rel_info_format[i].cleanup())
+					return (UNDEF);
+				break;
+			}
+		}
+	}
+	if (all_rel_infos) {
+		Free(all_rel_infos);
+		all_rel_infos = NULL;
+	}
+	num_all_rel_infos = 0;
+	if (max_num_rel_info_inputs > 0) {
+		Free(rel_info_inputs);
+		max_num_rel_info_inputs = 0;
+	}
+	num_rel_info_inputs = 0;
+	return (1);
+}
+
+/* Whether measure name is one of those of nickname */
+static int in_nickname(const char *nickname, const char *name) {
+	long i;
+	char **list;
+
+	for (i = 0; i < te_num_trec_measure_nicknames; i++) {
+		if (0 == strcmp(nickname, te_trec_measure_nicknames[i].name)) {
+			for (list = te_trec_measure_nicknames[i].name_list; *list; list++)
+				if (0 == strcmp(name, *list))
+					return (1);
+			break;
+		}
+	}
+	return (0);
+}
@@ -0,0 +1,123 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include "common.h"
+#include "sysfunc.h"
+#include "trec_eval.h"
+#include "functions.h"
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Accept evaluation requests (--serve) on the Unix domain socket
+ socket_path until terminated by SIGINT or SIGTERM.
+
+ Each connection is handed to a child process, which calls
+ serve_request(fd, info) and exits with its return value.  The children
+ share the server's memory (notably the rel_info, read once) copy on
+ write, and get their own copy of all the measure and loader state, so
+ requests cannot interfere with each other or with the server.  At most
+ num_jobs requests are served at the same time; further connections wait
+ in the listen queue.
+ */
+
+static void stop_serving(int sig);
+static void reap_children(long *num_running, int options);
+
+static volatile sig_atomic_t stop_flag = 0;
+
+int te_serve(const char *socket_path, long num_jobs,
+		int (*serve_request)(int fd, void *info), void *info) {
+	struct sockaddr_un addr;
+	struct sigaction action;
+	struct stat buf;
+	int sock, fd;
+	long num_running = 0;
+	pid_t pid;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "rec_eval.serve: Socket name too long '%s'\n",
+				socket_path);
+		return (UNDEF);
+	}
+	/* Replace the socket of an earlier server, but nothing else */
+	if (0 == stat(socket_path, &buf) && S_ISSOCK(buf.st_mode))
+		(void) unlink(socket_path);
+
+	(void) memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	(void) strcpy(addr.sun_path, socket_path);
+	if (-1 == (sock = socket(AF_UNIX, SOCK_STREAM, 0))
+			|| -1 == bind(sock, (struct sockaddr *) &addr, sizeof(addr))
+			|| -1 == listen(sock, SOMAXCONN)) {
+		fprintf(stderr, "rec_eval.serve: Cannot listen on socket '%s'\n",
+				socket_path);
+		return (UNDEF);
+	}
+
+	/* No SA_RESTART, so that a blocked accept or wait is interrupted */
+	(void) memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_serving;
+	(void) sigemptyset(&action.sa_mask);
+	(void) sigaction(SIGINT, &action, NULL);
+	(void) sigaction(SIGTERM, &action, NULL);
+	/* A client going away only fails its own request */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	while (!stop_flag) {
+		reap_children(&num_running, WNOHANG);
+		if (num_running >= num_jobs) {
+			reap_children(&num_running, 0);
+			continue;
+		}
+		if (-1 == (fd = accept(sock, NULL, NULL))) {
+			if (EINTR == errno || ECONNABORTED == errno)
+				continue;
+			fprintf(stderr, "rec_eval.serve: Cannot accept on socket '%s'\n",
+					socket_path);
+			break;
+		}
+		(void) fflush(stdout);
+		(void) fflush(stderr);
+		if (-1 == (pid = fork())) {
+			fprintf(stderr, "rec_eval.serve: Cannot start request\n");
+			(void) close(fd);
+			continue;
+		}
+		if (0 == pid) {
+			(void) close(sock);
+			(void) signal(SIGINT, SIG_DFL);
+			(void) signal(SIGTERM, SIG_DFL);
+			exit(serve_request(fd, info));
+		}
+		(void) close(fd);
+		num_running++;
+	}
+
+	(void) close(sock);
+	(void) unlink(socket_path);
+	/* Let the requests being served finish */
+	while (num_running > 0)
+		reap_children(&num_running, 0);
+	return (stop_flag ? 1 : UNDEF);
+}
+
+static void stop_serving(int sig) {
+	stop_flag = 1;
+}
+
+/* Wait for finished children; with options 0, block until one finishes
+ (or a signal arrives) */
+static void reap_children(long *num_running, int options) {
+	int status;
+
+	while (*num_running > 0 && 0 < waitpid(-1, &status, options)) {
+		(*num_running)--;
+		options = WNOHANG;
+	}
+}
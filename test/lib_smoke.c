@@ -0,0 +1,230 @@
+/*
+ Copyright (c) 2008 - Chris Buckley.
+
+ Permission is granted for use and modification of this file for
+ research, non-commercial purposes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "rec_eval.h"
+
+/* Smoke test of librec_eval (make libtest).
+
+ lib_smoke [-t threads] qrels_file results_file measure ...
+ loads qrels_file (qid iter docno rel, all integers) with
+ rec_eval_load_qrels_arrays, evaluates results_file (qid Q0 docno rank
+ sim run, sorted by qid, integer qid and docno) with
+ rec_eval_evaluate_arrays, and prints every per query and summary value
+ as
+ measure_name  qid  value
+ with qid "all" for the summary, as rec_eval -q does (values to 4
+ places), so that it can be compared with the command's output.
+ With -t, each of threads contexts loads and evaluates on a thread of its
+ own, all at the same time, and their values must all be the same.
+ */
+
+typedef struct {
+	long num_qrels;
+	int64_t *qrel_users, *qrel_items, *rels;
+	long num_users;
+	int64_t *users, *offsets, *items;
+	float *scores;
+	char **measures;
+	long num_measures;
+} ARRAYS;
+
+typedef struct {
+	const ARRAYS *arrays;
+	rec_eval_ctx *ctx;
+	int status;
+} EVALUATION;
+
+static void *grow(void *ptr, long *max, long needed, size_t size) {
+	if (needed <= *max)
+		return (ptr);
+	*max = 2 * needed;
+	if (NULL == (ptr = realloc(ptr, *max * size))) {
+		fprintf(stderr, "lib_smoke: out of memory\n");
+		exit(1);
+	}
+	return (ptr);
+}
+
+/* Load the qrels and evaluate the results of the ARRAYS of an EVALUATION
+ with its own context */
+static void *evaluate(void *ptr) {
+	EVALUATION *ev = ptr;
+	const ARRAYS *a = ev->arrays;
+	long i;
+
+	ev->status = -1;
+	if (-1 == rec_eval_load_qrels_arrays(ev->ctx, a->num_qrels,
+			a->qrel_users, a->qrel_items, a->rels))
+		return (NULL);
+	for (i = 0; i < a->num_measures; i++)
+		if (-1 == rec_eval_add_measure(ev->ctx, a->measures[i]))
+			return (NULL);
+	ev->status = rec_eval_evaluate_arrays(ev->ctx, a->num_users, a->users,
+			a->offsets, a->items, a->scores);
+	return (NULL);
+}
+
+/* Whether ctx2 has the same values as ctx1 */
+static int same_values(const rec_eval_ctx *ctx1, const rec_eval_ctx *ctx2) {
+	double value1, value2;
+	long q, v;
+
+	if (rec_eval_num_queries(ctx1) != rec_eval_num_queries(ctx2)
+			|| rec_eval_num_values(ctx1) != rec_eval_num_values(ctx2))
+		return (0);
+	for (v = 0; v < rec_eval_num_values(ctx1); v++) {
+		for (q = -1; q < rec_eval_num_queries(ctx1); q++) {
+			value1 = q < 0 ? rec_eval_value(ctx1, v)
+					: rec_eval_query_value(ctx1, q, v);
+			value2 = q < 0 ? rec_eval_value(ctx2, v)
+					: rec_eval_query_value(ctx2, q, v);
+			if (value1 != value2 && !(isnan(value1) && isnan(value2)))
+				return (0);
+		}
+	}
+	return (1);
+}
+
+int main(int argc, char **argv) {
+	ARRAYS a;
+	EVALUATION *evs;
+	pthread_t *threads;
+	FILE *fd;
+	long max_qrel_users = 0, max_qrel_items = 0, max_rels = 0;
+	long max_users = 0, max_offsets = 0, max_items = 0, max_scores = 0;
+	long num_threads = 1;
+	long num, t, q, v;
+	long long user, item, rel;
+	double sim, value;
+	char iter[64];
+
+	if (argc > 2 && 0 == strcmp(argv[1], "-t")) {
+		num_threads = atol(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 4 || num_threads < 1) {
+		fprintf(stderr,
+				"usage: lib_smoke [-t threads] qrels_file results_file measure ...\n");
+		exit(1);
+	}
+	(void) memset(&a, 0, sizeof(a));
+
+	if (NULL == (fd = fopen(argv[1], "r"))) {
+		fprintf(stderr, "lib_smoke: cannot read '%s'\n", argv[1]);
+		exit(1);
+	}
+	for (num = 0; 4 == fscanf(fd, "%lld %63s %lld %lld", &user, iter,
+			&item, &rel); num++) {
+		a.qrel_users = grow(a.qrel_users, &max_qrel_users, num + 1,
+				sizeof(int64_t));
+		a.qrel_items = grow(a.qrel_items, &max_qrel_items, num + 1,
+				sizeof(int64_t));
+		a.rels = grow(a.rels, &max_rels, num + 1, sizeof(int64_t));
+		a.qrel_users[num] = user;
+		a.qrel_items[num] = item;
+		a.rels[num] = rel;
+	}
+	(void) fclose(fd);
+	a.num_qrels = num;
+
+	if (NULL == (fd = fopen(argv[2], "r"))) {
+		fprintf(stderr, "lib_smoke: cannot read '%s'\n", argv[2]);
+		exit(1);
+	}
+	for (num = 0; 4 == fscanf(fd, "%lld %63s %lld %*s %lf %*s", &user, iter,
+			&item, &sim); num++) {
+		if (0 == a.num_users || a.users[a.num_users - 1] != user) {
+			a.users = grow(a.users, &max_users, a.num_users + 1,
+					sizeof(int64_t));
+			a.offsets = grow(a.offsets, &max_offsets, a.num_users + 2,
+					sizeof(int64_t));
+			a.users[a.num_users] = user;
+			a.offsets[a.num_users++] = num;
+		}
+		a.items = grow(a.items, &max_items, num + 1, sizeof(int64_t));
+		a.scores = grow(a.scores, &max_scores, num + 1, sizeof(float));
+		a.items[num] = item;
+		a.scores[num] = (float) sim;
+	}
+	(void) fclose(fd);
+	a.offsets = grow(a.offsets, &max_offsets, a.num_users + 1,
+			sizeof(int64_t));
+	a.offsets[a.num_users] = num;
+	a.measures = &argv[3];
+	a.num_measures = argc - 3;
+
+	if (NULL == (evs = malloc(num_threads * sizeof(EVALUATION)))
+			|| NULL == (threads = malloc(num_threads * sizeof(pthread_t)))) {
+		fprintf(stderr, "lib_smoke: out of memory\n");
+		exit(1);
+	}
+	for (t = 0; t < num_threads; t++) {
+		evs[t].arrays = &a;
+		if (NULL == (evs[t].ctx = rec_eval_create())) {
+			fprintf(stderr, "lib_smoke: out of memory\n");
+			exit(1);
+		}
+	}
+	if (1 == num_threads)
+		(void) evaluate(&evs[0]);
+	else {
+		for (t = 0; t < num_threads; t++) {
+			if (0 != pthread_create(&threads[t], NULL, evaluate, &evs[t])) {
+				fprintf(stderr, "lib_smoke: cannot start thread\n");
+				exit(1);
+			}
+		}
+		for (t = 0; t < num_threads; t++)
+			(void) pthread_join(threads[t], NULL);
+	}
+	for (t = 0; t < num_threads; t++) {
+		if (-1 == evs[t].status) {
+			fprintf(stderr, "lib_smoke: %s\n", rec_eval_error(evs[t].ctx));
+			exit(1);
+		}
+	}
+
+	/* Every context must agree with the first */
+	for (t = 1; t < num_threads; t++) {
+		if (!same_values(evs[0].ctx, evs[t].ctx)) {
+			fprintf(stderr, "lib_smoke: values of thread %ld differ\n", t);
+			exit(1);
+		}
+	}
+
+	for (q = 0; q < rec_eval_num_queries(evs[0].ctx); q++) {
+		for (v = 0; v < rec_eval_num_values(evs[0].ctx); v++) {
+			value = rec_eval_query_value(evs[0].ctx, q, v);
+			if (!isnan(value))
+				printf("%s\t%s\t%.4f\n", rec_eval_value_name(evs[0].ctx, v),
+						rec_eval_query_id(evs[0].ctx, q), value);
+		}
+	}
+	for (v = 0; v < rec_eval_num_values(evs[0].ctx); v++)
+		printf("%s\tall\t%.4f\n", rec_eval_value_name(evs[0].ctx, v),
+				rec_eval_value(evs[0].ctx, v));
+
+	for (t = 0; t < num_threads; t++)
+		rec_eval_destroy(evs[t].ctx);
+	free(evs);
+	free(threads);
+	free(a.qrel_users);
+	free(a.qrel_items);
+	free(a.rels);
+	free(a.users);
+	free(a.offsets);
+	free(a.items);
+	free(a.scores);
+	return (0);
+}
@@ -9,10 +9,22 @@ static char *VersionID = VERSIONID;
 static char *help_message =
 		"rec_eval [-h] [-q] [-m measure[.params] [-c] [-n] [-l <num>]\n\
    [-D debug_level] [-N <num>] [-M <num>] [-R rel_format] [-T results_format]\n\
-   rel_info_file  results_file \n\
+   [-F runs_file] [-j <num>] [--emit-partial partial_file]\n\
+   [--cache cache_file] [--prefs-conflicts policy]\n\
+   rel_info_file  results_file [results_file ...]\n\
+rec_eval [options] -R rel_format:rel_info_file [-R rel_format:rel_info_file\n\
+   ...] results_file [results_file ...]\n\
+rec_eval [-c] [-m measure[.params]] [-M <num>] --merge partial_file ...\n\
+rec_eval [-R rel_format] [-j <num>] --serve socket rel_info_file\n\
+rec_eval [-R rel_format] --publish image_file rel_info_file\n\
+rec_eval [options] --build-zscores Zmean_file rel_info_file results_file ...\n\
  \n\
 Calculate and print various evaluation measures, evaluating the results  \n\
 in results_file against the relevance info in rel_info_file. \n\
+If several results files are given, rel_info_file is read only once and \n\
+each run is evaluated against it in turn (several runs at once, see -j). \n\
+The output for each run starts with a line 'runid all <runid>', and runs \n\
+are printed in the order given. \n\
  \n\
 There are a fair number of options, of which only the lower case options are \n\
 normally ever used.   \n\
@@ -33,6 +45,11 @@ normally ever used.   \n\
     preceeding the period, and everything to the right of the period is\n\
     assumed to be a list of parameters for the measure, separated by ','. \n\
     There can be multiple occurrences of the -m flag.\n\
+    If the parameters start with 'label:', a separately named instance\n\
+    '<measure>_<label>' of the measure is evaluated with those parameters,\n\
+    so the same measure can be requested with several parameter sets in\n\
+    one run. Eg, '-m ndcg.A:1=1,2=3 -m ndcg.B:1=1,2=7'.  Only measures\n\
+    taking parameters can be labelled.\n\
     'measure' can also be a nickname for a set of measures. Current \n\
     nicknames include \n\
        'official': the main measures often used by TREC\n\
@@ -61,8 +78,11 @@ normally ever used.   \n\
  --Number_docs_in_coll num:\n\
  -N <num>: Number of docs in collection Default is MAX_LONG \n\
  -Max_retrieved_per_topic num:\n\
- -M <num>: Max number of docs per topic to use in evaluation (discard rest). \n\
-      Default is MAX_LONG.\n\
+ -M <num>[,<num>...]: Max number of docs per topic to use in evaluation\n\
+      (discard rest). Default is MAX_LONG.  If a comma separated list of\n\
+      depths is given, every measure is evaluated at each depth, sharing a \n\
+      single ranking of the results per topic.  Values for a depth are\n\
+      reported with '@<depth>' appended to the qid (eg, 'all@100').\n\
  --Judged_docs_only:\n\
  -J: Calculate all values only over the judged (either relevant or  \n\
      nonrelevant) documents.  All unjudged documents are removed from the \n\
@@ -74,10 +94,73 @@ normally ever used.   \n\
  -R format: The rel_info file is assumed to be in format 'format'.  Current\n\
     values for 'format' include 'qrels', 'prefs', 'qrels_prefs'.  Note not\n\
     all measures can be calculated with all formats.\n\
+ -R format:rel_info_file: Read rel_info_file in format 'format'.  Several\n\
+    rel info files of different formats may be given this way (and then\n\
+    no rel_info_file argument), so that eg, '-m recsys -m all_prefs -R\n\
+    qrels:file1 -R prefs:file2' evaluates qrels and preference measures\n\
+    with one read and ranking of the results.  Measures of the all_prefs\n\
+    nickname use the prefs (or qrels_prefs) file, those of the qrels_jg\n\
+    nickname the qrels_jg file, and all others the qrels file.  Queries\n\
+    are evaluated if they have results and are judged in every file.\n\
+    Not available with --serve, --publish, --merge, --emit-partial,\n\
+    --cache or --max-memory.\n\
  --Results_format format:\n\
  -T format: the top results_file is assumed to be in format 'format'. Current\n\
     values for 'format' include 'trec_results'. Note not all measures can be\n\
     calculated with all formats.\n\
+ --runs-from runs_file:\n\
+ -F runs_file: Also evaluate the results files named in runs_file, one per\n\
+    line, after any given on the command line.\n\
+ --jobs num:\n\
+ -j <num>: Evaluate at most num results files at the same time when several\n\
+    are given.  Default is the number of online processors.\n\
+ --emit-partial partial_file:\n\
+    Instead of printing the summary, write the raw accumulated values of\n\
+    each query and the rel_info queries to partial_file, so that runs\n\
+    evaluated in shards (each shard with some of the queries of the run)\n\
+    can be summarized together with --merge.\n\
+ --cache cache_file:\n\
+    Keep the values of each query evaluated in cache_file, and take those\n\
+    of queries whose results and rel info are unchanged since the last\n\
+    evaluation with cache_file from it instead of calculating them again.\n\
+    Output is unchanged.  The cache is only used by evaluations with the\n\
+    same measures and options; others start it afresh.\n\
+ --prefs-conflicts policy:\n\
+    What to do with a judgment group of a 'prefs' rel_info_file whose\n\
+    preferences are inconsistent (form a cycle).  The cycles are listed\n\
+    when the file is read, and then 'fail' (the default) stops, 'drop-jg'\n\
+    ignores the judgment group, and 'drop-cycles' ignores the judgments\n\
+    of the docs in the cycles.\n\
+ --max-memory size:\n\
+    Read the rel_info and results files a range of queries at a time, so\n\
+    that about size bytes (suffix K, M or G) of them are held in memory.\n\
+    The queries are spilled to temporary files in $TMPDIR.  Output is the\n\
+    same as when evaluating all of them at once.\n\
+ --serve socket:\n\
+    Read rel_info_file once and serve evaluation requests on the Unix\n\
+    domain socket, until terminated.  A request is one line of options\n\
+    and results files as on the command line, without the rel_info file\n\
+    (paths are relative to the server's directory).  A results file '-'\n\
+    is read from the rest of the connection, after the request line.\n\
+    The output is written back and the connection closed.  Options\n\
+    given to the server apply to every request; -R cannot be changed by\n\
+    a request.  Up to -j requests are evaluated at the same time.\n\
+    Requests cannot make the server write files (--emit-partial, --cache,\n\
+    --build-zscores, --publish) or read any but results files (-F, -R;\n\
+    -Z only as the server's own Zmean_file), but the server reads the\n\
+    results files requested with its own permissions: only let clients\n\
+    trusted with those permissions reach the socket.\n\
+ --publish image_file:\n\
+    Write the rel info read from rel_info_file to image_file, ready to be\n\
+    mapped into memory.  image_file can then be given as the rel_info_file\n\
+    (with the same -R) of any number of later evaluations, which attach to\n\
+    it read-only instead of reading the text file, and share one copy of\n\
+    it in memory.  Put it in /dev/shm to keep it in memory.\n\
+ --merge:\n\
+    Print the summary of the partial_files given as remaining arguments\n\
+    (no rel_info or results file), exactly as one evaluation of all their\n\
+    queries would have.  Measure options (-m, -c, -M, ...) must be those\n\
+    the partial files were written with.\n\
  --Zscore Zmean_file:\n\
  -Z Zmean_file: Instead of printing the raw score for each measure, print\n\
     a Z score instead. The score printed will be the deviation from the mean\n\
@@ -86,6 +169,13 @@ normally ever used.   \n\
     If mean is not in Zmeanfile for a measure and query, -1000000 is printed.\n\
     Zmean_file format is ascii lines of form \n\
        qid  measure_name  mean  std_dev\n\
+ --build-zscores Zmean_file:\n\
+    Write a Zmean_file for -Z instead of printing any evaluation.  The\n\
+    results_files are the reference runs; each is evaluated (several at\n\
+    once, see -j) with the measures and options given, and the mean and\n\
+    sample standard deviation over the runs of every measure for every\n\
+    query are written to Zmean_file.  Cannot be used with several -M\n\
+    depths.\n\
  \n\
  \n\
 Standard evaluation procedure:\n\
@@ -115,7 +205,7 @@ it will not be detected.  Use the -c flag to avoid this behavior. \n\
 #endif /* MDEBUG */
 
 static char *usage =
-		"Usage: rec_eval [-h] [-q] {-m measure}* trec_rel_file trec_top_file\n\
+		"Usage: rec_eval [-h] [-q] {-m measure}* trec_rel_file trec_top_file {trec_top_file}*\n\
    -h: Give full help information, including other options\n\
    -q: In addition to summary evaluation, give evaluation for each query\n\
    -m: calculate and print measures indicated by 'measure'\n\
@@ -132,27 +222,137 @@ extern RESULTS_FILE_FORMAT te_results_format[];
 extern long te_num_form_inter_procs;
 extern RESULTS_FILE_FORMAT te_form_inter_procs[];
 
+/* Measure instances to be evaluated, in evaluation order.  Normally just
+ the marked entries of te_trec_measures.  If several -M depths are given,
+ every measure gets a private copy (own params and eval_index) for each
+ depth after the first */
+typedef struct {
+	TREC_MEAS *tm;
+	long depth; /* Index into epi->max_num_docs_list */
+	long copied; /* tm is a malloc'd copy of a te_trec_measures entry */
+	long rel_info; /* Index of the rel info input (-R format:file, see
+	 rel_info_inputs.c) the measure is evaluated against, 0 if a single
+	 one */
+	long first_value, end_value; /* The measure's values in a TREC_EVAL
+	 are those from first_value up to end_value */
+} MEAS_INST;
+
+/* Labelled instances of measures (-m ndcg.A:1=1,2=3), each a private copy
+ of its base te_trec_measures entry named <base>_<label> */
+typedef struct {
+	TREC_MEAS *tm;
+	long base; /* Index of base measure in te_trec_measures */
+} LABELLED_MEAS;
+static LABELLED_MEAS *labelled_meas = NULL;
+static long num_labelled_meas = 0;
+static long max_num_labelled_meas = 0;
+
+/* Options which are not part of the eval parameter info */
+typedef struct {
+	char *runs_from_file;
+	long num_jobs;
+	char *partial_file; /* --emit-partial */
+	char *cache_file; /* --cache */
+	long merge_flag;
+	long max_memory;
+	char *zscores_file;
+	char *serve_socket;
+	char *image_file; /* --publish */
+	char *build_zscores_file; /* --build-zscores */
+	long help_wanted;
+	long measure_marked_flag;
+} OPTIONS;
+
+/* Reference runs of --build-zscores write their raw query values (see
+ build_zscores.c) for the parent to add up, instead of printing */
+static long zscore_values_flag = 0;
+
+/* What each request served (--serve) is evaluated with */
+typedef struct {
+	EPI *epi;
+	OPTIONS *opts;
+	ALL_REL_INFO *all_rel_info;
+	ALL_ZSCORES *all_zscores;
+} SERVE_INFO;
+
+/* Child process evaluating one of several results files */
+typedef struct {
+	pid_t pid;
+	FILE *out; /* Temporary file holding the child's output */
+	long done;
+} RUN_PROC;
+
 static int mark_measure(EPI *epi, char *optarg);
+static int mark_labelled_measure(EPI *epi, char *meas, char *label,
+		char *param);
+static int get_max_num_docs(EPI *epi, char *optarg);
+static int init_meas_insts(EPI *epi, TREC_EVAL *accum_eval,
+		MEAS_INST **meas_insts, long *num_meas_insts);
+static TREC_MEAS *copy_meas(const TREC_MEAS *tm);
+static char *depth_qid(const EPI *epi, const char *qid, const long depth);
 static int trec_eval_help(EPI *epi);
 static void get_debug_level_query(EPI *epi, char *optarg);
-static int cleanup(EPI *epi);
+static int cleanup(EPI *epi, MEAS_INST *meas_insts, long num_meas_insts);
+static void evaluate_run(EPI *epi, char *results_file,
+		const ALL_REL_INFO *all_rel_info, ALL_ZSCORES *all_zscores,
+		long runid_flag, char *partial_file, char *cache_file);
+static void evaluate_partitioned(EPI *epi, char *rel_info_file,
+		char *results_file, ALL_ZSCORES *all_zscores, long max_memory,
+		char *partial_file, char *cache_file);
+static void open_cache(EPI *epi, char *cache_file, MEAS_INST *meas_insts,
+		long num_meas_insts, const TREC_EVAL *accum_eval);
+static void evaluate_results(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, const ALL_REL_INFO *all_rel_info,
+		const ALL_RESULTS *all_results, ALL_ZSCORES *all_zscores,
+		TREC_EVAL *q_eval, TREC_EVAL *q_acc, TREC_EVAL *accum_eval,
+		long cache_flag);
+static void init_q_eval(const TREC_EVAL *accum_eval, TREC_EVAL *q_eval);
+static void get_rel_info(EPI *epi, char *rel_info_file,
+		ALL_REL_INFO *all_rel_info);
+static void get_results(EPI *epi, char *results_file,
+		ALL_RESULTS *all_results);
+static void print_summary(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, const ALL_REL_INFO *all_rel_info,
+		TREC_EVAL *accum_eval);
+static void cleanup_meas_values(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, TREC_EVAL *accum_eval);
+static void merge_partials(EPI *epi, char **partial_files,
+		long num_partial_files);
+static void summarize_partials(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, char **partial_files, long num_partial_files,
+		TREC_EVAL *accum_eval);
+static int cleanup_inputs(EPI *epi);
+static long get_max_memory(char *optarg);
+static void get_options(EPI *epi, OPTIONS *opts, int argc, char **argv);
+static int evaluate_files(EPI *epi, const OPTIONS *opts, char **results_files,
+		long num_runs, const ALL_REL_INFO *all_rel_info,
+		ALL_ZSCORES *all_zscores);
+static int serve_request(int fd, void *serve_info);
+static int get_inline_results(FILE *in, char **results_file);
+static int evaluate_runs(EPI *epi, char **results_files, long num_runs,
+		long num_jobs, const ALL_REL_INFO *all_rel_info,
+		ALL_ZSCORES *all_zscores);
+static int get_runs_from(char *file, char ***results_files, long *num_runs,
+		long *max_num_runs);
+static long find_rel_info(const ALL_REL_INFO *all_rel_info, const char *qid);
 
 int main(argc, argv)
 	int argc;char *argv[]; {
-	char *trec_results_file;
-	ALL_RESULTS all_results;
+	char **results_files = NULL;
+	long num_runs = 0;
+	long max_num_runs = 0;
+	long num_args_runs;
+	long num_rel_args;
+	int exit_status;
 	char *trec_rel_info_file;
 	ALL_REL_INFO all_rel_info;
-	char *zscores_file = NULL;
+	ALL_REL_INFO *all_rel_infos;
 	ALL_ZSCORES all_zscores;
+	SERVE_INFO serve_info;
 
 	EPI epi; /* Eval parameter info */
-	TREC_EVAL accum_eval;
-	TREC_EVAL q_eval;
-	long i, j, m;
-	int c;
-	long help_wanted = 0;
-	long measure_marked_flag = 0;
+	OPTIONS opts;
+	long i;
 
 #ifdef MDEBUG
 	/* Turn on memory debugging if environment variable MALLOC_TRACE is
@@ -173,14 +373,204 @@ int main(argc, argv)
 	epi.num_docs_in_coll = 0;
 	epi.relevance_level = 1;
 	epi.max_num_docs_per_topic = MAXLONG;
+	epi.num_max_num_docs = 0;
+	epi.max_num_docs_list = NULL;
 	epi.rel_info_format = "qrels";
 	epi.results_format = "trec_results";
 	epi.zscore_flag = 0;
+	epi.prefs_conflicts = PREFS_CONFLICTS_FAIL;
 	if (NULL == (epi.meas_arg = Malloc(argc + 1, MEAS_ARG)))
 		exit(1);
 	epi.meas_arg[0].measure_name = NULL;
+	opts.runs_from_file = NULL;
+	if (0 >= (opts.num_jobs = sysconf(_SC_NPROCESSORS_ONLN)))
+		opts.num_jobs = 1;
+	opts.partial_file = NULL;
+	opts.cache_file = NULL;
+	opts.merge_flag = 0;
+	opts.max_memory = 0;
+	opts.zscores_file = NULL;
+	opts.serve_socket = NULL;
+	opts.image_file = NULL;
+	opts.build_zscores_file = NULL;
+	opts.help_wanted = 0;
+	opts.measure_marked_flag = 0;
 
 	/* Get command line options */
+	get_options(&epi, &opts, argc, argv);
+
+	if (opts.help_wanted) {
+		if (UNDEF == trec_eval_help(&epi))
+			return (UNDEF);
+		exit(0);
+	}
+
+	/* Only the raw query values of the reference runs are wanted */
+	if (opts.build_zscores_file) {
+		if (opts.image_file || opts.serve_socket || opts.merge_flag
+				|| opts.partial_file || opts.cache_file || opts.max_memory
+				|| epi.zscore_flag || epi.num_max_num_docs) {
+			fprintf(stderr,
+					"rec_eval: --build-zscores cannot be used with --publish, --serve, --merge, --emit-partial, --cache, --max-memory, -Z or several -M depths\n");
+			exit(1);
+		}
+		epi.query_flag = 0;
+		epi.summary_flag = 0;
+		zscore_values_flag = 1;
+	}
+
+	/* Write an image of the single rel_info file given, for later runs to
+	 attach to */
+	if (opts.image_file) {
+		if (optind + 1 != argc || opts.serve_socket
+				|| te_num_rel_info_inputs()) {
+			(void) fputs(usage, stderr);
+			exit(1);
+		}
+		get_rel_info(&epi, argv[optind], &all_rel_info);
+		if (UNDEF == te_put_rel_image(&epi, &all_rel_info, opts.image_file)
+				|| UNDEF == cleanup_inputs(&epi))
+			exit(2);
+		Free(epi.meas_arg);
+		exit(0);
+	}
+
+	/* Serve evaluation requests against the single rel_info file given.
+	 Measures are marked by each request on top of those given here */
+	if (opts.serve_socket) {
+		if (optind + 1 != argc || opts.merge_flag || opts.partial_file
+				|| opts.runs_from_file || opts.max_memory || opts.cache_file
+				|| te_num_rel_info_inputs()) {
+			(void) fputs(usage, stderr);
+			exit(1);
+		}
+		if (epi.zscore_flag
+				&& UNDEF
+						== te_get_zscores(&epi, opts.zscores_file,
+								&all_zscores))
+			exit(2);
+		get_rel_info(&epi, argv[optind], &all_rel_info);
+		serve_info.epi = &epi;
+		serve_info.opts = &opts;
+		serve_info.all_rel_info = &all_rel_info;
+		serve_info.all_zscores = &all_zscores;
+		if (UNDEF
+				== te_serve(opts.serve_socket, opts.num_jobs, serve_request,
+						&serve_info))
+			exit(2);
+		exit(0);
+	}
+
+	/* Initialize all marked measures (possibly using command line info) */
+	if (0 == opts.measure_marked_flag) {
+		/* If no measures designated on command line, first mark "official" */
+		if (UNDEF == mark_measure(&epi, "official")) {
+			fprintf(stderr, "rec_eval: illegal measure 'official'\n");
+			exit(1);
+		}
+	}
+
+	/* Merge partial accumulator files named by all remaining arguments */
+	if (opts.merge_flag) {
+		if (optind >= argc || opts.partial_file || opts.runs_from_file
+				|| opts.cache_file || te_num_rel_info_inputs()) {
+			(void) fputs(usage, stderr);
+			exit(1);
+		}
+		merge_partials(&epi, &argv[optind], argc - optind);
+		Free(epi.meas_arg);
+		exit(0);
+	}
+
+	/* The rel_info_file argument, unless given with -R format:file */
+	num_rel_args = te_num_rel_info_inputs() ? 0 : 1;
+	if (optind + num_rel_args + 1 > argc
+			&& !(opts.runs_from_file && optind + num_rel_args == argc)) {
+		(void) fputs(usage, stderr);
+		exit(1);
+	}
+
+	trec_rel_info_file = num_rel_args ? argv[optind++] : NULL;
+
+	/* Results files are all remaining arguments, then those listed in
+	 runs_from_file */
+	if (NULL
+			== (results_files = te_chk_and_realloc(results_files, &max_num_runs,
+					argc - optind + 1, sizeof(char *))))
+		exit(3);
+	while (optind < argc)
+		results_files[num_runs++] = argv[optind++];
+	num_args_runs = num_runs;
+	if (opts.runs_from_file
+			&& UNDEF
+					== get_runs_from(opts.runs_from_file, &results_files,
+							&num_runs, &max_num_runs))
+		exit(2);
+	if (0 == num_runs) {
+		(void) fputs(usage, stderr);
+		exit(1);
+	}
+	if (opts.max_memory && 1 != num_runs) {
+		fprintf(stderr, "rec_eval: --max-memory needs a single results file\n");
+		exit(1);
+	}
+	if (opts.cache_file && 1 != num_runs) {
+		fprintf(stderr, "rec_eval: --cache needs a single results file\n");
+		exit(1);
+	}
+	if (te_num_rel_info_inputs()
+			&& (opts.max_memory || opts.cache_file || opts.partial_file)) {
+		fprintf(stderr,
+				"rec_eval: --max-memory, --cache and --emit-partial need a single rel_info file\n");
+		exit(1);
+	}
+	if (opts.max_memory && te_is_rel_image(trec_rel_info_file)) {
+		fprintf(stderr, "rec_eval: --max-memory needs a text rel_info file\n");
+		exit(1);
+	}
+
+	if (epi.zscore_flag) {
+		if (UNDEF == te_get_zscores(&epi, opts.zscores_file, &all_zscores))
+			return (UNDEF);
+	}
+
+	/* Find and get qrels information for all queries from the input text
+	 file, unless it is to be read a partition at a time */
+	if (opts.max_memory)
+		evaluate_partitioned(&epi, trec_rel_info_file, results_files[0],
+				&all_zscores, opts.max_memory, opts.partial_file,
+				opts.cache_file);
+	else if (te_num_rel_info_inputs()) {
+		if (UNDEF == te_get_rel_info_inputs(&epi, &all_rel_infos))
+			exit(2);
+		if (0
+				!= (exit_status = evaluate_files(&epi, &opts, results_files,
+						num_runs, all_rel_infos, &all_zscores)))
+			exit(exit_status);
+	} else {
+		get_rel_info(&epi, trec_rel_info_file, &all_rel_info);
+		if (0
+				!= (exit_status = evaluate_files(&epi, &opts, results_files,
+						num_runs, &all_rel_info, &all_zscores)))
+			exit(exit_status);
+	}
+
+	for (i = num_args_runs; i < num_runs; i++)
+		Free(results_files[i]);
+	Free(results_files);
+	Free(epi.meas_arg);
+	if (UNDEF == te_rel_info_inputs_cleanup()) {
+		fprintf(stderr, "rec_eval: cleanup failed\n");
+		exit(10);
+	}
+
+	exit(0);
+}
+
+/* Set epi and opts from the command line options in argv */
+static void get_options(EPI *epi, OPTIONS *opts, int argc, char **argv) {
+	int c;
+
 	while (1) {
 		int option_index = 0;
 		static struct option long_options[] = { { "help", 0, 0, 'h' }, {
@@ -193,63 +583,118 @@ int main(argc, argv)
 						"Max_retrieved_per_topic", 1, 0, 'M' }, {
 						"Rel_info_format", 1, 0, 'R' }, { "Results_format", 1,
 						0, 'T' }, { "Output_old_results_format", 1, 0, 'o' }, {
-						"Zscore", 1, 0, 'Z' }, { 0, 0, 0, 0 }, };
-		c = getopt_long(argc, argv, "hvqm:cl:nD:JN:M:R:T:oZ:", long_options,
+						"Zscore", 1, 0, 'Z' }, { "runs-from", 1, 0, 'F' }, {
+						"jobs", 1, 0, 'j' }, { "emit-partial", 1, 0, 'E' }, {
+						"merge", 0, 0, 'G' }, { "max-memory", 1, 0, 'X' }, {
+						"serve", 1, 0, 'S' }, { "publish", 1, 0, 'P' }, {
+						"cache", 1, 0, 'C' }, { "prefs-conflicts", 1, 0, 'I' }, {
+						"build-zscores", 1, 0, 'B' }, { 0, 0, 0, 0 }, };
+		c = getopt_long(argc, argv, "hvqm:cl:nD:JN:M:R:T:oZ:F:j:", long_options,
 				&option_index);
 		if (c == -1)
 			break;
 		switch (c) {
 		case 'h':
-			help_wanted++;
+			opts->help_wanted++;
 			break;
 		case 'v':
 			fprintf(stderr, "rec_eval version %s\n", VersionID);
 			exit(0);
 		case 'q':
-			epi.query_flag++;
+			epi->query_flag++;
 			break;
 		case 'm':
 			/* Mark measure(s) indicated by optarg to be done */
-			if (UNDEF == mark_measure(&epi, optarg)) {
+			if (UNDEF == mark_measure(epi, optarg)) {
 				fprintf(stderr, "rec_eval: illegal measure '%s'\n", optarg);
 				exit(1);
 			}
-			measure_marked_flag++;
+			opts->measure_marked_flag++;
 			break;
 		case 'c':
-			epi.average_complete_flag++;
+			epi->average_complete_flag++;
 			break;
 		case 'l':
-			epi.relevance_level = atol(optarg);
+			epi->relevance_level = atol(optarg);
 			break;
 		case 'n':
-			epi.summary_flag = 0;
+			epi->summary_flag = 0;
 			break;
 		case 'D':
-			get_debug_level_query(&epi, optarg);
+			get_debug_level_query(epi, optarg);
 			break;
 		case 'J':
-			epi.judged_docs_only_flag++;
+			epi->judged_docs_only_flag++;
 			break;
 		case 'N':
-			epi.num_docs_in_coll = atol(optarg);
+			epi->num_docs_in_coll = atol(optarg);
 			break;
 		case 'M':
-			epi.max_num_docs_per_topic = atol(optarg);
+			if (UNDEF == get_max_num_docs(epi, optarg)) {
+				fprintf(stderr, "rec_eval: illegal depth list '%s'\n", optarg);
+				exit(1);
+			}
 			break;
 		case 'R':
-			epi.rel_info_format = optarg;
+			if (NULL == strchr(optarg, ':'))
+				epi->rel_info_format = optarg;
+			else if (UNDEF == te_add_rel_info_input(epi, optarg))
+				exit(1);
 			break;
 		case 'T':
-			epi.results_format = optarg;
+			epi->results_format = optarg;
 			break;
 		case 'o':
 			/* Obsolete, no longer supported */
-			epi.relation_flag = 0;
+			epi->relation_flag = 0;
 			break;
 		case 'Z':
-			epi.zscore_flag++;
-			zscores_file = optarg;
+			epi->zscore_flag++;
+			opts->zscores_file = optarg;
+			break;
+		case 'F':
+			opts->runs_from_file = optarg;
+			break;
+		case 'j':
+			if (0 >= (opts->num_jobs = atol(optarg))) {
+				fprintf(stderr, "rec_eval: illegal number of jobs '%s'\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case 'E':
+			opts->partial_file = optarg;
+			break;
+		case 'G':
+			opts->merge_flag++;
+			break;
+		case 'X':
+			if (0 >= (opts->max_memory = get_max_memory(optarg))) {
+				fprintf(stderr, "rec_eval: illegal memory size '%s'\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case 'S':
+			opts->serve_socket = optarg;
+			break;
+		case 'P':
+			opts->image_file = optarg;
+			break;
+		case 'C':
+			opts->cache_file = optarg;
+			break;
+		case 'B':
+			opts->build_zscores_file = optarg;
+			break;
+		case 'I':
+			if (UNDEF
+					== (epi->prefs_conflicts = te_get_prefs_conflicts(optarg))) {
+				fprintf(stderr,
+						"rec_eval: illegal prefs conflicts policy '%s'\n",
+						optarg);
+				exit(1);
+			}
 			break;
 		case '?':
 		default:
@@ -257,163 +702,614 @@ int main(argc, argv)
 			exit(1);
 		}
 	}
+}
 
-	if (help_wanted) {
-		if (UNDEF == trec_eval_help(&epi))
-			return (UNDEF);
-		exit(0);
-	}
+/* Evaluate the num_runs results_files against all_rel_info, the way
+ opts asks (or with --build-zscores, add up their query values into
+ the zscores file).  Return 0 or the exit status of a failed run */
+static int evaluate_files(EPI *epi, const OPTIONS *opts, char **results_files,
+		long num_runs, const ALL_REL_INFO *all_rel_info,
+		ALL_ZSCORES *all_zscores) {
+	long i;
+	int exit_status;
 
-	if (optind + 2 != argc) {
-		(void) fputs(usage, stderr);
-		exit(1);
+	if (opts->build_zscores_file) {
+		if (0
+				== (exit_status = evaluate_runs(epi, results_files, num_runs,
+						opts->num_jobs, all_rel_info, all_zscores))
+				&& UNDEF == te_put_zscores(opts->build_zscores_file))
+			exit_status = 2;
+		if (UNDEF == te_build_zscores_cleanup()) {
+			fprintf(stderr, "rec_eval: cleanup failed\n");
+			exit_status = 10;
+		}
+		return (exit_status);
+	}
+	if (opts->partial_file && 1 != num_runs) {
+		fprintf(stderr,
+				"rec_eval: --emit-partial needs a single results file\n");
+		return (1);
+	}
+	if (1 == num_runs) {
+		evaluate_run(epi, results_files[0], all_rel_info, all_zscores, 0,
+				opts->partial_file, opts->cache_file);
+		return (0);
 	}
 
-	trec_rel_info_file = argv[optind++];
-	trec_results_file = argv[optind++];
+	/* Each run is tagged by a runid line of its own instead */
+	for (i = 0; i < te_num_trec_measures; i++)
+		if (0 == strcmp("runid", te_trec_measures[i]->name))
+			te_trec_measures[i]->eval_index = -1;
+	return (evaluate_runs(epi, results_files, num_runs, opts->num_jobs,
+			all_rel_info, all_zscores));
+}
 
-	/* Find and get qrels and ranked results information for all queries from
-	 the input text files */
-	for (i = 0; i < te_num_rel_info_format; i++) {
-		if (0 == strcmp(epi.rel_info_format, te_rel_info_format[i].name)) {
-			if (UNDEF
-					== te_rel_info_format[i].get_file(&epi, trec_rel_info_file,
-							&all_rel_info)) {
-				fprintf(stderr, "rec_eval: Quit in file '%s'\n",
-						trec_rel_info_file);
-				exit(2);
-			}
+/* Serve one evaluation request (in the server's child process) read from
+ the connection fd.  The request is a single line of options and results
+ files as on the command line, without the rel_info file; a results
+ file named '-' is read from the rest of the connection.  Output and
+ error messages are written back over fd */
+static int serve_request(int fd, void *info) {
+	SERVE_INFO *serve_info = info;
+	EPI epi = *serve_info->epi;
+	OPTIONS opts = *serve_info->opts;
+	ALL_ZSCORES all_zscores = *serve_info->all_zscores;
+	FILE *in;
+	char *request = NULL;
+	size_t max_request = 0;
+	char **argv, *ptr;
+	int argc;
+	long num_meas_arg, i;
+	char **results_files = NULL;
+	long num_runs = 0;
+	long max_num_runs = 0;
+	char *inline_file = NULL;
+	int exit_status;
+
+	if (NULL == (in = fdopen(fd, "r")) || -1 == getline(&request, &max_request,
+			in) || -1 == dup2(fd, 1) || -1 == dup2(fd, 2))
+		return (2);
+
+	/* Split the request into arguments, after a program name for getopt */
+	if (NULL == (argv = Malloc(strlen(request) / 2 + 3, char *)))
+		return (3);
+	argv[0] = "rec_eval";
+	argc = 1;
+	ptr = request;
+	while (1) {
+		while (*ptr && isspace(*ptr))
+			*ptr++ = '\0';
+		if (!*ptr)
 			break;
+		argv[argc++] = ptr;
+		while (*ptr && !isspace(*ptr))
+			ptr++;
+	}
+	argv[argc] = NULL;
+
+	/* Room for the server's measure args plus any the request adds */
+	for (num_meas_arg = 0; epi.meas_arg[num_meas_arg].measure_name;
+			num_meas_arg++)
+		;
+	if (NULL == (epi.meas_arg = Malloc(num_meas_arg + argc + 1, MEAS_ARG)))
+		return (3);
+	for (i = 0; i <= num_meas_arg; i++)
+		epi.meas_arg[i] = serve_info->epi->meas_arg[i];
+
+	optind = 0;
+	get_options(&epi, &opts, argc, argv);
+	if (opts.help_wanted) {
+		if (UNDEF == trec_eval_help(&epi))
+			return (1);
+		return (0);
+	}
+	/* A request may not name files for the server to write, nor any it
+	 reads other than results files */
+	if (opts.serve_socket != serve_info->opts->serve_socket || opts.merge_flag
+			|| opts.max_memory || opts.cache_file || opts.build_zscores_file
+			|| opts.partial_file || opts.runs_from_file || opts.image_file
+			|| epi.prefs_conflicts != serve_info->epi->prefs_conflicts
+			|| strcmp(epi.rel_info_format, serve_info->epi->rel_info_format)
+			|| te_num_rel_info_inputs()) {
+		fprintf(stderr,
+				"rec_eval: --serve, --merge, --max-memory, --cache, --build-zscores, --emit-partial, -F, --publish, --prefs-conflicts and -R are not available in a request\n");
+		return (1);
+	}
+	if (opts.zscores_file != serve_info->opts->zscores_file) {
+		if (NULL == serve_info->opts->zscores_file
+				|| strcmp(opts.zscores_file, serve_info->opts->zscores_file)) {
+			fprintf(stderr,
+					"rec_eval: -Z in a request can only name the server's Zmean_file\n");
+			return (1);
 		}
+		opts.zscores_file = serve_info->opts->zscores_file;
 	}
-	if (i >= te_num_rel_info_format) {
-		fprintf(stderr, "rec_eval: Illegal rel_format '%s'\n",
-				epi.rel_info_format);
-		exit(2);
+	if (0 == opts.measure_marked_flag
+			&& UNDEF == mark_measure(&epi, "official")) {
+		fprintf(stderr, "rec_eval: illegal measure 'official'\n");
+		return (1);
 	}
-	for (i = 0; i < te_num_results_format; i++) {
-		if (0 == strcmp(epi.results_format, te_results_format[i].name)) {
-			if (UNDEF
-					== te_results_format[i].get_file(&epi, trec_results_file,
-							&all_results)) {
-				fprintf(stderr, "rec_eval: Quit in file '%s'\n",
-						trec_results_file);
-				exit(2);
+
+	/* Results files are all remaining arguments, then those listed in
+	 runs_from_file */
+	if (NULL
+			== (results_files = te_chk_and_realloc(results_files, &max_num_runs,
+					argc - optind + 1, sizeof(char *))))
+		return (3);
+	while (optind < argc) {
+		if (0 == strcmp(argv[optind], "-")) {
+			if (inline_file) {
+				fprintf(stderr, "rec_eval: Only one results file may be '-'\n");
+				return (1);
 			}
+			if (UNDEF == get_inline_results(in, &inline_file))
+				return (2);
+			results_files[num_runs++] = inline_file;
+			optind++;
+		} else
+			results_files[num_runs++] = argv[optind++];
+	}
+	if (opts.runs_from_file
+			&& UNDEF
+					== get_runs_from(opts.runs_from_file, &results_files,
+							&num_runs, &max_num_runs))
+		exit_status = 2;
+	else if (0 == num_runs) {
+		(void) fputs(usage, stderr);
+		exit_status = 1;
+	} else
+		exit_status = evaluate_files(&epi, &opts, results_files, num_runs,
+				serve_info->all_rel_info, &all_zscores);
+
+	if (inline_file)
+		(void) unlink(inline_file);
+	return (exit_status);
+}
+
+/* Copy the rest of in to a new temporary file, whose name is returned in
+ results_file.  The loaders need a file they can seek in */
+static int get_inline_results(FILE *in, char **results_file) {
+	char *tmpdir;
+	char buf[8192];
+	size_t n;
+	int fd;
+	FILE *out;
+
+	if (NULL == (tmpdir = getenv("TMPDIR")) || '\0' == *tmpdir)
+		tmpdir = "/tmp";
+	if (NULL == (*results_file = Malloc(strlen(tmpdir) + 20, char)))
+		return (UNDEF);
+	(void) sprintf(*results_file, "%s/rec_eval.XXXXXX", tmpdir);
+	if (-1 == (fd = mkstemp(*results_file))
+			|| NULL == (out = fdopen(fd, "w"))) {
+		fprintf(stderr, "rec_eval: Cannot create file for inline results\n");
+		return (UNDEF);
+	}
+	while (0 < (n = fread(buf, 1, sizeof(buf), in)))
+		if (n != fwrite(buf, 1, n, out))
 			break;
-		}
+	if (ferror(in) || EOF == fclose(out)) {
+		fprintf(stderr, "rec_eval: Cannot read inline results\n");
+		(void) unlink(*results_file);
+		return (UNDEF);
 	}
-	if (i >= te_num_results_format) {
-		fprintf(stderr, "rec_eval: Illegal retrieval results format '%s'\n",
-				epi.results_format);
+	return (1);
+}
+
+/* Evaluate the results in results_file against all_rel_info, printing
+ query (if epi->query_flag) and summary values of all marked measures.  If
+ runid_flag, the output is preceded by a line giving the run's runid.
+ If partial_file, the per-query contributions to the summary are written
+ to it (see partial.c) instead of printing the summary.
+ If cache_file, query values are taken from and kept in it (see
+ query_cache.c).
+ Errors exit, since each run has a process of its own when several
+ results files are evaluated */
+static void evaluate_run(EPI *epi, char *results_file,
+		const ALL_REL_INFO *all_rel_info, ALL_ZSCORES *all_zscores,
+		long runid_flag, char *partial_file, char *cache_file) {
+	ALL_RESULTS all_results;
+	TREC_EVAL accum_eval;
+	TREC_EVAL q_eval;
+	TREC_EVAL q_acc; /* Contributions of query to accum_eval */
+	MEAS_INST *meas_insts;
+	long num_meas_insts;
+
+	get_results(epi, results_file, &all_results);
+
+	if (runid_flag)
+		printf("%-22s\t%s\t%s\n", "runid", "all",
+				all_results.num_q_results ?
+						all_results.results[0].run_id : results_file);
+
+	accum_eval = (TREC_EVAL ) { "all", 0, NULL, 0, 0 };
+	if (UNDEF
+			== init_meas_insts(epi, &accum_eval, &meas_insts, &num_meas_insts))
 		exit(2);
+	init_q_eval(&accum_eval, &q_eval);
+	if (partial_file) {
+		init_q_eval(&accum_eval, &q_acc);
+		if (UNDEF == te_put_partial_open(epi, partial_file, &accum_eval))
+			exit(9);
 	}
+	if (cache_file)
+		open_cache(epi, cache_file, meas_insts, num_meas_insts, &accum_eval);
 
-	if (epi.zscore_flag) {
-		if (UNDEF == te_get_zscores(&epi, zscores_file, &all_zscores))
-			return (UNDEF);
-	}
+	evaluate_results(epi, meas_insts, num_meas_insts, all_rel_info,
+			&all_results, all_zscores, &q_eval,
+			partial_file ? &q_acc : NULL, &accum_eval, cache_file != NULL);
+	if (cache_file
+			&& (UNDEF == te_cache_close(epi) || UNDEF == te_cache_cleanup()))
+		exit(11);
 
-	/* Initialize all marked measures (possibly using command line info) */
-	if (0 == measure_marked_flag) {
-		/* If no measures designated on command line, first mark "official" */
-		if (UNDEF == mark_measure(&epi, "official")) {
-			fprintf(stderr, "rec_eval: illegal measure 'official'\n");
-			exit(1);
-		}
+	if (partial_file) {
+		if (UNDEF == te_put_partial_rel_info(epi, all_rel_info)
+				|| UNDEF
+						== te_put_partial_close(epi,
+								all_results.num_q_results ?
+										all_results.results[0].run_id : NULL))
+			exit(9);
+		Free(q_acc.values);
+		cleanup_meas_values(epi, meas_insts, num_meas_insts, &accum_eval);
+	} else
+		print_summary(epi, meas_insts, num_meas_insts, all_rel_info,
+				&accum_eval);
+
+	if (UNDEF == cleanup(epi, meas_insts, num_meas_insts)) {
+		fprintf(stderr, "rec_eval: cleanup failed\n");
+		exit(10);
 	}
+	Free(q_eval.values);
+	Free(accum_eval.values);
+}
+
+/* Evaluate the results in results_file against the rel info in
+ rel_info_file, as evaluate_run does, using about max_memory bytes
+ however large the files are.  The files are split into partitions by
+ qid (see partition.c) and each partition is read and evaluated in turn,
+ writing per-query contributions to a partial file, from which the
+ summary is then printed as for --merge.  If partial_file is given, the
+ contributions go there instead, and no summary is printed */
+static void evaluate_partitioned(EPI *epi, char *rel_info_file,
+		char *results_file, ALL_ZSCORES *all_zscores, long max_memory,
+		char *partial_file, char *cache_file) {
+	ALL_REL_INFO all_rel_info;
+	ALL_RESULTS all_results;
+	TREC_EVAL accum_eval;
+	TREC_EVAL q_eval;
+	TREC_EVAL q_acc;
+	MEAS_INST *meas_insts;
+	long num_meas_insts;
+	PARTITION *partitions;
+	long num_partitions, p;
+	char *run_id, *scratch_file;
+
+	if (UNDEF
+			== te_partition_files(epi, rel_info_file, results_file, max_memory,
+					&partitions, &num_partitions, &run_id, &scratch_file))
+		exit(2);
+
 	accum_eval = (TREC_EVAL ) { "all", 0, NULL, 0, 0 };
-	for (m = 0; m < te_num_trec_measures; m++) {
-		if (MEASURE_MARKED(te_trec_measures[m])) {
-			if (UNDEF
-					== te_trec_measures[m]->init_meas(&epi, te_trec_measures[m],
-							&accum_eval)) {
-				fprintf(stderr, "rec_eval: Cannot initialize measure '%s'\n",
-						te_trec_measures[m]->name);
-				exit(2);
-			}
+	if (UNDEF
+			== init_meas_insts(epi, &accum_eval, &meas_insts, &num_meas_insts))
+		exit(2);
+	init_q_eval(&accum_eval, &q_eval);
+	init_q_eval(&accum_eval, &q_acc);
+	if (UNDEF
+			== te_put_partial_open(epi,
+					partial_file ? partial_file : scratch_file, &accum_eval))
+		exit(9);
+	if (cache_file)
+		open_cache(epi, cache_file, meas_insts, num_meas_insts, &accum_eval);
+
+	/* Partitions without rel info have no queries to evaluate, nor any
+	 to average over */
+	for (p = 0; p < num_partitions; p++) {
+		if (NULL == partitions[p].rel_info_file)
+			continue;
+		get_rel_info(epi, partitions[p].rel_info_file, &all_rel_info);
+		if (partitions[p].results_file) {
+			get_results(epi, partitions[p].results_file, &all_results);
+			evaluate_results(epi, meas_insts, num_meas_insts, &all_rel_info,
+					&all_results, all_zscores, &q_eval, &q_acc, &accum_eval,
+					cache_file != NULL);
+		}
+		if (UNDEF == te_put_partial_rel_info(epi, &all_rel_info))
+			exit(9);
+		if (UNDEF == cleanup_inputs(epi)) {
+			fprintf(stderr, "rec_eval: cleanup failed\n");
+			exit(10);
 		}
 	}
+	if (UNDEF == te_put_partial_close(epi, run_id))
+		exit(9);
+	if (cache_file
+			&& (UNDEF == te_cache_close(epi) || UNDEF == te_cache_cleanup()))
+		exit(11);
+	Free(q_acc.values);
 
-	/* Reserve space and initialize q_eval to be copy of accum_eval */
-	if (NULL
-			== (q_eval.values = Malloc(accum_eval.num_values, TREC_EVAL_VALUE)))
+	if (partial_file)
+		cleanup_meas_values(epi, meas_insts, num_meas_insts, &accum_eval);
+	else {
+		/* Start the summary afresh from the partial */
+		accum_eval.num_queries = 0;
+		summarize_partials(epi, meas_insts, num_meas_insts, &scratch_file, 1,
+				&accum_eval);
+	}
+
+	if (UNDEF == cleanup(epi, meas_insts, num_meas_insts)
+			|| UNDEF == te_partition_files_cleanup()) {
+		fprintf(stderr, "rec_eval: cleanup failed\n");
+		exit(10);
+	}
+	Free(q_eval.values);
+	Free(accum_eval.values);
+}
+
+/* Start using cache_file for the query values of meas_insts (already
+ initialized, so that their parameters are final) */
+static void open_cache(EPI *epi, char *cache_file, MEAS_INST *meas_insts,
+		long num_meas_insts, const TREC_EVAL *accum_eval) {
+	char *meas_config, *params;
+	long len, m;
+
+	len = 1;
+	for (m = 0; m < num_meas_insts; m++) {
+		params = meas_insts[m].tm->meas_params ?
+				meas_insts[m].tm->meas_params->printable_params : NULL;
+		len += strlen(meas_insts[m].tm->name) + (params ? strlen(params) : 0)
+				+ 24;
+	}
+	if (NULL == (meas_config = Malloc(len, char)))
 		exit(3);
-	(void) memcpy(q_eval.values, accum_eval.values,
-			accum_eval.num_values * sizeof(TREC_EVAL_VALUE));
-	q_eval.num_values = accum_eval.num_values;
-	q_eval.num_queries = 0;
-
-	/* For each topic which has both qrels and top results information,
-	 calculate, possibly print (if query_flag), and accumulate
-	 evaluation measures. */
-	for (i = 0; i < all_results.num_q_results; i++) {
+	meas_config[0] = '\0';
+	for (m = 0; m < num_meas_insts; m++) {
+		if (!MEASURE_REQUESTED(meas_insts[m].tm))
+			continue;
+		params = meas_insts[m].tm->meas_params ?
+				meas_insts[m].tm->meas_params->printable_params : NULL;
+		(void) sprintf(meas_config + strlen(meas_config), "%s%s%s@%ld ",
+				meas_insts[m].tm->name, params ? "." : "",
+				params ? params : "", meas_insts[m].depth);
+	}
+	if (UNDEF == te_cache_open(epi, cache_file, accum_eval, meas_config))
+		exit(11);
+	Free(meas_config);
+}
+
+/* For each topic of all_results which has both qrels and top results
+ information, calculate, possibly print (if query_flag), and accumulate
+ evaluation measures into accum_eval.  If q_acc, the contributions of
+ each topic are written to the partial file instead of accumulated.
+ If cache_flag, the values of topics found in the query cache are taken
+ from it instead of calculated, and those of the others are added to
+ it.  Values are cached before conversion to zscores.  Measures that
+ accumulate nothing (runid, relstring) keep what they print outside the
+ values, so are calculated either way */
+static void evaluate_results(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, const ALL_REL_INFO *all_rel_info,
+		const ALL_RESULTS *all_results, ALL_ZSCORES *all_zscores,
+		TREC_EVAL *q_eval, TREC_EVAL *q_acc, TREC_EVAL *accum_eval,
+		long cache_flag) {
+	long num_depths = epi->num_max_num_docs ? epi->num_max_num_docs : 1;
+	long num_inputs = MAX(te_num_rel_info_inputs(), 1);
+	long d, i, j, m, r;
+	long *rel_index; /* Index of the query's rel info in each input */
+	int cached = 0;
+	double *values = NULL;
+
+	if (NULL == (rel_index = Malloc(num_inputs, long)))
+		exit(3);
+	/* The zscores of every query and value are found once, indexed by
+	 the query's rel info (of the first input) */
+	if (epi->zscore_flag
+			&& UNDEF == te_form_zscore_index(all_zscores, all_rel_info, q_eval))
+		exit(3);
+	for (i = 0; i < all_results->num_q_results; i++) {
 		/* If debugging a particular query, then skip all others */
-		if (epi.debug_query
-				&& strcmp(epi.debug_query, all_results.results[i].qid))
+		if (epi->debug_query
+				&& strcmp(epi->debug_query, all_results->results[i].qid))
 			continue;
-		/* Find rel info for this query (skip if no rel info) */
-		for (j = 0; j < all_rel_info.num_q_rels; j++) {
+		/* Find rel info for this query in every input (skip if no rel
+		 info in any of them) */
+		for (r = 0; r < num_inputs; r++) {
 			if (0
-					== strcmp(all_results.results[i].qid,
-							all_rel_info.rel_info[j].qid))
+					> (rel_index[r] = find_rel_info(&all_rel_info[r],
+							all_results->results[i].qid)))
 				break;
 		}
-		if (j >= all_rel_info.num_q_rels)
+		if (r < num_inputs)
 			continue;
+		j = rel_index[0];
+		if (q_acc) {
+			for (m = 0; m < q_acc->num_values; m++)
+				q_acc->values[m].value = 0;
+			q_acc->qid = all_results->results[i].qid;
+		}
+		if (cache_flag
+				&& UNDEF
+						== (cached = te_cache_get_query(epi,
+								&all_rel_info->rel_info[j],
+								&all_results->results[i], &values)))
+			exit(11);
 
-		/* zero out all measures for new query */
-		for (m = 0; m < q_eval.num_values; m++)
-			q_eval.values[m].value = 0;
-		q_eval.qid = all_results.results[i].qid;
+		/* Evaluate the query at each depth in turn.  Rankings are cached by
+		 the intermediate form procedures, so only the first depth pays for
+		 sorting results and merging them with the rel info */
+		for (d = 0; d < num_depths; d++) {
+			if (epi->num_max_num_docs)
+				epi->max_num_docs_per_topic = epi->max_num_docs_list[d];
 
-		/* Calculate all measure scores */
-		for (m = 0; m < te_num_trec_measures; m++) {
-			if (MEASURE_REQUESTED(te_trec_measures[m])) {
-				if (UNDEF
-						== te_trec_measures[m]->calc_meas(&epi,
-								&all_rel_info.rel_info[j],
-								&all_results.results[i], te_trec_measures[m],
-								&q_eval)) {
-					fprintf(stderr, "rec_eval: Can't calculate measure '%s'\n",
-							te_trec_measures[m]->name);
-					exit(4);
+			/* zero out all measures for new query */
+			for (m = 0; m < q_eval->num_values; m++)
+				q_eval->values[m].value = 0;
+			q_eval->qid = all_results->results[i].qid;
+
+			/* Calculate all measure scores, or take cached ones */
+			if (cached)
+				for (m = 0; m < q_eval->num_values; m++)
+					q_eval->values[m].value = values[d * q_eval->num_values
+							+ m];
+			for (m = 0; m < num_meas_insts; m++) {
+				if (meas_insts[m].depth == d
+						&& MEASURE_REQUESTED(meas_insts[m].tm)
+						&& (!cached
+								|| te_acc_meas_empty
+										== meas_insts[m].tm->acc_meas)) {
+					r = meas_insts[m].rel_info;
+					if (UNDEF
+							== meas_insts[m].tm->calc_meas(epi,
+									&all_rel_info[r].rel_info[rel_index[r]],
+									&all_results->results[i], meas_insts[m].tm,
+									q_eval)) {
+						fprintf(stderr,
+								"rec_eval: Can't calculate measure '%s'\n",
+								meas_insts[m].tm->name);
+						exit(4);
+					}
+				}
+			}
+
+			if (cache_flag && !cached)
+				for (m = 0; m < q_eval->num_values; m++)
+					values[d * q_eval->num_values + m] =
+							q_eval->values[m].value;
+
+			/* Reference run of --build-zscores: write the raw values of
+			 the measures with per query values */
+			for (m = 0; zscore_values_flag && m < num_meas_insts; m++) {
+				if (meas_insts[m].depth == d
+						&& MEASURE_REQUESTED(meas_insts[m].tm)
+						&& te_print_single_meas_empty
+								!= meas_insts[m].tm->print_single_meas
+						&& UNDEF
+								== te_put_zscore_values(stdout, q_eval,
+										meas_insts[m].first_value,
+										meas_insts[m].end_value))
+					exit(9);
+			}
+
+			/* Convert values to zscores if requested */
+			if (epi->zscore_flag) {
+				if (UNDEF == te_convert_to_zscore(all_zscores, j, q_eval))
+					exit(UNDEF);
+			}
+
+			if (epi->num_max_num_docs
+					&& NULL == (q_eval->qid = depth_qid(epi, q_eval->qid, d)))
+				exit(3);
+
+			/* Add this topics value to accumulated values, and possibly print */
+			for (m = 0; m < num_meas_insts; m++) {
+				if (meas_insts[m].depth == d
+						&& MEASURE_REQUESTED(meas_insts[m].tm)) {
+					if (UNDEF
+							== meas_insts[m].tm->acc_meas(epi,
+									meas_insts[m].tm, q_eval,
+									q_acc ? q_acc : accum_eval)) {
+						fprintf(stderr,
+								"rec_eval: Can't accumulate measure '%s'\n",
+								meas_insts[m].tm->name);
+						exit(5);
+					}
+					if (epi->query_flag
+							&& UNDEF
+									== meas_insts[m].tm->print_single_meas(epi,
+											meas_insts[m].tm, q_eval)) {
+						fprintf(stderr,
+								"rec_eval: Can't print query measure '%s'\n",
+								meas_insts[m].tm->name);
+						exit(6);
+					}
 				}
 			}
 		}
+		if (q_acc && UNDEF == te_put_partial_query(epi, q_acc))
+			exit(9);
+		if (cache_flag
+				&& UNDEF
+						== te_cache_put_query(epi, all_results->results[i].qid))
+			exit(11);
+		accum_eval->num_queries++;
+	}
+	Free(rel_index);
+}
 
-		/* Convert values to zscores if requested */
-		if (epi.zscore_flag) {
-			if (UNDEF == te_convert_to_zscore(&all_zscores, &q_eval))
-				return (UNDEF);
+/* Reserve space and initialize q_eval to be copy of accum_eval */
+static void init_q_eval(const TREC_EVAL *accum_eval, TREC_EVAL *q_eval) {
+	if (NULL
+			== (q_eval->values = Malloc(accum_eval->num_values,
+					TREC_EVAL_VALUE)))
+		exit(3);
+	(void) memcpy(q_eval->values, accum_eval->values,
+			accum_eval->num_values * sizeof(TREC_EVAL_VALUE));
+	q_eval->num_values = accum_eval->num_values;
+	q_eval->num_queries = 0;
+}
+
+/* Get rel info from rel_info_file, in format epi->rel_info_format, or
+ attach to it if rel_info_file is an image of it (--publish) */
+static void get_rel_info(EPI *epi, char *rel_info_file,
+		ALL_REL_INFO *all_rel_info) {
+	long i;
+
+	if (te_is_rel_image(rel_info_file)) {
+		if (UNDEF == te_get_rel_image(epi, rel_info_file, all_rel_info)) {
+			fprintf(stderr, "rec_eval: Quit in file '%s'\n", rel_info_file);
+			exit(2);
+		}
+		return;
+	}
+	for (i = 0; i < te_num_rel_info_format; i++) {
+		if (0 == strcmp(epi->rel_info_format, te_rel_info_format[i].name)) {
+			if (UNDEF
+					== te_rel_info_format[i].get_file(epi, rel_info_file,
+							all_rel_info)) {
+				fprintf(stderr, "rec_eval: Quit in file '%s'\n",
+						rel_info_file);
+				exit(2);
+			}
+			break;
 		}
+	}
+	if (i >= te_num_rel_info_format) {
+		fprintf(stderr, "rec_eval: Illegal rel_format '%s'\n",
+				epi->rel_info_format);
+		exit(2);
+	}
+}
 
-		/* Add this topics value to accumulated values, and possibly print */
-		for (m = 0; m < te_num_trec_measures; m++) {
-			if (MEASURE_REQUESTED(te_trec_measures[m])) {
-				if (UNDEF
-						== te_trec_measures[m]->acc_meas(&epi,
-								te_trec_measures[m], &q_eval, &accum_eval)) {
-					fprintf(stderr, "rec_eval: Can't accumulate measure '%s'\n",
-							te_trec_measures[m]->name);
-					exit(5);
-				}
-				if (epi.query_flag
-						&&
-						UNDEF
-								== te_trec_measures[m]->print_single_meas(&epi,
-										te_trec_measures[m], &q_eval)) {
-					fprintf(stderr,
-							"rec_eval: Can't print query measure '%s'\n",
-							te_trec_measures[m]->name);
-					exit(6);
-				}
+/* Get ranked results from results_file, in format epi->results_format */
+static void get_results(EPI *epi, char *results_file,
+		ALL_RESULTS *all_results) {
+	long i;
+
+	for (i = 0; i < te_num_results_format; i++) {
+		if (0 == strcmp(epi->results_format, te_results_format[i].name)) {
+			if (UNDEF
+					== te_results_format[i].get_file(epi, results_file,
+							all_results)) {
+				fprintf(stderr, "rec_eval: Quit in file '%s'\n",
+						results_file);
+				exit(2);
 			}
+			break;
 		}
-		accum_eval.num_queries++;
 	}
+	if (i >= te_num_results_format) {
+		fprintf(stderr, "rec_eval: Illegal retrieval results format '%s'\n",
+				epi->results_format);
+		exit(2);
+	}
+}
+
+/* Print the summary of the queries accumulated in accum_eval */
+static void print_summary(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, const ALL_REL_INFO *all_rel_info,
+		TREC_EVAL *accum_eval) {
+	long m;
 
-	if (accum_eval.num_queries == 0) {
+	if (accum_eval->num_queries == 0) {
 		fprintf(stderr,
 				"rec_eval: No queries with both results and relevance info\n");
 		exit(7);
@@ -421,32 +1317,262 @@ int main(argc, argv)
 
 	/* Calculate final averages, and print (if desired) */
 	/* Note that averages may depend on the entire rel_info data if
-	 epi.average_complete_flag is set */
-	for (m = 0; m < te_num_trec_measures; m++) {
-		if (MEASURE_REQUESTED(te_trec_measures[m])) {
+	 epi->average_complete_flag is set */
+	for (m = 0; m < num_meas_insts; m++) {
+		if (MEASURE_REQUESTED(meas_insts[m].tm)) {
+			if (epi->num_max_num_docs
+					&& NULL
+							== (accum_eval->qid = depth_qid(epi, "all",
+									meas_insts[m].depth)))
+				exit(3);
 			if (UNDEF
-					== te_trec_measures[m]->calc_avg_meas(&epi,
-							te_trec_measures[m], &all_rel_info, &accum_eval)
+					== meas_insts[m].tm->calc_avg_meas(epi, meas_insts[m].tm,
+							&all_rel_info[meas_insts[m].rel_info], accum_eval)
 					||
 					UNDEF
-							== te_trec_measures[m]->print_final_and_cleanup_meas(
-									&epi, te_trec_measures[m], &accum_eval)) {
+							== meas_insts[m].tm->print_final_and_cleanup_meas(
+									epi, meas_insts[m].tm, accum_eval)) {
 				fprintf(stderr, "rec_eval: Can't print measure '%s'\n",
-						te_trec_measures[m]->name);
+						meas_insts[m].tm->name);
 				exit(8);
 			}
 		}
 	}
+}
 
-	if (UNDEF == cleanup(&epi)) {
+/* Final cleanup of the measures, as done when printing the summary, for
+ runs whose summary is not printed */
+static void cleanup_meas_values(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, TREC_EVAL *accum_eval) {
+	long m;
+
+	epi->summary_flag = 0;
+	for (m = 0; m < num_meas_insts; m++) {
+		if (MEASURE_REQUESTED(meas_insts[m].tm)
+				&& UNDEF
+						== meas_insts[m].tm->print_final_and_cleanup_meas(epi,
+								meas_insts[m].tm, accum_eval)) {
+			fprintf(stderr, "rec_eval: Can't print measure '%s'\n",
+					meas_insts[m].tm->name);
+			exit(8);
+		}
+	}
+}
+
+/* Print the summary of the partial accumulator files partial_files, as
+ it would have been printed by evaluating all their queries at once */
+static void merge_partials(EPI *epi, char **partial_files,
+		long num_partial_files) {
+	TREC_EVAL accum_eval;
+	MEAS_INST *meas_insts;
+	long num_meas_insts;
+
+	accum_eval = (TREC_EVAL ) { "all", 0, NULL, 0, 0 };
+	if (UNDEF
+			== init_meas_insts(epi, &accum_eval, &meas_insts, &num_meas_insts))
+		exit(2);
+
+	summarize_partials(epi, meas_insts, num_meas_insts, partial_files,
+			num_partial_files, &accum_eval);
+
+	if (UNDEF == cleanup(epi, meas_insts, num_meas_insts)) {
 		fprintf(stderr, "rec_eval: cleanup failed\n");
 		exit(10);
 	}
-	Free(q_eval.values);
 	Free(accum_eval.values);
-	Free(epi.meas_arg);
+}
 
-	exit(0);
+/* Add up the partial files partial_files into accum_eval (initialized
+ for meas_insts) and print the summary */
+static void summarize_partials(EPI *epi, MEAS_INST *meas_insts,
+		long num_meas_insts, char **partial_files, long num_partial_files,
+		TREC_EVAL *accum_eval) {
+	ALL_REL_INFO all_rel_info;
+	RESULTS results;
+	long m;
+
+	if (UNDEF
+			== te_get_partials(epi, partial_files, num_partial_files,
+					accum_eval, &all_rel_info, &results.run_id))
+		exit(2);
+
+	/* The runid measure is the only one printing per-run state rather than
+	 accumulated values.  Give it the runid of the partials */
+	results.qid = "all";
+	results.ret_format = epi->results_format;
+	results.q_results = NULL;
+	for (m = 0; m < num_meas_insts; m++) {
+		if (MEASURE_REQUESTED(meas_insts[m].tm)
+				&& 0 == strcmp("runid", meas_insts[m].tm->name)
+				&& UNDEF
+						== meas_insts[m].tm->calc_meas(epi, NULL, &results,
+								meas_insts[m].tm, accum_eval)) {
+			fprintf(stderr, "rec_eval: Can't calculate measure '%s'\n",
+					meas_insts[m].tm->name);
+			exit(4);
+		}
+	}
+
+	print_summary(epi, meas_insts, num_meas_insts, &all_rel_info,
+			accum_eval);
+
+	if (UNDEF == te_get_partials_cleanup()) {
+		fprintf(stderr, "rec_eval: cleanup failed\n");
+		exit(10);
+	}
+}
+
+/* Evaluate each of the num_runs results_files against all_rel_info, each
+ in a child process of its own, with at most num_jobs children running at
+ once.  all_rel_info has been read once already, and is shared with the
+ children copy on write.  The output of a child goes to a temporary file,
+ copied to stdout (or with --build-zscores, added to the zscores) in the
+ order of results_files as soon as all earlier runs are done.  Returns
+ the exit status of the first failed run (0 if none) */
+static int evaluate_runs(EPI *epi, char **results_files, long num_runs,
+		long num_jobs, const ALL_REL_INFO *all_rel_info,
+		ALL_ZSCORES *all_zscores) {
+	RUN_PROC *procs;
+	long next_run, next_print, num_running, r;
+	int status, exit_status = 0;
+	pid_t pid;
+	char buf[8192];
+	size_t n;
+
+	if (NULL == (procs = Malloc(num_runs, RUN_PROC)))
+		return (3);
+
+	next_run = 0;
+	next_print = 0;
+	num_running = 0;
+	while (next_print < num_runs) {
+		/* Start runs while there are free job slots */
+		while (next_run < num_runs && num_running < num_jobs) {
+			(void) fflush(stdout);
+			if (NULL == (procs[next_run].out = tmpfile())
+					|| -1 == (pid = fork())) {
+				fprintf(stderr, "rec_eval: Cannot start run for file '%s'\n",
+						results_files[next_run]);
+				if (procs[next_run].out)
+					(void) fclose(procs[next_run].out);
+				/* Give up on this and all later runs */
+				num_runs = next_run;
+				if (0 == exit_status)
+					exit_status = 3;
+				break;
+			}
+			if (0 == pid) {
+				if (-1 == dup2(fileno(procs[next_run].out), 1))
+					exit(3);
+				evaluate_run(epi, results_files[next_run], all_rel_info,
+						all_zscores, !zscore_values_flag, NULL, NULL);
+				exit(0);
+			}
+			procs[next_run].pid = pid;
+			procs[next_run].done = 0;
+			num_running++;
+			next_run++;
+		}
+		if (0 == num_running)
+			break;
+
+		/* Wait for a run to finish */
+		if (-1 == (pid = wait(&status))) {
+			fprintf(stderr, "rec_eval: Lost track of runs\n");
+			exit_status = 3;
+			break;
+		}
+		for (r = 0; r < next_run && procs[r].pid != pid; r++)
+			;
+		if (r >= next_run)
+			continue;
+		procs[r].done = 1;
+		num_running--;
+		/* A failed run has already explained itself, unless killed */
+		if (WIFSIGNALED(status))
+			fprintf(stderr, "rec_eval: Run for file '%s' killed by signal %d\n",
+					results_files[r], WTERMSIG(status));
+		if (0 == exit_status && (!WIFEXITED(status) || 0 != WEXITSTATUS(status)))
+			exit_status = WIFEXITED(status) ?
+					WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+		/* Copy out all finished runs not preceded by an unfinished one */
+		while (next_print < next_run && procs[next_print].done) {
+			rewind(procs[next_print].out);
+			if (zscore_values_flag) {
+				if (UNDEF == te_add_zscore_values(procs[next_print].out)
+						&& 0 == exit_status)
+					exit_status = 2;
+			} else
+				while (0 < (n = fread(buf, 1, sizeof(buf),
+						procs[next_print].out)))
+					(void) fwrite(buf, 1, n, stdout);
+			(void) fclose(procs[next_print].out);
+			next_print++;
+		}
+	}
+	(void) fflush(stdout);
+
+	Free(procs);
+	return (exit_status);
+}
+
+/* Append the results files named in file (one per line, blank lines
+ ignored) to results_files */
+static int get_runs_from(char *file, char ***results_files, long *num_runs,
+		long *max_num_runs) {
+	FILE *fd;
+	char line[PATH_MAX + 2];
+	char *ptr;
+	long len;
+
+	if (NULL == (fd = fopen(file, "r"))) {
+		fprintf(stderr, "rec_eval: Cannot open runs file '%s'\n", file);
+		return (UNDEF);
+	}
+	while (NULL != fgets(line, sizeof(line), fd)) {
+		len = strlen(line);
+		while (len > 0 && isspace(line[len - 1]))
+			line[--len] = '\0';
+		for (ptr = line; isspace(*ptr); ptr++)
+			;
+		if ('\0' == *ptr)
+			continue;
+		if (NULL
+				== (*results_files = te_chk_and_realloc(*results_files,
+						max_num_runs, *num_runs + 1, sizeof(char *)))
+				|| NULL
+						== ((*results_files)[*num_runs] = Malloc(
+								strlen(ptr) + 1, char))) {
+			(void) fclose(fd);
+			return (UNDEF);
+		}
+		(void) strcpy((*results_files)[*num_runs], ptr);
+		(*num_runs)++;
+	}
+	(void) fclose(fd);
+	return (1);
+}
+
+/* Index of the rel info for qid in all_rel_info, -1 if none.  All
+ rel_info formats return their queries sorted by qid */
+static long find_rel_info(const ALL_REL_INFO *all_rel_info, const char *qid) {
+	long low = 0;
+	long high = all_rel_info->num_q_rels - 1;
+	long mid;
+	int cmp;
+
+	while (low <= high) {
+		mid = low + (high - low) / 2;
+		cmp = strcmp(qid, all_rel_info->rel_info[mid].qid);
+		if (0 == cmp)
+			return (mid);
+		if (cmp < 0)
+			high = mid - 1;
+		else
+			low = mid + 1;
+	}
+	return (-1);
 }
 
 static int add_meas_arg_info(EPI *epi, char *meas, char *param) {
@@ -498,6 +1624,14 @@ static int mark_measure(EPI *epi, char *optarg) {
 		ptr++;
 	if (*ptr == '.') {
 		*ptr++ = '\0';
+		/* Parameters of form label:params define a labelled instance */
+		for (i = 0; ptr[i] && ptr[i] != ':' && ptr[i] != ',' && ptr[i] != '=';
+				i++)
+			;
+		if (ptr[i] == ':' && i > 0) {
+			ptr[i] = '\0';
+			return (mark_labelled_measure(epi, optarg, ptr, &ptr[i + 1]));
+		}
 		if (UNDEF == add_meas_arg_info(epi, optarg, ptr))
 			return (UNDEF);
 	}
@@ -520,6 +1654,245 @@ static int mark_measure(EPI *epi, char *optarg) {
 	return (mark_single_measure(optarg));
 }
 
+/* Create a copy of measure meas named meas_label, to be evaluated with
+ parameters param independently of meas itself.  Only measures taking
+ parameters can be labelled */
+static int mark_labelled_measure(EPI *epi, char *meas, char *label,
+		char *param) {
+	long i, m;
+	TREC_MEAS *tm;
+	char *name;
+
+	for (m = 0; m < te_num_trec_measures; m++) {
+		if (0 == strcmp(meas, te_trec_measures[m]->name))
+			break;
+	}
+	if (m >= te_num_trec_measures)
+		return (UNDEF);
+	if (NULL == te_trec_measures[m]->meas_params) {
+		fprintf(stderr,
+				"rec_eval: measure '%s' takes no parameters, so cannot be labelled\n",
+				meas);
+		return (UNDEF);
+	}
+
+	if (NULL
+			== (name = Malloc(strlen(meas) + strlen(label) + 2, char)))
+		return (UNDEF);
+	(void) sprintf(name, "%s_%s", meas, label);
+	for (i = 0; i < num_labelled_meas; i++) {
+		if (0 == strcmp(name, labelled_meas[i].tm->name)) {
+			fprintf(stderr, "rec_eval: duplicate measure instance '%s'\n",
+					name);
+			Free(name);
+			return (UNDEF);
+		}
+	}
+
+	if (NULL
+			== (labelled_meas = te_chk_and_realloc(labelled_meas,
+					&max_num_labelled_meas, num_labelled_meas + 1,
+					sizeof(LABELLED_MEAS))) || NULL == (tm = copy_meas(
+			te_trec_measures[m])))
+		return (UNDEF);
+	tm->name = name;
+	MARK_MEASURE(tm);
+	labelled_meas[num_labelled_meas].tm = tm;
+	labelled_meas[num_labelled_meas].base = m;
+	num_labelled_meas++;
+
+	return (add_meas_arg_info(epi, name, param));
+}
+
+/* -M argument is either a single depth, or a comma separated list of
+ depths at each of which all measures are to be evaluated */
+static int get_max_num_docs(EPI *epi, char *optarg) {
+	long num_depths;
+	long i, j, depth;
+	char *ptr;
+
+	num_depths = 1;
+	for (ptr = optarg; *ptr; ptr++) {
+		if (*ptr == ',')
+			num_depths++;
+	}
+	if (num_depths == 1) {
+		epi->max_num_docs_per_topic = atol(optarg);
+		return (1);
+	}
+
+	if (epi->max_num_docs_list)
+		Free(epi->max_num_docs_list);
+	if (NULL == (epi->max_num_docs_list = Malloc(num_depths, long)))
+		return (UNDEF);
+
+	/* Insertion sort into increasing order, rejecting duplicates */
+	ptr = optarg;
+	for (i = 0; i < num_depths; i++) {
+		depth = atol(ptr);
+		if (depth <= 0)
+			return (UNDEF);
+		for (j = i; j > 0 && epi->max_num_docs_list[j - 1] > depth; j--)
+			epi->max_num_docs_list[j] = epi->max_num_docs_list[j - 1];
+		if (j > 0 && epi->max_num_docs_list[j - 1] == depth)
+			return (UNDEF);
+		epi->max_num_docs_list[j] = depth;
+		while (*ptr && *ptr != ',')
+			ptr++;
+		if (*ptr)
+			ptr++;
+	}
+	epi->num_max_num_docs = num_depths;
+	epi->max_num_docs_per_topic = epi->max_num_docs_list[num_depths - 1];
+	return (1);
+}
+
+/* Build the list of measure instances to evaluate and initialize them all
+ into accum_eval.  With several -M depths the marked measures are repeated
+ for each depth, each repetition using a copy of the measure so that
+ parameters, values and cleanup are independent.  Measure parameter strings
+ are modified (and pointed into) when parsed by init_meas, so each depth
+ after the first parses its own copy, kept in depth_meas_arg until cleanup */
+static MEAS_ARG *depth_meas_arg = NULL;
+static long num_depth_meas_arg = 0;
+
+static int init_meas_insts(EPI *epi, TREC_EVAL *accum_eval,
+		MEAS_INST **meas_insts, long *num_meas_insts) {
+	long num_depths = epi->num_max_num_docs ? epi->num_max_num_docs : 1;
+	long num_marked, num_args, per_depth;
+	long d, m, n, l;
+	TREC_MEAS *tm;
+	MEAS_ARG *meas_arg = epi->meas_arg;
+
+	num_marked = num_labelled_meas;
+	for (m = 0; m < te_num_trec_measures; m++) {
+		if (MEASURE_MARKED(te_trec_measures[m]))
+			num_marked++;
+	}
+	for (num_args = 0; meas_arg[num_args].measure_name; num_args++)
+		;
+	num_depth_meas_arg = num_args + 1;
+
+	if (NULL == (*meas_insts = Malloc(num_marked * num_depths, MEAS_INST))
+			|| NULL
+					== (depth_meas_arg = Malloc((num_args + 1) * num_depths,
+							MEAS_ARG)))
+		return (UNDEF);
+	for (d = 1; d < num_depths; d++) {
+		for (m = 0; m < num_args; m++) {
+			depth_meas_arg[d * (num_args + 1) + m].measure_name =
+					meas_arg[m].measure_name;
+			if (NULL
+					== (depth_meas_arg[d * (num_args + 1) + m].parameters =
+							Malloc(strlen(meas_arg[m].parameters) + 1, char)))
+				return (UNDEF);
+			(void) strcpy(depth_meas_arg[d * (num_args + 1) + m].parameters,
+					meas_arg[m].parameters);
+		}
+		depth_meas_arg[d * (num_args + 1) + num_args].measure_name = NULL;
+	}
+
+	/* Copies are made before the originals are initialized (and so are
+	 no longer marked).  Labelled instances follow their base measure */
+	n = 0;
+	for (d = 0; d < num_depths; d++) {
+		for (m = 0; m < te_num_trec_measures; m++) {
+			for (l = -1; l < num_labelled_meas; l++) {
+				if (l < 0) {
+					if (!MEASURE_MARKED(te_trec_measures[m]))
+						continue;
+					tm = te_trec_measures[m];
+				} else {
+					if (labelled_meas[l].base != m)
+						continue;
+					tm = labelled_meas[l].tm;
+				}
+				(*meas_insts)[n].tm = tm;
+				(*meas_insts)[n].depth = d;
+				(*meas_insts)[n].copied = 0;
+				(*meas_insts)[n].rel_info = 0;
+				if (te_num_rel_info_inputs()
+						&& UNDEF
+								== ((*meas_insts)[n].rel_info =
+										te_meas_rel_info_input(
+												te_trec_measures[m]->name))) {
+					fprintf(stderr,
+							"rec_eval: No rel info file (-R format:file) for measure '%s'\n",
+							tm->name);
+					return (UNDEF);
+				}
+				if (d > 0) {
+					if (NULL == ((*meas_insts)[n].tm = copy_meas(tm)))
+						return (UNDEF);
+					(*meas_insts)[n].copied = 1;
+				}
+				n++;
+			}
+		}
+	}
+	*num_meas_insts = n;
+
+	/* A copy aggregating the values of another measure (base_meas) must
+	 share them with the copy of that measure at the same depth */
+	per_depth = n / num_depths;
+	for (n = per_depth; n < *num_meas_insts; n++) {
+		tm = (*meas_insts)[n].tm;
+		if (NULL == tm->base_meas)
+			continue;
+		for (l = 0; l < per_depth; l++) {
+			if ((*meas_insts)[l].tm == tm->base_meas) {
+				tm->base_meas = (*meas_insts)[n - n % per_depth + l].tm;
+				break;
+			}
+		}
+	}
+
+	for (n = 0; n < *num_meas_insts; n++) {
+		d = (*meas_insts)[n].depth;
+		epi->meas_arg = d ? &depth_meas_arg[d * (num_args + 1)] : meas_arg;
+		(*meas_insts)[n].first_value = accum_eval->num_values;
+		if (UNDEF
+				== (*meas_insts)[n].tm->init_meas(epi, (*meas_insts)[n].tm,
+						accum_eval)) {
+			fprintf(stderr, "rec_eval: Cannot initialize measure '%s'\n",
+					(*meas_insts)[n].tm->name);
+			return (UNDEF);
+		}
+		(*meas_insts)[n].end_value = accum_eval->num_values;
+	}
+	epi->meas_arg = meas_arg;
+	return (1);
+}
+
+/* Private copy of measure tm (and its parameters) that can be initialized,
+ evaluated and cleaned up independently of tm */
+static TREC_MEAS *copy_meas(const TREC_MEAS *tm) {
+	TREC_MEAS *new_tm;
+
+	if (NULL == (new_tm = Malloc(1, TREC_MEAS)))
+		return (NULL);
+	*new_tm = *tm;
+	if (tm->meas_params) {
+		if (NULL == (new_tm->meas_params = Malloc(1, PARAMS)))
+			return (NULL);
+		*new_tm->meas_params = *tm->meas_params;
+	}
+	return (new_tm);
+}
+
+/* Qid tagged with the -M depth it was evaluated at (eg "301@100").
+ Returned string is reused by the next call */
+static char *depth_qid(const EPI *epi, const char *qid, const long depth) {
+	static char *buf;
+	static long max_buf = 0;
+	long len = strlen(qid) + 22;
+
+	if (NULL == (buf = te_chk_and_malloc(buf, &max_buf, len, sizeof(char))))
+		return (NULL);
+	snprintf(buf, len, "%s@%ld", qid, epi->max_num_docs_list[depth]);
+	return (buf);
+}
+
 static int trec_eval_help(EPI *epi) {
 	long m, f;
 	long m_marked = 0;
@@ -572,14 +1945,93 @@ static void get_debug_level_query(EPI *epi, char *optarg) {
 	epi->debug_level = atol(optarg);
 }
 
-static int cleanup(EPI *epi) {
+/* Memory size in bytes, given as a number optionally followed by K, M
+ or G.  0 if illegal */
+static long get_max_memory(char *optarg) {
+	char *ptr;
+	long size;
+
+	size = strtol(optarg, &ptr, 10);
+	switch (*ptr) {
+	case 'k':
+	case 'K':
+		size <<= 10;
+		ptr++;
+		break;
+	case 'm':
+	case 'M':
+		size <<= 20;
+		ptr++;
+		break;
+	case 'g':
+	case 'G':
+		size <<= 30;
+		ptr++;
+		break;
+	}
+	if (*ptr || size <= 0)
+		return (0);
+	return (size);
+}
+
+static int cleanup(EPI *epi, MEAS_INST *meas_insts, long num_meas_insts) {
 	long i;
 
-	for (i = 0; i < te_num_rel_info_format; i++) {
-		if (0 == strcmp(epi->rel_info_format, te_rel_info_format[i].name)) {
-			if (UNDEF == te_rel_info_format[i].cleanup())
-				return (UNDEF);
-			break;
+	if (UNDEF == cleanup_inputs(epi))
+		return (UNDEF);
+	if (epi->zscore_flag) {
+		if (UNDEF == te_get_zscores_cleanup()
+				|| UNDEF == te_convert_zscores_cleanup())
+			return (UNDEF);
+	}
+	for (i = 0; i < num_meas_insts; i++) {
+		if (meas_insts[i].copied) {
+			if (meas_insts[i].tm->meas_params)
+				Free(meas_insts[i].tm->meas_params);
+			Free(meas_insts[i].tm);
+		}
+	}
+	Free(meas_insts);
+	for (i = 0; i < num_labelled_meas; i++) {
+		Free(labelled_meas[i].tm->name);
+		if (labelled_meas[i].tm->meas_params)
+			Free(labelled_meas[i].tm->meas_params);
+		Free(labelled_meas[i].tm);
+	}
+	if (max_num_labelled_meas > 0) {
+		Free(labelled_meas);
+		max_num_labelled_meas = 0;
+	}
+	num_labelled_meas = 0;
+	if (depth_meas_arg) {
+		/* First depth's slot was never filled in (it uses epi->meas_arg) */
+		for (i = num_depth_meas_arg; i < epi->num_max_num_docs
+				* num_depth_meas_arg; i++) {
+			if (depth_meas_arg[i].measure_name)
+				Free(depth_meas_arg[i].parameters);
+		}
+		Free(depth_meas_arg);
+	}
+	if (epi->max_num_docs_list)
+		Free(epi->max_num_docs_list);
+	return (1);
+}
+
+/* Free the rel info and results read, and the intermediate forms made
+ from them */
+static int cleanup_inputs(EPI *epi) {
+	long i;
+
+	if (te_num_rel_info_inputs()) {
+		if (UNDEF == te_rel_info_inputs_cleanup())
+			return (UNDEF);
+	} else {
+		for (i = 0; i < te_num_rel_info_format; i++) {
+			if (0 == strcmp(epi->rel_info_format, te_rel_info_format[i].name)) {
+				if (UNDEF == te_rel_info_format[i].cleanup())
+					return (UNDEF);
+				break;
+			}
 		}
 	}
 	for (i = 0; i < te_num_results_format; i++) {
@@ -593,9 +2045,7 @@ static int cleanup(EPI *epi) {
 		if (UNDEF == te_form_inter_procs[i].cleanup())
 			return (UNDEF);
 	}
-	if (epi->zscore_flag) {
-		if (UNDEF == te_get_zscores_cleanup())
-			return (UNDEF);
-	}
+	if (UNDEF == te_get_rel_image_cleanup())
+		return (UNDEF);
 	return (1);
 }
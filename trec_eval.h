@@ -17,6 +17,12 @@ typedef struct {
 	char *parameters;
 } MEAS_ARG;
 
+/* What te_get_prefs does with a judgment group whose preferences form a
+ cycle (--prefs-conflicts) */
+#define PREFS_CONFLICTS_FAIL 0		/* Report the cycles and fail */
+#define PREFS_CONFLICTS_DROP_JG 1	/* Drop the whole judgment group */
+#define PREFS_CONFLICTS_DROP_CYCLES 2	/* Drop the docs of the cycles */
+
 typedef struct {
 	long query_flag; /* 0. If set, evaluation output will be
 	 printed for each query, in addition
@@ -41,10 +47,18 @@ typedef struct {
 	 which a doc is considered relevant for
 	 this evaluation */
 	long max_num_docs_per_topic; /* MAXLONG. evaluate only this many docs */
+	long num_max_num_docs; /* 0. If more than one depth was given to -M,
+	 the number of depths in max_num_docs_list */
+	long *max_num_docs_list; /* NULL. Depths given to -M, in increasing
+	 order.  All measures are evaluated once per
+	 depth, with max_num_docs_per_topic set to the
+	 depth currently being evaluated */
 	char *rel_info_format; /* "qrels", format of input rel_info_file */
 	char *results_format; /* "trec_results"  format of input results*/
 	long zscore_flag; /* 0. If set, output Z score for measure
 	 instead of raw score */
+	long prefs_conflicts; /* PREFS_CONFLICTS_FAIL.  Handling of prefs
+	 judgment groups with cyclic preferences */
 	/* List of command line arguments giving individual measure parameters.
 	 meas_arg is NULL if there are no such arguments.  
 	 If arguments, final list member contains a NULL measure_name */
@@ -83,6 +97,15 @@ typedef struct {
 	double value;
 } FLOAT_PARAM_PAIR;
 
+/* Mapping of judged relevance levels applied before a measure sees them
+ (eg, the *45 measures map level 4 to 1, 5 to 2 and everything else to 0).
+ Judged level l maps to levels[l] if l < num_levels, and to 0 otherwise.
+ Unjudged values (RELVALUE_NONPOOL, RELVALUE_UNJUDGED) are not mapped */
+typedef struct {
+	long num_levels;
+	long *levels;
+} REL_MAP;
+
 /* Definitions of internal formats for retrieval ranking and relevance info */
 /* These are format independent definitions, which have a pointer
  to the format dependent definitions found in trec_format.h.
@@ -155,6 +178,16 @@ typedef struct trec_meas {
 	 -2 indicates measure to be calculated, but has not yet been initialized.
 	 Set in init_meas */
 	long eval_index;
+	/* Measure whose per-query values this measure aggregates differently
+	 (eg, gm_map aggregates the values of map with a geometric mean).
+	 NULL if the measure calculates its own values.  Default parameters
+	 must be the same as those of base_meas.  If base_meas is also
+	 requested with the same parameters its values are reused rather than
+	 calculated again */
+	struct trec_meas *base_meas;
+	/* Mapping of relevance levels the measure is calculated with, NULL if
+	 none.  Applied by te_form_res_rels_map */
+	REL_MAP *rel_map;
 } TREC_MEAS;
 
 /* Mapping of a nickname to a group of measures that it applies to.
@@ -211,6 +244,13 @@ typedef struct {
 
 #define MISSING_ZSCORE_VALUE -1000000
 
+/* Partition of the input files of a run too large to evaluate in memory,
+ holding all lines of a range of qids (NULL if no lines) */
+typedef struct {
+	char *rel_info_file;
+	char *results_file;
+} PARTITION;
+
 /* Macros for marking measures to be calculated in this invocation */
 #define MARK_MEASURE(x)  x->eval_index = -2;
 #define MEASURE_MARKED(x) (-2 == x->eval_index)
@@ -60,6 +60,28 @@ typedef struct { /* For each query in rel judgements */
 	TEXT_PREFS *text_prefs; /* Array of judged TEXT_PREFS */
 } TEXT_PREFS_INFO;
 
+/* ----------------------------------------------------------------------*/
+/* Ranking of the results of a query, independent of rel_info and of
+ epi->max_num_docs_per_topic.  Formed once per query by
+ te_form_ranked_results and shared by all the intermediate form builders
+ below */
+typedef struct {
+	char *docno;
+	float sim;
+	long rank; /* Rank (starting at 1) in the whole ranking */
+} RANKED_DOC;
+
+typedef struct {
+	long num_ranked; /* Number of results of the query */
+	RANKED_DOC *ranked; /* Results by decreasing sim, ties broken by
+	 decreasing docno.  ranked[i].rank is i+1 */
+	RANKED_DOC *docno_index; /* The same results by increasing docno,
+	 copies of a docno by increasing rank */
+	long dup_depth; /* Smallest depth at which two copies of a docno
+	 are both ranked (MAXLONG if no duplicates) */
+	char *dup_docno; /* Duplicated docno at dup_depth */
+} RANKED_RESULTS;
+
 /* ----------------------------------------------------------------------*/
 /* Intermediate form of merged results plus rel_info that can be more 
  directly used by several measures */
@@ -116,13 +138,17 @@ typedef struct {
 	 docid_rank numbers. */
 } EC;
 
-/* Preference array.  A square array, num_judgments * num_judgments, where
- pref_array[i][j] is 1 iff doc with docid_rank i is preferred to doc with 
- docid_rank j.
- could use bitstring to save more space, but at present not worth the
- added complexity.
+/* Preference array of a JG.  A square array over the num_judged docs the
+ JG mentions (not all docs judged for the topic), where array[i][j] is 1
+ iff doc with docid_rank docid_ranks[i] is preferred to doc with docid_rank
+ docid_ranks[j].  docid_ranks is increasing, so the retrieved docs of the
+ JG come first (i < num_judged_ret) and in retrieval order, and the areas
+ below are the same as they would be over all docs judged for the topic.
+ Each row is a bitstring of num_words words (bit j of row i is bit
+ j % PA_WORD_BITS of word j / PA_WORD_BITS), so that rows can be combined
+ and counted a word at a time.  Use PA_BIT to test a single entry.
  Given preference array PA there are five areas of importance, divided
- by lines i == NJR (where NJR is num_judged_ret), j == NJR, and i == j
+ by lines i == NJR (where NJR is PA's num_judged_ret), j == NJR, and i == j
  NJR
  \................|...
  .\...............|...
@@ -144,19 +170,35 @@ typedef struct {
  Area A5 is both i and j not retrieved.
  */
 typedef struct {
-	unsigned char *full_array;
-	unsigned char **array;
-	unsigned long num_judged;
+	unsigned long *full_array;
+	unsigned long **array;
+	long *docid_ranks; /* docid_rank of each doc, increasing */
+	unsigned long num_judged; /* Num docs in the JG */
+	unsigned long num_words; /* Words per row */
+	long num_judged_ret; /* Num of those retrieved */
 } PREFS_ARRAY;
-/* Counts array.  A summary square array, num_judgments * num_judgments, where
- counts_array[i][j] gives the number of JGs preferring i to j as above.
- Note number of JGs countaining the same docno must be bounded by
- MAX_SHORT */
+#define PA_WORD_BITS (8 * sizeof(unsigned long))
+#define PA_NUM_WORDS(num_judged) (((num_judged) + PA_WORD_BITS - 1) / PA_WORD_BITS)
+#define PA_BIT(pa,i,j) \
+	(((pa)->array[i][(j) / PA_WORD_BITS] >> ((j) % PA_WORD_BITS)) & 1)
+#define PA_SET_BIT(pa,i,j) \
+	((pa)->array[i][(j) / PA_WORD_BITS] |= 1UL << ((j) % PA_WORD_BITS))
+#define PA_CLEAR_BIT(pa,i,j) \
+	((pa)->array[i][(j) / PA_WORD_BITS] &= ~(1UL << ((j) % PA_WORD_BITS)))
+/* Pair counts.  For every pair of docs doc1 < doc2 (docid_ranks) that
+ some JG has a preference between, the number of JGs preferring doc1 to
+ doc2 and the number preferring doc2 to doc1.  Pairs are sorted by doc1,
+ then doc2; pairs no JG has a preference between are not present */
 typedef struct {
-	unsigned short *full_array;
-	unsigned short **array;
-	unsigned long num_judged;
-} COUNTS_ARRAY;
+	long doc1;
+	long doc2;
+	long count12; /* Num JGs preferring doc1 to doc2 */
+	long count21; /* Num JGs preferring doc2 to doc1 */
+} PREF_COUNT;
+typedef struct {
+	PREF_COUNT *pairs;
+	long num_pairs;
+} PREF_COUNTS;
 
 /* For every judgment group (JG) within a topic, give the preferences for
  the JG in one of two forms: either an ordered list of ECs, or a 
@@ -170,14 +212,13 @@ typedef struct {
 	long num_ecs; /* num_ecs == 0 means prefs_array being used for
 	 preference info rather than EC */
 
-	PREFS_ARRAY prefs_array;/* prefs_array[i][j] is 1 iff doc with docid_rank i
-	 is preferred to doc with docid_rank j.
-	 Size num_judged * num_judged where
-	 num_judged is the same for all JGs and is the
-	 total number of distinct docnos involved
-	 with preferences for this topic */
-	float *rel_array; /* Size num_judged. A rel_level value for each
-	 doc in the judgements.  There may be multiple
+	PREFS_ARRAY prefs_array;/* Preferences between the docs of the JG.
+	 Size prefs_array.num_judged squared bits,
+	 where num_judged is the number of distinct
+	 docnos of this JG */
+	float *rel_array; /* Size prefs_array.num_judged.  A rel_level
+	 value for each doc of the JG, in
+	 prefs_array order.  There may be multiple
 	 different values for a given docno, only the
 	 last encountered is used.  The restriction
 	 that values for a docno must be either all
@@ -216,23 +257,23 @@ typedef struct {
  directly give information about conflicts or multiple representations
  of a preference (as when docno_i and docno_j both appear in multiple JGs).
 
- The second is an array of counts, size num_judged ** 2.
- pref_counts[i,j] gives the number of times docno_i is preferred to docno_j in
- judged preferences.  If i < j, then it is a preference fulfilled,
- if i > j, then a preference was not fulfilled.  This structure gives
- direct info for handling conflicts, but has no summary info for an
- individual JG.
+ The second is a list of counts for the pairs of docs with judged
+ preferences.  For a pair docno_i, docno_j (i < j), it gives the number of
+ times docno_i is preferred to docno_j (a preference fulfilled) and the
+ number of times docno_j is preferred to docno_i (a preference not
+ fulfilled).  This structure gives direct info for handling conflicts,
+ but has no summary info for an individual JG.
  */
 typedef struct {
 	long num_jgs;
 	JG *jgs;
 	long num_judged; /* Num docs mentioned in trec_prefs */
 	long num_judged_ret; /* number of those docs retrieved */
-	COUNTS_ARRAY pref_counts; /* Array size num_judged**2  where
-	 counts_array[i][j] gives num of
-	 JG with doc i preferred to doc j
-	 (i and j are internal ids, sorted
-	 by retrieval rank then docno) */
+	PREF_COUNTS pref_counts; /* Counts of JGs preferring doc i to
+	 doc j and j to i, for each pair
+	 with any (i and j are internal ids,
+	 sorted by retrieval rank then
+	 docno) */
 } RESULTS_PREFS;
 
 /* ----------------------------------------------------------------------*/
@@ -240,16 +281,30 @@ typedef struct {
  input format RESULTS to an intermediate form appropriate to the two
  input formats that can be more directly used by several measures */
 
+/* trec_results to RANKED_RESULTS */
+int te_form_ranked_results(const EPI *epi, const RESULTS *results,
+		RANKED_RESULTS *ranked_results);
+int te_form_ranked_results_cleanup();
+
 /* trec_results and qrels to RES_RELS */
 int te_form_res_rels(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, RES_RELS *res_rels);
 
+/* trec_results and qrels to RES_RELS, with relevance levels mapped by
+ rel_map (if non-NULL) */
+int te_form_res_rels_map(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, const REL_MAP *rel_map, RES_RELS *res_rels);
+long te_map_rel(const REL_MAP *rel_map, const long rel);
+
 /* trec_results and qrels to RES_RELS */
 int te_form_res_rels_jg(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, RES_RELS_JG *res_rels);
 
-/* trec_results and prefs (or qrels_prefs) to RESULT_PREFS */
+/* trec_results and prefs (or qrels_prefs) to RESULT_PREFS.  pref_counts
+ are only formed by form_prefs_pair_counts (they are empty otherwise) */
 int form_prefs_counts(const EPI *epi, const REL_INFO *rel_info,
 		const RESULTS *results, RESULTS_PREFS *results_prefs);
+int form_prefs_pair_counts(const EPI *epi, const REL_INFO *rel_info,
+		const RESULTS *results, RESULTS_PREFS *results_prefs);
 
 #endif /* TRECFORMATH */